@@ -6,6 +6,8 @@
 #include <math.h>
 
 #include <set>
+#include <map>
+#include <algorithm>
 
 class vec3 {
 public:
@@ -72,7 +74,7 @@ std::vector<Triplet> calcEnergyMatrixCoeffs(
 	const Vec& delta,
 	const int nRoi,
 
-	std::vector<std::vector<int> > adj,
+	const std::vector<std::vector<int> >& adj,
 
 	const std::vector<int>& rowBegins,
 	const std::vector<Triplet>& laplacianCoeffs
@@ -386,7 +388,7 @@ std::vector<Triplet> calcCotangentLaplacianCoeffs(
 
 std::vector<Triplet> calcUniformLaplacianCoeffs(
 	int nRoi,
-	std::vector<std::vector<int> > adj,
+	const std::vector<std::vector<int> >& adj,
 
 	std::vector<int>& rowBegins
 ) {
@@ -412,19 +414,28 @@ std::vector<Triplet> calcUniformLaplacianCoeffs(
 	return result;
 }
 
-struct State {
-	bool RSI;
+// all solver state lives here, so that each deformer owns its own instance.
+struct LaplacianDeformation {
+	bool RSI = false;
 
 	Vec roiDelta;
 
-	SpMat augEnergyMatrixTrans;
-	SpMat augNormalizeDeltaCoordinatesTrans;
+	// columns of the energy / laplacian matrices, split into fixed (handle + boundary) and free vertices.
+	// fixed vertices are moved to the right-hand side, so only free vertices are solved.
+	SpMat energyFree, energyFixed, energyFreeTrans;
+	SpMat lapFree, lapFixed, lapFreeTrans;
 
-	Eigen::SimplicialCholesky<SpMat>*energyMatrixCholesky = nullptr;
-	Eigen::SimplicialCholesky<SpMat>*normalizeDeltaCoordinatesCholesky = nullptr;
+	Eigen::SimplicialCholesky<SpMat> energyMatrixCholesky;
+	Eigen::SimplicialCholesky<SpMat> normalizeDeltaCoordinatesCholesky;
+	bool energyAnalyzed = false;
+	bool normalizeAnalyzed = false;
 
-	int* roiIndices;
-	int nRoi;
+	// region topology of the last analyzed system. the sparsity pattern only depends on it,
+	// so the symbolic factorization can be reused when the same region is prepared again.
+	std::vector<int> cells;
+
+	int nRoi = 0;
+	int nFixed = 0;
 
 	SpMat lapMat;
 
@@ -433,213 +444,180 @@ struct State {
 	Vec b;
 };
 
-State s;
-
 double getLength(double ax, double ay, double az) {
 	return sqrt(ax*ax + ay * ay + az * az);
 }
 
-void freeDeform() {
-	if (s.energyMatrixCholesky != nullptr) {
-		delete s.energyMatrixCholesky;
-		s.energyMatrixCholesky = nullptr;
-	}
-	if (s.normalizeDeltaCoordinatesCholesky != nullptr) {
-		delete s.normalizeDeltaCoordinatesCholesky;
-		s.normalizeDeltaCoordinatesCholesky = nullptr;
+static bool factorize(Eigen::SimplicialCholesky<SpMat>& solver, const SpMat& m, bool& analyzed) {
+	if (!analyzed) {
+		solver.analyzePattern(m);
+		analyzed = true;
 	}
+	solver.factorize(m);
+	return solver.info() == Eigen::Success;
+}
+
+LaplacianDeformation* createDeform() {
+	return new LaplacianDeformation;
+}
+
+void freeDeform(LaplacianDeformation* s) {
+	delete s;
 }
 
 /*
 For reference, the equation numbers refer to the paper:
 https://people.eecs.berkeley.edu/~jrs/meshpapers/SCOLARS.pdf
 */
-void prepareDeform(
-	int* cells, const int nCells,
+bool prepareDeform(
+	LaplacianDeformation* s,
 
-	double* positions, const int nPositions,
+	int* cells, const int nCells,
 
-	int* roiIndices, const int nRoi,
+	double* roiPositionData, const int nRoi,
 
 	const int unconstrainedBegin,
 
 	bool RSI) {
 
-	// free memory from previous call of prepareDeform()
-	if (s.energyMatrixCholesky != nullptr) {
-		delete s.energyMatrixCholesky;
-		s.energyMatrixCholesky = nullptr;
-	}
-	if (s.normalizeDeltaCoordinatesCholesky != nullptr) {
-		delete s.normalizeDeltaCoordinatesCholesky;
-		s.normalizeDeltaCoordinatesCholesky = nullptr;
+	if (s == nullptr || nRoi <= 0 || unconstrainedBegin > nRoi) {
+		return false;
 	}
 
-	std::vector<std::vector<int> > adj;
-	std::vector<int> roiMap(nPositions, -1);
-
-	{
-		for (int i = 0; i < nRoi; ++i) {
-			roiMap[roiIndices[i]] = i;
-		}
+	// check if the region topology changed since the last call. if not, we keep the symbolic factorizations.
+	bool samePattern =
+		s->nRoi == nRoi && s->nFixed == unconstrainedBegin && s->RSI == RSI &&
+		(int)s->cells.size() == nCells && std::equal(cells, cells + nCells, s->cells.begin());
+	if (!samePattern) {
+		s->energyAnalyzed = false;
+		s->normalizeAnalyzed = false;
+		s->cells.assign(cells, cells + nCells);
+	}
 
-		adj.resize(nRoi);
-		for (int i = 0; i < adj.size(); ++i) {
-			adj[i] = std::vector<int>();
-		}
-		for (int i = 0; i < nCells; i += 3) {
-			int c[3] = { cells[i + 0], cells[i + 1] , cells[i + 2] };
+	// cells are local to the ROI. negative indices are vertices outside of it.
+	std::vector<std::vector<int> > adj(nRoi);
+	for (int i = 0; i < nCells; i += 3) {
+		int c[3] = { cells[i + 0], cells[i + 1] , cells[i + 2] };
 
-			for (int j = 0; j < 3; ++j) {
-				int a = roiMap[c[j]];
+		for (int j = 0; j < 3; ++j) {
+			int a = c[j];
 
-				int b = roiMap[c[(j + 1) % 3]];
+			int b = c[(j + 1) % 3];
 
-				if (a != -1 && b != -1) {
-					adj[a].push_back(b);
-				}
+			if (a >= 0 && b >= 0) {
+				adj[a].push_back(b);
 			}
 		}
 	}
 
-	// put all the positions of the vertices in ROI in a single vector.
-	Vec roiPositions(nRoi * 3);
-	{
-		int c = 0;
-		for (int i = 0; i < nRoi; ++i) {
-			for (int d = 0; d < 3; ++d) {
-				roiPositions[c++] = positions[3 * roiIndices[i] + d];
-			}
-		}
-	}
+	Vec roiPositions = Eigen::Map<Vec>(roiPositionData, nRoi * 3);
 
 	std::vector<int> rowBegins;
 	std::vector<Triplet> laplacianCoeffs;
-	
-	/*
-	// cotangent laplacian doesnt yield any good results, for some reason :/
-	so we don't use it. instead, use uniform.
-	laplacianCoeffs = calcCotangentLaplacianCoeffs(
-		
-		cells, nCells, 
-		roiMap,
 
-		nRoi,
-		adj,
-		rowBegins,
-	
-		roiPositions);
-		*/	
-	  
+	// cotangent laplacian doesnt yield any good results, for some reason :/
+	// so we don't use it. instead, use uniform.
 	laplacianCoeffs = calcUniformLaplacianCoeffs(nRoi, adj, rowBegins);
 
-	s.lapMat = SpMat(nRoi * 3, nRoi * 3);
-	s.lapMat.setFromTriplets(laplacianCoeffs.begin(), laplacianCoeffs.end());
+	s->lapMat = SpMat(nRoi * 3, nRoi * 3);
+	s->lapMat.setFromTriplets(laplacianCoeffs.begin(), laplacianCoeffs.end());
 
 	// by simply multiplying by the laplacian matrix, we can compute the laplacian coordinates(the delta coordinates)
 	// of the vertices in ROI.
-	s.roiDelta = s.lapMat * roiPositions;
+	s->roiDelta = s->lapMat * roiPositions;
 
 	// we save away the original lengths of the delta coordinates.
 	// we need these when normalizing the results of our solver.
 	{
-		s.roiDeltaLengths = std::vector<double>(s.roiDelta.size() / 3, 0.0f);
-		for (int i = 0; i < s.roiDelta.size() / 3; ++i) {
-			s.roiDeltaLengths[i] = getLength(
-				s.roiDelta[3 * i + 0],
-				s.roiDelta[3 * i + 1],
-				s.roiDelta[3 * i + 2]
+		s->roiDeltaLengths = std::vector<double>(s->roiDelta.size() / 3, 0.0f);
+		for (int i = 0; i < s->roiDelta.size() / 3; ++i) {
+			s->roiDeltaLengths[i] = getLength(
+				s->roiDelta[3 * i + 0],
+				s->roiDelta[3 * i + 1],
+				s->roiDelta[3 * i + 2]
 			);
 		}
 	}
 
-	std::vector<Triplet> energyMatrixCoeffs;
-
-	// num rows in augmented matrix. 
 	// notice that we put x, y, and z in a large single matrix, and therefore it is multiplied by 3.
-	int M = (nRoi + unconstrainedBegin) * 3;
-	// num columns in augmented matrix.
+	// handle and boundary vertices come first in ROI and are fixed. they are not part of the unknowns,
+	// so the system only covers the free vertices. (fixed rows instead of the soft augmented constraints)
 	int N = nRoi * 3;
+	int nFixedCols = unconstrainedBegin * 3;
+	int nFreeCols = N - nFixedCols;
+
+	std::vector<Triplet> energyMatrixCoeffs;
+	bool ok = true;
 
 	if (RSI) {
 		// this matrix represents the first term of the energy (5).
 		energyMatrixCoeffs = calcEnergyMatrixCoeffs(
 			roiPositions,
-			s.roiDelta, nRoi, adj, rowBegins, laplacianCoeffs);
+			s->roiDelta, nRoi, adj, rowBegins, laplacianCoeffs);
 
-		for (int i = 0; i < unconstrainedBegin; ++i) {
-			laplacianCoeffs.push_back(Triplet(i * 3 + N + 0, 3 * i + 0, 1));
-			laplacianCoeffs.push_back(Triplet(i * 3 + N + 1, 3 * i + 1, 1));
-			laplacianCoeffs.push_back(Triplet(i * 3 + N + 2, 3 * i + 2, 1));
+		s->lapFixed = s->lapMat.leftCols(nFixedCols);
+		s->lapFree = s->lapMat.rightCols(nFreeCols);
+		s->lapFreeTrans = s->lapFree.transpose();
+		if (nFreeCols > 0) {
+			ok &= factorize(s->normalizeDeltaCoordinatesCholesky,
+				s->lapFreeTrans * s->lapFree, s->normalizeAnalyzed);
 		}
-
-		SpMat augMat(M, N);
-		augMat.setFromTriplets(laplacianCoeffs.begin(), laplacianCoeffs.end());
-		s.augNormalizeDeltaCoordinatesTrans = augMat.transpose();
-
-		s.normalizeDeltaCoordinatesCholesky = new Eigen::SimplicialCholesky<SpMat>(s.augNormalizeDeltaCoordinatesTrans * augMat);
 	}
 	else {
 		// if not rotation-scale-invariant, we simply use the regular laplacian matrix. This is the first term of the energy (4)
 		energyMatrixCoeffs = laplacianCoeffs;
 	}
 
-	// in order to add the second term of the energy (4) or (5), we now augment the matrix.
 	{
-		// we augment the matrix by adding constraints for the handles.
-		// these constraints ensure that if the handles are dragged, the handles will strictly follow in the specified direction.
-		// the handle vertices are not free, unlike the unconstrained vertices.
-		for (int i = 0; i < unconstrainedBegin; ++i) {
-			energyMatrixCoeffs.push_back(Triplet(i * 3 + N + 0, 3 * i + 0, 1));
-			energyMatrixCoeffs.push_back(Triplet(i * 3 + N + 1, 3 * i + 1, 1));
-			energyMatrixCoeffs.push_back(Triplet(i * 3 + N + 2, 3 * i + 2, 1));
-		}
+		SpMat energyMat(N, N);
+		energyMat.setFromTriplets(energyMatrixCoeffs.begin(), energyMatrixCoeffs.end());
+		s->energyFixed = energyMat.leftCols(nFixedCols);
+		s->energyFree = energyMat.rightCols(nFreeCols);
+		s->energyFreeTrans = s->energyFree.transpose();
 
-		SpMat augMat(M, N);
-		augMat.setFromTriplets(energyMatrixCoeffs.begin(), energyMatrixCoeffs.end());
-		s.augEnergyMatrixTrans = augMat.transpose();
-
-		// for solving later, we need the cholesky decomposition of (transpose(augMat) * augMat)
+		// for solving later, we need the cholesky decomposition of (transpose(A_free) * A_free)
 		// this is a slow step! probably the slowest part of the entire algorithm.
-		s.energyMatrixCholesky = new Eigen::SimplicialCholesky<SpMat>(s.augEnergyMatrixTrans * augMat);
+		if (nFreeCols > 0) {
+			ok &= factorize(s->energyMatrixCholesky,
+				s->energyFreeTrans * s->energyFree, s->energyAnalyzed);
+		}
 	}
 
-	s.b = Vec(M);
-	s.roiIndices = roiIndices;
-	s.nRoi = nRoi;
-	s.RSI = RSI;
+	s->b = Vec(N);
+	s->nRoi = nRoi;
+	s->nFixed = unconstrainedBegin;
+	s->RSI = RSI;
+	return ok;
 }
 
-void doDeform(double* newHandlePositions, int nHandlePositions, double* outPositions) {
-	{
-		int count = 0;
-		for (int i = 0; i < s.roiDelta.size(); ++i) {
-			if (s.RSI) {
-				// following from our derivations, we must set all these to zero. 
-				s.b[count++] = 0.0f;
-			}
-			else {
-				s.b[count++] = s.roiDelta[i];
-			}
-		}
-		for (int j = 0; j < nHandlePositions; ++j) {
-			s.b[count++] = newHandlePositions[j * 3 + 0];
-			s.b[count++] = newHandlePositions[j * 3 + 1];
-			s.b[count++] = newHandlePositions[j * 3 + 2];
-		}
+void doDeform(LaplacianDeformation* s, double* newHandlePositions, int nHandlePositions, double* outPositions) {
+	if (s == nullptr || nHandlePositions != s->nFixed) {
+		return;
 	}
 
-	Vec minimizerSolution;
-	{
+	int N = s->nRoi * 3;
+	int nFixedCols = s->nFixed * 3;
+	int nFreeCols = N - nFixedCols;
+
+	Vec fixedPositions = Eigen::Map<Vec>(newHandlePositions, nFixedCols);
+	Vec solution(N);
+	solution.head(nFixedCols) = fixedPositions;
+
+	for (int i = 0; i < N; ++i) {
+		// following from our derivations, we must set all these to zero in RSI case.
+		s->b[i] = s->RSI ? 0.0 : s->roiDelta[i];
+	}
+
+	if (nFreeCols > 0) {
 		// Now we solve 
 		// Ax = b
-		// where A is the energy matrix, and the value of b depends on whether we are optimizing (4) or (5)
+		// where A is the energy matrix of free vertices, and fixed vertices contribute to the right-hand side.
 		// by solving, we obtain the deformed surface coordinates that minimizes either (4) or (5).
-		Vec y = s.augEnergyMatrixTrans * s.b;
-		minimizerSolution = s.energyMatrixCholesky->solve(y);
+		Vec y = s->energyFreeTrans * (s->b - s->energyFixed * fixedPositions);
+		solution.tail(nFreeCols) = s->energyMatrixCholesky.solve(y);
 	}
 
-	if (s.RSI) {
+	if (s->RSI && nFreeCols > 0) {
 		// if minimizing (5), a local scaling is introduced by the solver.
 		// so we need to normalize the delta coordinates of the deformed vertices back to their
 		// original lengths.
@@ -651,35 +629,25 @@ void doDeform(double* newHandlePositions, int nHandlePositions, double* outPosit
 		// then we simply do a minimization to find the coordinates that are as close as possible to the normalized delta coordinates	
 		// and the solution of this minimization is our final solution.
 
-		Vec solutionDelta = s.lapMat * minimizerSolution;
+		Vec solutionDelta = s->lapMat * solution;
 
 		int count = 0;
-		for (int i = 0; i < s.roiDeltaLengths.size(); ++i) {
+		for (int i = 0; i < s->roiDeltaLengths.size(); ++i) {
 
 			double len = getLength(solutionDelta[3 * i + 0], solutionDelta[3 * i + 1], solutionDelta[3 * i + 2]);
-			double originalLength = s.roiDeltaLengths[i];
-			double scale = originalLength / len;
+			double originalLength = s->roiDeltaLengths[i];
+			double scale = len > 0.0 ? originalLength / len : 0.0;
 
 			for (int d = 0; d < 3; ++d) {
-				s.b[count++] = scale * solutionDelta[3 * i + d];
+				s->b[count++] = scale * solutionDelta[3 * i + d];
 			}
 		}
 
-		Vec y = s.augNormalizeDeltaCoordinatesTrans * s.b;
-		Vec normalizedSolution = s.normalizeDeltaCoordinatesCholesky->solve(y);
-
-		for (int i = 0; i < s.nRoi; ++i) {
-			for (int d = 0; d < 3; ++d) {
-				outPositions[3 * s.roiIndices[i] + d] = normalizedSolution[3 * i + d];
-			}
-		}
+		Vec y = s->lapFreeTrans * (s->b - s->lapFixed * fixedPositions);
+		solution.tail(nFreeCols) = s->normalizeDeltaCoordinatesCholesky.solve(y);
 	}
-	else {
-		for (int i = 0; i < s.nRoi; ++i) {
-			for (int d = 0; d < 3; ++d) {
-				outPositions[3 * s.roiIndices[i] + d] = minimizerSolution[3 * i + d];
-			}
-		}
+
+	for (int i = 0; i < N; ++i) {
+		outPositions[i] = solution[i];
 	}
 }
-
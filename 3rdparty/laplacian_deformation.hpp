@@ -1,19 +1,31 @@
 #pragma once
 
+// Opaque solver state. Every deformer owns one, so multiple deformers may exist at the same time.
+struct LaplacianDeformation;
+
 extern "C" {
 
-	void prepareDeform(
-		int* cells, const int nCells,
+	LaplacianDeformation* createDeform();
 
-		double* positions, const int nPositions,
+	// cells and positions are local to the ROI (region of interest). Cell indices refer to
+	// ROI vertices, and negative ones mark vertices outside of it. The first unconstrainedBegin
+	// ROI vertices are handles/boundary and stay fixed; the remaining ones are solved.
+	// Calling it again with the same region topology reuses the symbolic factorizations.
+	bool prepareDeform(
+		LaplacianDeformation* state,
+
+		int* cells, const int nCells,
 
-		int* roiIndices, const int nRoi,
+		double* roiPositions, const int nRoi,
 
 		const int unconstrainedBegin,
 
 		bool RSI);
 
-	void doDeform(double* handlePositions, int nHandlePositions, double* outPositions);
+	// handlePositions contains the unconstrainedBegin fixed vertices, and outPositions receives
+	// all ROI vertices in the same order as prepareDeform().
+	void doDeform(LaplacianDeformation* state, double* handlePositions, int nHandlePositions,
+	              double* outPositions);
 
-	void freeDeform();
+	void freeDeform(LaplacianDeformation* state);
 }
\ No newline at end of file
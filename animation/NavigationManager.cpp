@@ -0,0 +1,554 @@
+#include <osg/io_utils>
+#include <osg/Notify>
+#include <osg/FrameStamp>
+#include <recastnavigation/Recast/Recast.h>
+#include <recastnavigation/Detour/DetourCommon.h>
+#include <recastnavigation/Detour/DetourNavMesh.h>
+#include <recastnavigation/Detour/DetourNavMeshBuilder.h>
+#include <recastnavigation/Detour/DetourNavMeshQuery.h>
+#include <recastnavigation/DetourCrowd/DetourCrowd.h>
+#include <modeling/Utilities.h>
+#include "NavigationManager.h"
+#include <string.h>
+#include <float.h>
+#ifdef _OPENMP
+#   include <omp.h>
+#endif
+using namespace osgVerse;
+
+#define MAX_PATH_POLYGONS 256
+static dtQueryFilter s_defaultFilter;
+
+// Recast uses a Y-up system, while scene coordinates are Z-up
+static inline void toRecast(const osg::Vec3& v, float* p)
+{ p[0] = v[0]; p[1] = v[2]; p[2] = -v[1]; }
+
+static inline osg::Vec3 fromRecast(const float* p)
+{ return osg::Vec3(p[0], -p[2], p[1]); }
+
+/// Intermediate Recast results of one tile, released together
+struct TileBuildData
+{
+    TileBuildData() : solid(NULL), chf(NULL), cset(NULL), pmesh(NULL), dmesh(NULL) {}
+    ~TileBuildData()
+    {
+        rcFreeHeightField(solid); rcFreeCompactHeightfield(chf); rcFreeContourSet(cset);
+        rcFreePolyMesh(pmesh); rcFreePolyMeshDetail(dmesh);
+    }
+
+    rcHeightfield* solid; rcCompactHeightfield* chf; rcContourSet* cset;
+    rcPolyMesh* pmesh; rcPolyMeshDetail* dmesh;
+};
+
+static bool findPathInternal(const dtNavMeshQuery* query, const float* extents,
+                             const osg::Vec3& start, const osg::Vec3& end,
+                             std::vector<osg::Vec3>& path)
+{
+    float s[3], e[3], startPos[3], endPos[3]; dtPolyRef startRef = 0, endRef = 0;
+    toRecast(start, s); toRecast(end, e); path.clear();
+    query->findNearestPoly(s, extents, &s_defaultFilter, &startRef, startPos);
+    query->findNearestPoly(e, extents, &s_defaultFilter, &endRef, endPos);
+    if (!startRef || !endRef) return false;
+
+    dtPolyRef polygons[MAX_PATH_POLYGONS]; int numPolygons = 0;
+    query->findPath(startRef, endRef, startPos, endPos, &s_defaultFilter,
+                    polygons, &numPolygons, MAX_PATH_POLYGONS);
+    if (numPolygons < 1) return false;
+
+    // End polygon may be unreachable, so stop at the nearest point of last one
+    if (polygons[numPolygons - 1] != endRef)
+        query->closestPointOnPoly(polygons[numPolygons - 1], endPos, endPos, NULL);
+
+    float points[MAX_PATH_POLYGONS * 3]; int numPoints = 0;
+    query->findStraightPath(startPos, endPos, polygons, numPolygons, points, NULL, NULL,
+                            &numPoints, MAX_PATH_POLYGONS);
+    for (int i = 0; i < numPoints; ++i) path.push_back(fromRecast(points + i * 3));
+    return numPoints > 0;
+}
+
+static bool raycastInternal(const dtNavMeshQuery* query, const float* extents,
+                            const osg::Vec3& start, const osg::Vec3& end, osg::Vec3& hitPoint)
+{
+    float s[3], e[3], startPos[3]; dtPolyRef startRef = 0;
+    toRecast(start, s); toRecast(end, e); hitPoint = end;
+    query->findNearestPoly(s, extents, &s_defaultFilter, &startRef, startPos);
+    if (!startRef) return false;
+
+    dtPolyRef polygons[MAX_PATH_POLYGONS]; int numPolygons = 0;
+    float t = 0.0f, hitNormal[3], hit[3];
+    query->raycast(startRef, startPos, e, &s_defaultFilter, &t, hitNormal,
+                   polygons, &numPolygons, MAX_PATH_POLYGONS);
+    if (t > 1.0f) return false;  // FLT_MAX if no wall is hit
+
+    dtVlerp(hit, startPos, e, t);
+    hitPoint = fromRecast(hit); return true;
+}
+
+NavigationManager::NavigationManager(const Settings& settings)
+:   _settings(settings), _navMesh(NULL), _crowd(NULL),
+    _numTilesX(0), _numTilesY(0), _nextGeometryID(0)
+{ _origin[0] = _origin[1] = _origin[2] = 0.0f; }
+
+NavigationManager::~NavigationManager()
+{ destroy(); }
+
+void NavigationManager::destroy()
+{
+    if (_crowd) dtFreeCrowd(_crowd);
+    for (size_t i = 0; i < _queries.size(); ++i) dtFreeNavMeshQuery(_queries[i]);
+    if (_navMesh) dtFreeNavMesh(_navMesh);  // tile data are freed by the navmesh
+    _queries.clear(); _crowd = NULL; _navMesh = NULL;
+    _numTilesX = _numTilesY = 0;
+}
+
+int NavigationManager::addWalkableGeometry(osg::Node* node, const osg::Matrix& matrix)
+{
+    int id = _nextGeometryID++;
+    GeometryData& data = _geometries[id];
+    collectGeometry(data, node, matrix);
+    if (data.bound.valid()) _modifiedBounds.push_back(data.bound);
+    return id;
+}
+
+bool NavigationManager::updateWalkableGeometry(int id, osg::Node* node, const osg::Matrix& matrix)
+{
+    std::map<int, GeometryData>::iterator itr = _geometries.find(id);
+    if (itr == _geometries.end()) return false;
+    if (itr->second.bound.valid()) _modifiedBounds.push_back(itr->second.bound);
+
+    collectGeometry(itr->second, node, matrix);
+    if (itr->second.bound.valid()) _modifiedBounds.push_back(itr->second.bound);
+    return true;
+}
+
+bool NavigationManager::removeWalkableGeometry(int id)
+{
+    std::map<int, GeometryData>::iterator itr = _geometries.find(id);
+    if (itr == _geometries.end()) return false;
+    if (itr->second.bound.valid()) _modifiedBounds.push_back(itr->second.bound);
+    _geometries.erase(itr); return true;
+}
+
+void NavigationManager::removeAllWalkableGeometries()
+{
+    for (std::map<int, GeometryData>::iterator itr = _geometries.begin();
+         itr != _geometries.end(); ++itr)
+    { if (itr->second.bound.valid()) _modifiedBounds.push_back(itr->second.bound); }
+    _geometries.clear();
+}
+
+void NavigationManager::collectGeometry(GeometryData& data, osg::Node* node,
+                                        const osg::Matrix& matrix)
+{
+    MeshCollector collector; osg::Matrix m = matrix;
+    collector.setUseGlobalVertices(true); collector.pushMatrix(m);
+    if (node != NULL) node->accept(collector);
+
+    const std::vector<osg::Vec3>& vertices = collector.getVertices();
+    const std::vector<unsigned int>& triangles = collector.getTriangles();
+    data.vertices.resize(vertices.size() * 3); data.bound.init();
+    for (size_t i = 0; i < vertices.size(); ++i)
+    { toRecast(vertices[i], &data.vertices[i * 3]); data.bound.expandBy(vertices[i]); }
+    data.triangles.assign(triangles.begin(), triangles.end());
+}
+
+bool NavigationManager::build()
+{
+    osg::BoundingBox bound;
+    for (std::map<int, GeometryData>::iterator itr = _geometries.begin();
+         itr != _geometries.end(); ++itr) bound.expandBy(itr->second.bound);
+    destroy(); _modifiedBounds.clear();
+    if (!bound.valid())
+    { OSG_WARN << "[NavigationManager] No walkable geometry to build" << std::endl; return false; }
+
+    // Tile grid covers the whole XY range of geometries
+    float tileWidth = (float)_settings.tileSize * _settings.cellSize;
+    _numTilesX = osg::maximum((int)ceil((bound.xMax() - bound.xMin()) / tileWidth), 1);
+    _numTilesY = osg::maximum((int)ceil((bound.yMax() - bound.yMin()) / tileWidth), 1);
+    toRecast(osg::Vec3(bound.xMin(), bound.yMax(), bound.zMin()), _origin);
+
+    int tileBits = osg::minimum((int)dtIlog2(dtNextPow2(_numTilesX * _numTilesY)), 14);
+    dtNavMeshParams params; memset(&params, 0, sizeof(params));
+    dtVcopy(params.orig, _origin); params.tileWidth = params.tileHeight = tileWidth;
+    params.maxTiles = 1 << tileBits; params.maxPolys = 1 << (22 - tileBits);
+
+    _navMesh = dtAllocNavMesh();
+    if (!_navMesh || dtStatusFailed(_navMesh->init(&params)))
+    {
+        OSG_WARN << "[NavigationManager] Failed to initialize navigation mesh of "
+                 << _numTilesX << "x" << _numTilesY << " tiles" << std::endl;
+        destroy(); return false;
+    }
+
+#ifdef _OPENMP
+    int numThreads = osg::maximum(omp_get_max_threads(), 1);
+#else
+    int numThreads = 1;
+#endif
+    for (int i = 0; i < numThreads; ++i)
+    {
+        dtNavMeshQuery* query = dtAllocNavMeshQuery();
+        if (query && dtStatusFailed(query->init(_navMesh, 2048)))
+        { dtFreeNavMeshQuery(query); query = NULL; }
+        _queries.push_back(query);
+    }
+
+    _crowd = dtAllocCrowd();
+    if (!_crowd || !_crowd->init(_settings.maxAgents, _settings.agentRadius, _navMesh))
+    {
+        OSG_WARN << "[NavigationManager] Failed to initialize crowd of "
+                 << _settings.maxAgents << " agents" << std::endl;
+        dtFreeCrowd(_crowd); _crowd = NULL;
+    }
+
+    TileSet tiles;
+    for (int y = 0; y < _numTilesY; ++y)
+        for (int x = 0; x < _numTilesX; ++x) tiles.insert(std::pair<int, int>(x, y));
+    buildTiles(tiles); return true;
+}
+
+int NavigationManager::rebuildTiles(const osg::BoundingBox& bound)
+{
+    TileSet tiles; collectTiles(bound, tiles);
+    return buildTiles(tiles);
+}
+
+int NavigationManager::rebuildModifiedTiles()
+{
+    TileSet tiles;
+    for (size_t i = 0; i < _modifiedBounds.size(); ++i) collectTiles(_modifiedBounds[i], tiles);
+    _modifiedBounds.clear(); return buildTiles(tiles);
+}
+
+void NavigationManager::collectTiles(const osg::BoundingBox& bound, TileSet& tiles) const
+{
+    if (!_navMesh || !bound.valid()) return;
+    float tileWidth = (float)_settings.tileSize * _settings.cellSize;
+    float border = (float)(int(ceilf(_settings.agentRadius / _settings.cellSize)) + 3)
+                 * _settings.cellSize;  // tiles also rasterize geometry in their borders
+
+    float bmin[3], bmax[3];
+    toRecast(osg::Vec3(bound.xMin() - border, bound.yMax() + border, 0.0f), bmin);
+    toRecast(osg::Vec3(bound.xMax() + border, bound.yMin() - border, 0.0f), bmax);
+    int x0 = osg::maximum((int)floor((bmin[0] - _origin[0]) / tileWidth), 0);
+    int y0 = osg::maximum((int)floor((bmin[2] - _origin[2]) / tileWidth), 0);
+    int x1 = osg::minimum((int)floor((bmax[0] - _origin[0]) / tileWidth), _numTilesX - 1);
+    int y1 = osg::minimum((int)floor((bmax[2] - _origin[2]) / tileWidth), _numTilesY - 1);
+    for (int y = y0; y <= y1; ++y)
+        for (int x = x0; x <= x1; ++x) tiles.insert(std::pair<int, int>(x, y));
+}
+
+int NavigationManager::buildTiles(const TileSet& tileSet)
+{
+    if (!_navMesh || tileSet.empty()) return 0;
+    std::vector<TileTriangles> tiles(tileSet.size());
+    std::vector<int> tileLookup(_numTilesX * _numTilesY, -1); int index = 0;
+    for (TileSet::const_iterator itr = tileSet.begin(); itr != tileSet.end(); ++itr, ++index)
+    {
+        TileTriangles& tile = tiles[index]; tile.data = NULL; tile.dataSize = 0;
+        tile.x = itr->first; tile.y = itr->second;
+        tileLookup[tile.y * _numTilesX + tile.x] = index;
+    }
+
+    // Assign triangles to all tiles they overlap, including tile borders
+    float tileWidth = (float)_settings.tileSize * _settings.cellSize;
+    float border = (float)(int(ceilf(_settings.agentRadius / _settings.cellSize)) + 3)
+                 * _settings.cellSize;
+    for (std::map<int, GeometryData>::const_iterator itr = _geometries.begin();
+         itr != _geometries.end(); ++itr)
+    {
+        const GeometryData& geom = itr->second;
+        const float* vertices = geom.vertices.empty() ? NULL : &geom.vertices[0];
+        for (size_t i = 0; i + 2 < geom.triangles.size(); i += 3)
+        {
+            const int* t = &geom.triangles[i];
+            const float *v0 = vertices + t[0] * 3, *v1 = vertices + t[1] * 3,
+                        *v2 = vertices + t[2] * 3;
+            float minX = osg::minimum(v0[0], osg::minimum(v1[0], v2[0])) - border;
+            float maxX = osg::maximum(v0[0], osg::maximum(v1[0], v2[0])) + border;
+            float minZ = osg::minimum(v0[2], osg::minimum(v1[2], v2[2])) - border;
+            float maxZ = osg::maximum(v0[2], osg::maximum(v1[2], v2[2])) + border;
+            int x0 = osg::maximum((int)floor((minX - _origin[0]) / tileWidth), 0);
+            int y0 = osg::maximum((int)floor((minZ - _origin[2]) / tileWidth), 0);
+            int x1 = osg::minimum((int)floor((maxX - _origin[0]) / tileWidth), _numTilesX - 1);
+            int y1 = osg::minimum((int)floor((maxZ - _origin[2]) / tileWidth), _numTilesY - 1);
+            for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x)
+                {
+                    int tileIndex = tileLookup[y * _numTilesX + x];
+                    if (tileIndex < 0) continue;
+
+                    TileTriangles& tile = tiles[tileIndex];
+                    if (tile.geometries.empty() || tile.geometries.back().first != &geom)
+                        tile.geometries.push_back(std::pair<const GeometryData*, std::vector<int>>(
+                            &geom, std::vector<int>()));
+                    tile.geometries.back().second.insert(
+                        tile.geometries.back().second.end(), t, t + 3);
+                }
+        }
+    }
+
+    // Each tile is rasterized with its own context and heightfield
+    int numTiles = (int)tiles.size();
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < numTiles; ++i)
+        tiles[i].data = buildTileData(tiles[i], tiles[i].dataSize);
+
+    // Replacing tiles of the navmesh is not thread-safe, so do it serially
+    for (int i = 0; i < numTiles; ++i)
+    {
+        TileTriangles& tile = tiles[i];
+        dtTileRef ref = _navMesh->getTileRefAt(tile.x, tile.y, 0);
+        if (ref) _navMesh->removeTile(ref, NULL, NULL);
+        if (!tile.data) continue;
+
+        if (dtStatusFailed(_navMesh->addTile(tile.data, tile.dataSize,
+                                             DT_TILE_FREE_DATA, 0, NULL)))
+        {
+            OSG_WARN << "[NavigationManager] Failed to add tile (" << tile.x << ", "
+                     << tile.y << ")" << std::endl; dtFree(tile.data);
+        }
+    }
+    return numTiles;
+}
+
+unsigned char* NavigationManager::buildTileData(TileTriangles& tile, int& dataSize) const
+{
+    if (tile.geometries.empty()) return NULL;
+    const Settings& s = _settings;
+    rcConfig cfg; memset(&cfg, 0, sizeof(cfg));
+    cfg.cs = s.cellSize; cfg.ch = s.cellHeight;
+    cfg.walkableSlopeAngle = s.agentMaxSlope;
+    cfg.walkableHeight = (int)ceilf(s.agentHeight / cfg.ch);
+    cfg.walkableClimb = (int)floorf(s.agentMaxClimb / cfg.ch);
+    cfg.walkableRadius = (int)ceilf(s.agentRadius / cfg.cs);
+    cfg.maxEdgeLen = (int)(s.edgeMaxLength / cfg.cs);
+    cfg.maxSimplificationError = s.edgeMaxError;
+    cfg.minRegionArea = (int)rcSqr(s.regionMinSize);
+    cfg.mergeRegionArea = (int)rcSqr(s.regionMergeSize);
+    cfg.maxVertsPerPoly = DT_VERTS_PER_POLYGON;
+    cfg.tileSize = s.tileSize; cfg.borderSize = cfg.walkableRadius + 3;
+    cfg.width = cfg.height = cfg.tileSize + cfg.borderSize * 2;
+    cfg.detailSampleDist = (s.detailSampleDistance < 0.9f) ? 0.0f
+                         : cfg.cs * s.detailSampleDistance;
+    cfg.detailSampleMaxError = cfg.ch * s.detailSampleMaxError;
+
+    // Tile bound with borders, and height range of geometries in it
+    float tileWidth = (float)cfg.tileSize * cfg.cs, border = (float)cfg.borderSize * cfg.cs;
+    cfg.bmin[0] = _origin[0] + (float)tile.x * tileWidth - border;
+    cfg.bmin[2] = _origin[2] + (float)tile.y * tileWidth - border;
+    cfg.bmax[0] = _origin[0] + (float)(tile.x + 1) * tileWidth + border;
+    cfg.bmax[2] = _origin[2] + (float)(tile.y + 1) * tileWidth + border;
+    cfg.bmin[1] = FLT_MAX; cfg.bmax[1] = -FLT_MAX;
+    for (size_t i = 0; i < tile.geometries.size(); ++i)
+    {
+        const osg::BoundingBox& bb = tile.geometries[i].first->bound;
+        cfg.bmin[1] = osg::minimum(cfg.bmin[1], bb.zMin());
+        cfg.bmax[1] = osg::maximum(cfg.bmax[1], bb.zMax());
+    }
+
+    rcContext ctx(false); TileBuildData b;
+    b.solid = rcAllocHeightfield();
+    if (!b.solid || !rcCreateHeightfield(&ctx, *b.solid, cfg.width, cfg.height,
+                                         cfg.bmin, cfg.bmax, cfg.cs, cfg.ch)) return NULL;
+
+    std::vector<unsigned char> areas;
+    for (size_t i = 0; i < tile.geometries.size(); ++i)
+    {
+        const GeometryData& geom = *tile.geometries[i].first;
+        const std::vector<int>& triangles = tile.geometries[i].second;
+        int numVertices = (int)geom.vertices.size() / 3, numTriangles = (int)triangles.size() / 3;
+        areas.assign(numTriangles, 0);
+        rcMarkWalkableTriangles(&ctx, cfg.walkableSlopeAngle, &geom.vertices[0], numVertices,
+                                &triangles[0], numTriangles, &areas[0]);
+        if (!rcRasterizeTriangles(&ctx, &geom.vertices[0], numVertices, &triangles[0],
+                                  &areas[0], numTriangles, *b.solid, cfg.walkableClimb))
+            return NULL;
+    }
+    tile.geometries.clear();  // triangle lists are not needed any more
+
+    rcFilterLowHangingWalkableObstacles(&ctx, cfg.walkableClimb, *b.solid);
+    rcFilterLedgeSpans(&ctx, cfg.walkableHeight, cfg.walkableClimb, *b.solid);
+    rcFilterWalkableLowHeightSpans(&ctx, cfg.walkableHeight, *b.solid);
+
+    b.chf = rcAllocCompactHeightfield();
+    if (!b.chf || !rcBuildCompactHeightfield(&ctx, cfg.walkableHeight, cfg.walkableClimb,
+                                             *b.solid, *b.chf)) return NULL;
+    rcFreeHeightField(b.solid); b.solid = NULL;
+    if (!rcErodeWalkableArea(&ctx, cfg.walkableRadius, *b.chf)) return NULL;
+    if (!rcBuildDistanceField(&ctx, *b.chf)) return NULL;
+    if (!rcBuildRegions(&ctx, *b.chf, cfg.borderSize, cfg.minRegionArea, cfg.mergeRegionArea))
+        return NULL;
+
+    b.cset = rcAllocContourSet();
+    if (!b.cset || !rcBuildContours(&ctx, *b.chf, cfg.maxSimplificationError,
+                                    cfg.maxEdgeLen, *b.cset)) return NULL;
+    if (b.cset->nconts == 0) return NULL;
+
+    b.pmesh = rcAllocPolyMesh(); b.dmesh = rcAllocPolyMeshDetail();
+    if (!b.pmesh || !rcBuildPolyMesh(&ctx, *b.cset, cfg.maxVertsPerPoly, *b.pmesh)) return NULL;
+    if (!b.dmesh || !rcBuildPolyMeshDetail(&ctx, *b.pmesh, *b.chf, cfg.detailSampleDist,
+                                           cfg.detailSampleMaxError, *b.dmesh)) return NULL;
+    if (b.pmesh->nverts >= 0xffff || b.pmesh->npolys < 1) return NULL;
+
+    // All walkable polygons share area 0 and flag 1, which default query filter accepts
+    for (int i = 0; i < b.pmesh->npolys; ++i)
+    {
+        if (b.pmesh->areas[i] == RC_WALKABLE_AREA)
+        { b.pmesh->areas[i] = 0; b.pmesh->flags[i] = 1; }
+        else b.pmesh->flags[i] = 0;
+    }
+
+    dtNavMeshCreateParams params; memset(&params, 0, sizeof(params));
+    params.verts = b.pmesh->verts; params.vertCount = b.pmesh->nverts;
+    params.polys = b.pmesh->polys; params.polyAreas = b.pmesh->areas;
+    params.polyFlags = b.pmesh->flags; params.polyCount = b.pmesh->npolys;
+    params.nvp = b.pmesh->nvp; params.detailMeshes = b.dmesh->meshes;
+    params.detailVerts = b.dmesh->verts; params.detailVertsCount = b.dmesh->nverts;
+    params.detailTris = b.dmesh->tris; params.detailTriCount = b.dmesh->ntris;
+    params.walkableHeight = s.agentHeight; params.walkableRadius = s.agentRadius;
+    params.walkableClimb = s.agentMaxClimb; params.tileX = tile.x; params.tileY = tile.y;
+    rcVcopy(params.bmin, b.pmesh->bmin); rcVcopy(params.bmax, b.pmesh->bmax);
+    params.cs = cfg.cs; params.ch = cfg.ch; params.buildBvTree = true;
+
+    unsigned char* data = NULL;
+    if (!dtCreateNavMeshData(&params, &data, &dataSize)) return NULL;
+    return data;
+}
+
+bool NavigationManager::findPath(const osg::Vec3& start, const osg::Vec3& end,
+                                 std::vector<osg::Vec3>& path)
+{
+    if (_queries.empty() || !_queries[0]) return false;
+    float extents[3] = { _settings.agentRadius * 2.0f, _settings.agentHeight,
+                         _settings.agentRadius * 2.0f };
+    return findPathInternal(_queries[0], extents, start, end, path);
+}
+
+bool NavigationManager::raycast(const osg::Vec3& start, const osg::Vec3& end, osg::Vec3& hitPoint)
+{
+    if (_queries.empty() || !_queries[0]) return false;
+    float extents[3] = { _settings.agentRadius * 2.0f, _settings.agentHeight,
+                         _settings.agentRadius * 2.0f };
+    return raycastInternal(_queries[0], extents, start, end, hitPoint);
+}
+
+int NavigationManager::findPaths(std::vector<PathQuery>& queries)
+{
+    if (_queries.empty()) return 0;
+    float extents[3] = { _settings.agentRadius * 2.0f, _settings.agentHeight,
+                         _settings.agentRadius * 2.0f };
+    int numQueries = (int)queries.size(), numThreads = (int)_queries.size(), numFound = 0;
+#pragma omp parallel for schedule(dynamic, 16) reduction(+:numFound) num_threads(numThreads)
+    for (int i = 0; i < numQueries; ++i)
+    {
+#ifdef _OPENMP
+        const dtNavMeshQuery* query = _queries[omp_get_thread_num()];
+#else
+        const dtNavMeshQuery* query = _queries[0];
+#endif
+        PathQuery& q = queries[i];
+        q.found = query ? findPathInternal(query, extents, q.start, q.end, q.path) : false;
+        if (q.found) numFound++;
+    }
+    return numFound;
+}
+
+int NavigationManager::raycasts(std::vector<RaycastQuery>& queries)
+{
+    if (_queries.empty()) return 0;
+    float extents[3] = { _settings.agentRadius * 2.0f, _settings.agentHeight,
+                         _settings.agentRadius * 2.0f };
+    int numQueries = (int)queries.size(), numThreads = (int)_queries.size(), numHits = 0;
+#pragma omp parallel for schedule(dynamic, 64) reduction(+:numHits) num_threads(numThreads)
+    for (int i = 0; i < numQueries; ++i)
+    {
+#ifdef _OPENMP
+        const dtNavMeshQuery* query = _queries[omp_get_thread_num()];
+#else
+        const dtNavMeshQuery* query = _queries[0];
+#endif
+        RaycastQuery& q = queries[i];
+        q.hit = query ? raycastInternal(query, extents, q.start, q.end, q.hitPoint) : false;
+        if (q.hit) numHits++;
+    }
+    return numHits;
+}
+
+int NavigationManager::addAgent(const osg::Vec3& pos, float maxSpeed, float maxAcceleration)
+{
+    if (!_crowd) return -1;
+    dtCrowdAgentParams ap; memset(&ap, 0, sizeof(ap));
+    ap.radius = _settings.agentRadius; ap.height = _settings.agentHeight;
+    ap.maxAcceleration = maxAcceleration; ap.maxSpeed = maxSpeed;
+    ap.collisionQueryRange = ap.radius * 12.0f;
+    ap.pathOptimizationRange = ap.radius * 30.0f;
+    ap.separationWeight = 2.0f; ap.obstacleAvoidanceType = 3;
+    ap.updateFlags = DT_CROWD_ANTICIPATE_TURNS | DT_CROWD_OPTIMIZE_VIS |
+                     DT_CROWD_OPTIMIZE_TOPO | DT_CROWD_OBSTACLE_AVOIDANCE | DT_CROWD_SEPARATION;
+
+    float p[3]; toRecast(pos, p);
+    return _crowd->addAgent(p, &ap);
+}
+
+void NavigationManager::removeAgent(int id)
+{ if (isAgentActive(id)) _crowd->removeAgent(id); }
+
+bool NavigationManager::setAgentTarget(int id, const osg::Vec3& target)
+{
+    if (!isAgentActive(id)) return false;
+    float p[3], nearest[3]; dtPolyRef ref = 0; toRecast(target, p);
+    _crowd->getNavMeshQuery()->findNearestPoly(p, _crowd->getQueryExtents(),
+                                               _crowd->getFilter(0), &ref, nearest);
+    if (!ref) return false;
+    return _crowd->requestMoveTarget(id, ref, nearest);
+}
+
+bool NavigationManager::isAgentActive(int id) const
+{
+    if (!_crowd || id < 0 || id >= _crowd->getAgentCount()) return false;
+    const dtCrowdAgent* agent = _crowd->getAgent(id);
+    return agent != NULL && agent->active;
+}
+
+osg::Vec3 NavigationManager::getAgentPosition(int id) const
+{
+    if (!isAgentActive(id)) return osg::Vec3();
+    return fromRecast(_crowd->getAgent(id)->npos);
+}
+
+osg::Vec3 NavigationManager::getAgentVelocity(int id) const
+{
+    if (!isAgentActive(id)) return osg::Vec3();
+    return fromRecast(_crowd->getAgent(id)->vel);
+}
+
+int NavigationManager::getAgentPositions(std::vector<osg::Vec3>& positions) const
+{
+    if (!_crowd) return 0;
+    int numAgents = _crowd->getAgentCount(), numActive = 0;
+    positions.resize(numAgents);
+    for (int i = 0; i < numAgents; ++i)
+    {
+        const dtCrowdAgent* agent = _crowd->getAgent(i);
+        if (!agent || !agent->active) continue;
+        positions[i] = fromRecast(agent->npos); numActive++;
+    }
+    return numActive;
+}
+
+void NavigationManager::update(float dt)
+{ if (_crowd && dt > 0.0f) _crowd->update(dt, NULL); }
+
+void NavigationUpdateCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+{
+    const osg::FrameStamp* fs = nv->getFrameStamp();
+    if (_manager.valid() && fs != NULL)
+    {
+        double time = fs->getSimulationTime();
+        if (_lastTime >= 0.0)  // avoid large steps after pauses
+            _manager->update((float)osg::minimum(time - _lastTime, 0.1));
+        _lastTime = time;
+    }
+    traverse(node, nv);
+}
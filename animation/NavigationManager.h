@@ -0,0 +1,149 @@
+#ifndef MANA_ANIM_NAVIGATIONMANAGER_HPP
+#define MANA_ANIM_NAVIGATIONMANAGER_HPP
+
+#include <osg/Version>
+#include <osg/BoundingBox>
+#include <osg/Matrix>
+#include <osg/NodeCallback>
+#include <osg/observer_ptr>
+#include <vector>
+#include <set>
+#include <map>
+
+class dtNavMesh;
+class dtNavMeshQuery;
+class dtCrowd;
+
+namespace osgVerse
+{
+
+    /** Tiled navigation mesh built by Recast/Detour, with path queries and crowd steering.
+        Positions are in Z-up world coordinates of the scene, and converted internally to the
+        Y-up system of Recast. Walkable geometry is collected by MeshCollector, and tiles of
+        the mesh are built concurrently with OpenMP */
+    class NavigationManager : public osg::Referenced
+    {
+    public:
+        struct Settings
+        {
+            Settings() : cellSize(0.3f), cellHeight(0.2f), agentHeight(2.0f), agentRadius(0.6f),
+                         agentMaxClimb(0.9f), agentMaxSlope(45.0f), regionMinSize(8.0f),
+                         regionMergeSize(20.0f), edgeMaxLength(12.0f), edgeMaxError(1.3f),
+                         detailSampleDistance(6.0f), detailSampleMaxError(1.0f),
+                         tileSize(48), maxAgents(1024) {}
+            float cellSize, cellHeight, agentHeight, agentRadius, agentMaxClimb, agentMaxSlope;
+            float regionMinSize, regionMergeSize, edgeMaxLength, edgeMaxError;
+            float detailSampleDistance, detailSampleMaxError;
+            int tileSize;  // in cells
+            int maxAgents;
+        };
+
+        NavigationManager(const Settings& settings = Settings());
+        const Settings& getSettings() const { return _settings; }
+
+        /** Add walkable geometry transformed by 'matrix', and return its ID. Changed geometries
+            mark their areas as modified, and tiles there are updated by rebuildModifiedTiles() */
+        int addWalkableGeometry(osg::Node* node, const osg::Matrix& matrix = osg::Matrix());
+        bool updateWalkableGeometry(int id, osg::Node* node, const osg::Matrix& matrix);
+        bool removeWalkableGeometry(int id);
+        void removeAllWalkableGeometries();
+
+        /** Create the tile grid covering all geometries and build every tile. Crowd agents and
+            cached queries are reset, so call it again only if geometries grow out of the grid */
+        bool build();
+
+        /** Rebuild tiles overlapping the world bound (e.g., a moved obstacle), and return number
+            of rebuilt tiles. Tiles out of the grid created by build() are ignored */
+        int rebuildTiles(const osg::BoundingBox& bound);
+        int rebuildModifiedTiles();
+        bool isBuilt() const { return _navMesh != NULL; }
+
+        /** Find a smoothed path between two points, which are snapped to the nearest polygons */
+        bool findPath(const osg::Vec3& start, const osg::Vec3& end, std::vector<osg::Vec3>& path);
+
+        /** Cast a 'walkability' ray along the surface from start to end. Returns true if it hits
+            a wall, and 'hitPoint' is where the ray stops */
+        bool raycast(const osg::Vec3& start, const osg::Vec3& end, osg::Vec3& hitPoint);
+
+        struct PathQuery
+        {
+            PathQuery() : found(false) {}
+            PathQuery(const osg::Vec3& s, const osg::Vec3& e) : start(s), end(e), found(false) {}
+            osg::Vec3 start, end; std::vector<osg::Vec3> path; bool found;
+        };
+
+        struct RaycastQuery
+        {
+            RaycastQuery() : hit(false) {}
+            RaycastQuery(const osg::Vec3& s, const osg::Vec3& e) : start(s), end(e), hit(false) {}
+            osg::Vec3 start, end, hitPoint; bool hit;
+        };
+
+        /** Batched queries evaluated concurrently, each thread using its own Detour query.
+            Return number of found paths / hit rays */
+        int findPaths(std::vector<PathQuery>& queries);
+        int raycasts(std::vector<RaycastQuery>& queries);
+
+        // Crowd functions, available after build()
+        int addAgent(const osg::Vec3& pos, float maxSpeed = 3.5f, float maxAcceleration = 8.0f);
+        void removeAgent(int id);
+        bool setAgentTarget(int id, const osg::Vec3& target);
+        bool isAgentActive(int id) const;
+        osg::Vec3 getAgentPosition(int id) const;
+        osg::Vec3 getAgentVelocity(int id) const;
+
+        /** Copy positions of all agents to 'positions', which is indexed by agent ID. Positions
+            of inactive agents are left unchanged. Returns number of active agents */
+        int getAgentPositions(std::vector<osg::Vec3>& positions) const;
+
+        /** Move all crowd agents by 'dt' seconds */
+        void update(float dt);
+
+    protected:
+        virtual ~NavigationManager();
+
+        struct GeometryData
+        {
+            std::vector<float> vertices;  // in Recast coordinates
+            std::vector<int> triangles;
+            osg::BoundingBox bound;  // in world coordinates
+        };
+
+        struct TileTriangles
+        {
+            std::vector<std::pair<const GeometryData*, std::vector<int>>> geometries;
+            int x, y; unsigned char* data; int dataSize;
+        };
+
+        void collectGeometry(GeometryData& data, osg::Node* node, const osg::Matrix& matrix);
+        typedef std::set<std::pair<int, int>> TileSet;
+        void collectTiles(const osg::BoundingBox& bound, TileSet& tiles) const;
+        int buildTiles(const TileSet& tiles);
+        unsigned char* buildTileData(TileTriangles& tile, int& dataSize) const;
+        void destroy();
+
+        std::map<int, GeometryData> _geometries;
+        std::vector<osg::BoundingBox> _modifiedBounds;
+        std::vector<dtNavMeshQuery*> _queries;  // one per thread
+        Settings _settings;
+        dtNavMesh* _navMesh;
+        dtCrowd* _crowd;
+        float _origin[3];
+        int _numTilesX, _numTilesY, _nextGeometryID;
+    };
+
+    /** Update crowd agents of the navigation manager once per frame */
+    class NavigationUpdateCallback : public osg::NodeCallback
+    {
+    public:
+        NavigationUpdateCallback(NavigationManager* m) : _manager(m), _lastTime(-1.0) {}
+        virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+    protected:
+        osg::observer_ptr<NavigationManager> _manager;
+        double _lastTime;
+    };
+
+}
+
+#endif
@@ -9,22 +9,95 @@
 #include <btBulletDynamicsCommon.h>
 #include <btBulletCollisionCommon.h>
 //#include <BulletCollision/NarrowPhaseCollision/btRaycastCallback.h>
+#if BT_BULLET_VERSION >= 287
+#   include <LinearMath/btThreads.h>
+#   include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#   include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#endif
+#if BT_BULLET_VERSION >= 288
+#   include <BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h>
+#endif
 #include "PhysicsEngine.h"
 using namespace osgVerse;
 
-PhysicsEngine::PhysicsEngine()
+/** Motion state marking its body as moved, which is called by Bullet for active bodies only */
+class PhysicsMotionState : public btDefaultMotionState
 {
-    // FIXME: use a parallel processing dispatcher? (Extras/BulletMultiThreaded)
-    _collisionCfg = new btDefaultCollisionConfiguration;
-    _collisionDispatcher = new btCollisionDispatcher(_collisionCfg);
+public:
+    PhysicsMotionState(const btTransform& t, std::vector<char>& flags, int handle)
+    :   btDefaultMotionState(t), _flags(flags), _handle(handle) {}
+
+    virtual void setWorldTransform(const btTransform& t)
+    { btDefaultMotionState::setWorldTransform(t); _flags[_handle] = 1; }
+
+protected:
+    std::vector<char>& _flags;
+    int _handle;
+};
+
+static bool setupTaskScheduler(int numThreads)
+{
+#if BT_BULLET_VERSION >= 287
+    // Schedulers are only created if Bullet is built with BT_THREADSAFE
+    static btITaskScheduler* s_scheduler = NULL;
+    if (!s_scheduler)
+    {
+        s_scheduler = btGetOpenMPTaskScheduler();
+        if (!s_scheduler) s_scheduler = btCreateDefaultTaskScheduler();
+        if (!s_scheduler) return false; else btSetTaskScheduler(s_scheduler);
+    }
+
+    int maxThreads = s_scheduler->getMaxNumThreads();
+    s_scheduler->setNumThreads(numThreads > 0 ? osg::minimum(numThreads, maxThreads) : maxThreads);
+    return true;
+#else
+    return false;
+#endif
+}
+
+PhysicsEngine::PhysicsEngine(bool multithreaded, int numThreads)
+:   _solverMt(NULL), _multithreaded(false)
+{
+    if (multithreaded && !setupTaskScheduler(numThreads))
+    {
+        OSG_NOTICE << "[PhysicsEngine] Bullet task scheduler not available (requires Bullet "
+                   << "2.87 or later built with BT_THREADSAFE), using single thread" << std::endl;
+        multithreaded = false;
+    }
 
     // A good general purpose broadphase, may also try out btAxis3Sweep
     _overlappingPairCache = new btDbvtBroadphase;
-
-    // FIXME: use a parallel processing solver?
-    _solver = new btSequentialImpulseConstraintSolver;
-    _world = new btDiscreteDynamicsWorld(_collisionDispatcher, _overlappingPairCache,
-                                         _solver, _collisionCfg);
+#if BT_BULLET_VERSION >= 287
+    if (multithreaded)
+    {
+        // Collision algorithms and manifolds are allocated concurrently, so pools must be large
+        btDefaultCollisionConstructionInfo cci;
+        cci.m_defaultMaxPersistentManifoldPoolSize = 80000;
+        cci.m_defaultMaxCollisionAlgorithmPoolSize = 80000;
+        _collisionCfg = new btDefaultCollisionConfiguration(cci);
+        _collisionDispatcher = new btCollisionDispatcherMt(_collisionCfg, 40);
+
+        // Islands are solved by a pool of sequential solvers, and large ones by a parallel solver
+        _solver = new btConstraintSolverPoolMt(BT_MAX_THREAD_COUNT);
+#   if BT_BULLET_VERSION >= 288
+        _solverMt = new btSequentialImpulseConstraintSolverMt;
+        _world = new btDiscreteDynamicsWorldMt(_collisionDispatcher, _overlappingPairCache,
+            static_cast<btConstraintSolverPoolMt*>(_solver), _solverMt, _collisionCfg);
+#   else
+        _world = new btDiscreteDynamicsWorldMt(_collisionDispatcher, _overlappingPairCache,
+            static_cast<btConstraintSolverPoolMt*>(_solver), _collisionCfg);
+#   endif
+        _multithreaded = true;
+    }
+    else
+#endif
+    {
+        _collisionCfg = new btDefaultCollisionConfiguration;
+        _collisionDispatcher = new btCollisionDispatcher(_collisionCfg);
+        _solver = new btSequentialImpulseConstraintSolver;
+        _world = new btDiscreteDynamicsWorld(_collisionDispatcher, _overlappingPairCache,
+                                             _solver, _collisionCfg);
+    }
     _world->setGravity(btVector3(0, 0, -9.8));
 }
 
@@ -44,9 +117,13 @@ PhysicsEngine::~PhysicsEngine()
         delete itr->second;
     }
     for (std::map<std::string, btCollisionShape*>::iterator itr = _shapes.begin();
-         itr != _shapes.end(); ++itr) { delete itr->second; }
+         itr != _shapes.end(); ++itr) { releaseShape(itr->second); }
+    for (std::map<std::string, SharedShape>::iterator itr = _sharedShapes.begin();
+         itr != _sharedShapes.end(); ++itr) { releaseShape(itr->second.first); }
+    _shapes.clear(); _sharedShapes.clear();
 
     delete _world; delete _solver;
+    if (_solverMt) delete _solverMt;
     delete _overlappingPairCache;
     delete _collisionDispatcher;
     delete _collisionCfg;
@@ -64,9 +141,13 @@ btRigidBody* PhysicsEngine::addRigidBody(const std::string& name, btCollisionSha
     transform.setOrigin(btVector3(p.x(), p.y(), p.z()));
     transform.setRotation(btQuaternion(q.x(), q.y(), q.z(), q.w()));
 
+    int handle = (int)_bodyTable.size();
+    if (!_freeHandles.empty()) { handle = _freeHandles.back(); _freeHandles.pop_back(); }
+    else { _bodyTable.push_back(BodyRecord()); _movedFlags.push_back(0); }
+
     btVector3 localInertia(0, 0, 0);
     if (isDynamic) shape->calculateLocalInertia(mass, localInertia);
-    btDefaultMotionState* motionState = new btDefaultMotionState(transform);
+    PhysicsMotionState* motionState = new PhysicsMotionState(transform, _movedFlags, handle);
     btRigidBody::btRigidBodyConstructionInfo rbInfo(mass, motionState, shape, localInertia);
     
     btRigidBody* body = new btRigidBody(rbInfo);
@@ -78,9 +159,10 @@ btRigidBody* PhysicsEngine::addRigidBody(const std::string& name, btCollisionSha
     else if (mass <= 0.0f)
         body->setCollisionFlags(body->getCollisionFlags() | btCollisionObject::CF_STATIC_OBJECT);
 
-    _world->addRigidBody(body);
-    _shapes[name] = shape; _bodies[name] = body;
-    return body;
+    _world->addRigidBody(body); body->setUserIndex(handle);
+    _shapes[name] = shape; _bodies[name] = body; retainShape(shape);
+    _bodyTable[handle].body = body; _bodyTable[handle].name = name;
+    _movedFlags[handle] = 1; return body;
 }
 
 void PhysicsEngine::removeBody(const std::string& name)
@@ -88,13 +170,17 @@ void PhysicsEngine::removeBody(const std::string& name)
     std::map<std::string, btRigidBody*>::iterator itr = _bodies.find(name);
     if (itr != _bodies.end())
     {
+        int handle = itr->second->getUserIndex();
+        _bodyTable[handle] = BodyRecord(); _movedFlags[handle] = 0;
+        _freeHandles.push_back(handle);
+
         if (itr->second->getMotionState()) delete itr->second->getMotionState();
         _world->removeCollisionObject(itr->second);
         delete itr->second; _bodies.erase(itr);
     }
 
     std::map<std::string, btCollisionShape*>::iterator itr2 = _shapes.find(name);
-    if (itr2 != _shapes.end()) { delete itr2->second; _shapes.erase(itr2); }
+    if (itr2 != _shapes.end()) { releaseShape(itr2->second); _shapes.erase(itr2); }
 }
 
 bool PhysicsEngine::isDynamicBody(const std::string& name, bool& isKinematic)
@@ -109,68 +195,117 @@ bool PhysicsEngine::isDynamicBody(const std::string& name, bool& isKinematic)
     return false;
 }
 
-void PhysicsEngine::setTransform(const std::string& name, const osg::Matrix& matrix)
+int PhysicsEngine::getBodyHandle(const std::string& name) const
 {
-    std::map<std::string, btRigidBody*>::iterator itr = _bodies.find(name);
-    if (itr != _bodies.end())
-    {
-        osg::Quat q = matrix.getRotate();
-        osg::Vec3 p = matrix.getTrans();
+    std::map<std::string, btRigidBody*>::const_iterator itr = _bodies.find(name);
+    return (itr != _bodies.end()) ? itr->second->getUserIndex() : -1;
+}
 
-        btTransform transform; transform.setIdentity();
-        transform.setOrigin(btVector3(p.x(), p.y(), p.z()));
-        transform.setRotation(btQuaternion(q.x(), q.y(), q.z(), q.w()));
+int PhysicsEngine::getBodyHandle(const btRigidBody* body) const
+{
+    if (!body) return -1; int handle = body->getUserIndex();
+    if (handle < 0 || handle >= (int)_bodyTable.size()) return -1;
+    return (_bodyTable[handle].body == body) ? handle : -1;
+}
 
-        btRigidBody* body = itr->second;
-        if (body->getMotionState())
-            body->getMotionState()->setWorldTransform(transform);
-        body->setWorldTransform(transform);
-    }
+const std::string& PhysicsEngine::getBodyName(int handle) const
+{
+    static std::string s_emptyName;
+    if (handle < 0 || handle >= (int)_bodyTable.size()) return s_emptyName;
+    return _bodyTable[handle].name;
+}
+
+void PhysicsEngine::setTransform(btRigidBody* body, const osg::Matrix& matrix)
+{
+    osg::Quat q = matrix.getRotate();
+    osg::Vec3 p = matrix.getTrans();
+
+    btTransform transform; transform.setIdentity();
+    transform.setOrigin(btVector3(p.x(), p.y(), p.z()));
+    transform.setRotation(btQuaternion(q.x(), q.y(), q.z(), q.w()));
+    if (body->getMotionState())
+        body->getMotionState()->setWorldTransform(transform);
+    body->setWorldTransform(transform);
+}
+
+osg::Matrix PhysicsEngine::getTransform(btRigidBody* body)
+{
+    btTransform transform;
+    if (body->getMotionState())
+        body->getMotionState()->getWorldTransform(transform);
+    else
+        transform = body->getWorldTransform();
+
+    // Bullet's OpenGL matrix has the same layout as OSG, so no quaternion conversion needed
+    btScalar m[16]; transform.getOpenGLMatrix(m);
+    return osg::Matrix(m);
+}
+
+void PhysicsEngine::setTransform(const std::string& name, const osg::Matrix& matrix)
+{
+    std::map<std::string, btRigidBody*>::iterator itr = _bodies.find(name);
+    if (itr != _bodies.end()) setTransform(itr->second, matrix);
 }
 
 osg::Matrix PhysicsEngine::getTransform(const std::string& name, bool& valid)
 {
     std::map<std::string, btRigidBody*>::iterator itr = _bodies.find(name);
-    if (itr != _bodies.end())
-    {
-        btTransform transform; valid = true;
-        btRigidBody* body = itr->second;
-        if (body->getMotionState())
-            body->getMotionState()->getWorldTransform(transform);
-        else
-            transform = body->getWorldTransform();
-
-        const btVector3& p = transform.getOrigin();
-        btQuaternion q = transform.getRotation();
-        return osg::Matrix(osg::Matrix::rotate(osg::Quat(q.x(), q.y(), q.z(), q.w()))
-                         * osg::Matrix::translate(p.x(), p.y(), p.z()));
-    }
-    valid = false;
-    return osg::Matrix();
+    valid = (itr != _bodies.end());
+    return valid ? getTransform(itr->second) : osg::Matrix();
+}
+
+void PhysicsEngine::setTransform(int handle, const osg::Matrix& matrix)
+{
+    btRigidBody* body = getRigidBody(handle);
+    if (body != NULL) setTransform(body, matrix);
+}
+
+osg::Matrix PhysicsEngine::getTransform(int handle, bool& valid)
+{
+    btRigidBody* body = getRigidBody(handle); valid = (body != NULL);
+    return valid ? getTransform(body) : osg::Matrix();
 }
 
 void PhysicsEngine::setVelocity(const std::string& name, const osg::Vec3& v, bool linearOrAngular)
 {
     std::map<std::string, btRigidBody*>::iterator itr = _bodies.find(name);
-    if (itr != _bodies.end())
-    {
-        btRigidBody* body = itr->second;
-        if (linearOrAngular) body->setLinearVelocity(btVector3(v[0], v[1], v[2]));
-        else body->setAngularVelocity(btVector3(v[0], v[1], v[2]));
-    }
+    if (itr != _bodies.end()) setVelocity(itr->second->getUserIndex(), v, linearOrAngular);
 }
 
 osg::Vec3 PhysicsEngine::getVelocity(const std::string& name, bool linearOrAngular)
 {
     std::map<std::string, btRigidBody*>::iterator itr = _bodies.find(name);
-    if (itr != _bodies.end())
+    if (itr != _bodies.end()) return getVelocity(itr->second->getUserIndex(), linearOrAngular);
+    return osg::Vec3();
+}
+
+void PhysicsEngine::setVelocity(int handle, const osg::Vec3& v, bool linearOrAngular)
+{
+    btRigidBody* body = getRigidBody(handle); if (!body) return;
+    if (linearOrAngular) body->setLinearVelocity(btVector3(v[0], v[1], v[2]));
+    else body->setAngularVelocity(btVector3(v[0], v[1], v[2]));
+}
+
+osg::Vec3 PhysicsEngine::getVelocity(int handle, bool linearOrAngular)
+{
+    btRigidBody* body = getRigidBody(handle); if (!body) return osg::Vec3();
+    btVector3 vel = linearOrAngular ? body->getLinearVelocity() : body->getAngularVelocity();
+    return osg::Vec3(vel.x(), vel.y(), vel.z());
+}
+
+int PhysicsEngine::syncTransforms(std::vector<osg::Matrix>& matrices, std::vector<int>* moved)
+{
+    // Flags are only set by motion states of active bodies during stepping
+    int numBodies = (int)_bodyTable.size(), numMoved = 0;
+    if (matrices.size() != _bodyTable.size()) matrices.resize(numBodies);
+    for (int i = 0; i < numBodies; ++i)
     {
-        btRigidBody* body = itr->second; btVector3 vel;
-        if (linearOrAngular) vel = body->getLinearVelocity();
-        else vel = body->getAngularVelocity();
-        return osg::Vec3(vel.x(), vel.y(), vel.z());
+        if (!_movedFlags[i]) continue; else _movedFlags[i] = 0;
+        btRigidBody* body = _bodyTable[i].body; if (!body) continue;
+        matrices[i] = getTransform(body); numMoved++;
+        if (moved) moved->push_back(i);
     }
-    return osg::Vec3();
+    return numMoved;
 }
 
 void PhysicsEngine::addConstraint(const std::string& name, btTypedConstraint* constraint,
@@ -212,6 +347,68 @@ void PhysicsEngine::removeConstraint(const std::string& name)
     }
 }
 
+void PhysicsEngine::addSharedShape(const std::string& key, btCollisionShape* shape,
+                                   osg::Referenced* data)
+{
+    if (!shape) return; removeSharedShape(key);
+    _sharedShapes[key] = SharedShape(shape, data); retainShape(shape);
+}
+
+void PhysicsEngine::removeSharedShape(const std::string& key)
+{
+    std::map<std::string, SharedShape>::iterator itr = _sharedShapes.find(key);
+    if (itr == _sharedShapes.end()) return;
+
+    // Shape data must live longer than the shape itself
+    osg::ref_ptr<osg::Referenced> data = itr->second.second;
+    releaseShape(itr->second.first); _sharedShapes.erase(itr);
+}
+
+btCollisionShape* PhysicsEngine::getSharedShape(const std::string& key)
+{
+    std::map<std::string, SharedShape>::iterator itr = _sharedShapes.find(key);
+    return (itr != _sharedShapes.end()) ? itr->second.first : NULL;
+}
+
+void PhysicsEngine::retainShape(btCollisionShape* shape)
+{
+    // A compound holds references of its tracked (e.g., shared) children from the first use
+    if ((_shapeRefCounts[shape]++) > 0 || !shape->isCompound()) return;
+    btCompoundShape* compound = static_cast<btCompoundShape*>(shape);
+    for (int i = 0; i < compound->getNumChildShapes(); ++i)
+    {
+        btCollisionShape* child = compound->getChildShape(i);
+        if (_shapeRefCounts.find(child) != _shapeRefCounts.end()) retainShape(child);
+    }
+}
+
+void PhysicsEngine::releaseShape(btCollisionShape* shape)
+{
+    std::map<btCollisionShape*, int>::iterator itr = _shapeRefCounts.find(shape);
+    if (itr == _shapeRefCounts.end()) return;
+    if ((--itr->second) > 0) return;
+    _shapeRefCounts.erase(itr); destroyShape(shape);
+}
+
+void PhysicsEngine::destroyShape(btCollisionShape* shape)
+{
+    // Untracked children of compound shapes are owned by the compound, and tracked ones are
+    // only released, as other bodies or the shared shape list may still use them
+    btCompoundShape* compound = shape->isCompound()
+                              ? static_cast<btCompoundShape*>(shape) : NULL;
+    if (compound != NULL)
+    {
+        for (int i = compound->getNumChildShapes() - 1; i >= 0; --i)
+        {
+            btCollisionShape* child = compound->getChildShape(i);
+            compound->removeChildShapeByIndex(i);
+            if (_shapeRefCounts.find(child) != _shapeRefCounts.end()) releaseShape(child);
+            else destroyShape(child);
+        }
+    }
+    delete shape;
+}
+
 btCollisionShape* PhysicsEngine::getShape(const std::string& name)
 {
     if (_shapes.find(name) == _shapes.end()) return NULL;
@@ -224,6 +421,12 @@ btRigidBody* PhysicsEngine::getRigidBody(const std::string& name)
     return _bodies[name];
 }
 
+btRigidBody* PhysicsEngine::getRigidBody(int handle)
+{
+    if (handle < 0 || handle >= (int)_bodyTable.size()) return NULL;
+    return _bodyTable[handle].body;
+}
+
 btTypedConstraint* PhysicsEngine::getConstraint(const std::string& name)
 {
     if (_constraints.find(name) == _constraints.end()) return NULL;
@@ -248,12 +451,7 @@ bool PhysicsEngine::raycast(const osg::Vec3& s, const osg::Vec3& e,
         result.normal = osg::Vec3(norm.x(), norm.y(), norm.z());
         result.rigidBody = (btRigidBody*)btRigidBody::upcast(rayCallback.m_collisionObject);
 
-        if (getNameFromBody)
-        {
-            for (std::map<std::string, btRigidBody*>::iterator itr = _bodies.begin();
-                 itr != _bodies.end(); ++itr)
-            { if (itr->second == result.rigidBody) {result.name = itr->first; break;} }
-        }
+        if (getNameFromBody) result.name = getBodyName(getBodyHandle(result.rigidBody));
         return true;
     }
     return false;
@@ -279,17 +477,71 @@ std::vector<PhysicsEngine::RaycastHit> PhysicsEngine::raycastAll(const osg::Vec3
             result.normal = osg::Vec3(norm.x(), norm.y(), norm.z());
             result.rigidBody = (btRigidBody*)btRigidBody::upcast(rayCallback.m_collisionObjects[i]);
 
-            if (getNameFromBody)
-            {
-                for (std::map<std::string, btRigidBody*>::iterator itr = _bodies.begin();
-                     itr != _bodies.end(); ++itr)
-                { if (itr->second == result.rigidBody) {result.name = itr->first; break;} }
-            }
+            if (getNameFromBody) result.name = getBodyName(getBodyHandle(result.rigidBody));
             hitList.push_back(result);
         }
     }
     return hitList;
 }
 
+class RaycastBatchBody
+#if BT_BULLET_VERSION >= 287
+    : public btIParallelForBody
+#endif
+{
+public:
+    RaycastBatchBody(btCollisionWorld* w, const std::vector<PhysicsEngine::Ray>& r,
+                     std::vector<PhysicsEngine::RaycastHit>& h)
+    :   _world(w), _rays(r), _hits(h) {}
+
+    void forLoop(int iBegin, int iEnd) const
+    {
+        // rayTest() only reads the world, so it is safe to call concurrently
+        for (int i = iBegin; i < iEnd; ++i)
+        {
+            const osg::Vec3 &s = _rays[i].first, &e = _rays[i].second;
+            btVector3 from(s.x(), s.y(), s.z()), to(e.x(), e.y(), e.z());
+            btCollisionWorld::ClosestRayResultCallback rayCallback(from, to);
+            _world->rayTest(from, to, rayCallback);
+
+            PhysicsEngine::RaycastHit& result = _hits[i];
+            if (!rayCallback.hasHit()) { result.rigidBody = NULL; continue; }
+            btVector3 pos = rayCallback.m_hitPointWorld, norm = rayCallback.m_hitNormalWorld;
+            result.position = osg::Vec3(pos.x(), pos.y(), pos.z());
+            result.normal = osg::Vec3(norm.x(), norm.y(), norm.z());
+            result.rigidBody = (btRigidBody*)btRigidBody::upcast(rayCallback.m_collisionObject);
+        }
+    }
+
+protected:
+    btCollisionWorld* _world;
+    const std::vector<PhysicsEngine::Ray>& _rays;
+    std::vector<PhysicsEngine::RaycastHit>& _hits;
+};
+
+int PhysicsEngine::raycastBatch(const std::vector<Ray>& rays, std::vector<RaycastHit>& results,
+                                bool getNameFromBody)
+{
+    int numRays = (int)rays.size(), numHits = 0;
+    results.clear(); results.resize(numRays);
+    if (numRays == 0) return 0;
+
+    // Without BT_THREADSAFE, btParallelFor() simply runs the loop in calling thread
+    RaycastBatchBody body(_world, rays, results);
+#if BT_BULLET_VERSION >= 287
+    btParallelFor(0, numRays, 64, body);
+#else
+    body.forLoop(0, numRays);
+#endif
+
+    for (int i = 0; i < numRays; ++i)
+    {
+        RaycastHit& result = results[i]; if (!result.rigidBody) continue;
+        if (getNameFromBody) result.name = getBodyName(getBodyHandle(result.rigidBody));
+        numHits++;
+    }
+    return numHits;
+}
+
 void PhysicsEngine::advance(float timeStep, int maxSubSteps)
 { _world->stepSimulation(timeStep, maxSubSteps); }
@@ -3,12 +3,13 @@
 
 #include <osg/Version>
 #include <osg/MatrixTransform>
+#include <vector>
 #include <map>
 
 class btDefaultCollisionConfiguration;
 class btCollisionDispatcher;
 class btBroadphaseInterface;
-class btSequentialImpulseConstraintSolver;
+class btConstraintSolver;
 class btDiscreteDynamicsWorld;
 class btCollisionShape;
 class btRigidBody;
@@ -20,7 +21,12 @@ namespace osgVerse
     class PhysicsEngine : public osg::Referenced
     {
     public:
-        PhysicsEngine();
+        /** Set 'multithreaded' to use btDiscreteDynamicsWorldMt with a solver pool, which requires
+            Bullet built with BT_THREADSAFE. Bullet's task scheduler is process-wide: it is created
+            by the first multithreaded engine (in main thread), and 'numThreads' (0 = all) applies
+            to all engines. A single-threaded world is created if no scheduler is available */
+        PhysicsEngine(bool multithreaded = false, int numThreads = 0);
+        bool isMultithreaded() const { return _multithreaded; }
 
         // Rigid-body functions
         btRigidBody* addRigidBody(const std::string& name, btCollisionShape* s, float mass = 0.0f,
@@ -28,21 +34,49 @@ namespace osgVerse
         void removeBody(const std::string& name);
         bool isDynamicBody(const std::string& name, bool& isKinematic);
 
+        /** Integer handles of bodies, which index a dense body table and avoid name lookups.
+            A handle is valid until the body is removed, and may be reused by new bodies later */
+        int getBodyHandle(const std::string& name) const;
+        int getBodyHandle(const btRigidBody* body) const;
+        const std::string& getBodyName(int handle) const;
+        unsigned int getBodyTableSize() const { return _bodyTable.size(); }
+
         // Setting/getting transform and velocity functions
         void setTransform(const std::string& name, const osg::Matrix& matrix);
         osg::Matrix getTransform(const std::string& name, bool& valid);
+        void setTransform(int handle, const osg::Matrix& matrix);
+        osg::Matrix getTransform(int handle, bool& valid);
 
         void setVelocity(const std::string& name, const osg::Vec3& v, bool linearOrAngular);
         osg::Vec3 getVelocity(const std::string& name, bool linearOrAngular);
+        void setVelocity(int handle, const osg::Vec3& v, bool linearOrAngular);
+        osg::Vec3 getVelocity(int handle, bool linearOrAngular);
+
+        /** Copy matrices of bodies moved since last call to 'matrices', which is indexed by handle
+            and resized to the body table size. Only entries of moved bodies are written, as
+            reported by motion states of active bodies. Handles of them are appended to 'moved'
+            if it is not NULL. Returns number of moved bodies */
+        int syncTransforms(std::vector<osg::Matrix>& matrices, std::vector<int>* moved = NULL);
 
         // Constraint functions
         void addConstraint(const std::string& name, btTypedConstraint* constraint,
                            bool noCollisionsBetweenLinked = true);
         void removeConstraint(const std::string& name);
 
+        /** Shared shapes are kept until removed or the engine is destroyed, and can be used by any
+            number of bodies; other shapes are deleted with the last body using them. 'data' keeps
+            resources (e.g., mesh arrays) the shape refers to. Children of compounds are deleted
+            together with the compound shape, except shared children, which are only released
+            if they were already shared when the compound was first used */
+        void addSharedShape(const std::string& key, btCollisionShape* s,
+                            osg::Referenced* data = NULL);
+        void removeSharedShape(const std::string& key);
+        btCollisionShape* getSharedShape(const std::string& key);
+
         // Misc functions
         btCollisionShape* getShape(const std::string& name);
         btRigidBody* getRigidBody(const std::string& name);
+        btRigidBody* getRigidBody(int handle);
         btTypedConstraint* getConstraint(const std::string& name);
 
         void setGravity(const osg::Vec3& gravity);
@@ -60,22 +94,44 @@ namespace osgVerse
         std::vector<RaycastHit> raycastAll(const osg::Vec3& start, const osg::Vec3& end,
                                            bool getNameFromBody = true);
 
+        /** Cast a batch of rays (start, end) and get the closest hits in the same order. Missed
+            rays have NULL rigid body. Rays are tested concurrently using Bullet's task scheduler
+            if it is available, so don't modify the world while calling this. Returns hit count */
+        typedef std::pair<osg::Vec3, osg::Vec3> Ray;
+        int raycastBatch(const std::vector<Ray>& rays, std::vector<RaycastHit>& results,
+                         bool getNameFromBody = false);
+
         // Advance the world
         void advance(float timeStep, int maxSubSteps = 1);
 
     protected:
         virtual ~PhysicsEngine();
+        void setTransform(btRigidBody* body, const osg::Matrix& matrix);
+        osg::Matrix getTransform(btRigidBody* body);
+        void retainShape(btCollisionShape* shape);
+        void releaseShape(btCollisionShape* shape);
+        void destroyShape(btCollisionShape* shape);
 
         btDefaultCollisionConfiguration* _collisionCfg;
         btCollisionDispatcher* _collisionDispatcher;
         btBroadphaseInterface* _overlappingPairCache;
-        btSequentialImpulseConstraintSolver* _solver;
+        btConstraintSolver* _solver;
+        btConstraintSolver* _solverMt;
         btDiscreteDynamicsWorld* _world;
 
         typedef std::pair<btTypedConstraint*, int> ConstraintAndState;
         std::map<std::string, ConstraintAndState> _constraints;
+        typedef std::pair<btCollisionShape*, osg::ref_ptr<osg::Referenced>> SharedShape;
+        std::map<std::string, SharedShape> _sharedShapes;
         std::map<std::string, btCollisionShape*> _shapes;
+        std::map<btCollisionShape*, int> _shapeRefCounts;
         std::map<std::string, btRigidBody*> _bodies;
+
+        struct BodyRecord { btRigidBody* body; std::string name; };
+        std::vector<BodyRecord> _bodyTable;
+        std::vector<char> _movedFlags;  // set by motion states, may be concurrently
+        std::vector<int> _freeHandles;
+        bool _multithreaded;
     };
 
 }
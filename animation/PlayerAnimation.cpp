@@ -332,7 +332,8 @@ namespace ozz
             void build(OzzAnimation::AnimationSampler& sampler,
                        std::vector<osg::Transform*> nodes, const AnimationMap& dataMap)
             {
-                ozz::animation::Animation& anim = sampler.animation;
+                sampler.clip = new OzzSharedClip;
+                ozz::animation::Animation& anim = sampler.clip->animation;
                 anim.Deallocate(); anim.num_tracks_ = (int)nodes.size();
 
                 // Get max/min time range
@@ -518,13 +519,13 @@ namespace ozz
 
 static void printPlayerData(OzzAnimation* ozz)
 {
-    for (size_t i = 0; i < ozz->_meshes.size(); ++i)
+    for (size_t i = 0; i < ozz->meshes().size(); ++i)
     {
-        OzzMesh& mesh = ozz->_meshes[i];
+        const OzzMesh& mesh = ozz->meshes()[i];
         std::cout << "Mesh-" << i << ": Parts = " << mesh.parts.size() << std::endl;
         for (size_t j = 0; j < mesh.parts.size(); ++j)
         {
-            OzzMesh::Part& part = mesh.parts[j];
+            const OzzMesh::Part& part = mesh.parts[j];
             std::cout << "  Part: Vertices = " << part.vertex_count() << ", Influences = "
                 << part.influences_count() << ", JointIdx = " << part.joint_indices.size()
                 << ", Weights = " << part.joint_weights.size() << std::endl;
@@ -536,6 +537,8 @@ PlayerAnimation::PlayerAnimation()
 {
     _internal = new OzzAnimation; _animated = true; _drawSkeleton = true;
     _blendingThreshold = ozz::animation::BlendingJob().threshold;
+    _lastViewDistance = 0.0f; _lastPixelSize = 0.0f; _lastCullFrame = -1;
+    _lodPhase = (int)(((size_t)this >> 4) % 97);  // stagger throttled updates of players
 }
 
 bool PlayerAnimation::initialize(osg::Node& skeletonRoot, osg::Node& meshRoot,
@@ -545,11 +548,13 @@ bool PlayerAnimation::initialize(osg::Node& skeletonRoot, osg::Node& meshRoot,
 
     // Load skeleton data from 'skeletonRoot'
     ozz::animation::CreateSkeletonVisitor csv;
-    skeletonRoot.accept(csv); csv.build(ozz->_skeleton);
+    ozz->_skeletonData = new OzzSharedSkeleton;
+    skeletonRoot.accept(csv); csv.build(ozz->_skeletonData->skeleton);
 
     // Load mesh data from 'meshRoot' and 'jointDataMap'
     ozz::animation::CreateMeshVisitor cmv(csv.getSkeletonNodes(), jointDataMap);
-    meshRoot.accept(cmv); ozz->_meshes = cmv.getMeshes();
+    ozz->_meshData = new OzzSharedMeshes;
+    meshRoot.accept(cmv); ozz->_meshData->meshes = cmv.getMeshes();
     _meshStateSetList = cmv.getStateSets(); _blendshapes = cmv.getBS();
 #if 0
     printPlayerData(ozz);
@@ -563,10 +568,12 @@ bool PlayerAnimation::initialize(const std::vector<osg::Transform*>& nodes,
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
     ozz::animation::CreateSkeletonVisitor csv;
-    csv.initialize(nodes); csv.build(ozz->_skeleton);
+    ozz->_skeletonData = new OzzSharedSkeleton;
+    csv.initialize(nodes); csv.build(ozz->_skeletonData->skeleton);
 
     ozz::animation::CreateMeshVisitor cmv(csv.getSkeletonNodes(), jointDataMap);
-    cmv.initialize(meshList); ozz->_meshes = cmv.getMeshes();
+    ozz->_meshData = new OzzSharedMeshes;
+    cmv.initialize(meshList); ozz->_meshData->meshes = cmv.getMeshes();
     _meshStateSetList = cmv.getStateSets(); _blendshapes = cmv.getBS();
 #if 0
     printPlayerData(ozz);
@@ -577,8 +584,9 @@ bool PlayerAnimation::initialize(const std::vector<osg::Transform*>& nodes,
 bool PlayerAnimation::initialize(const std::string& skeleton, const std::string& mesh)
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
-    if (!ozz->loadSkeleton(skeleton.c_str(), &(ozz->_skeleton))) return false;
-    if (!ozz->loadMesh(mesh.c_str(), &(ozz->_meshes))) return false;
+    ozz->_skeletonData = OzzResourceCache::instance()->getSkeleton(skeleton);
+    ozz->_meshData = OzzResourceCache::instance()->getMeshes(mesh);
+    if (!ozz->_skeletonData || !ozz->_meshData) return false;
 #if 0
     printPlayerData(ozz);
 #endif
@@ -589,7 +597,8 @@ bool PlayerAnimation::loadAnimation(const std::string& key, const std::string& a
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
     OzzAnimation::AnimationSampler& sampler = ozz->_animations[key];
-    if (!ozz->loadAnimation(animation.c_str(), &(sampler.animation))) return false;
+    sampler.clip = OzzResourceCache::instance()->getClip(animation);
+    if (!sampler.clip) return false;
     return loadAnimationInternal(key);
 }
 
@@ -620,21 +629,21 @@ std::vector<PlayerAnimation::ThisAndParent> PlayerAnimation::getSkeletonIndices(
     } itr;
 
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
-    itr = ozz::animation::IterateJointsDF(ozz->_skeleton, itr, from);
+    itr = ozz::animation::IterateJointsDF(ozz->skeleton(), itr, from);
     return itr.names;
 }
 
 std::string PlayerAnimation::getSkeletonJointName(int j) const
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
-    return (j < ozz->_skeleton.num_joints()) ? ozz->_skeleton.joint_names()[j] : "";
+    return (j < ozz->skeleton().num_joints()) ? ozz->skeleton().joint_names()[j] : "";
 }
 
 int PlayerAnimation::getSkeletonJointIndex(const std::string& joint) const
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
-    auto names = ozz->_skeleton.joint_names();
-    for (size_t i = 0; i < ozz->_skeleton.num_joints(); ++i)
+    auto names = ozz->skeleton().joint_names();
+    for (size_t i = 0; i < ozz->skeleton().num_joints(); ++i)
     { if (names[i] == joint) return i; } return -1;
 }
 
@@ -661,10 +670,37 @@ osg::Matrix PlayerAnimation::getModelSpaceJointMatrix(int joint) const
         ozz::math::GetX(m.cols[3]), ozz::math::GetY(m.cols[3]), ozz::math::GetZ(m.cols[3]), ozz::math::GetW(m.cols[3]));
 }
 
+void PlayerAnimation::getModelSpaceJointMatrices(std::vector<osg::Matrix>& matrices) const
+{
+    OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
+    matrices.resize(ozz->_models.size());
+    for (size_t i = 0; i < matrices.size(); ++i)
+        matrices[i] = getModelSpaceJointMatrix((int)i);
+}
+
+void PlayerAnimation::setModelSpaceJointMatrices(const std::vector<osg::Matrix>& matrices,
+                                                 float weight)
+{
+    OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
+    size_t numJoints = osg::minimum(matrices.size(), ozz->_models.size());
+    if (weight <= 0.0f) return;
+
+    for (size_t i = 0; i < numJoints; ++i)
+    {
+        if (weight >= 1.0f) { setModelSpaceJointMatrix((int)i, matrices[i]); continue; }
+        osg::Vec3d t0, t1, s0, s1; osg::Quat r0, r1, so, r;
+        getModelSpaceJointMatrix((int)i).decompose(t0, r0, s0, so);
+        matrices[i].decompose(t1, r1, s1, so); r.slerp(weight, r0, r1);
+        setModelSpaceJointMatrix((int)i, osg::Matrix::scale(s0 + (s1 - s0) * weight) *
+                                 osg::Matrix::rotate(r) *
+                                 osg::Matrix::translate(t0 + (t1 - t0) * weight));
+    }
+}
+
 osg::BoundingBox PlayerAnimation::computeSkeletonBounds() const
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
-    const int numJoints = ozz->_skeleton.num_joints();
+    const int numJoints = ozz->skeleton().num_joints();
     if (numJoints <= 0) return osg::BoundingBox();
 
     osg::BoundingBoxf bound;
@@ -672,9 +708,9 @@ osg::BoundingBox PlayerAnimation::computeSkeletonBounds() const
 
     // Compute model space bind pose.
     ozz::animation::LocalToModelJob job;
-    job.input = ozz->_skeleton.joint_rest_poses();
+    job.input = ozz->skeleton().joint_rest_poses();
     job.output = ozz::make_span(models);
-    job.skeleton = &(ozz->_skeleton);
+    job.skeleton = &(ozz->skeleton());
     if (job.Run())
     {
         ozz::span<const ozz::math::Float4x4> matrices = job.output;
@@ -695,6 +731,16 @@ osg::BoundingBox PlayerAnimation::computeSkeletonBounds() const
     return bound;
 }
 
+std::vector<std::string> PlayerAnimation::getAnimationNames() const
+{
+    OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
+    std::vector<std::string> names;
+    std::map<std::string, OzzAnimation::AnimationSampler>::iterator itr;
+    for (itr = ozz->_animations.begin(); itr != ozz->_animations.end(); ++itr)
+        names.push_back(itr->first);
+    return names;
+}
+
 float PlayerAnimation::getAnimationStartTime(const std::string& key)
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
@@ -713,7 +759,7 @@ float PlayerAnimation::getDuration(const std::string& key) const
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
     OzzAnimation::AnimationSampler& sampler = ozz->_animations[key];
-    return sampler.animation.duration();
+    return sampler.animation().duration();
 }
 
 float PlayerAnimation::getPlaybackSpeed(const std::string& key) const
@@ -760,7 +806,7 @@ void PlayerAnimation::selectPartial(const std::string& key, float weight, bool l
             soa = ozz::math::SetI(soa, ozz::math::simd_float4::Load1(v), j % 4);
         }
     } itr(&(sampler.jointWeights), func, userData);
-    ozz::animation::IterateJointsDF(ozz->_skeleton, itr, -1);
+    ozz::animation::IterateJointsDF(ozz->skeleton(), itr, -1);
 }
 
 void PlayerAnimation::seek(const std::string& key, float timeRatio)
@@ -795,14 +841,14 @@ void PlayerAnimation::clearAllBlendShapes()
 bool PlayerAnimation::initializeInternal()
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
-    ozz->_models.resize(ozz->_skeleton.num_joints());
-    ozz->_blended_locals.resize(ozz->_skeleton.num_soa_joints());
+    ozz->_models.resize(ozz->skeleton().num_joints());
+    ozz->_blended_locals.resize(ozz->skeleton().num_soa_joints());
 
-    size_t num_skinning_matrices = 0, num_joints = ozz->_skeleton.num_joints();
-    for (const OzzMesh& mesh : ozz->_meshes)
+    size_t num_skinning_matrices = 0, num_joints = ozz->skeleton().num_joints();
+    for (const OzzMesh& mesh : ozz->meshes())
         num_skinning_matrices = ozz::math::Max(num_skinning_matrices, mesh.joint_remaps.size());
     ozz->_skinning_matrices.resize(num_skinning_matrices);
-    for (const OzzMesh& mesh : ozz->_meshes)
+    for (const OzzMesh& mesh : ozz->meshes())
     {
         if (num_joints < mesh.highest_joint_index())
         {
@@ -819,16 +865,16 @@ bool PlayerAnimation::loadAnimationInternal(const std::string& key)
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
     OzzAnimation::AnimationSampler& sampler = ozz->_animations[key];
 
-    const int num_joints = ozz->_skeleton.num_joints();
-    if (num_joints != sampler.animation.num_tracks())
+    const int num_joints = ozz->skeleton().num_joints();
+    if (num_joints != sampler.animation().num_tracks())
     {
         ozz::log::Err() << "The provided animation " << key << " doesn't match skeleton "
             << "(joint count mismatch)" << std::endl;
         return false;
     }
 
-    sampler.locals.resize(ozz->_skeleton.num_soa_joints());
-    ozz->_context.Resize(num_joints);
+    sampler.locals.resize(ozz->skeleton().num_soa_joints());
+    sampler.context.Resize(num_joints);
     if (ozz->_animations.size() > 1) sampler.weight = 0.0f;
     else sampler.weight = 1.0f;  // by default only the first animation is full weighted
     return true;
@@ -4,10 +4,14 @@
 #include <osg/Version>
 #include <osg/Texture2D>
 #include <osg/Geometry>
+#include <osg/Geode>
+#include <osg/FrameStamp>
+#include <set>
 
 namespace osgVerse
 {
     class BlendShapeAnimation;
+    class CrowdAnimationManager;
 
     /** The player animation support class */
     class PlayerAnimation : public osg::NodeCallback
@@ -22,6 +26,23 @@ namespace osgVerse
         bool getDrawingSkeleton() const { return _drawSkeleton; }
         virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
 
+        /** Update throttling settings. When enabled, a cull callback is chained to the animated
+            node, to record its visibility, distance and pixel size of last frame:
+            - Within fullRateDistance: update and skin every frame
+            - Farther than that: update and skin every 'reducedInterval' frames
+            - Beyond freezeDistance or smaller than minPixelSize: skeleton is frozen
+            - Out of view: skeleton is updated at reduced rate, but skinning is skipped
+        */
+        struct UpdateLOD
+        {
+            UpdateLOD() : fullRateDistance(20.0f), freezeDistance(200.0f), minPixelSize(4.0f),
+                          reducedInterval(4), enabled(false) {}
+            float fullRateDistance, freezeDistance, minPixelSize;
+            int reducedInterval; bool enabled;
+        };
+        void setUpdateLOD(const UpdateLOD& lod) { _updateLOD = lod; }
+        const UpdateLOD& getUpdateLOD() const { return _updateLOD; }
+
         struct GeometryJointData
         {
             typedef std::vector<std::pair<osg::Transform*, float>> JointWeights;  // [joint, weight]
@@ -49,10 +70,11 @@ namespace osgVerse
                         const std::vector<osg::Geometry*>& meshList,
                         const std::map<osg::Geometry*, GeometryJointData>& jointDataMap);
 
-        /// Initialize the player from ozz skeleton and mesh files
+        /// Initialize the player from ozz skeleton and mesh files.
+        /// Loaded data is immutable and shared with other players using the same files
         bool initialize(const std::string& skeleton, const std::string& mesh);
 
-        /// Load animation data from ozz files
+        /// Load animation data from ozz files. Clips are shared with other players in the same way
         bool loadAnimation(const std::string& key, const std::string& animation);
 
         /// Load animation data from structure
@@ -79,7 +101,35 @@ namespace osgVerse
         void setModelSpaceJointMatrix(int joint, const osg::Matrix& m);
         osg::Matrix getModelSpaceJointMatrix(int joint) const;
 
+        /** Bulk access of model-space matrices of all joints. A 'weight' less than 1 blends given
+            matrices with current ones (lerp of translation/scale and slerp of rotation) */
+        void getModelSpaceJointMatrices(std::vector<osg::Matrix>& matrices) const;
+        void setModelSpaceJointMatrices(const std::vector<osg::Matrix>& matrices,
+                                        float weight = 1.0f);
+
+        /** Called at the end of each update() to modify the model-space pose before skinning,
+            e.g., by ragdolls. It is called again after IK updates with the frame stamp of last
+            update(), so it may run several times in one frame. Under a CrowdAnimationManager,
+            callbacks of different players may run concurrently, so they should only touch data
+            of their own player. skipped() is called instead in frames when UpdateLOD skips the
+            update, so that callbacks may still react to visibility changes */
+        class PoseCallback : public osg::Referenced
+        {
+        public:
+            virtual void operator()(PlayerAnimation& player, const osg::FrameStamp& fs) = 0;
+            virtual void skipped(PlayerAnimation& player, const osg::FrameStamp& fs) {}
+        };
+        void setPoseCallback(PoseCallback* cb) { _poseCallback = cb; }
+        PoseCallback* getPoseCallback() { return _poseCallback.get(); }
+
+        /** View distance, pixel size and frame number recorded at last cull traversal, only
+            when UpdateLOD is enabled. Frame number is -1 if never culled */
+        float getLastViewDistance() const { return _lastViewDistance; }
+        float getLastPixelSize() const { return _lastPixelSize; }
+        int getLastCullFrame() const { return _lastCullFrame; }
+
         osg::BoundingBox computeSkeletonBounds() const;
+        std::vector<std::string> getAnimationNames() const;
         float getAnimationStartTime(const std::string& key);
         float getTimeRatio(const std::string& key) const;
         float getDuration(const std::string& key) const;
@@ -95,6 +145,24 @@ namespace osgVerse
         void setBlendShape(const std::string& key, float weight);
         void clearAllBlendShapes();
 
+        /** A clip baked by bakeSkinningMatrices(): rows [startFrame, startFrame + numFrames) */
+        struct BakedClip
+        {
+            BakedClip() : startFrame(0), numFrames(0), duration(0.0f), looping(true) {}
+            std::string name; int startFrame, numFrames;
+            float duration; bool looping;
+        };
+
+        /** Bake skinning matrices of selected clips to a RGBA32F image, for GPU-instanced crowds.
+            Each row is a frame sampled at given rate, and each skinning joint of all meshes takes
+            3 texels (rows of a 3x4 matrix). Clips are appended to 'clips' in order of keys */
+        osg::Image* bakeSkinningMatrices(const std::vector<std::string>& keys, float framesPerSecond,
+                                         std::vector<BakedClip>& clips);
+
+        /** Create bind-pose meshes to work with the baked image: joint columns and weights (at most
+            4 influences) are set to texture coordinates 2 and 3, and tangents to attribute 6 */
+        osg::Geode* createBakedMeshes();
+
         BlendShapeAnimation* getBlendShapeCallback(int i) { return _blendshapes[i].get(); }
         const BlendShapeAnimation* getBlendShapeCallback(int i) const { return _blendshapes[i].get(); }
         unsigned int getNumBlendShapeCallbacks() const { return _blendshapes.size(); }
@@ -102,15 +170,106 @@ namespace osgVerse
     protected:
         bool initializeInternal();
         bool loadAnimationInternal(const std::string& key);
+        void prepareMeshes(osg::Geode& meshDataRoot);
+        bool skinMeshes(osg::Geode& meshDataRoot, bool withSkinning, bool dirtyBounds);
         void updateSkeletonMesh(osg::Geometry& geom);
+        void recordCullData(osg::Node* node, osg::NodeVisitor* nv);
+        void installCullRecorder(osg::Node* node);
+        friend class CrowdAnimationManager;
+        class CullRecorder;
 
         std::vector<osg::ref_ptr<BlendShapeAnimation>> _blendshapes;
         std::vector<osg::ref_ptr<osg::StateSet>> _meshStateSetList;
+        osg::ref_ptr<PoseCallback> _poseCallback;
+        osg::ref_ptr<osg::FrameStamp> _lastFrameStamp;  // of last update(), for pose callbacks
         osg::ref_ptr<osg::Referenced> _internal;
-        float _blendingThreshold;
+        UpdateLOD _updateLOD;
+        float _blendingThreshold, _lastViewDistance, _lastPixelSize;
+        int _lastCullFrame, _lodPhase;
         bool _animated, _drawSkeleton;
     };
 
+    /** The crowd animation manager. Set it as update callback of a parent of animated characters,
+        then player callbacks below it only register themselves during the update traversal.
+        Sampling, blending and skinning of all registered players are evaluated concurrently after
+        that, and bounds, skeleton meshes and blendshapes are handled in a serial phase. Nodes
+        below the players are still traversed normally; blendshape callbacks of skinned meshes
+        then run again after the deferred skinning, which rewrites vertices they blended */
+    class CrowdAnimationManager : public osg::NodeCallback
+    {
+    public:
+        CrowdAnimationManager();
+        virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+        /** Get the manager collecting players in current thread, or NULL if none */
+        static CrowdAnimationManager* getCollectingManager();
+        void addPlayer(PlayerAnimation* player, osg::Geode* geode, bool toUpdate, bool toSkin);
+
+        /** Set to false to evaluate players one after another, e.g., for comparison */
+        void setParallel(bool b) { _parallel = b; }
+        bool getParallel() const { return _parallel; }
+
+        /** Number of players evaluated in last update traversal */
+        int getNumEvaluatedPlayers() const { return _numEvaluated; }
+
+    protected:
+        struct PlayerTask
+        {
+            osg::ref_ptr<PlayerAnimation> player;
+            osg::ref_ptr<osg::Geode> geode;
+            bool toUpdate, toSkin;
+        };
+        std::vector<PlayerTask> _tasks;
+        std::set<PlayerAnimation*> _collected;
+        int _numEvaluated;
+        bool _parallel;
+    };
+
+    /** The GPU-instanced crowd. Selected clips of a player are baked to a skinning texture, and all
+        characters are then drawn by one instanced call per mesh, with per-instance position,
+        heading, clip, time offset, speed and scale saved in a float texture read by gl_InstanceID.
+        Set it as update callback of the geode passed to initialize(), and apply a program made of
+        std_gbuffer_crowd.vert.glsl and the GBuffer fragment shader with PROTECTED flag to render
+        it in the deferred pipeline. Exclude SHADOW_CASTER_MASK as shadow shaders can't skin it */
+    class InstancedCrowd : public osg::NodeCallback
+    {
+    public:
+        InstancedCrowd();
+        virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+        struct Instance
+        {
+            Instance() : heading(0.0f), timeOffset(0.0f), speed(1.0f), scale(1.0f), clip(0) {}
+            osg::Vec3 position; float heading, timeOffset, speed, scale; int clip;
+        };
+
+        /** Bake clips of the player and create shared meshes in the geode. The player itself is
+            not needed after that and can be released */
+        bool initialize(PlayerAnimation* player, osg::Geode& geode,
+                        const std::vector<std::string>& clips, float framesPerSecond = 30.0f);
+        int getClipIndex(const std::string& name) const;
+        const std::vector<PlayerAnimation::BakedClip>& getClips() const { return _clips; }
+
+        unsigned int addInstance(const Instance& instance);
+        void setInstance(unsigned int i, const Instance& instance);
+        const Instance& getInstance(unsigned int i) const { return _instances[i]; }
+        unsigned int getNumInstances() const { return _instances.size(); }
+        void removeAllInstances() { _instances.clear(); _dirty = true; }
+
+        osg::Texture2D* getSkinningTexture() { return _skinningTexture.get(); }
+        osg::Texture2D* getInstanceTexture() { return _instanceTexture.get(); }
+
+    protected:
+        void applyInstances(osg::Geode& geode);
+
+        std::vector<Instance> _instances;
+        std::vector<PlayerAnimation::BakedClip> _clips;
+        osg::ref_ptr<osg::Texture2D> _skinningTexture, _instanceTexture;
+        osg::ref_ptr<osg::Uniform> _timeUniform, _countUniform, _parameterUniform;
+        osg::BoundingSphere _meshBound;
+        bool _dirty;
+    };
+
 }
 
 #endif
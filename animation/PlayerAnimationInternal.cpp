@@ -8,6 +8,9 @@
 #include <osg/PositionAttitudeTransform>
 #include <osg/ShapeDrawable>
 #include <osgUtil/SmoothingVisitor>
+#include <osgUtil/CullVisitor>
+#include <osgDB/FileNameUtils>
+#include <algorithm>
 using namespace osgVerse;
 
 bool OzzAnimation::loadSkeleton(const char* filename, ozz::animation::Skeleton* skeleton)
@@ -59,6 +62,76 @@ bool OzzAnimation::loadMesh(const char* filename, ozz::vector<ozz::sample::Mesh>
     return true;
 }
 
+const ozz::animation::Animation& OzzAnimation::AnimationSampler::animation() const
+{
+    static ozz::animation::Animation s_emptyAnimation;
+    return clip.valid() ? clip->animation : s_emptyAnimation;
+}
+
+const ozz::animation::Skeleton& OzzAnimation::skeleton() const
+{
+    static ozz::animation::Skeleton s_emptySkeleton;
+    return _skeletonData.valid() ? _skeletonData->skeleton : s_emptySkeleton;
+}
+
+const ozz::vector<OzzMesh>& OzzAnimation::meshes() const
+{
+    static ozz::vector<OzzMesh> s_emptyMeshes;
+    return _meshData.valid() ? _meshData->meshes : s_emptyMeshes;
+}
+
+OzzResourceCache* OzzResourceCache::instance()
+{
+    static osg::ref_ptr<OzzResourceCache> s_instance = new OzzResourceCache;
+    return s_instance.get();
+}
+
+template<typename T>
+osg::ref_ptr<T> OzzResourceCache::getOrLoad(std::map<std::string, osg::observer_ptr<T>>& cache,
+                                            const std::string& file,
+                                            std::function<bool (T*)> loader)
+{
+    // Always return a ref_ptr, so that data can't be released between unlocking and use
+    std::string key = osgDB::convertFileNameToUnixStyle(osgDB::getRealPath(file));
+    osg::ref_ptr<T> data;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        typename std::map<std::string, osg::observer_ptr<T>>::iterator itr = cache.find(key);
+        if (itr != cache.end() && itr->second.lock(data)) return data;
+    }
+
+    // Load outside the lock, so that different files can be read concurrently
+    data = new T; if (!loader(data.get())) return NULL;
+    std::unique_lock<std::mutex> lock(_mutex);
+    osg::ref_ptr<T> existing; osg::observer_ptr<T>& entry = cache[key];
+    if (entry.lock(existing)) return existing;  // loaded by another thread
+    entry = data.get();
+
+    // Remove entries of data already released by all players
+    for (typename std::map<std::string, osg::observer_ptr<T>>::iterator itr = cache.begin();
+         itr != cache.end();)
+    { if (!itr->second.valid()) cache.erase(itr++); else ++itr; }
+    return data;
+}
+
+osg::ref_ptr<OzzSharedSkeleton> OzzResourceCache::getSkeleton(const std::string& file)
+{
+    return getOrLoad<OzzSharedSkeleton>(_skeletons, file, [&file](OzzSharedSkeleton* d)
+        { return OzzAnimation::loadSkeleton(file.c_str(), &(d->skeleton)); });
+}
+
+osg::ref_ptr<OzzSharedClip> OzzResourceCache::getClip(const std::string& file)
+{
+    return getOrLoad<OzzSharedClip>(_clips, file, [&file](OzzSharedClip* d)
+        { return OzzAnimation::loadAnimation(file.c_str(), &(d->animation)); });
+}
+
+osg::ref_ptr<OzzSharedMeshes> OzzResourceCache::getMeshes(const std::string& file)
+{
+    return getOrLoad<OzzSharedMeshes>(_meshes, file, [&file](OzzSharedMeshes* d)
+        { return OzzAnimation::loadMesh(file.c_str(), &(d->meshes)); });
+}
+
 bool OzzAnimation::applyMesh(osg::Geometry& geom, const OzzMesh& mesh)
 {
     int vCount = mesh.vertex_count(), vIndex = 0, dirtyVA = 4;
@@ -128,7 +201,7 @@ bool OzzAnimation::applyMesh(osg::Geometry& geom, const OzzMesh& mesh)
     return true;
 }
 
-bool OzzAnimation::applySkinningMesh(osg::Geometry& geom, const OzzMesh& mesh)
+bool OzzAnimation::applySkinningMesh(osg::Geometry& geom, const OzzMesh& mesh, bool withBound)
 {
     const ozz::span<ozz::math::Float4x4> skinningMat = ozz::make_span(_skinning_matrices);
     int vCount = mesh.vertex_count(), vIndex = 0, dirtyVA = 2;
@@ -242,7 +315,7 @@ bool OzzAnimation::applySkinningMesh(osg::Geometry& geom, const OzzMesh& mesh)
     if (!hasNormals) osgUtil::SmoothingVisitor::smooth(geom);
     if (!hasColors && ca->size() > 0) memset(&((*ca)[0]), 255, ca->size() * sizeof(uint8_t) * 4);
     if (dirtyVA > 0) { ta->dirty(); ca->dirty(); }
-    va->dirty(); na->dirty(); geom.dirtyBound();
+    va->dirty(); na->dirty(); if (withBound) geom.dirtyBound();
     return true;
 }
 
@@ -263,6 +336,8 @@ void OzzAnimation::multiplySoATransformQuaternion(
 bool PlayerAnimation::update(const osg::FrameStamp& fs, bool paused)
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
+    if (!_lastFrameStamp) _lastFrameStamp = new osg::FrameStamp(fs);
+    else *_lastFrameStamp = fs;
     ozz::vector<ozz::animation::BlendingJob::Layer> layers;
 
     std::map<std::string, OzzAnimation::AnimationSampler>::iterator itr;
@@ -281,13 +356,13 @@ bool PlayerAnimation::update(const osg::FrameStamp& fs, bool paused)
             {
                 sampler.startTime =
                     (float)fs.getSimulationTime() -
-                    (sampler.timeRatio * sampler.animation.duration() / sampler.playbackSpeed);
+                    (sampler.timeRatio * sampler.animation().duration() / sampler.playbackSpeed);
                 sampler.resetTimeRatio = false;
             }
             else
             {
                 sampler.timeRatio = ((float)fs.getSimulationTime() - sampler.startTime)
-                    * sampler.playbackSpeed / sampler.animation.duration();
+                    * sampler.playbackSpeed / sampler.animation().duration();
                 if (sampler.looping && sampler.timeRatio > 1.0f) sampler.timeRatio = -1.0f;
             }
         }
@@ -304,8 +379,8 @@ bool PlayerAnimation::update(const osg::FrameStamp& fs, bool paused)
 
         // Sample animation data to its local space
         ozz::animation::SamplingJob samplingJob;
-        samplingJob.animation = &(sampler.animation);
-        samplingJob.context = &(ozz->_context);
+        samplingJob.animation = &(sampler.animation());
+        samplingJob.context = &(sampler.context);
         samplingJob.ratio = osg::clampBetween(timeRatio, 0.0f, 1.0f);
         samplingJob.output = ozz::make_span(sampler.locals);
         if (!samplingJob.Run())
@@ -319,7 +394,7 @@ bool PlayerAnimation::update(const osg::FrameStamp& fs, bool paused)
     ozz::animation::BlendingJob blendJob;
     blendJob.threshold = _blendingThreshold;
     blendJob.layers = ozz::make_span(layers);
-    blendJob.rest_pose = ozz->_skeleton.joint_rest_poses();
+    blendJob.rest_pose = ozz->skeleton().joint_rest_poses();
     blendJob.output = ozz::make_span(ozz->_blended_locals);
     if (!blendJob.Run())
     {
@@ -329,10 +404,13 @@ bool PlayerAnimation::update(const osg::FrameStamp& fs, bool paused)
 
     // Convert sampler data to world space for updating skeleton
     ozz::animation::LocalToModelJob ltmJob;
-    ltmJob.skeleton = &(ozz->_skeleton);
+    ltmJob.skeleton = &(ozz->skeleton());
     ltmJob.input = ozz::make_span(ozz->_blended_locals);
     ltmJob.output = ozz::make_span(ozz->_models);
-    return ltmJob.Run();
+    if (!ltmJob.Run()) return false;
+
+    if (_poseCallback.valid()) (*_poseCallback)(*this, fs);
+    return true;
 }
 
 bool PlayerAnimation::updateAimIK(const osg::Vec3& target, const std::vector<JointIkData>& chain,
@@ -381,11 +459,15 @@ bool PlayerAnimation::updateAimIK(const osg::Vec3& target, const std::vector<Joi
 
     // Convert IK data to world space for updating skeleton
     ozz::animation::LocalToModelJob ltmJob;
-    ltmJob.skeleton = &(ozz->_skeleton);
+    ltmJob.skeleton = &(ozz->skeleton());
     ltmJob.from = chain.back().joint;
     ltmJob.input = ozz::make_span(ozz->_blended_locals);
     ltmJob.output = ozz::make_span(ozz->_models);
-    return ltmJob.Run();
+    if (!ltmJob.Run()) return false;
+
+    if (_poseCallback.valid() && _lastFrameStamp.valid())
+        (*_poseCallback)(*this, *_lastFrameStamp);
+    return true;
 }
 
 bool PlayerAnimation::updateTwoBoneIK(const osg::Vec3& target, int start, int mid, int end, bool& reached,
@@ -415,17 +497,33 @@ bool PlayerAnimation::updateTwoBoneIK(const osg::Vec3& target, int start, int mi
 
     // Convert IK data to world space for updating skeleton
     ozz::animation::LocalToModelJob ltmJob;
-    ltmJob.skeleton = &(ozz->_skeleton);
+    ltmJob.skeleton = &(ozz->skeleton());
     ltmJob.from = start; //ltmJob.to = end;
     ltmJob.input = ozz::make_span(ozz->_blended_locals);
     ltmJob.output = ozz::make_span(ozz->_models);
-    return ltmJob.Run();
+    if (!ltmJob.Run()) return false;
+
+    if (_poseCallback.valid() && _lastFrameStamp.valid())
+        (*_poseCallback)(*this, *_lastFrameStamp);
+    return true;
 }
 
 bool PlayerAnimation::applyMeshes(osg::Geode& meshDataRoot, bool withSkinning)
+{
+    prepareMeshes(meshDataRoot);
+    if (!skinMeshes(meshDataRoot, withSkinning, true)) return false;
+    if (_drawSkeleton)
+    {
+        unsigned int numMeshes = meshDataRoot.getNumDrawables();
+        updateSkeletonMesh(*(meshDataRoot.getDrawable(numMeshes - 1)->asGeometry()));
+    }
+    return true;
+}
+
+void PlayerAnimation::prepareMeshes(osg::Geode& meshDataRoot)
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
-    size_t numMeshes = ozz->_meshes.size() + (_drawSkeleton ? 1 : 0);
+    size_t numMeshes = ozz->meshes().size() + (_drawSkeleton ? 1 : 0);
     if (meshDataRoot.getNumDrawables() != numMeshes)
     {
         meshDataRoot.removeDrawables(0, meshDataRoot.getNumDrawables());
@@ -441,10 +539,14 @@ bool PlayerAnimation::applyMeshes(osg::Geode& meshDataRoot, bool withSkinning)
             meshDataRoot.addDrawable(geom.get());
         }
     }
+}
 
-    for (size_t i = 0; i < ozz->_meshes.size(); ++i)
+bool PlayerAnimation::skinMeshes(osg::Geode& meshDataRoot, bool withSkinning, bool dirtyBounds)
+{
+    OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
+    for (size_t i = 0; i < ozz->meshes().size(); ++i)
     {
-        const ozz::sample::Mesh& mesh = ozz->_meshes[i];
+        const ozz::sample::Mesh& mesh = ozz->meshes()[i];
         osg::Geometry* geom = meshDataRoot.getDrawable(i)->asGeometry();
         if (!withSkinning) { ozz->applyMesh(*geom, mesh); continue; }
 
@@ -454,13 +556,159 @@ bool PlayerAnimation::applyMeshes(osg::Geode& meshDataRoot, bool withSkinning)
             ozz->_skinning_matrices[j] =
                 ozz->_models[mesh.joint_remaps[j]] * mesh.inverse_bind_poses[j];
         }
-        if (!ozz->applySkinningMesh(*geom, mesh)) return false;
+        if (!ozz->applySkinningMesh(*geom, mesh, dirtyBounds)) return false;
     }
-    if (_drawSkeleton)
-        updateSkeletonMesh(*(meshDataRoot.getDrawable(numMeshes - 1)->asGeometry()));
     return true;
 }
 
+osg::Image* PlayerAnimation::bakeSkinningMatrices(const std::vector<std::string>& keys,
+                                                  float framesPerSecond,
+                                                  std::vector<BakedClip>& clips)
+{
+    OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
+    const ozz::animation::Skeleton& skeleton = ozz->skeleton();
+    int numJoints = skeleton.num_joints(), numSlots = 0, numFrames = 0; clips.clear();
+    if (numJoints <= 0 || framesPerSecond <= 0.0f) return NULL;
+    for (size_t i = 0; i < ozz->meshes().size(); ++i)
+        numSlots += (int)ozz->meshes()[i].joint_remaps.size();
+    if (numSlots <= 0) return NULL;
+
+    std::vector<const OzzAnimation::AnimationSampler*> samplers;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        std::map<std::string, OzzAnimation::AnimationSampler>::const_iterator
+            itr = ozz->_animations.find(keys[i]);
+        if (itr == ozz->_animations.end())
+        {
+            OSG_WARN << "[PlayerAnimation] Clip to bake not found: " << keys[i] << std::endl;
+            continue;
+        }
+
+        BakedClip clip; clip.name = keys[i]; clip.startFrame = numFrames;
+        clip.duration = itr->second.animation().duration();
+        clip.numFrames = osg::maximum((int)ceil(clip.duration * framesPerSecond) + 1, 2);
+        clip.looping = itr->second.looping; numFrames += clip.numFrames;
+        clips.push_back(clip); samplers.push_back(&(itr->second));
+    }
+    if (numFrames <= 0) return NULL;
+    else if (numFrames > 4096 || numSlots * 3 > 4096)
+        OSG_NOTICE << "[PlayerAnimation] Baked skinning image is large (" << numSlots * 3 << "x"
+                   << numFrames << "), which may not be supported by all devices" << std::endl;
+
+    osg::ref_ptr<osg::Image> image = new osg::Image;
+    image->allocateImage(numSlots * 3, numFrames, 1, GL_RGBA, GL_FLOAT);
+    image->setInternalTextureFormat(GL_RGBA32F_ARB);
+
+    ozz::animation::SamplingJob::Context context(numJoints);
+    ozz::vector<ozz::math::SoaTransform> locals(skeleton.num_soa_joints());
+    ozz::vector<ozz::math::Float4x4> models(numJoints);
+    for (size_t c = 0; c < clips.size(); ++c)
+    {
+        const BakedClip& clip = clips[c];
+        for (int f = 0; f < clip.numFrames; ++f)
+        {
+            // Sample the clip only, without blending with other layers
+            ozz::animation::SamplingJob samplingJob;
+            samplingJob.animation = &(samplers[c]->animation());
+            samplingJob.context = &context;
+            samplingJob.ratio = (float)f / (float)(clip.numFrames - 1);
+            samplingJob.output = ozz::make_span(locals);
+
+            ozz::animation::LocalToModelJob ltmJob;
+            ltmJob.skeleton = &skeleton;
+            ltmJob.input = ozz::make_span(locals);
+            ltmJob.output = ozz::make_span(models);
+            if (!samplingJob.Run() || !ltmJob.Run())
+            {
+                OSG_WARN << "[PlayerAnimation] Failed to bake clip " << clip.name << std::endl;
+                return NULL;
+            }
+
+            // Save skinning matrices of all meshes as 3 rows of each transposed matrix
+            osg::Vec4f* texels = (osg::Vec4f*)image->data(0, clip.startFrame + f);
+            for (size_t i = 0; i < ozz->meshes().size(); ++i)
+            {
+                const ozz::sample::Mesh& mesh = ozz->meshes()[i];
+                for (size_t j = 0; j < mesh.joint_remaps.size(); ++j, texels += 3)
+                {
+                    ozz::math::Float4x4 m =
+                        models[mesh.joint_remaps[j]] * mesh.inverse_bind_poses[j];
+                    float cols[4][4];
+                    for (int k = 0; k < 4; ++k) ozz::math::StorePtrU(m.cols[k], cols[k]);
+                    for (int r = 0; r < 3; ++r)
+                        texels[r].set(cols[0][r], cols[1][r], cols[2][r], cols[3][r]);
+                }
+            }
+        }
+    }
+    return image.release();
+}
+
+osg::Geode* PlayerAnimation::createBakedMeshes()
+{
+    OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    int slotOffset = 0;
+    for (size_t i = 0; i < ozz->meshes().size(); ++i)
+    {
+        const ozz::sample::Mesh& mesh = ozz->meshes()[i];
+        osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+        geom->setUseDisplayList(false);
+        geom->setUseVertexBufferObjects(true);
+        if (i < _meshStateSetList.size()) geom->setStateSet(_meshStateSetList[i].get());
+        if (!ozz->applyMesh(*geom, mesh))
+        { slotOffset += (int)mesh.joint_remaps.size(); continue; }
+
+        int vCount = mesh.vertex_count(), vIndex = 0;
+        osg::Vec4Array* tangents = new osg::Vec4Array(vCount);
+        osg::Vec4Array* joints = new osg::Vec4Array(vCount);
+        osg::Vec4Array* weights = new osg::Vec4Array(vCount);
+        for (size_t p = 0; p < mesh.parts.size(); ++p)
+        {
+            const OzzMesh::Part& part = mesh.parts[p];
+            int count = part.vertex_count(), numInfluences = part.influences_count();
+            bool hasTangents = part.tangents.size() == count * 4;
+            for (int v = 0; v < count; ++v, ++vIndex)
+            {
+                const float* t = hasTangents ? &(part.tangents[v * 4]) : NULL;
+                (*tangents)[vIndex] = t ? osg::Vec4(t[0], t[1], t[2], t[3])
+                                    : osg::Vec4(1.0f, 0.0f, 0.0f, 1.0f);
+
+                // Weight of the last influence is not saved in ozz mesh, compute it here
+                std::vector<std::pair<float, int>> influences(numInfluences);
+                float lastWeight = 1.0f, sum = 0.0f;
+                for (int k = 0; k < numInfluences; ++k)
+                {
+                    float w = (k < numInfluences - 1)
+                            ? part.joint_weights[v * (numInfluences - 1) + k] : lastWeight;
+                    influences[k] = std::pair<float, int>(
+                        w, part.joint_indices[v * numInfluences + k]);
+                    lastWeight -= w;
+                }
+
+                // Keep the 4 most important influences and re-normalize their weights
+                std::sort(influences.begin(), influences.end(),
+                          std::greater<std::pair<float, int>>());
+                if (influences.size() > 4) influences.resize(4);
+                for (size_t k = 0; k < influences.size(); ++k) sum += influences[k].first;
+                for (size_t k = 0; k < influences.size(); ++k)
+                {
+                    (*joints)[vIndex][k] = (float)(influences[k].second + slotOffset);
+                    (*weights)[vIndex][k] = (sum > 0.0f) ? influences[k].first / sum : 0.0f;
+                }
+            }
+        }
+
+        geom->setVertexAttribArray(6, tangents);
+        geom->setVertexAttribBinding(6, osg::Geometry::BIND_PER_VERTEX);
+        geom->setTexCoordArray(2, joints);
+        geom->setTexCoordArray(3, weights);
+        geode->addDrawable(geom.get());
+        slotOffset += (int)mesh.joint_remaps.size();
+    }
+    return geode.release();
+}
+
 static bool applyTransform(osg::Transform& node, const ozz::math::Float4x4& m, const osg::Matrix& parentM)
 {
     osg::Matrix matrix(
@@ -487,8 +735,8 @@ bool PlayerAnimation::applyTransforms(osg::Transform& skeletonRoot,
                                       bool createIfMissing, bool createWithShape)
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
-    ozz::span<const int16_t> parents = ozz->_skeleton.joint_parents();
-    ozz::span<const char* const> joints = ozz->_skeleton.joint_names();
+    ozz::span<const int16_t> parents = ozz->skeleton().joint_parents();
+    ozz::span<const char* const> joints = ozz->skeleton().joint_names();
     const ozz::vector<ozz::math::Float4x4>& matrices = ozz->_models;
     if (parents.empty() || joints.size() != matrices.size()) return false;
 
@@ -541,7 +789,7 @@ bool PlayerAnimation::applyTransforms(osg::Transform& skeletonRoot,
 void PlayerAnimation::updateSkeletonMesh(osg::Geometry& geom)
 {
     OzzAnimation* ozz = static_cast<OzzAnimation*>(_internal.get());
-    ozz::span<const int16_t> parents = ozz->_skeleton.joint_parents();
+    ozz::span<const int16_t> parents = ozz->skeleton().joint_parents();
     const ozz::vector<ozz::math::Float4x4>& matrices = ozz->_models;
     size_t vCount = parents.size();
     if (vCount < 1 || vCount != matrices.size()) return;
@@ -585,11 +833,301 @@ void PlayerAnimation::updateSkeletonMesh(osg::Geometry& geom)
 void PlayerAnimation::operator()(osg::Node* node, osg::NodeVisitor* nv)
 {
     osg::Geode* geode = node->asGeode();
-    if (nv->getFrameStamp()) update(*nv->getFrameStamp(), !_animated);
-    if (node->asGeode()) applyMeshes(*node->asGeode(), true);
-    else OSG_WARN << "[PlayerAnimation] Callback should set to a geode to animate meshes" << std::endl;
+    const osg::FrameStamp* fs = nv->getFrameStamp();
+    if (!geode)
+    {
+        if (fs) update(*fs, !_animated);
+        OSG_WARN << "[PlayerAnimation] Callback should set to a geode to animate meshes" << std::endl;
+        traverse(node, nv); return;
+    }
+
+    bool toUpdate = true, toSkin = true;
+    if (_updateLOD.enabled && fs != NULL)
+    {
+        installCullRecorder(node);
+        int frame = (int)fs->getFrameNumber();
+        int interval = osg::maximum(_updateLOD.reducedInterval, 1);
+        bool visible = (_lastCullFrame >= 0 && frame - _lastCullFrame <= 1);
+        bool reduced = !visible || _lastViewDistance > _updateLOD.fullRateDistance;
+        bool frozen = visible && (_lastViewDistance > _updateLOD.freezeDistance ||
+                                  _lastPixelSize < _updateLOD.minPixelSize);
+
+        // Never-culled players are not frozen, so that they can be shown after entering view
+        if (frozen) toUpdate = toSkin = false;
+        else if (reduced) toUpdate = toSkin = ((frame + _lodPhase) % interval) == 0;
+        if (!visible && geode->getNumDrawables() > 0) toSkin = false;
+        if (!toUpdate && _poseCallback.valid()) _poseCallback->skipped(*this, *fs);
+    }
+
+    CrowdAnimationManager* crowd = CrowdAnimationManager::getCollectingManager();
+    if (crowd != NULL && fs != NULL)
+    {
+        // Only evaluation and skinning are deferred to the crowd manager
+        if (toSkin) prepareMeshes(*geode);
+        crowd->addPlayer(this, geode, toUpdate, toSkin);
+        traverse(node, nv); return;
+    }
+
+    if (fs && toUpdate) update(*fs, !_animated);
+    if (toSkin) applyMeshes(*geode, true);
 
     //node->getParent(0)->asTransform()->asMatrixTransform()->setMatrix(osg::Matrix());
     //applyTransforms(*(node->getParent(0)->asTransform()), true, true);
     traverse(node, nv);
 }
+
+/** Records cull data for its player. It is nested with existing cull callbacks of the node,
+    instead of sharing the player object whose nested callbacks belong to the update chain */
+class PlayerAnimation::CullRecorder : public osg::NodeCallback
+{
+public:
+    CullRecorder(PlayerAnimation* p) : _player(p) {}
+    osg::observer_ptr<PlayerAnimation> _player;
+
+    virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
+    {
+        osg::ref_ptr<PlayerAnimation> player;
+        if (_player.lock(player)) player->recordCullData(node, nv);
+        traverse(node, nv);
+    }
+};
+
+void PlayerAnimation::installCullRecorder(osg::Node* node)
+{
+    osg::NodeCallback* cb = dynamic_cast<osg::NodeCallback*>(node->getCullCallback());
+    for (; cb != NULL; cb = dynamic_cast<osg::NodeCallback*>(cb->getNestedCallback()))
+    {
+        CullRecorder* recorder = dynamic_cast<CullRecorder*>(cb);
+        if (recorder != NULL && recorder->_player == this) return;
+    }
+
+    if (node->getCullCallback() != NULL)
+        OSG_INFO << "[PlayerAnimation] Chaining cull recorder to existing cull callback of "
+                 << node->getName() << std::endl;
+    node->addCullCallback(new CullRecorder(this));
+}
+
+void PlayerAnimation::recordCullData(osg::Node* node, osg::NodeVisitor* nv)
+{
+    // Cull callback is only called for nodes passing frustum culling
+    osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>(nv);
+    const osg::FrameStamp* fs = nv->getFrameStamp();
+    if (!cv || !fs) return;
+
+    const osg::BoundingSphere& bs = node->getBound();
+    float distance = cv->getDistanceToViewPoint(bs.center(), true);
+    float pixelSize = cv->clampedPixelSize(bs);
+    int frame = (int)fs->getFrameNumber();
+    if (frame != _lastCullFrame)
+    { _lastViewDistance = distance; _lastPixelSize = pixelSize; _lastCullFrame = frame; }
+    else
+    {
+        // Multiple views in the same frame: use the nearest one
+        _lastViewDistance = osg::minimum(_lastViewDistance, distance);
+        _lastPixelSize = osg::maximum(_lastPixelSize, pixelSize);
+    }
+}
+
+static thread_local CrowdAnimationManager* s_collectingManager = NULL;
+
+CrowdAnimationManager::CrowdAnimationManager()
+:   _numEvaluated(0), _parallel(true) {}
+
+CrowdAnimationManager* CrowdAnimationManager::getCollectingManager()
+{ return s_collectingManager; }
+
+void CrowdAnimationManager::addPlayer(PlayerAnimation* player, osg::Geode* geode,
+                                      bool toUpdate, bool toSkin)
+{
+    // A player shared by multiple geodes is evaluated only once
+    if (_collected.find(player) != _collected.end()) return;
+    PlayerTask task; task.player = player; task.geode = geode;
+    task.toUpdate = toUpdate; task.toSkin = toSkin;
+    _tasks.push_back(task); _collected.insert(player);
+}
+
+void CrowdAnimationManager::operator()(osg::Node* node, osg::NodeVisitor* nv)
+{
+    const osg::FrameStamp* fs = nv->getFrameStamp();
+    if (!fs || nv->getVisitorType() != osg::NodeVisitor::UPDATE_VISITOR)
+    { traverse(node, nv); return; }
+
+    // Collect players while traversing, and nested managers work as part of this one
+    CrowdAnimationManager* lastManager = s_collectingManager;
+    if (!lastManager) s_collectingManager = this;
+    traverse(node, nv); s_collectingManager = lastManager;
+    if (lastManager) return;
+
+    // Evaluate ozz jobs and skinning of each player concurrently
+    int numTasks = (int)_tasks.size();
+#pragma omp parallel for schedule(dynamic) if (_parallel)
+    for (int i = 0; i < numTasks; ++i)
+    {
+        PlayerTask& task = _tasks[i]; PlayerAnimation* player = task.player.get();
+        if (task.toUpdate) player->update(*fs, !player->getPlaying());
+        if (task.toSkin) task.toSkin = player->skinMeshes(*task.geode, true, false);
+    }
+
+    // Apply bounds, blendshapes and skeleton meshes of skinned players in serial
+    for (int i = 0; i < numTasks; ++i)
+    {
+        PlayerTask& task = _tasks[i]; osg::Geode* geode = task.geode.get();
+        if (!task.toSkin) continue;
+
+        PlayerAnimation* player = task.player.get();
+        unsigned int numDrawables = geode->getNumDrawables();
+        for (unsigned int j = 0; j < numDrawables; ++j)
+        {
+            osg::Drawable* drawable = geode->getDrawable(j);
+            if (j < player->_blendshapes.size() && player->_blendshapes[j].valid())
+                player->_blendshapes[j]->update(nv, drawable);
+            drawable->dirtyBound();
+        }
+
+        osg::Geometry* last = numDrawables > 0
+                            ? geode->getDrawable(numDrawables - 1)->asGeometry() : NULL;
+        if (player->getDrawingSkeleton() && last) player->updateSkeletonMesh(*last);
+    }
+    _numEvaluated = numTasks; _tasks.clear(); _collected.clear();
+}
+
+InstancedCrowd::InstancedCrowd()
+:   _dirty(false) {}
+
+bool InstancedCrowd::initialize(PlayerAnimation* player, osg::Geode& geode,
+                                const std::vector<std::string>& clips, float framesPerSecond)
+{
+    osg::ref_ptr<osg::Image> skinning =
+        player ? player->bakeSkinningMatrices(clips, framesPerSecond, _clips) : NULL;
+    if (!skinning)
+    {
+        OSG_WARN << "[InstancedCrowd] Failed to bake clips of the player" << std::endl;
+        return false;
+    }
+    else if (_clips.size() > 16)
+    {
+        OSG_NOTICE << "[InstancedCrowd] At most 16 clips are supported, others are ignored"
+                   << std::endl; _clips.resize(16);
+    }
+
+    // Meshes in bind pose are shared by all instances
+    osg::ref_ptr<osg::Geode> meshes = player->createBakedMeshes();
+    geode.removeDrawables(0, geode.getNumDrawables()); _meshBound.init();
+    for (unsigned int i = 0; i < meshes->getNumDrawables(); ++i)
+    {
+        osg::Drawable* drawable = meshes->getDrawable(i);
+        _meshBound.expandBy(drawable->getBound()); geode.addDrawable(drawable);
+    }
+
+    _skinningTexture = new osg::Texture2D;
+    _skinningTexture->setImage(skinning.get());
+    _instanceTexture = new osg::Texture2D;
+    osg::Texture2D* textures[2] = { _skinningTexture.get(), _instanceTexture.get() };
+    for (int i = 0; i < 2; ++i)
+    {
+        textures[i]->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+        textures[i]->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+        textures[i]->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+        textures[i]->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+        textures[i]->setResizeNonPowerOfTwoHint(false);
+    }
+
+    // Use units after material maps of the GBuffer shader, and don't enable fixed-pipeline modes
+    osg::StateSet* ss = geode.getOrCreateStateSet();
+    ss->setTextureAttribute(8, _skinningTexture.get());
+    ss->setTextureAttribute(9, _instanceTexture.get());
+    ss->addUniform(new osg::Uniform("SkinningTexture", (int)8));
+    ss->addUniform(new osg::Uniform("InstanceTexture", (int)9));
+
+    osg::Uniform* clipUniform = new osg::Uniform(osg::Uniform::FLOAT_VEC4, "CrowdClips", 16);
+    for (unsigned int i = 0; i < 16; ++i)
+    {
+        if (i < _clips.size())
+        {
+            const PlayerAnimation::BakedClip& c = _clips[i];
+            clipUniform->setElement(i, osg::Vec4((float)c.startFrame, (float)c.numFrames,
+                                                 c.duration, c.looping ? 1.0f : 0.0f));
+        }
+        else
+            clipUniform->setElement(i, osg::Vec4(0.0f, 1.0f, 1.0f, 1.0f));
+    }
+    ss->addUniform(clipUniform);
+
+    _timeUniform = new osg::Uniform("CrowdTime", 0.0f);
+    _countUniform = new osg::Uniform("CrowdInstanceCount", 0.0f);
+    _parameterUniform = new osg::Uniform(
+        "CrowdParameters", osg::Vec4((float)skinning->s(), (float)skinning->t(), 1.0f, 1.0f));
+    ss->addUniform(_timeUniform.get()); ss->addUniform(_countUniform.get());
+    ss->addUniform(_parameterUniform.get());
+    _dirty = true; return true;
+}
+
+int InstancedCrowd::getClipIndex(const std::string& name) const
+{
+    for (size_t i = 0; i < _clips.size(); ++i)
+    { if (_clips[i].name == name) return (int)i; }
+    return -1;
+}
+
+unsigned int InstancedCrowd::addInstance(const Instance& instance)
+{ _instances.push_back(instance); _dirty = true; return _instances.size() - 1; }
+
+void InstancedCrowd::setInstance(unsigned int i, const Instance& instance)
+{ if (i < _instances.size()) { _instances[i] = instance; _dirty = true; } }
+
+void InstancedCrowd::operator()(osg::Node* node, osg::NodeVisitor* nv)
+{
+    osg::Geode* geode = node->asGeode();
+    if (geode && _instanceTexture.valid())
+    {
+        const osg::FrameStamp* fs = nv->getFrameStamp();
+        if (fs) _timeUniform->set((float)fs->getSimulationTime());
+        if (_dirty) { applyInstances(*geode); _dirty = false; }
+    }
+    traverse(node, nv);
+}
+
+void InstancedCrowd::applyInstances(osg::Geode& geode)
+{
+    // Each instance takes 2 texels, and the image grows in power-of-two rows
+    unsigned int numInstances = _instances.size(), width = 1024;
+    unsigned int rows = osg::maximum((numInstances * 2 + width - 1) / width, 1u);
+    osg::Image* image = _instanceTexture->getImage();
+    if (!image || image->t() < (int)rows)
+    {
+        unsigned int height = 1; while (height < rows) height *= 2;
+        osg::ref_ptr<osg::Image> newImage = new osg::Image;
+        newImage->allocateImage(width, height, 1, GL_RGBA, GL_FLOAT);
+        newImage->setInternalTextureFormat(GL_RGBA32F_ARB);
+        _instanceTexture->setImage(newImage.get()); image = newImage.get();
+
+        osg::Vec4 parameters; _parameterUniform->get(parameters);
+        parameters[2] = (float)width; parameters[3] = (float)height;
+        _parameterUniform->set(parameters);
+    }
+
+    osg::BoundingBox bound; int numClips = (int)_clips.size();
+    float radius = _meshBound.center().length() + _meshBound.radius();
+    osg::Vec4f* texels = (osg::Vec4f*)image->data();
+    for (unsigned int i = 0; i < numInstances; ++i)
+    {
+        const Instance& d = _instances[i]; const osg::Vec3& pos = d.position;
+        texels[i * 2].set(pos[0], pos[1], pos[2], d.heading);
+        texels[i * 2 + 1].set((float)osg::clampBetween(d.clip, 0, numClips - 1),
+                              d.timeOffset, d.speed, d.scale);
+        bound.expandBy(osg::BoundingSphere(pos, radius * d.scale));
+    }
+    image->dirty(); _countUniform->set((float)numInstances);
+
+    // Instances beyond the count are collapsed in shader, so an empty crowd is fine
+    for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+    {
+        osg::Geometry* geom = geode.getDrawable(i)->asGeometry(); if (!geom) continue;
+        for (unsigned int j = 0; j < geom->getNumPrimitiveSets(); ++j)
+        {
+            osg::PrimitiveSet* p = geom->getPrimitiveSet(j);
+            p->setNumInstances(numInstances); p->dirty();
+        }
+        geom->setInitialBound(bound); geom->dirtyBound();
+    }
+}
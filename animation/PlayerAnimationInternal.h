@@ -29,18 +29,47 @@
 #include <ozz/base/memory/allocator.h>
 #include <ozz/geometry/runtime/skinning_job.h>
 #include <ozz/mesh.h>
+#include <functional>
 #include <fstream>
+#include <mutex>
+#include <map>
 
 typedef ozz::sample::Mesh OzzMesh;
+
+/** Immutable skeleton, clip and mesh data, which can be shared by all players */
+struct OzzSharedSkeleton : public osg::Referenced { ozz::animation::Skeleton skeleton; };
+struct OzzSharedClip : public osg::Referenced { ozz::animation::Animation animation; };
+struct OzzSharedMeshes : public osg::Referenced { ozz::vector<OzzMesh> meshes; };
+
+/** The file-keyed cache of shared data. Only observers are kept here, so data is released
+    automatically once the last player referring to it is destroyed */
+class OzzResourceCache : public osg::Referenced
+{
+public:
+    static OzzResourceCache* instance();
+    osg::ref_ptr<OzzSharedSkeleton> getSkeleton(const std::string& file);
+    osg::ref_ptr<OzzSharedClip> getClip(const std::string& file);
+    osg::ref_ptr<OzzSharedMeshes> getMeshes(const std::string& file);
+
+protected:
+    template<typename T> osg::ref_ptr<T> getOrLoad(
+        std::map<std::string, osg::observer_ptr<T>>& cache, const std::string& file,
+        std::function<bool (T*)> loader);
+    std::map<std::string, osg::observer_ptr<OzzSharedSkeleton>> _skeletons;
+    std::map<std::string, osg::observer_ptr<OzzSharedClip>> _clips;
+    std::map<std::string, osg::observer_ptr<OzzSharedMeshes>> _meshes;
+    std::mutex _mutex;
+};
+
 class OzzAnimation : public osg::Referenced
 {
 public:
-    bool loadSkeleton(const char* filename, ozz::animation::Skeleton* skeleton);
-    bool loadAnimation(const char* filename, ozz::animation::Animation* anim);
-    bool loadMesh(const char* filename, ozz::vector<ozz::sample::Mesh>* meshes);
+    static bool loadSkeleton(const char* filename, ozz::animation::Skeleton* skeleton);
+    static bool loadAnimation(const char* filename, ozz::animation::Animation* anim);
+    static bool loadMesh(const char* filename, ozz::vector<ozz::sample::Mesh>* meshes);
 
     bool applyMesh(osg::Geometry& geom, const OzzMesh& mesh);
-    bool applySkinningMesh(osg::Geometry& geom, const OzzMesh& mesh);
+    bool applySkinningMesh(osg::Geometry& geom, const OzzMesh& mesh, bool withBound = true);
     void multiplySoATransformQuaternion(int index, const ozz::math::SimdQuaternion& quat,
                                         const ozz::span<ozz::math::SoaTransform>& transforms);
 
@@ -48,19 +77,26 @@ public:
     {
         AnimationSampler() : weight(0.0f), playbackSpeed(1.0f), timeRatio(-1.0f),
             startTime(0.0f), resetTimeRatio(true), looping(false) {}
-        ozz::animation::Animation animation;
-        //ozz::animation::SamplingCache cache;
+        const ozz::animation::Animation& animation() const;
+
+        osg::ref_ptr<OzzSharedClip> clip;
+        ozz::animation::SamplingJob::Context context;  // keyframe cursor of this clip
         ozz::vector<ozz::math::SoaTransform> locals;
         ozz::vector<ozz::math::SimdFloat4> jointWeights;
         float weight, playbackSpeed, timeRatio, startTime;
         bool resetTimeRatio, looping;
     };
 
+    const ozz::animation::Skeleton& skeleton() const;
+    const ozz::vector<OzzMesh>& meshes() const;
+
+    // Shared immutable data
+    osg::ref_ptr<OzzSharedSkeleton> _skeletonData;
+    osg::ref_ptr<OzzSharedMeshes> _meshData;
+
+    // Per-instance mutable data
     std::map<std::string, AnimationSampler> _animations;
-    ozz::animation::Skeleton _skeleton;
-    ozz::animation::SamplingJob::Context _context;
     ozz::vector<ozz::math::SoaTransform> _blended_locals;
     ozz::vector<ozz::math::Float4x4> _models;
     ozz::vector<ozz::math::Float4x4> _skinning_matrices;
-    ozz::vector<OzzMesh> _meshes;
 };
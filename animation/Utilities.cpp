@@ -6,11 +6,19 @@
 #include <osg/MatrixTransform>
 #include <osg/PositionAttitudeTransform>
 #include <osgDB/ReadFile>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
 #include <osgUtil/SmoothingVisitor>
+#include <osgTerrain/TerrainTile>
 
 #include <btBulletDynamicsCommon.h>
 #include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
 #include <modeling/Utilities.h>
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <set>
 #include "Utilities.h"
 using namespace osgVerse;
 
@@ -42,6 +50,905 @@ void PhysicsUpdateCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
     traverse(node, nv);
 }
 
+static void applyTransformMatrix(osg::Transform* transform, const osg::Matrix& m)
+{
+    osg::MatrixTransform* mt = transform->asMatrixTransform();
+    if (mt) mt->setMatrix(m);
+
+    osg::PositionAttitudeTransform* pat = transform->asPositionAttitudeTransform();
+    if (pat) { pat->setAttitude(m.getRotate()); pat->setPosition(m.getTrans()); }
+}
+
+PhysicsSyncCallback::PhysicsSyncCallback(PhysicsEngine* e)
+{ _engine = e; }
+
+void PhysicsSyncCallback::addTransform(int bodyHandle, osg::Transform* t)
+{
+    if (bodyHandle < 0) return;
+    if (bodyHandle >= (int)_transforms.size()) _transforms.resize(bodyHandle + 1);
+    _transforms[bodyHandle] = t;
+}
+
+void PhysicsSyncCallback::addTransform(const std::string& bodyName, osg::Transform* t)
+{ if (_engine.valid()) addTransform(_engine->getBodyHandle(bodyName), t); }
+
+void PhysicsSyncCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+{
+    osg::ref_ptr<PhysicsEngine> engine;
+    if (_engine.lock(engine))
+    {
+        _movedHandles.clear();
+        engine->syncTransforms(_matrices, &_movedHandles);
+        for (size_t i = 0; i < _movedHandles.size(); ++i)
+        {
+            int handle = _movedHandles[i]; if (handle >= (int)_transforms.size()) continue;
+            osg::ref_ptr<osg::Transform> transform;
+            if (_transforms[handle].lock(transform))
+                applyTransformMatrix(transform.get(), _matrices[handle]);
+        }
+    }
+    traverse(node, nv);
+}
+
+static btTransform toTransform(const osg::Matrix& m)
+{
+    osg::Quat q = m.getRotate(); osg::Vec3 p = m.getTrans();
+    btTransform transform; transform.setIdentity();
+    transform.setOrigin(btVector3(p.x(), p.y(), p.z()));
+    transform.setRotation(btQuaternion(q.x(), q.y(), q.z(), q.w()));
+    return transform;
+}
+
+PhysicsRagdoll::PhysicsRagdoll(PhysicsEngine* e, const Settings& settings)
+:   _engine(e), _settings(settings), _lastTime(-1.0), _blendWeight(0.0f), _blendDuration(0.0f),
+    _lastFrame(-1), _lastPoseFrame(-1), _simulated(false), _sleeping(false), _frozen(false),
+    _poseValid(false), _finalPoseValid(false) {}
+
+PhysicsRagdoll::~PhysicsRagdoll()
+{ removeBodies(); }
+
+bool PhysicsRagdoll::build(PlayerAnimation* player, const std::string& prefix,
+                           const osg::Matrix& worldMatrix)
+{
+    osg::ref_ptr<PhysicsEngine> engine;
+    if (!player || !_engine.lock(engine)) return false;
+    destroy(); _player = player; _worldMatrix = worldMatrix;
+
+    std::vector<PlayerAnimation::ThisAndParent> joints = player->getSkeletonIndices();
+    player->getModelSpaceJointMatrices(_animatedPose);
+    int numJoints = (int)_animatedPose.size();
+    if (numJoints == 0 || (int)joints.size() != numJoints)
+    { OSG_WARN << "[PhysicsRagdoll] Invalid player skeleton" << std::endl; return false; }
+
+    std::vector<std::vector<int>> children(numJoints);
+    std::vector<osg::Vec3> positions(numJoints);
+    _parents.assign(numJoints, -1); _jointBones.assign(numJoints, -1);
+    for (int i = 0; i < numJoints; ++i)
+    {
+        int joint = joints[i].first, parent = joints[i].second; _parents[joint] = parent;
+        if (parent >= 0) children[parent].push_back(joint);
+        positions[joint] = _animatedPose[joint].getTrans() * worldMatrix;
+    }
+
+    // Each joint has a capsule towards its farthest child, if the bone is long enough
+    std::vector<osg::Vec3> boneEnds(numJoints); float totalLength = 0.0f;
+    for (int j = 0; j < numJoints; ++j)
+    {
+        float length = 0.0f;
+        for (size_t c = 0; c < children[j].size(); ++c)
+        {
+            float l = (positions[children[j][c]] - positions[j]).length();
+            if (l > length) { length = l; boneEnds[j] = positions[children[j][c]]; }
+        }
+        if (length < _settings.minBoneLength) continue;
+        _jointBones[j] = (int)_bones.size(); totalLength += length;
+        Bone bone; bone.joint = j; bone.handle = -1; _bones.push_back(bone);
+    }
+
+    std::vector<osg::Matrix> bodyMatrices(_bones.size());
+    for (size_t b = 0; b < _bones.size(); ++b)
+    {
+        Bone& bone = _bones[b]; int j = bone.joint;
+        osg::Vec3 dir = boneEnds[j] - positions[j]; float length = dir.normalize();
+        float radius = osg::minimum(length * _settings.radiusRatio, length * 0.5f);
+        float mass = _settings.totalMass * length / totalLength;
+
+        std::string name = prefix + player->getSkeletonJointName(j);
+        bodyMatrices[b] = osg::Matrix::rotate(osg::Y_AXIS, dir) *
+                          osg::Matrix::translate((positions[j] + boneEnds[j]) * 0.5f);
+        btRigidBody* body = engine->addRigidBody(
+            name, createPhysicsCapsule(radius, length - radius * 2.0f), mass, bodyMatrices[b]);
+        body->setDamping(_settings.linearDamping, _settings.angularDamping);
+
+        bone.offset = _animatedPose[j] * worldMatrix * osg::Matrix::inverse(bodyMatrices[b]);
+        bone.invOffset = osg::Matrix::inverse(bone.offset);
+        bone.lastPosition = bodyMatrices[b].getTrans();
+        bone.handle = engine->getBodyHandle(body); _bodyNames.push_back(name);
+    }
+
+    // Connect each body to the body of its nearest ancestor, at the joint position
+    for (size_t b = 0; b < _bones.size(); ++b)
+    {
+        int j = _bones[b].joint, parent = _parents[j];
+        while (parent >= 0 && _jointBones[parent] < 0) parent = _parents[parent];
+        if (parent < 0) continue;
+
+        int a = _jointBones[parent]; osg::Vec3 dir = boneEnds[j] - positions[j]; dir.normalize();
+        osg::Matrix frame = osg::Matrix::rotate(osg::X_AXIS, dir) *
+                            osg::Matrix::translate(positions[j]);  // X is the twist axis
+        btConeTwistConstraint* constraint = new btConeTwistConstraint(
+            *engine->getRigidBody(_bones[a].handle), *engine->getRigidBody(_bones[b].handle),
+            toTransform(frame * osg::Matrix::inverse(bodyMatrices[a])),
+            toTransform(frame * osg::Matrix::inverse(bodyMatrices[b])));
+        constraint->setLimit(_settings.swingLimit, _settings.swingLimit, _settings.twistLimit);
+
+        std::string name = _bodyNames[b] + "/" + player->getSkeletonJointName(_bones[a].joint);
+        engine->addConstraint(name, constraint, true); _constraintNames.push_back(name);
+    }
+
+    _simulated = true; setSimulated(false, 0.0f); _blendWeight = 0.0f;
+    player->setPoseCallback(this); return !_bones.empty();
+}
+
+void PhysicsRagdoll::destroy()
+{
+    removeBodies();
+    osg::ref_ptr<PlayerAnimation> player;
+    if (_player.lock(player) && player->getPoseCallback() == this)
+        player->setPoseCallback(NULL);  // may release this ragdoll, so do it at last
+}
+
+void PhysicsRagdoll::removeBodies()
+{
+    osg::ref_ptr<PhysicsEngine> engine;
+    if (_engine.lock(engine))
+    {
+        for (size_t i = 0; i < _constraintNames.size(); ++i)
+            engine->removeConstraint(_constraintNames[i]);
+        for (size_t i = 0; i < _bodyNames.size(); ++i) engine->removeBody(_bodyNames[i]);
+    }
+    _bones.clear(); _jointBones.clear(); _parents.clear();
+    _bodyNames.clear(); _constraintNames.clear(); _poseValid = false;
+}
+
+int PhysicsRagdoll::getBodyHandle(int joint) const
+{
+    if (joint < 0 || joint >= (int)_jointBones.size() || _jointBones[joint] < 0) return -1;
+    return _bones[_jointBones[joint]].handle;
+}
+
+void PhysicsRagdoll::setSimulated(bool b, float blendDuration)
+{
+    _blendDuration = blendDuration; if (b == _simulated) return;
+    osg::ref_ptr<PhysicsEngine> engine; _simulated = b;
+    _sleeping = false; _frozen = false;
+    if (b) _poseValid = false;  // otherwise last simulated pose is kept for blending out
+    if (!_engine.lock(engine)) return;
+
+    // Kinematic bodies are moved by the animation, others by the engine
+    for (size_t i = 0; i < _bones.size(); ++i)
+    {
+        btRigidBody* body = engine->getRigidBody(_bones[i].handle);
+        if (!body) continue;
+
+        int flags = body->getCollisionFlags();
+        if (b)
+        {
+            const osg::Vec3& v = _bones[i].velocity;
+            body->setCollisionFlags(flags & ~btCollisionObject::CF_KINEMATIC_OBJECT);
+            body->forceActivationState(ACTIVE_TAG); body->activate(true);
+            body->setLinearVelocity(btVector3(v[0], v[1], v[2]));
+            body->setAngularVelocity(btVector3(0.0f, 0.0f, 0.0f));
+        }
+        else
+        {
+            body->setCollisionFlags(flags | btCollisionObject::CF_KINEMATIC_OBJECT);
+            body->forceActivationState(DISABLE_DEACTIVATION);
+        }
+    }
+}
+
+void PhysicsRagdoll::computeSimulatedPose(PhysicsEngine* engine)
+{
+    // Joints are sorted so that parents are always computed before children
+    osg::Matrix invWorld = osg::Matrix::inverse(_worldMatrix);
+    _simulatedPose.resize(_animatedPose.size());
+    for (size_t j = 0; j < _animatedPose.size(); ++j)
+    {
+        int b = _jointBones[j], parent = _parents[j]; bool valid = false;
+        if (b >= 0)
+        {
+            osg::Matrix m = engine->getTransform(_bones[b].handle, valid);
+            if (valid) { _simulatedPose[j] = _bones[b].offset * m * invWorld; continue; }
+        }
+
+        if (parent < 0) _simulatedPose[j] = _animatedPose[j];
+        else _simulatedPose[j] = _animatedPose[j] * osg::Matrix::inverse(_animatedPose[parent])
+                               * _simulatedPose[parent];
+    }
+    _poseValid = true;
+}
+
+void PhysicsRagdoll::operator()(PlayerAnimation& player, const osg::FrameStamp& fs)
+{
+    osg::ref_ptr<PhysicsEngine> engine;
+    if (_bones.empty() || !_engine.lock(engine)) return;
+
+    // Called again in the same frame, e.g., after IK: don't blend or move bodies twice
+    int frame = (int)fs.getFrameNumber();
+    if (frame == _lastFrame)
+    {
+        if (_finalPoseValid) player.setModelSpaceJointMatrices(_finalPose);
+        return;
+    }
+    _lastFrame = frame; _finalPoseValid = false;
+
+    double time = fs.getSimulationTime();
+    float dt = (_lastTime < 0.0) ? 0.0f : (float)(time - _lastTime); _lastTime = time;
+    float target = _simulated ? 1.0f : 0.0f;
+    if (_blendDuration <= 0.0f) _blendWeight = target;
+    else if (_blendWeight < target)
+        _blendWeight = osg::minimum(_blendWeight + dt / _blendDuration, 1.0f);
+    else _blendWeight = osg::maximum(_blendWeight - dt / _blendDuration, 0.0f);
+
+    player.getModelSpaceJointMatrices(_animatedPose);
+    if (_animatedPose.size() != _jointBones.size()) return;
+    if (!_simulated)
+    {
+        // Kinematic bodies follow the animation, recording velocities for later simulation
+        for (size_t i = 0; i < _bones.size(); ++i)
+        {
+            Bone& bone = _bones[i];
+            osg::Matrix m = bone.invOffset * _animatedPose[bone.joint] * _worldMatrix;
+            if (dt > 0.0f) bone.velocity = (m.getTrans() - bone.lastPosition) / dt;
+            bone.lastPosition = m.getTrans(); engine->setTransform(bone.handle, m);
+        }
+
+        // Blend out from the last simulated pose, which is kept unchanged
+        if (_poseValid && _blendWeight > 0.0f)
+        {
+            player.setModelSpaceJointMatrices(_simulatedPose, _blendWeight);
+            player.getModelSpaceJointMatrices(_finalPose); _finalPoseValid = true;
+        }
+        return;
+    }
+
+    // Read back bodies at most every 'reducedInterval' frames when far away
+    updateFreezing(player, engine.get(), frame);
+    bool reduced = player.getLastViewDistance() > _settings.reducedDistance &&
+                   frame - _lastPoseFrame < osg::maximum(_settings.reducedInterval, 1);
+    if (!_poseValid || (!_sleeping && !reduced))
+    { computeSimulatedPose(engine.get()); _lastPoseFrame = frame; }
+    player.setModelSpaceJointMatrices(_simulatedPose, _blendWeight);
+    player.getModelSpaceJointMatrices(_finalPose); _finalPoseValid = true;
+}
+
+void PhysicsRagdoll::skipped(PlayerAnimation& player, const osg::FrameStamp& fs)
+{
+    osg::ref_ptr<PhysicsEngine> engine;
+    if (_bones.empty() || !_simulated || !_engine.lock(engine)) return;
+    updateFreezing(player, engine.get(), (int)fs.getFrameNumber());
+}
+
+void PhysicsRagdoll::updateFreezing(PlayerAnimation& player, PhysicsEngine* engine, int frame)
+{
+    // Freeze hidden, far away or tiny ragdolls, and wake them up when shown again
+    const PlayerAnimation::UpdateLOD& lod = player.getUpdateLOD(); bool toFreeze = false;
+    if (lod.enabled)
+    {
+        int lastCull = player.getLastCullFrame(); float distance = player.getLastViewDistance();
+        bool visible = (lastCull >= 0 && frame - lastCull <= 1);
+        toFreeze = !visible || distance > _settings.freezeDistance ||
+                   distance > lod.freezeDistance || player.getLastPixelSize() < lod.minPixelSize;
+    }
+
+    if (toFreeze && !_frozen)
+    {
+        for (size_t i = 0; i < _bones.size(); ++i)
+        {
+            btRigidBody* body = engine->getRigidBody(_bones[i].handle);
+            if (body) body->forceActivationState(ISLAND_SLEEPING);
+        }
+        _frozen = true;
+    }
+    else if (!toFreeze && _frozen)
+    {
+        for (size_t i = 0; i < _bones.size(); ++i)
+        {
+            btRigidBody* body = engine->getRigidBody(_bones[i].handle);
+            if (body) body->activate(true);
+        }
+        _frozen = false;
+    }
+
+    _sleeping = true;
+    for (size_t i = 0; i < _bones.size() && _sleeping; ++i)
+    {
+        btRigidBody* body = engine->getRigidBody(_bones[i].handle);
+        if (body && body->isActive()) _sleeping = false;
+    }
+}
+
+struct HeightFieldGrid
+{
+    osg::HeightField* heightField;
+    osg::Matrix gridMatrix;  // relative to the collected root
+    float xInterval, yInterval;
+};
+
+class HeightFieldCollector : public osg::NodeVisitor
+{
+public:
+    HeightFieldCollector() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+    std::vector<HeightFieldGrid> grids;
+
+    virtual void apply(osg::Group& group)
+    {
+        osgTerrain::TerrainTile* tile = dynamic_cast<osgTerrain::TerrainTile*>(&group);
+        if (tile != NULL) applyTerrainTile(*tile);
+        traverse(group);
+    }
+
+    virtual void apply(osg::Geode& geode)
+    {
+        for (unsigned int i = 0; i < geode.getNumDrawables(); ++i)
+        {
+            osg::ShapeDrawable* sd = dynamic_cast<osg::ShapeDrawable*>(geode.getDrawable(i));
+            osg::HeightField* hf = sd ? dynamic_cast<osg::HeightField*>(sd->getShape()) : NULL;
+            if (hf == NULL) continue;
+
+            HeightFieldGrid grid; grid.heightField = hf;
+            grid.xInterval = hf->getXInterval(); grid.yInterval = hf->getYInterval();
+            grid.gridMatrix = osg::Matrix::rotate(hf->getRotation()) *
+                              osg::Matrix::translate(hf->getOrigin()) *
+                              osg::computeLocalToWorld(getNodePath());
+            grids.push_back(grid);
+        }
+    }
+
+    void applyTerrainTile(osgTerrain::TerrainTile& tile)
+    {
+        // The elevation layer covers the unit square of its locator
+        osgTerrain::HeightFieldLayer* layer =
+            dynamic_cast<osgTerrain::HeightFieldLayer*>(tile.getElevationLayer());
+        osg::HeightField* hf = layer ? layer->getHeightField() : NULL;
+        osgTerrain::Locator* locator = layer ? layer->getLocator() : NULL;
+        if (!locator) locator = tile.getLocator();
+        if (!hf || !locator || hf->getNumColumns() < 2 || hf->getNumRows() < 2) return;
+        if (locator->getCoordinateSystemType() != osgTerrain::Locator::PROJECTED)
+        {
+            OSG_NOTICE << "[PhysicsTerrainManager] Only projected terrain tiles are supported, "
+                       << "ignoring " << tile.getName() << std::endl; return;
+        }
+
+        const osg::Matrixd& m = locator->getTransform();
+        osg::Vec3 origin = osg::Vec3() * m;
+        osg::Vec3 xAxis = osg::X_AXIS * m - origin, yAxis = osg::Y_AXIS * m - origin;
+        float width = xAxis.normalize(), length = yAxis.normalize();
+        osg::Vec3 zAxis = xAxis ^ yAxis; zAxis.normalize();
+
+        HeightFieldGrid grid; grid.heightField = hf;
+        grid.xInterval = width / (float)(hf->getNumColumns() - 1);
+        grid.yInterval = length / (float)(hf->getNumRows() - 1);
+        grid.gridMatrix = osg::Matrix(xAxis[0], xAxis[1], xAxis[2], 0.0,
+                                      yAxis[0], yAxis[1], yAxis[2], 0.0,
+                                      zAxis[0], zAxis[1], zAxis[2], 0.0,
+                                      origin[0], origin[1], origin[2], 1.0) *
+                          osg::computeLocalToWorld(getNodePath());
+        grids.push_back(grid);
+    }
+};
+
+class TerrainReadFileCallback : public osgDB::ReadFileCallback
+{
+public:
+    TerrainReadFileCallback(PhysicsTerrainManager* m, osgDB::ReadFileCallback* cb)
+    :   _manager(m), _previous(cb) {}
+
+    virtual osgDB::ReaderWriter::ReadResult readNode(const std::string& file,
+                                                     const osgDB::Options* options)
+    {
+        osgDB::ReaderWriter::ReadResult rr = _previous.valid()
+            ? _previous->readNode(file, options)
+            : osgDB::Registry::instance()->readNodeImplementation(file, options);
+
+        // Called in pager threads, so tiles are only recorded here
+        osg::ref_ptr<PhysicsTerrainManager> manager;
+        if (rr.validNode() && _manager.lock(manager)) manager->addTerrainTile(rr.getNode());
+        return rr;
+    }
+
+protected:
+    osg::observer_ptr<PhysicsTerrainManager> _manager;
+    osg::ref_ptr<osgDB::ReadFileCallback> _previous;
+};
+
+static float distance2D(const osg::BoundingBox& bb, const osg::Vec3& p)
+{
+    float dx = osg::maximum(osg::maximum(bb.xMin() - p[0], p[0] - bb.xMax()), 0.0f);
+    float dy = osg::maximum(osg::maximum(bb.yMin() - p[1], p[1] - bb.yMax()), 0.0f);
+    return sqrt(dx * dx + dy * dy);
+}
+
+static bool overlaps2D(const osg::BoundingBox& a, const osg::BoundingBox& b)
+{
+    return a.xMin() < b.xMax() && b.xMin() < a.xMax() &&
+           a.yMin() < b.yMax() && b.yMin() < a.yMax();
+}
+
+static bool equivalent2D(const osg::BoundingBox& a, const osg::BoundingBox& b, float eps)
+{
+    return osg::absolute(a.xMin() - b.xMin()) <= eps && osg::absolute(a.xMax() - b.xMax()) <= eps &&
+           osg::absolute(a.yMin() - b.yMin()) <= eps && osg::absolute(a.yMax() - b.yMax()) <= eps;
+}
+
+PhysicsTerrainManager::PhysicsTerrainManager(PhysicsEngine* e)
+:   _engine(e), _radius(50.0f), _keepRatio(1.5f), _numActiveTiles(0), _tileCounter(0),
+    _tilesChanged(true) {}
+
+void PhysicsTerrainManager::setActivationRadius(float radius, float keepRatio)
+{ _radius = radius; _keepRatio = osg::maximum(keepRatio, 1.0f); _tilesChanged = true; }
+
+void PhysicsTerrainManager::addTerrainTile(osg::Node* tileRoot)
+{
+    if (!tileRoot) return;
+    HeightFieldCollector collector; tileRoot->accept(collector);
+    for (size_t i = 0; i < collector.grids.size(); ++i)
+    {
+        const HeightFieldGrid& grid = collector.grids[i];
+        addGrid(grid.heightField, tileRoot, grid.gridMatrix, grid.xInterval, grid.yInterval);
+    }
+}
+
+void PhysicsTerrainManager::addHeightField(osg::HeightField* hf, osg::Node* owner,
+                                           const osg::Matrix& localMatrix)
+{
+    if (!hf) return;
+    addGrid(hf, owner, osg::Matrix::rotate(hf->getRotation()) *
+                       osg::Matrix::translate(hf->getOrigin()) * localMatrix,
+            hf->getXInterval(), hf->getYInterval());
+}
+
+void PhysicsTerrainManager::addGrid(osg::HeightField* hf, osg::Node* owner,
+                                    const osg::Matrix& gridMatrix, float xInterval,
+                                    float yInterval)
+{
+    if (!hf || !owner || hf->getNumColumns() < 2 || hf->getNumRows() < 2) return;
+    TerrainTile tile; tile.heightField = hf; tile.owner = owner;
+    tile.localMatrix = gridMatrix;  // relative to parent of the owner
+    tile.xInterval = xInterval; tile.yInterval = yInterval;
+    tile.interval = osg::minimum(xInterval, yInterval);
+
+    std::unique_lock<std::mutex> lock(_pendingMutex);
+    _pendingTiles.push_back(tile);
+}
+
+void PhysicsTerrainManager::installReadFileCallback(osgDB::Options* options)
+{
+    if (options != NULL)
+    {
+        options->setReadFileCallback(
+            new TerrainReadFileCallback(this, options->getReadFileCallback()));
+    }
+    else
+    {
+        osgDB::Registry* registry = osgDB::Registry::instance();
+        registry->setReadFileCallback(
+            new TerrainReadFileCallback(this, registry->getReadFileCallback()));
+    }
+}
+
+bool PhysicsTerrainManager::prepareTile(TerrainTile& tile)
+{
+    // World matrix is known only after the pager merges the tile into the scene graph
+    osg::ref_ptr<osg::Node> owner; osg::ref_ptr<osg::HeightField> hf;
+    if (!tile.owner.lock(owner) || !tile.heightField.lock(hf)) return false;
+
+    osg::NodePathList paths = owner->getParentalNodePaths();
+    if (owner->getNumParents() == 0 || paths.empty()) return false;
+    paths[0].pop_back();  // the owner itself is already applied in local matrix
+    tile.worldMatrix = tile.localMatrix * osg::computeLocalToWorld(paths[0]);
+
+    const osg::HeightField::HeightList& heights = hf->getHeightList();
+    float minHeight = *std::min_element(heights.begin(), heights.end());
+    float maxHeight = *std::max_element(heights.begin(), heights.end());
+    float width = (float)(hf->getNumColumns() - 1) * tile.xInterval;
+    float length = (float)(hf->getNumRows() - 1) * tile.yInterval;
+    tile.bound.init();
+    for (int i = 0; i < 8; ++i)
+    {
+        osg::Vec3 corner((i & 1) ? width : 0.0f, (i & 2) ? length : 0.0f,
+                         (i & 4) ? maxHeight : minHeight);
+        tile.bound.expandBy(corner * tile.worldMatrix);
+    }
+    tile.ready = true; return true;
+}
+
+void PhysicsTerrainManager::activateTile(PhysicsEngine* engine, TerrainTile& tile)
+{
+    osg::ref_ptr<osg::HeightField> hf;
+    if (!tile.heightField.lock(hf)) return;
+
+    // Bullet reads heights of the render tile directly, and centers the shape at its bound
+    const osg::HeightField::HeightList& heights = hf->getHeightList();
+    float minHeight = *std::min_element(heights.begin(), heights.end());
+    float maxHeight = *std::max_element(heights.begin(), heights.end());
+    btHeightfieldTerrainShape* shape = new btHeightfieldTerrainShape(
+        hf->getNumColumns(), hf->getNumRows(), &heights[0], minHeight, maxHeight, 2, false);
+    shape->setLocalScaling(btVector3(tile.xInterval, tile.yInterval, 1.0f));
+    shape->setUseDiamondSubdivision(true);
+
+    osg::Vec3 center((float)(hf->getNumColumns() - 1) * tile.xInterval * 0.5f,
+                     (float)(hf->getNumRows() - 1) * tile.yInterval * 0.5f,
+                     (minHeight + maxHeight) * 0.5f);
+    std::stringstream ss; ss << "terrain:" << (_tileCounter++);
+    tile.bodyName = ss.str(); tile.active = true; _numActiveTiles++;
+
+    // The shared shape keeps the heightfield alive even if the render tile expires
+    engine->addSharedShape(tile.bodyName, shape, hf.get());
+    engine->addRigidBody(tile.bodyName, shape, 0.0f,
+                         osg::Matrix::translate(center) * tile.worldMatrix);
+}
+
+static long long getGridKey(int x, int y)
+{ return ((long long)x << 32) | (long long)(unsigned int)y; }
+
+void PhysicsTerrainManager::operator()(osg::Node* node, osg::NodeVisitor* nv)
+{
+    osg::ref_ptr<PhysicsEngine> engine;
+    if (!_engine.lock(engine)) { traverse(node, nv); return; }
+    {
+        std::unique_lock<std::mutex> lock(_pendingMutex);
+        if (!_pendingTiles.empty()) _tilesChanged = true;
+        _tiles.insert(_tiles.end(), _pendingTiles.begin(), _pendingTiles.end());
+        _pendingTiles.clear();
+    }
+
+    // Collect positions of all dynamic bodies, including sleeping ones, which should
+    // not fall through the terrain after waking up
+    _bodyPositions.clear(); _bodyHandles.clear();
+    for (unsigned int h = 0; h < engine->getBodyTableSize(); ++h)
+    {
+        btRigidBody* body = engine->getRigidBody((int)h);
+        if (!body || body->isStaticOrKinematicObject()) continue;
+        const btVector3& p = body->getWorldTransform().getOrigin();
+        _bodyPositions.push_back(osg::Vec3(p.x(), p.y(), p.z())); _bodyHandles.push_back(h);
+    }
+
+    for (size_t i = 0; i < _tiles.size(); ++i)
+    {
+        TerrainTile& tile = _tiles[i];
+        if (!tile.ready && prepareTile(tile)) _tilesChanged = true;
+    }
+
+    // Select tiles again only if tiles changed or any body moved enough since last selection
+    bool toSelect = _tilesChanged || _bodyHandles != _selectedHandles;
+    float threshold2 = _radius * _radius * 0.01f;
+    for (size_t b = 0; b < _bodyPositions.size() && !toSelect; ++b)
+        toSelect = (_bodyPositions[b] - _selectedPositions[b]).length2() > threshold2;
+
+    if (toSelect)
+    {
+        // Bucket bodies in a grid of keep-radius cells
+        float keepRadius = _radius * _keepRatio, cellSize = osg::maximum(keepRadius, 1.0f);
+        _bodyGrid.clear(); _candidates.resize(_bodyPositions.size());
+        for (size_t b = 0; b < _bodyPositions.size(); ++b)
+        {
+            const osg::Vec3& pos = _bodyPositions[b]; _candidates[b].clear();
+            _bodyGrid[getGridKey((int)floor(pos[0] / cellSize), (int)floor(pos[1] / cellSize))]
+                .push_back((int)b);
+        }
+
+        // Find bodies around each tile from cells it overlaps (or from all occupied cells if
+        // there are less of them, e.g., for large coarse tiles)
+        for (size_t i = 0; i < _tiles.size(); ++i)
+        {
+            TerrainTile& tile = _tiles[i]; tile.wanted = tile.kept = false;
+            if (!tile.ready) continue;
+
+            const osg::BoundingBox& bb = tile.bound;
+            int x0 = (int)floor((bb.xMin() - keepRadius) / cellSize);
+            int x1 = (int)floor((bb.xMax() + keepRadius) / cellSize);
+            int y0 = (int)floor((bb.yMin() - keepRadius) / cellSize);
+            int y1 = (int)floor((bb.yMax() + keepRadius) / cellSize);
+            std::vector<const std::vector<int>*> cells;
+            if ((double)(x1 - x0 + 1) * (double)(y1 - y0 + 1) > (double)_bodyGrid.size())
+            {
+                for (std::unordered_map<long long, std::vector<int>>::iterator itr =
+                     _bodyGrid.begin(); itr != _bodyGrid.end(); ++itr)
+                    cells.push_back(&(itr->second));
+            }
+            else
+            {
+                for (int y = y0; y <= y1; ++y)
+                    for (int x = x0; x <= x1; ++x)
+                    {
+                        std::unordered_map<long long, std::vector<int>>::iterator itr =
+                            _bodyGrid.find(getGridKey(x, y));
+                        if (itr != _bodyGrid.end()) cells.push_back(&(itr->second));
+                    }
+            }
+
+            for (size_t c = 0; c < cells.size(); ++c)
+                for (size_t k = 0; k < cells[c]->size(); ++k)
+                {
+                    int b = (*cells[c])[k];
+                    if (distance2D(bb, _bodyPositions[b]) <= keepRadius)
+                        _candidates[b].push_back((int)i);
+                }
+        }
+
+        // For each body, select finest tiles around it. An expired tile kept by its body is
+        // also dropped once the pager reloads the same tile, to avoid duplicated collision
+        for (size_t b = 0; b < _bodyPositions.size(); ++b)
+        {
+            const osg::Vec3& pos = _bodyPositions[b];
+            const std::vector<int>& candidates = _candidates[b];
+            for (size_t c = 0; c < candidates.size(); ++c)
+            {
+                TerrainTile& tile = _tiles[candidates[c]]; bool covered = false;
+                bool expired = !tile.owner.valid() || !tile.heightField.valid();
+                float eps = tile.interval * 0.01f;
+                for (size_t f = 0; f < candidates.size() && !covered; ++f)
+                {
+                    const TerrainTile& other = _tiles[candidates[f]];
+                    if (other.interval < tile.interval)
+                        covered = overlaps2D(other.bound, tile.bound);
+                    else if (expired && other.interval == tile.interval &&
+                             other.owner.valid() && other.heightField.valid())
+                        covered = equivalent2D(other.bound, tile.bound, eps);
+                }
+                if (covered) continue;
+
+                tile.kept = true;
+                if (distance2D(tile.bound, pos) <= _radius) tile.wanted = true;
+            }
+        }
+        _selectedPositions = _bodyPositions; _selectedHandles = _bodyHandles;
+        _tilesChanged = false;
+    }
+
+    // Update tiles in the engine, and release expired ones not used any more
+    for (size_t i = 0; i < _tiles.size();)
+    {
+        TerrainTile& tile = _tiles[i];
+        if (!tile.active && tile.wanted) activateTile(engine.get(), tile);
+        else if (tile.active && !tile.kept)
+        {
+            engine->removeBody(tile.bodyName); engine->removeSharedShape(tile.bodyName);
+            tile.active = false; _numActiveTiles--;
+        }
+
+        bool expired = !tile.owner.valid() || !tile.heightField.valid();
+        if (expired && !tile.active)
+        { _tiles.erase(_tiles.begin() + i); _tilesChanged = true; }
+        else ++i;
+    }
+    traverse(node, nv);
+}
+
+static btConvexHullShape* createHull(const std::vector<osg::Vec3>& vertices, bool optimized)
+{
+    btConvexHullShape* shape = new btConvexHullShape(
+        (const btScalar*)&vertices[0], vertices.size(), sizeof(btScalar) * 3);
+    if (optimized) { shape->optimizeConvexHull(); shape->initializePolyhedralFeatures(); }
+    return shape;
+}
+
+static btTriangleIndexVertexArray* createMeshInterface(const std::vector<osg::Vec3>& vertices,
+                                                       const std::vector<unsigned int>& triangles)
+{
+    btIndexedMesh meshPart;
+    meshPart.m_numTriangles = triangles.size() / 3;
+    meshPart.m_numVertices = vertices.size();
+    meshPart.m_indexType = PHY_INTEGER;
+    meshPart.m_triangleIndexStride = 3 * sizeof(int);
+    meshPart.m_vertexType = PHY_FLOAT;
+    meshPart.m_vertexStride = sizeof(btVector3FloatData);
+
+    int* indexArray = (int*)btAlignedAlloc(sizeof(int) * 3 * meshPart.m_numTriangles, 16);
+    for (int j = 0; j < 3 * meshPart.m_numTriangles; j++) indexArray[j] = triangles[j];
+    meshPart.m_triangleIndexBase = (const unsigned char*)indexArray;
+
+    btVector3FloatData* btVertices = (btVector3FloatData*)btAlignedAlloc(
+        sizeof(btVector3FloatData) * meshPart.m_numVertices, 16);
+    for (int j = 0; j < meshPart.m_numVertices; j++)
+    {
+        btVertices[j].m_floats[0] = vertices[j][0];
+        btVertices[j].m_floats[1] = vertices[j][1];
+        btVertices[j].m_floats[2] = vertices[j][2];
+        btVertices[j].m_floats[3] = 0.f;
+    }
+    meshPart.m_vertexBase = (const unsigned char*)btVertices;
+
+    btTriangleIndexVertexArray* meshInterface = new btTriangleIndexVertexArray();
+    meshInterface->addIndexedMesh(meshPart, meshPart.m_indexType);
+    return meshInterface;
+}
+
+/** Mesh arrays and in-place BVH buffer of a shared triangle mesh shape */
+class PhysicsMeshData : public osg::Referenced
+{
+public:
+    PhysicsMeshData(btTriangleIndexVertexArray* m) : meshInterface(m), bvhBuffer(NULL) {}
+    btTriangleIndexVertexArray* meshInterface;
+    void* bvhBuffer;
+
+protected:
+    virtual ~PhysicsMeshData()
+    {
+        IndexedMeshArray& meshes = meshInterface->getIndexedMeshArray();
+        for (int i = 0; i < meshes.size(); ++i)
+        {
+            btAlignedFree((void*)meshes[i].m_triangleIndexBase);
+            btAlignedFree((void*)meshes[i].m_vertexBase);
+        }
+        delete meshInterface; if (bvhBuffer) btAlignedFree(bvhBuffer);
+    }
+};
+
+static btCollisionShape* createBvhTriangleMesh(PhysicsMeshData* data, const std::string& file)
+{
+    // Try to load the BVH baked before, which is stored in serialized in-place format
+    if (!file.empty() && osgDB::fileExists(file))
+    {
+        std::ifstream in(file.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+        std::streamoff length = in ? (std::streamoff)in.tellg() : -1;
+        void* buffer = NULL; unsigned int size = 0;
+        if (length > 0 && length <= (std::streamoff)INT_MAX)
+        {
+            size = (unsigned int)length; in.seekg(0, std::ios::beg);
+            buffer = btAlignedAlloc(size, 16); in.read((char*)buffer, size);
+        }
+
+        btOptimizedBvh* bvh = (buffer != NULL && in.good())
+                            ? btOptimizedBvh::deSerializeInPlace(buffer, size, false) : NULL;
+        if (bvh != NULL)
+        {
+            btBvhTriangleMeshShape* shape = new btBvhTriangleMeshShape(
+                data->meshInterface, bvh->isQuantized(), false);
+            shape->setOptimizedBvh(bvh); data->bvhBuffer = buffer; return shape;
+        }
+        OSG_NOTICE << "[createBvhTriangleMesh] Invalid BVH cache " << file << ", rebuilding it\n";
+        if (buffer != NULL) btAlignedFree(buffer);
+    }
+
+    btBvhTriangleMeshShape* shape = new btBvhTriangleMeshShape(data->meshInterface, true);
+    btOptimizedBvh* bvh = shape->getOptimizedBvh();
+    if (!file.empty() && bvh != NULL)
+    {
+        unsigned int size = bvh->calculateSerializeBufferSize();
+        void* buffer = btAlignedAlloc(size, 16);
+        if (bvh->serializeInPlace(buffer, size, false))
+        {
+            std::ofstream out(file.c_str(), std::ios::out | std::ios::binary);
+            if (out) out.write((const char*)buffer, size);
+            else OSG_NOTICE << "[createBvhTriangleMesh] Failed to write " << file << std::endl;
+        }
+        btAlignedFree(buffer);
+    }
+    return shape;
+}
+
+static std::string getShapeCacheKey(const std::vector<osg::Vec3>& vertices,
+                                    const std::vector<unsigned int>& triangles, int type)
+{
+    // Hash of mesh content
+    uint64_t hash = vertices.empty() ? hashBytes(NULL, 0)
+                  : hashBytes(&vertices[0], vertices.size() * sizeof(osg::Vec3));
+    if (!triangles.empty())
+        hash = hashBytes(&triangles[0], triangles.size() * sizeof(unsigned int), hash);
+    return hashToString(hash) + "_" + std::to_string(type);
+}
+
+struct HullPart
+{
+    std::vector<unsigned int> triangles;
+    osg::ref_ptr<osg::Vec3Array> points;
+    float concavity;
+};
+
+static void computeHullPart(const std::vector<osg::Vec3>& vertices, HullPart& part)
+{
+    // Collect vertices referred by triangles of the part
+    std::set<unsigned int> indices(part.triangles.begin(), part.triangles.end());
+    part.points = new osg::Vec3Array; part.concavity = 0.0f;
+    osg::BoundingBox bound;
+    for (std::set<unsigned int>::iterator itr = indices.begin(); itr != indices.end(); ++itr)
+    { part.points->push_back(vertices[*itr]); bound.expandBy(vertices[*itr]); }
+    if (part.points->size() < 4) return;
+
+    // Concavity is the largest depth of part vertices inside the hull, relative to part size
+    btConvexHullShape* hull = new btConvexHullShape(
+        (const btScalar*)&(*part.points)[0], part.points->size(), sizeof(btScalar) * 3);
+    hull->initializePolyhedralFeatures();
+    const btConvexPolyhedron* poly = hull->getConvexPolyhedron();
+    if (poly != NULL && bound.radius() > 0.0f)
+    {
+        float maxDepth = 0.0f;
+        for (size_t i = 0; i < part.points->size(); ++i)
+        {
+            const osg::Vec3& p = (*part.points)[i]; float depth = FLT_MAX;
+            for (int f = 0; f < poly->m_faces.size(); ++f)
+            {
+                const btScalar* plane = poly->m_faces[f].m_plane;
+                float d = -(plane[0] * p[0] + plane[1] * p[1] + plane[2] * p[2] + plane[3]);
+                depth = osg::minimum(depth, d);
+            }
+            maxDepth = osg::maximum(maxDepth, depth);
+        }
+        part.concavity = maxDepth / (bound.radius() * 2.0f);
+    }
+    delete hull;
+}
+
+static bool splitHullPart(const std::vector<osg::Vec3>& vertices, const HullPart& part,
+                          HullPart& part0, HullPart& part1)
+{
+    // Split triangles at the median of their centers along the longest axis
+    std::vector<std::pair<float, size_t>> centers; osg::BoundingBox bound;
+    for (size_t i = 0; i < part.triangles.size(); i += 3)
+    {
+        osg::Vec3 c = (vertices[part.triangles[i]] + vertices[part.triangles[i + 1]]
+                     + vertices[part.triangles[i + 2]]) / 3.0f;
+        centers.push_back(std::pair<float, size_t>(0.0f, i)); bound.expandBy(c);
+    }
+    if (centers.size() < 2) return false;
+
+    osg::Vec3 size = bound._max - bound._min;
+    int axis = (size[0] > size[1]) ? (size[0] > size[2] ? 0 : 2) : (size[1] > size[2] ? 1 : 2);
+    for (size_t i = 0; i < centers.size(); ++i)
+    {
+        size_t t = centers[i].second;
+        centers[i].first = vertices[part.triangles[t]][axis] + vertices[part.triangles[t + 1]][axis]
+                         + vertices[part.triangles[t + 2]][axis];
+    }
+
+    size_t half = centers.size() / 2;
+    std::nth_element(centers.begin(), centers.begin() + half, centers.end());
+    for (size_t i = 0; i < centers.size(); ++i)
+    {
+        HullPart& target = (i < half) ? part0 : part1; size_t t = centers[i].second;
+        target.triangles.insert(target.triangles.end(), part.triangles.begin() + t,
+                                part.triangles.begin() + t + 3);
+    }
+    computeHullPart(vertices, part0); computeHullPart(vertices, part1);
+    return part0.points->size() >= 4 && part1.points->size() >= 4;
+}
+
+static btCollisionShape* createCompoundHull(const std::vector<osg::Vec3>& vertices,
+                                            const std::vector<unsigned int>& triangles,
+                                            int maxParts, float maxConcavity)
+{
+    if (vertices.empty() || triangles.empty()) return NULL;
+    std::vector<HullPart> parts(1); parts[0].triangles = triangles;
+    computeHullPart(vertices, parts[0]);
+
+    // Keep splitting the most concave part, until all are convex enough or too many parts
+    while ((int)parts.size() < maxParts)
+    {
+        size_t worst = 0;
+        for (size_t i = 1; i < parts.size(); ++i)
+        { if (parts[i].concavity > parts[worst].concavity) worst = i; }
+        if (parts[worst].concavity <= maxConcavity) break;
+
+        HullPart part0, part1;
+        if (!splitHullPart(vertices, parts[worst], part0, part1))
+        { parts[worst].concavity = 0.0f; continue; }
+        parts[worst] = part0; parts.push_back(part1);
+    }
+
+    btCompoundShape* compound = new btCompoundShape;
+    btTransform identity; identity.setIdentity();
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        if (!parts[i].points || parts[i].points->empty()) continue;
+        std::vector<osg::Vec3> points(parts[i].points->begin(), parts[i].points->end());
+        compound->addChildShape(identity, createHull(points, true));
+    }
+    return compound;
+}
+
 namespace osgVerse
 {
 
@@ -60,16 +967,14 @@ namespace osgVerse
     btCollisionShape* createPhysicsSphere(float radius)
     { return new btSphereShape(radius); }
 
+    btCollisionShape* createPhysicsCapsule(float radius, float height)
+    { return new btCapsuleShape(radius, height); }
+
     btCollisionShape* createPhysicsHull(osg::Node* node, bool optimized)
     {
         osgVerse::MeshCollector bvv; if (node != NULL) node->accept(bvv);
         const std::vector<osg::Vec3>& vertices = bvv.getVertices();
-        if (vertices.empty()) return NULL;
-
-        btConvexHullShape* shape = new btConvexHullShape(
-            (const btScalar*)&vertices[0], vertices.size(), sizeof(btScalar) * 3);
-        if (optimized) { shape->optimizeConvexHull(); shape->initializePolyhedralFeatures(); }
-        return shape;
+        if (vertices.empty()) return NULL; else return createHull(vertices, optimized);
     }
 
     btCollisionShape* createPhysicsTriangleMesh(osg::Node* node, bool compressed)
@@ -78,33 +983,44 @@ namespace osgVerse
         const std::vector<osg::Vec3>& vertices = bvv.getVertices();
         const std::vector<unsigned int>& triangles = bvv.getTriangles();
         if (vertices.empty() || triangles.empty()) return NULL;
+        return new btBvhTriangleMeshShape(createMeshInterface(vertices, triangles), compressed);
+    }
 
-        btIndexedMesh meshPart;
-        meshPart.m_numTriangles = triangles.size() / 3;
-        meshPart.m_numVertices = vertices.size();
-        meshPart.m_indexType = PHY_INTEGER;
-        meshPart.m_triangleIndexStride = 3 * sizeof(int);
-        meshPart.m_vertexType = PHY_FLOAT;
-        meshPart.m_vertexStride = sizeof(btVector3FloatData);
+    btCollisionShape* createPhysicsCompoundHull(osg::Node* node, int maxParts, float maxConcavity)
+    {
+        osgVerse::MeshCollector bvv; if (node != NULL) node->accept(bvv);
+        return createCompoundHull(bvv.getVertices(), bvv.getTriangles(), maxParts, maxConcavity);
+    }
 
-        int* indexArray = (int*)btAlignedAlloc(sizeof(int) * 3 * meshPart.m_numTriangles, 16);
-        for (int j = 0; j < 3 * meshPart.m_numTriangles; j++) indexArray[j] = triangles[j];
-        meshPart.m_triangleIndexBase = (const unsigned char*)indexArray;
+    btCollisionShape* getOrCreatePhysicsShape(PhysicsEngine* engine, osg::Node* node,
+                                              PhysicsShapeType type, const std::string& cacheDir)
+    {
+        osgVerse::MeshCollector bvv; if (node != NULL) node->accept(bvv);
+        const std::vector<osg::Vec3>& vertices = bvv.getVertices();
+        const std::vector<unsigned int>& triangles = bvv.getTriangles();
+        if (!engine || vertices.empty()) return NULL;
+
+        // Identical meshes share the same shape, no matter which node they come from
+        std::string key = getShapeCacheKey(vertices, triangles, type);
+        btCollisionShape* shape = engine->getSharedShape(key);
+        if (shape != NULL) return shape;
 
-        btVector3FloatData* btVertices = (btVector3FloatData*)btAlignedAlloc(
-            sizeof(btVector3FloatData) * meshPart.m_numVertices, 16);
-        for (int j = 0; j < meshPart.m_numVertices; j++)
+        osg::ref_ptr<PhysicsMeshData> data;
+        switch (type)
         {
-            btVertices[j].m_floats[0] = vertices[j][0];
-            btVertices[j].m_floats[1] = vertices[j][1];
-            btVertices[j].m_floats[2] = vertices[j][2];
-            btVertices[j].m_floats[3] = 0.f;
+        case HULL_SHAPE:
+            shape = createHull(vertices, true); break;
+        case COMPOUND_HULL_SHAPE:
+            shape = createCompoundHull(vertices, triangles, 16, 0.05f); break;
+        case TRIANGLE_MESH_SHAPE:
+            if (triangles.empty()) return NULL;
+            data = new PhysicsMeshData(createMeshInterface(vertices, triangles));
+            shape = createBvhTriangleMesh(data.get(), cacheDir.empty()
+                                        ? cacheDir : (cacheDir + "/" + key + ".bvh"));
+            break;
         }
-        meshPart.m_vertexBase = (const unsigned char*)btVertices;
-
-        btTriangleIndexVertexArray* meshInterface = new btTriangleIndexVertexArray();
-        meshInterface->addIndexedMesh(meshPart, meshPart.m_indexType);
-        return new btBvhTriangleMeshShape(meshInterface, compressed);
+        if (shape != NULL) engine->addSharedShape(key, shape, data.get());
+        return shape;
     }
 
     btCollisionShape* createPhysicsHeightField(osg::HeightField* hf, bool filpQuad)
@@ -6,10 +6,14 @@
 #include <osg/Shape>
 #include <osg/Geometry>
 #include "PhysicsEngine.h"
+#include "PlayerAnimation.h"
+#include <mutex>
+#include <unordered_map>
 
 class btCollisionShape;
 class btRigidBody;
 class btTypedConstraint;
+namespace osgDB { class Options; }
 
 namespace osgVerse
 {
@@ -25,15 +29,196 @@ namespace osgVerse
         std::string _bodyName;
     };
 
+    /** Update transforms of many bodies in one callback: only bodies moved since last frame are
+        copied from the engine, and no name lookup is needed. Set it to any node updated once
+        per frame, e.g., the scene root */
+    class PhysicsSyncCallback : public osg::NodeCallback
+    {
+    public:
+        PhysicsSyncCallback(PhysicsEngine* e);
+        virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+        /** Add a MatrixTransform or PositionAttitudeTransform to follow the body */
+        void addTransform(int bodyHandle, osg::Transform* t);
+        void addTransform(const std::string& bodyName, osg::Transform* t);
+
+    protected:
+        osg::observer_ptr<PhysicsEngine> _engine;
+        std::vector<osg::observer_ptr<osg::Transform>> _transforms;  // indexed by handle
+        std::vector<osg::Matrix> _matrices;
+        std::vector<int> _movedHandles;
+    };
+
+    /** Ragdoll of capsule bodies and cone-twist constraints built from the player skeleton. It
+        works as pose callback of the player: while animated, bodies are kinematic and follow the
+        animation; while simulated, bone transforms are written back to model-space matrices in
+        bulk and blended with the animated pose. Joints without bodies (short or leaf bones) keep
+        animated transforms relative to their parents */
+    class PhysicsRagdoll : public PlayerAnimation::PoseCallback
+    {
+    public:
+        /** Ragdoll LOD uses cull data of the player (with UpdateLOD enabled). Beyond
+            'reducedDistance', simulated pose is read back at most every 'reducedInterval' frames,
+            counted in frames and not in updates, so the player's own reduced rate doesn't
+            multiply with it. Bodies are put to sleep beyond 'freezeDistance', out of view, or
+            when the player is frozen by its UpdateLOD. This is checked in every frame, also
+            when the player skips its update, and bodies wake up when shown again */
+        struct Settings
+        {
+            Settings() : totalMass(60.0f), radiusRatio(0.2f), minBoneLength(0.05f),
+                         swingLimit(osg::PI_4), twistLimit(osg::PI_4 * 0.5f),
+                         linearDamping(0.05f), angularDamping(0.85f), reducedDistance(30.0f),
+                         freezeDistance(100.0f), reducedInterval(4) {}
+            float totalMass, radiusRatio, minBoneLength, swingLimit, twistLimit;
+            float linearDamping, angularDamping, reducedDistance, freezeDistance;
+            int reducedInterval;
+        };
+
+        PhysicsRagdoll(PhysicsEngine* e, const Settings& settings = Settings());
+        const Settings& getSettings() const { return _settings; }
+
+        /** Create bodies from current pose of the player placed at 'worldMatrix', and set the
+            ragdoll as pose callback of the player. Names of bodies and constraints start with
+            'prefix' followed by joint names */
+        bool build(PlayerAnimation* player, const std::string& prefix,
+                   const osg::Matrix& worldMatrix);
+        void destroy();
+
+        /** World matrix of the player, which should be kept updated while it is animated */
+        void setWorldMatrix(const osg::Matrix& m) { _worldMatrix = m; }
+        const osg::Matrix& getWorldMatrix() const { return _worldMatrix; }
+
+        /** Switch between simulated and animated pose, blending in 'duration' seconds. Bodies
+            start with linear velocities of the animation when simulation begins */
+        void setSimulated(bool b, float blendDuration = 0.2f);
+        bool isSimulated() const { return _simulated; }
+        float getBlendWeight() const { return _blendWeight; }
+
+        /** A simulated ragdoll is sleeping when all its bodies are deactivated by the engine. Its
+            cached pose is reused then, without reading any body */
+        bool isSleeping() const { return _sleeping; }
+
+        int getBodyHandle(int joint) const;  // -1 if the joint has no body
+
+        /** Evaluated once per frame. Repeated calls of the same frame, e.g., after IK updates,
+            only re-apply the pose written by the first call */
+        virtual void operator()(PlayerAnimation& player, const osg::FrameStamp& fs);
+        virtual void skipped(PlayerAnimation& player, const osg::FrameStamp& fs);
+
+    protected:
+        virtual ~PhysicsRagdoll();
+        void removeBodies();
+        void computeSimulatedPose(PhysicsEngine* engine);
+        void updateFreezing(PlayerAnimation& player, PhysicsEngine* engine, int frame);
+
+        struct Bone
+        {
+            osg::Matrix offset, invOffset;  // joint matrix relative to body, and its inverse
+            osg::Vec3 lastPosition, velocity; int joint, handle;
+        };
+
+        osg::observer_ptr<PhysicsEngine> _engine;
+        osg::observer_ptr<PlayerAnimation> _player;
+        std::vector<Bone> _bones;
+        std::vector<int> _jointBones, _parents;
+        std::vector<std::string> _bodyNames, _constraintNames;
+        std::vector<osg::Matrix> _animatedPose, _simulatedPose, _finalPose;
+        osg::Matrix _worldMatrix;
+        Settings _settings;
+        double _lastTime;
+        float _blendWeight, _blendDuration;
+        int _lastFrame, _lastPoseFrame;
+        bool _simulated, _sleeping, _frozen, _poseValid, _finalPoseValid;
+    };
+
+    /** Collision paging of heightfield terrain. Heightfield tiles are registered when loaded
+        (e.g., by the DatabasePager), and only tiles near dynamic bodies are added to the
+        engine, so memory and broadphase size stay bounded. Collision shapes read heights of the
+        render tiles directly, without copying. Set it as update callback of any node updated
+        once per frame, e.g., the scene root */
+    class PhysicsTerrainManager : public osg::NodeCallback
+    {
+    public:
+        PhysicsTerrainManager(PhysicsEngine* e);
+        virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+        /** Tiles within 'radius' (on XY plane) of any body are activated, and removed when no
+            body is within 'radius * keepRatio'. Where tiles of different resolutions overlap,
+            only the finest ones are used: finer tiles are expected to cover their coarser
+            parent completely, as in quad-tree paged databases. Bodies are bucketed in a grid of
+            'radius * keepRatio' cells to find tiles around them, and the selection is skipped
+            in frames when tiles are unchanged and no body moved more than 'radius * 0.1' */
+        void setActivationRadius(float radius, float keepRatio = 1.5f);
+        float getActivationRadius() const { return _radius; }
+
+        /** Register heightfields in a loaded subgraph, of ShapeDrawables and of elevation layers
+            of osgTerrain::TerrainTile (placed by their projected locators, e.g., VPB databases).
+            Each tile is released after 'tileRoot' expires and no body is around it, or when the
+            same tile is loaded again. It can be called in any thread, and new tiles are processed
+            at next update after being added to the scene graph */
+        void addTerrainTile(osg::Node* tileRoot);
+        void addHeightField(osg::HeightField* hf, osg::Node* owner,
+                            const osg::Matrix& localMatrix = osg::Matrix());
+
+        /** Install a read-file callback registering every loaded node, to 'options' of paged
+            nodes, or to the registry if it is NULL. Previously set callback is still used */
+        void installReadFileCallback(osgDB::Options* options = NULL);
+
+        unsigned int getNumTiles() const { return _tiles.size(); }
+        unsigned int getNumActiveTiles() const { return _numActiveTiles; }
+
+    protected:
+        struct TerrainTile
+        {
+            TerrainTile() : xInterval(0.0f), yInterval(0.0f), interval(0.0f), ready(false),
+                            active(false), wanted(false), kept(false) {}
+            osg::observer_ptr<osg::HeightField> heightField;  // referenced by engine if active
+            osg::observer_ptr<osg::Node> owner;
+            osg::Matrix localMatrix, worldMatrix;  // of the grid, without interval scaling
+            osg::BoundingBox bound; std::string bodyName;
+            float xInterval, yInterval, interval; bool ready, active, wanted, kept;
+        };
+        void addGrid(osg::HeightField* hf, osg::Node* owner, const osg::Matrix& gridMatrix,
+                     float xInterval, float yInterval);
+        bool prepareTile(TerrainTile& tile);
+        void activateTile(PhysicsEngine* engine, TerrainTile& tile);
+
+        osg::observer_ptr<PhysicsEngine> _engine;
+        std::vector<TerrainTile> _tiles, _pendingTiles;
+        std::vector<osg::Vec3> _bodyPositions, _selectedPositions;
+        std::vector<int> _bodyHandles, _selectedHandles;
+        std::vector<std::vector<int>> _candidates;  // tiles around each body
+        std::unordered_map<long long, std::vector<int>> _bodyGrid;
+        std::mutex _pendingMutex;
+        float _radius, _keepRatio;
+        unsigned int _numActiveTiles, _tileCounter;
+        bool _tilesChanged;
+    };
+
     extern btCollisionShape* createPhysicsPoint();  // for kinematic use only
     extern btCollisionShape* createPhysicsBox(const osg::Vec3& halfSize);
     extern btCollisionShape* createPhysicsCylinder(const osg::Vec3& halfSize);
     extern btCollisionShape* createPhysicsCone(float radius, float height);
     extern btCollisionShape* createPhysicsSphere(float radius);
+    extern btCollisionShape* createPhysicsCapsule(float radius, float height);  // along Y axis
     extern btCollisionShape* createPhysicsHull(osg::Node* node, bool optimized = true);
     extern btCollisionShape* createPhysicsTriangleMesh(osg::Node* node, bool compressed = true);
     extern btCollisionShape* createPhysicsHeightField(osg::HeightField* hf, bool filpQuad = false);
 
+    /** Approximate convex decomposition for dynamic props: triangles are split recursively along
+        longest axes, until concavity of each hull (largest depth of its vertices inside the hull,
+        relative to its size) is below 'maxConcavity' or there are 'maxParts' hulls */
+    extern btCollisionShape* createPhysicsCompoundHull(osg::Node* node, int maxParts = 16,
+                                                       float maxConcavity = 0.05f);
+
+    /** Get a shape shared in the engine by geometry content of the node, or create and share it.
+        BVH of triangle mesh is also saved to 'cacheDir' if set, and loaded instead of rebuilding
+        next time. The returned shape is owned by the engine, don't delete it */
+    enum PhysicsShapeType { HULL_SHAPE, COMPOUND_HULL_SHAPE, TRIANGLE_MESH_SHAPE };
+    extern btCollisionShape* getOrCreatePhysicsShape(PhysicsEngine* engine, osg::Node* node,
+                                                     PhysicsShapeType type,
+                                                     const std::string& cacheDir = "");
+
     struct ConstraintSetting
     {
         ConstraintSetting() : tau(0.3f), damping(1.0f),
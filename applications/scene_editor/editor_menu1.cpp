@@ -61,9 +61,15 @@ void EditorContentHandler::createEditorMenu1()
     osgVerse::MenuBar::MenuData editMenu(osgVerse::MenuBar::TR("Edit##menu02"));
     {
         osgVerse::MenuBar::MenuItemData undoItem(osgVerse::MenuBar::TR("Undo##menu0201"));
+        undoItem.callback = [&](osgVerse::ImGuiManager* mgr, osgVerse::ImGuiContentHandler*,
+                                osgVerse::ImGuiComponentBase* me)
+        { osgVerse::CommandBuffer::instance()->add(osgVerse::UndoCommand, NULL, linb::any(), 1); };
         editMenu.items.push_back(undoItem);
 
         osgVerse::MenuBar::MenuItemData redoItem(osgVerse::MenuBar::TR("Redo##menu0202"));
+        redoItem.callback = [&](osgVerse::ImGuiManager* mgr, osgVerse::ImGuiContentHandler*,
+                                osgVerse::ImGuiComponentBase* me)
+        { osgVerse::CommandBuffer::instance()->add(osgVerse::RedoCommand, NULL, linb::any(), 1); };
         editMenu.items.push_back(redoItem);
 
         osgVerse::MenuBar::MenuItemData undoListItem(osgVerse::MenuBar::TR("Undo List##menu0203"));
@@ -338,6 +338,8 @@ void Hierarchy::addModelFromUrl(const std::string& url)
 
     osg::MatrixTransform* modelRoot = new osg::MatrixTransform;
     modelRoot->setName(simpleName); modelRoot->addChild(loadedModel.get());
+    modelRoot->setUserValue("TangentCacheFile",
+                            osgVerse::TangentSpaceGenerator::getCacheFileName(url));
 
     osg::Node* n = modelRoot; osg::Group* parent = getSelectedGroup();
     if (parent != NULL)
@@ -82,16 +82,21 @@ protected:
 int main(int argc, char** argv)
 {
     osg::ArgumentParser arguments = osgVerse::globalInitialize(argc, argv);
+    std::string sceneFile = BASE_DIR "/models/Sponza.osgb";
+    for (int i = 1; i < arguments.argc(); ++i)
+    { if (!arguments.isOption(i)) { sceneFile = arguments[i]; break; } }
+
     osg::ref_ptr<osg::Node> scene = (argc > 1) ? osgDB::readNodeFiles(arguments)
-                                  : osgDB::readNodeFile(BASE_DIR "/models/Sponza.osgb");
+                                  : osgDB::readNodeFile(sceneFile);
     if (!scene) { OSG_WARN << "Failed to load scene model"; return 1; }
 
-    // Add tangent/bi-normal arrays for normal mapping
-    osgVerse::TangentSpaceVisitor tsv;
-    scene->accept(tsv);
+    // Add tangent/bi-normal arrays for normal mapping in background, cached with the model
+    osgVerse::TangentSpaceGenerator* tsg = osgVerse::TangentSpaceGenerator::instance();
+    tsg->add(scene.get(), osgVerse::TangentSpaceGenerator::getCacheFileName(sceneFile));
 
     if (arguments.read("--save"))
     {
+        tsg->flush();  // saved scene must contain all tangents
         osg::ref_ptr<osgDB::Options> options = new osgDB::Options;
         options->setPluginStringData("TargetFileVersion", "91");  // the first version
 
@@ -119,6 +124,7 @@ int main(int argc, char** argv)
     if (argc == 1) root->addChild(otherSceneRoot.get());
     root->addChild(sceneRoot.get());
     root->setName("Root");
+    root->addUpdateCallback(tsg);  // apply background tangents at frame boundary
 
 #if TRANSPARENT_OBJECT_TEST
     // Test transparent object
@@ -134,7 +140,7 @@ int main(int argc, char** argv)
     geode->addDrawable(shape);
 
     // Add tangent/bi-normal arrays for normal mapping
-    tsv.reset(); geode->accept(tsv);
+    tsg->add(geode.get());
     root->addChild(geode.get());
 #endif
 
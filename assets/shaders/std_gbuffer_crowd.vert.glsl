@@ -0,0 +1,77 @@
+#ifdef osg_Vertex
+#define osg_JointIndices gl_MultiTexCoord2
+#define osg_JointWeights gl_MultiTexCoord3
+#else
+VERSE_VS_IN vec4 osg_MultiTexCoord2, osg_MultiTexCoord3;
+#define osg_JointIndices osg_MultiTexCoord2
+#define osg_JointWeights osg_MultiTexCoord3
+#endif
+
+uniform sampler2D SkinningTexture, InstanceTexture;
+uniform vec4 CrowdClips[16];  // (start row, frame count, duration, looping)
+uniform vec4 CrowdParameters;  // (skinning width, skinning height, instance width, instance height)
+uniform float CrowdTime, CrowdInstanceCount;
+VERSE_VS_IN vec4 osg_Tangent;
+VERSE_VS_OUT vec4 texCoord0, texCoord1, color;
+VERSE_VS_OUT vec3 eyeNormal, eyeTangent, eyeBinormal;
+
+vec4 fetchTexel(sampler2D tex, float index, float width, float height)
+{
+    float row = floor(index / width), col = index - row * width;
+    return VERSE_TEX2D(tex, vec2((col + 0.5) / width, (row + 0.5) / height));
+}
+
+mat4 fetchSkinning(float joint, float frame)
+{
+    float w = CrowdParameters.x, h = CrowdParameters.y;
+    vec2 uv = vec2((joint * 3.0 + 0.5) / w, (frame + 0.5) / h), du = vec2(1.0 / w, 0.0);
+    vec4 r0 = VERSE_TEX2D(SkinningTexture, uv), r1 = VERSE_TEX2D(SkinningTexture, uv + du);
+    vec4 r2 = VERSE_TEX2D(SkinningTexture, uv + du * 2.0);
+    return mat4(r0.x, r1.x, r2.x, 0.0, r0.y, r1.y, r2.y, 0.0,
+                r0.z, r1.z, r2.z, 0.0, r0.w, r1.w, r2.w, 1.0);
+}
+
+void main()
+{
+    // Per-instance data: (position, heading) and (clip, time offset, speed, scale)
+    float instance = float(gl_InstanceID);
+    float instanceW = CrowdParameters.z, instanceH = CrowdParameters.w;
+    vec4 data0 = fetchTexel(InstanceTexture, instance * 2.0, instanceW, instanceH);
+    vec4 data1 = fetchTexel(InstanceTexture, instance * 2.0 + 1.0, instanceW, instanceH);
+    if (instance >= CrowdInstanceCount)
+    { gl_Position = vec4(0.0, 0.0, -2.0, 1.0); return; }
+
+    // Compute frames of current clip to interpolate
+    vec4 clip = CrowdClips[int(data1.x)];
+    float ratio = (CrowdTime * data1.z + data1.y) / max(clip.z, 0.001);
+    ratio = (clip.w > 0.5) ? fract(ratio) : clamp(ratio, 0.0, 1.0);
+    float frameF = ratio * (clip.y - 1.0), frame0 = floor(frameF);
+    float frame1 = min(frame0 + 1.0, clip.y - 1.0), t = frameF - frame0;
+
+    // Blend skinning matrices of at most 4 joints
+    mat4 skinning = mat4(0.0);
+    for (int i = 0; i < 4; ++i)
+    {
+        float weight = osg_JointWeights[i]; if (weight <= 0.0) continue;
+        mat4 m0 = fetchSkinning(osg_JointIndices[i], clip.x + frame0);
+        mat4 m1 = fetchSkinning(osg_JointIndices[i], clip.x + frame1);
+        skinning += (m0 * (1.0 - t) + m1 * t) * weight;
+    }
+
+    float s = sin(data0.w) * data1.w, c = cos(data0.w) * data1.w;
+    mat4 instanceMatrix = mat4(c, s, 0.0, 0.0, -s, c, 0.0, 0.0,
+                               0.0, 0.0, data1.w, 0.0, data0.xyz, 1.0);
+    mat4 modelMatrix = instanceMatrix * skinning;
+    mat3 normalMatrix = VERSE_MATRIX_N *
+                        mat3(modelMatrix[0].xyz, modelMatrix[1].xyz, modelMatrix[2].xyz);
+
+    vec3 normal = osg_Normal, tangent = osg_Tangent.xyz;
+    eyeNormal = normalize(normalMatrix * normal);
+    eyeTangent = normalize(normalMatrix * tangent);
+    eyeBinormal = normalize(normalMatrix * (cross(normal, tangent) * osg_Tangent.w));
+
+    texCoord0 = osg_MultiTexCoord0;
+    texCoord1 = osg_MultiTexCoord1;
+    color = osg_Color;
+    gl_Position = VERSE_MATRIX_MVP * (modelMatrix * vec4(osg_Vertex.xyz, 1.0));
+}
@@ -3,6 +3,9 @@
 #include <iostream>
 #include <cstdio>
 #include <climits>
+#include <atomic>
+#include <mutex>
+#include <set>
 
 #include <exprtk.hpp>
 #include <cdt/CDT.h>
@@ -200,8 +203,81 @@ namespace osgVerse
         exprtk::symbol_table<double> symbolTable;
         exprtk::expression<double> expression;
         exprtk::parser<double> parser;
+        std::map<std::string, double*> variables;  // bound references, or values in constants
+        std::map<std::string, double> constants;
+        std::map<std::string, std::pair<const double*, size_t>> arrays;
+        std::set<std::string> workerKeys;  // worker pools used by evaluate(results, count)
     };
 
+    /** Compiled copy of an expression with its own variable storage, used by one thread at a
+        time. Workers are pooled by expression string and variable names, so later calls and
+        other MathExpression objects of the same expression don't compile again. A pool is
+        released when the last MathExpression object using it is destroyed */
+    struct MathExpressionWorker
+    {
+        exprtk::symbol_table<double> symbolTable;
+        exprtk::expression<double> expression;
+        std::vector<double> values;
+    };
+
+    struct MathExpressionPool
+    {
+        std::vector<MathExpressionWorker*> workers;
+        int numUsers;
+        MathExpressionPool() : numUsers(0) {}
+    };
+    static std::map<std::string, MathExpressionPool> g_expressionPools;
+    static std::mutex g_expressionMutex;
+
+    static void retainExpressionPool(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(g_expressionMutex);
+        g_expressionPools[key].numUsers++;
+    }
+
+    static void releaseExpressionPool(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(g_expressionMutex);
+        std::map<std::string, MathExpressionPool>::iterator itr = g_expressionPools.find(key);
+        if (itr == g_expressionPools.end() || --(itr->second.numUsers) > 0) return;
+
+        std::vector<MathExpressionWorker*>& workers = itr->second.workers;
+        for (size_t i = 0; i < workers.size(); ++i) delete workers[i];
+        g_expressionPools.erase(itr);
+    }
+
+    static MathExpressionWorker* acquireExpressionWorker(
+            const std::string& key, const std::string& exp, const std::vector<std::string>& names)
+    {
+        {
+            std::lock_guard<std::mutex> lock(g_expressionMutex);
+            std::vector<MathExpressionWorker*>& pool = g_expressionPools[key].workers;
+            if (!pool.empty()) { MathExpressionWorker* w = pool.back(); pool.pop_back(); return w; }
+        }
+
+        MathExpressionWorker* worker = new MathExpressionWorker;
+        worker->values.resize(names.size(), 0.0);  // never resized again, as symbols refer to it
+        worker->symbolTable.add_constants();
+        for (size_t i = 0; i < names.size(); ++i)
+            worker->symbolTable.add_variable(names[i], worker->values[i]);
+        worker->expression.register_symbol_table(worker->symbolTable);
+
+        exprtk::parser<double> parser;
+        if (!parser.compile(exp, worker->expression))
+        {
+            OSG_NOTICE << "[MathExpression] expression " << exp << " is invalid: "
+                       << parser.error() << std::endl;
+            delete worker; return NULL;
+        }
+        return worker;
+    }
+
+    static void releaseExpressionWorker(const std::string& key, MathExpressionWorker* worker)
+    {
+        std::lock_guard<std::mutex> lock(g_expressionMutex);
+        g_expressionPools[key].workers.push_back(worker);
+    }
+
 }
 
 using namespace osgVerse;
@@ -217,25 +293,49 @@ MathExpression::MathExpression(const std::string& exp)
 
 MathExpression::~MathExpression()
 {
+    for (std::set<std::string>::iterator itr = _private->workerKeys.begin();
+         itr != _private->workerKeys.end(); ++itr) releaseExpressionPool(*itr);
     delete _private;
 }
 
 void MathExpression::setVariable(const std::string& name, double& value)
 {
+    std::map<std::string, double*>::iterator itr = _private->variables.find(name);
+    if (itr != _private->variables.end() && itr->second == &value) return;
+
     if (_private->symbolTable.symbol_exists(name))
         _private->symbolTable.remove_variable(name);
     _private->symbolTable.add_variable(name, value);
-    _compiled = false;
+    _private->variables[name] = &value; _private->constants.erase(name);
+    _private->arrays.erase(name); _compiled = false;
 }
 
 void MathExpression::setVariable(const std::string& name, const double& value)
 {
+    // Constants are variables bound to own storage, so changing them keeps compiled result
+    std::map<std::string, double>::iterator itr = _private->constants.find(name);
+    if (itr != _private->constants.end()) { itr->second = value; return; }
+
     if (_private->symbolTable.symbol_exists(name))
         _private->symbolTable.remove_variable(name);
-    _private->symbolTable.add_constant(name, value);
+    double& storage = _private->constants[name]; storage = value;
+    _private->symbolTable.add_variable(name, storage);
+    _private->variables[name] = &storage; _private->arrays.erase(name);
     _compiled = false;
 }
 
+void MathExpression::setArray(const std::string& name, const double* values, size_t stride)
+{
+    // Keep a scalar variable of the same name, so that evaluate() still compiles and uses it
+    if (_private->variables.find(name) == _private->variables.end())
+        setVariable(name, 0.0);
+    _private->arrays[name] =
+        std::pair<const double*, size_t>(values, osg::maximum(stride, (size_t)1));
+}
+
+void MathExpression::removeArray(const std::string& name)
+{ _private->arrays.erase(name); }
+
 double MathExpression::evaluate(bool* ok)
 {
     if (!_compiled)
@@ -253,6 +353,68 @@ double MathExpression::evaluate(bool* ok)
     return _private->expression.value();
 }
 
+bool MathExpression::evaluate(double* results, size_t count)
+{
+    // Worker variables are scalars followed by arrays, both sorted by name
+    std::vector<std::string> names; std::vector<const double*> scalars;
+    std::vector<std::pair<const double*, size_t>> arrays;
+    std::string key = _expressionString + "|";
+    for (std::map<std::string, double*>::iterator itr = _private->variables.begin();
+         itr != _private->variables.end(); ++itr)
+    {
+        if (_private->arrays.find(itr->first) != _private->arrays.end()) continue;
+        names.push_back(itr->first); scalars.push_back(itr->second); key += itr->first + ",";
+    }
+    key += "|";
+    for (std::map<std::string, std::pair<const double*, size_t>>::iterator
+         itr = _private->arrays.begin(); itr != _private->arrays.end(); ++itr)
+    { names.push_back(itr->first); arrays.push_back(itr->second); key += itr->first + ","; }
+    if (count == 0) return true;
+    if (_private->workerKeys.insert(key).second) retainExpressionPool(key);
+
+    // Compile (or fetch) one worker here, so that an invalid expression is reported only once
+    MathExpressionWorker* first = acquireExpressionWorker(key, _expressionString, names);
+    if (!first) return false; else releaseExpressionWorker(key, first);
+
+    const size_t blockSize = 4096, numScalars = scalars.size();
+    int numBlocks = (int)((count + blockSize - 1) / blockSize);
+    std::atomic<bool> ok(true);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < numBlocks; ++b)
+    {
+        MathExpressionWorker* worker = ok ?
+            acquireExpressionWorker(key, _expressionString, names) : NULL;
+        if (!worker) { ok = false; continue; }
+
+        double* values = worker->values.data();
+        for (size_t k = 0; k < numScalars; ++k) values[k] = *scalars[k];
+
+        size_t i0 = (size_t)b * blockSize, i1 = osg::minimum(i0 + blockSize, count);
+        for (size_t i = i0; i < i1; ++i)
+        {
+            for (size_t k = 0; k < arrays.size(); ++k)
+                values[numScalars + k] = arrays[k].first[i * arrays[k].second];
+            results[i] = worker->expression.value();
+        }
+        releaseExpressionWorker(key, worker);
+    }
+    return ok;
+}
+
+void MathExpression::clearCache()
+{
+    std::lock_guard<std::mutex> lock(g_expressionMutex);
+    for (std::map<std::string, MathExpressionPool>::iterator itr = g_expressionPools.begin();
+         itr != g_expressionPools.end();)
+    {
+        std::vector<MathExpressionWorker*>& workers = itr->second.workers;
+        for (size_t i = 0; i < workers.size(); ++i) delete workers[i];
+        workers.clear();
+        if (itr->second.numUsers > 0) ++itr; else g_expressionPools.erase(itr++);
+    }
+}
+
 /* GeometryAlgorithm */
 
 bool GeometryAlgorithm::project(const PointList3D& pIn, PointList2D& proj)
@@ -536,3 +698,132 @@ std::vector<size_t> GeometryAlgorithm::delaunayTriangulation(
     }
     return indices;
 }
+
+/// Scratch buffers of batched triangulation, reused by all polygons of one thread
+struct TriangulationScratch
+{
+    std::vector<CDT::V2d<double>> vertices;
+    std::vector<CDT::Edge> edges;
+    std::vector<size_t> order, mapping, uniqueToInput;
+};
+
+static bool pointInsideEdges(const std::vector<CDT::V2d<double>>& vertices,
+                             const std::vector<CDT::Edge>& edges, double x, double y)
+{
+    // Even-odd rule, same as eraseOuterTrianglesAndHoles()
+    bool inside = false;
+    for (size_t i = 0; i < edges.size(); ++i)
+    {
+        const CDT::V2d<double>& a = vertices[edges[i].v1()];
+        const CDT::V2d<double>& b = vertices[edges[i].v2()];
+        if ((a.y > y) == (b.y > y)) continue;
+        if (x < a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y)) inside = !inside;
+    }
+    return inside;
+}
+
+static bool triangulatePolygon(GeometryAlgorithm::TriangulationData& data,
+                               TriangulationScratch& scratch)
+{
+    PointList2D& points = data.points; data.indices.clear();
+    size_t numPoints = points.size(); if (numPoints < 3) return false;
+
+    // Merge duplicated points, mapping[i] is the unique index of input point i
+    scratch.order.resize(numPoints); scratch.mapping.resize(numPoints);
+    for (size_t i = 0; i < numPoints; ++i) scratch.order[i] = i;
+    std::sort(scratch.order.begin(), scratch.order.end(), [&points](size_t a, size_t b)
+    {
+        const osg::Vec2& pa = points[a].first; const osg::Vec2& pb = points[b].first;
+        return pa[0] < pb[0] || (pa[0] == pb[0] && pa[1] < pb[1]);
+    });
+
+    scratch.vertices.clear(); scratch.uniqueToInput.clear();
+    for (size_t k = 0; k < numPoints; ++k)
+    {
+        size_t i = scratch.order[k];
+        if (k == 0 || points[i].first != points[scratch.order[k - 1]].first)
+        {
+            const osg::Vec2& p = points[i].first;
+            scratch.vertices.push_back(CDT::V2d<double>::make(p[0], p[1]));
+            scratch.uniqueToInput.push_back(i);
+        }
+        scratch.mapping[i] = scratch.vertices.size() - 1;
+    }
+
+    // Remap constraints, and drop degenerated and duplicated ones
+    scratch.edges.clear();
+    for (size_t i = 0; i < data.edges.size(); ++i)
+    {
+        const EdgeType& e = data.edges[i];
+        if (e.first >= numPoints || e.second >= numPoints) continue;
+        size_t v1 = scratch.mapping[e.first], v2 = scratch.mapping[e.second];
+        if (v1 != v2) scratch.edges.push_back(CDT::Edge((CDT::VertInd)v1, (CDT::VertInd)v2));
+    }
+    std::sort(scratch.edges.begin(), scratch.edges.end(),
+              [](const CDT::Edge& a, const CDT::Edge& b)
+    { return a.v1() < b.v1() || (a.v1() == b.v1() && a.v2() < b.v2()); });
+    scratch.edges.erase(std::unique(scratch.edges.begin(), scratch.edges.end()),
+                        scratch.edges.end());
+
+    size_t numUnique = scratch.vertices.size();
+    if (numUnique < 3) return false;
+    try
+    {
+        // Intersecting constraints are split at new vertices, appended to the input points
+        CDT::Triangulation<double> cdt(CDT::VertexInsertionOrder::Auto,
+                                       CDT::IntersectingConstraintEdges::TryResolve, 0.0);
+        cdt.insertVertices(scratch.vertices);
+        if (scratch.edges.empty()) cdt.eraseSuperTriangle();
+        else { cdt.insertEdges(scratch.edges); cdt.eraseOuterTrianglesAndHoles(); }
+
+        for (size_t i = numUnique; i < cdt.vertices.size(); ++i)
+        {
+            const CDT::V2d<double>& v = cdt.vertices[i];
+            points.push_back(PointType2D(osg::Vec2(v.x, v.y), (size_t)-1));
+        }
+
+        data.indices.reserve(cdt.triangles.size() * 3);
+        for (size_t i = 0; i < cdt.triangles.size(); ++i)
+        {
+            const CDT::VerticesArr3& t = cdt.triangles[i].vertices;
+            for (int k = 0; k < 3; ++k)
+                data.indices.push_back(t[k] < numUnique ? scratch.uniqueToInput[t[k]]
+                                       : numPoints + (t[k] - numUnique));
+        }
+        return true;
+    }
+    catch (const std::exception&) { points.resize(numPoints); data.indices.clear(); }
+
+    try
+    {
+        // Fallback: unconstrained triangulation, keeping triangles inside constraints only
+        CDT::Triangulation<double> cdt; cdt.insertVertices(scratch.vertices);
+        cdt.eraseSuperTriangle();
+        for (size_t i = 0; i < cdt.triangles.size(); ++i)
+        {
+            const CDT::VerticesArr3& t = cdt.triangles[i].vertices;
+            const CDT::V2d<double>& v0 = scratch.vertices[t[0]];
+            const CDT::V2d<double>& v1 = scratch.vertices[t[1]];
+            const CDT::V2d<double>& v2 = scratch.vertices[t[2]];
+            if (!scratch.edges.empty() && !pointInsideEdges(scratch.vertices, scratch.edges,
+                (v0.x + v1.x + v2.x) / 3.0, (v0.y + v1.y + v2.y) / 3.0)) continue;
+            for (int k = 0; k < 3; ++k) data.indices.push_back(scratch.uniqueToInput[t[k]]);
+        }
+        return true;
+    }
+    catch (const std::exception&) { data.indices.clear(); }
+    return false;
+}
+
+size_t GeometryAlgorithm::delaunayTriangulation(std::vector<TriangulationData>& polygons)
+{
+    int numPolygons = (int)polygons.size(), numFailed = 0;
+#pragma omp parallel reduction(+:numFailed)
+    {
+        TriangulationScratch scratch;
+#pragma omp for schedule(dynamic, 64)
+        for (int i = 0; i < numPolygons; ++i)
+        { if (!triangulatePolygon(polygons[i], scratch)) numFailed++; }
+    }
+    return (size_t)numFailed;
+}
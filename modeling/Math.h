@@ -75,10 +75,26 @@ namespace osgVerse
         MathExpression(const std::string& exp);
         ~MathExpression();
 
+        /** Bind a variable by reference, or set a constant value. Changing the value of an
+            existing constant or rebinding the same reference doesn't need recompiling */
         void setVariable(const std::string& name, double& value);
         void setVariable(const std::string& name, const double& value);
         double evaluate(bool* ok = NULL);
 
+        /** Bind a variable to an array, which is read element-wise by evaluate(results, count).
+            Stride is counted in doubles, e.g. 3 to read one component of a Vec3d array.
+            A scalar variable of the same name (0 if not set before) is kept for evaluate() */
+        void setArray(const std::string& name, const double* values, size_t stride = 1);
+        void removeArray(const std::string& name);
+
+        /** Evaluate over count elements of bound arrays, using worker threads. Other variables
+            keep their current values during the call */
+        bool evaluate(double* results, size_t count);
+
+        /** Release compiled expressions cached for evaluate(results, count). They are also
+            released when the last MathExpression object using them is destroyed */
+        static void clearCache();
+
     protected:
         MathExpressionPrivate* _private;
         std::string _expressionString;
@@ -110,6 +126,19 @@ namespace osgVerse
         /** Delaunay triangulation (with/without auto-detected boundaries and holes) */
         static std::vector<size_t> delaunayTriangulation(
                 const PointList2D& points, const EdgeList& edges);
+
+        /** Polygon data for batched triangulation. Resulting indices refer to points, to which
+            vertices created at intersecting constraints are appended with index field of -1 */
+        struct TriangulationData
+        {
+            PointList2D points; EdgeList edges;
+            std::vector<size_t> indices;
+        };
+
+        /** Triangulate independent polygons in parallel. Duplicated points and constraints are
+            merged, and intersecting constraints are split instead of failing the polygon.
+            Return number of polygons that failed and have empty indices */
+        static size_t delaunayTriangulation(std::vector<TriangulationData>& polygons);
     };
 
 }
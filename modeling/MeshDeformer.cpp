@@ -1,17 +1,16 @@
+#include <osg/Notify>
 #include "MeshDeformer.h"
 #include "laplacian_deformation.hpp"
+#include <algorithm>
 using namespace osgVerse;
 using namespace osgVerse::helper;
 
 MeshDeformer::MeshDeformer()
     : _boundaryBegin(-1), _updatingCount(-1)
-{
-}
+{ _solver = createDeform(); }
 
 MeshDeformer::~MeshDeformer()
-{
-    if (_updatingCount >= 0) freeDeform();
-}
+{ freeDeform(_solver); }
 
 void MeshDeformer::initialize(const std::vector<vec3>& pos, const std::vector<int>& cells)
 {
@@ -35,22 +34,24 @@ void MeshDeformer::initialize(const std::vector<vec3>& pos, const std::vector<in
         newCells.push_back(_sharedIndexMap[cells[i]]);
 
     // Set variables
-    if (_updatingCount >= 0) freeDeform();
-    _positions = newPos; _cells = newCells; _updatingCount = -1;
+    _positions = newPos; _cells = newCells; _updatingCount = -1; _boundaryBegin = -1;
+    _handles.clear(); _unconstrained.clear(); _combined.clear();
     _adjacancies = computeAdjacancy((int)_positions.size(), _cells);
+    _localIndices.assign(_positions.size(), -1);
+
+    _vertexCells.assign(_positions.size(), std::vector<int>());
+    for (size_t i = 0; i < _cells.size(); i += 3)
+    { for (int j = 0; j < 3; ++j) _vertexCells[_cells[i + j]].push_back((int)i); }
 }
 
 bool MeshDeformer::setHandle(int mainHandle, int handleSize, int unconstrainedSize)
 {
-    if (_updatingCount >= 0)
-    { _handles.clear(); _unconstrained.clear(); freeDeform(); }
-    
+    _handles.clear(); _unconstrained.clear();
     int numVertices = (int)_positions.size();
     if (numVertices == 0) return false; else _updatingCount = 0;
 
-    std::vector<bool> unconstrainedSet(numVertices, false);
-    std::vector<bool> handlesSet(numVertices, false);
-    std::vector<bool> visited(numVertices, false);
+    // Use local index list to mark visited vertices, avoiding whole-mesh allocations
+    std::vector<int>& visited = _localIndices;
     std::vector<int> currentRing;
     currentRing.push_back(_sharedIndexMap[mainHandle]);
 
@@ -59,8 +60,8 @@ bool MeshDeformer::setHandle(int mainHandle, int handleSize, int unconstrainedSi
         std::vector<int> nextRing;
         for (int i = 0; i < currentRing.size(); ++i)
         {
-            int e = currentRing[i]; if (visited[e]) continue;
-            visited[e] = true; handlesSet[e] = true;
+            int e = currentRing[i]; if (visited[e] >= 0) continue;
+            visited[e] = 0;
             _handles.push_back(e);
 
             const std::vector<int>& adjs = _adjacancies[e];
@@ -74,8 +75,8 @@ bool MeshDeformer::setHandle(int mainHandle, int handleSize, int unconstrainedSi
         std::vector<int> nextRing;
         for (int i = 0; i < currentRing.size(); ++i)
         {
-            int e = currentRing[i]; if (visited[e]) continue;
-            visited[e] = true; unconstrainedSet[e] = true;
+            int e = currentRing[i]; if (visited[e] >= 0) continue;
+            visited[e] = 0;
             _unconstrained.push_back(e);
 
             const std::vector<int>& adjs = _adjacancies[e];
@@ -87,17 +88,31 @@ bool MeshDeformer::setHandle(int mainHandle, int handleSize, int unconstrainedSi
     _boundaryBegin = (int)_handles.size();
     for (int i = 0; i < currentRing.size(); ++i)
     {
-        int e = currentRing[i]; if (visited[e]) continue;
-        _handles.push_back(e); visited[e] = true;
+        int e = currentRing[i]; if (visited[e] >= 0) continue;
+        _handles.push_back(e); visited[e] = 0;
     }
 
-    // Prepare deformation
+    // Prepare deformation on ROI only, so cost depends on region size instead of whole mesh
     int unconstrainedBegin = (int)_handles.size(); _combined.clear();
     _combined.insert(_combined.end(), _handles.begin(), _handles.end());
     _combined.insert(_combined.end(), _unconstrained.begin(), _unconstrained.end());
-    prepareDeform(_cells.data(), (int)_cells.size(),
-                  (double*)_positions.data(), numVertices * 3,
-                  _combined.data(), (int)_combined.size(), unconstrainedBegin, true);
+
+    std::vector<int> localCells; collectRegionCells(localCells);
+    _roiPositions.resize(_combined.size() * 3);
+    for (size_t i = 0; i < _combined.size(); ++i)
+    {
+        const vec3& v = _positions[_combined[i]];
+        _roiPositions[i * 3 + 0] = v.x; _roiPositions[i * 3 + 1] = v.y;
+        _roiPositions[i * 3 + 2] = v.z;
+    }
+
+    if (!prepareDeform(_solver, localCells.data(), (int)localCells.size(), _roiPositions.data(),
+                       (int)_combined.size(), unconstrainedBegin, true))
+    {
+        OSG_WARN << "[MeshDeformer] Failed to factorize region of " << _combined.size()
+                 << " vertices" << std::endl;
+        _boundaryBegin = -1; return false;
+    }
     return true;
 }
 
@@ -122,12 +137,18 @@ bool MeshDeformer::updateDeformation(double dx, double dy, double dz)
     }
     
     // Compute deformation
-    doDeform(&inputData[0], handleSize, (double*)_positions.data());
+    doDeform(_solver, &inputData[0], handleSize, _roiPositions.data());
 
-    // Reconstruct original vertex list
-    for (std::map<int, int>::iterator itr = _sharedIndexMap.begin();
-         itr != _sharedIndexMap.end(); ++itr)
-    { _positions0[itr->first] = _positions[itr->second]; }
+    // Reconstruct original vertex list, only ROI vertices are changed
+    for (size_t i = 0; i < _combined.size(); ++i)
+    {
+        vec3& v = _positions[_combined[i]];
+        v = vec3(_roiPositions[i * 3], _roiPositions[i * 3 + 1], _roiPositions[i * 3 + 2]);
+
+        std::map<int, std::vector<int>>::iterator itr = _sharedToOriginIndexMap.find(_combined[i]);
+        if (itr == _sharedToOriginIndexMap.end()) continue;
+        for (size_t j = 0; j < itr->second.size(); ++j) _positions0[itr->second[j]] = v;
+    }
     _updatingCount++; return true;
 }
 
@@ -165,3 +186,26 @@ MeshDeformer::AdjacancyList MeshDeformer::computeAdjacancy(int numVertices, cons
         }
     return adj; 
 }
+
+void MeshDeformer::collectRegionCells(std::vector<int>& localCells)
+{
+    // Cells touching the ROI, re-indexed to ROI vertices (-1 for outside vertices)
+    // Index list will be reset to -1 after that, which also clears visited flags of setHandle()
+    std::vector<int> cellStarts;
+    for (size_t i = 0; i < _combined.size(); ++i)
+    {
+        const std::vector<int>& vc = _vertexCells[_combined[i]];
+        cellStarts.insert(cellStarts.end(), vc.begin(), vc.end());
+        _localIndices[_combined[i]] = (int)i;
+    }
+    std::sort(cellStarts.begin(), cellStarts.end());
+    cellStarts.erase(std::unique(cellStarts.begin(), cellStarts.end()), cellStarts.end());
+
+    localCells.resize(cellStarts.size() * 3);
+    for (size_t i = 0; i < cellStarts.size(); ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+            localCells[i * 3 + j] = _localIndices[_cells[cellStarts[i] + j]];
+    }
+    for (size_t i = 0; i < _combined.size(); ++i) _localIndices[_combined[i]] = -1;
+}
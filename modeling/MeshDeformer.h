@@ -5,6 +5,7 @@
 #include <map>
 #include <vector>
 #include <iostream>
+struct LaplacianDeformation;
 
 namespace osgVerse
 {
@@ -62,6 +63,10 @@ namespace osgVerse
         MeshDeformer();
         ~MeshDeformer();
 
+        // The solver is owned by each instance, so copying is not allowed
+        MeshDeformer(const MeshDeformer&) = delete;
+        MeshDeformer& operator=(const MeshDeformer&) = delete;
+
         void initialize(const std::vector<helper::vec3>& pos, const std::vector<int>& cells);
         bool setHandle(int mainHandle, int handleSize, int unconstrainedSize);
         bool updateDeformation(double dx, double dy, double dz);
@@ -72,12 +77,16 @@ namespace osgVerse
     protected:
         typedef std::vector<std::vector<int>> AdjacancyList;
         AdjacancyList computeAdjacancy(int numVertices, const std::vector<int>& cells);
+        void collectRegionCells(std::vector<int>& localCells);
 
         std::map<int, std::vector<int>> _sharedToOriginIndexMap;
         std::map<int, int> _sharedIndexMap;
         std::vector<helper::vec3> _positions, _positions0;
         std::vector<int> _cells, _combined;
-        AdjacancyList _adjacancies;
+        AdjacancyList _adjacancies, _vertexCells;
+        std::vector<int> _localIndices;     // shared vertex -> ROI index, -1 if outside
+        std::vector<double> _roiPositions;  // ROI-local input/output of the solver
+        LaplacianDeformation* _solver;
 
         std::vector<int> _handles;
         std::vector<int> _unconstrained;
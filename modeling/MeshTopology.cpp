@@ -1,14 +1,83 @@
 #include <osg/Texture2D>
+#include <osgDB/FileNameUtils>
+#include <osgDB/WriteFile>
 #include <pmp/surface_mesh.h>
 #include <pmp/algorithms/utilities.h>
 #include <pmp/algorithms/remeshing.h>
 #include <pmp/algorithms/decimation.h>
+#include <pmp/algorithms/features.h>
 #include <pmp/algorithms/hole_filling.h>
+#include <pmp/algorithms/distance_point_triangle.h>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cfloat>
 #include "MeshTopology.h"
 #include "Utilities.h"
 using namespace osgVerse;
 
-MeshTopology::MeshTopology() : _mesh(NULL)
+static void partitionMeshFaces(pmp::SurfaceMesh& mesh, unsigned int maxFaces,
+                               std::vector<std::vector<pmp::Face>>& partitions);
+static void extractMeshFaces(pmp::SurfaceMesh& mesh, const std::vector<pmp::Face>& faces,
+                             pmp::SurfaceMesh& result, bool withOrigins = false);
+static void lockMeshFeatures(pmp::SurfaceMesh& mesh, float featureAngle, bool lockBorders);
+
+static osg::Geometry* createGeometryArrays(pmp::SurfaceMesh& mesh)
+{
+    pmp::VertexProperty<pmp::Point> points = mesh.get_vertex_property<pmp::Point>("v:point");
+    pmp::VertexProperty<pmp::Normal> normals = mesh.get_vertex_property<pmp::Normal>("v:normal");
+    pmp::VertexProperty<pmp::Color> colors = mesh.get_vertex_property<pmp::Color>("v:color");
+    pmp::VertexProperty<pmp::TexCoord> texcoords = mesh.get_vertex_property<pmp::TexCoord>("v:tex");
+
+    osg::ref_ptr<osg::Vec3Array> va = (points) ? new osg::Vec3Array : NULL;
+    osg::ref_ptr<osg::Vec3Array> na = (normals) ? new osg::Vec3Array : NULL;
+    osg::ref_ptr<osg::Vec4Array> ca = (colors) ? new osg::Vec4Array : NULL;
+    osg::ref_ptr<osg::Vec2Array> ta = (texcoords) ? new osg::Vec2Array : NULL;
+    if (!va) return NULL;
+
+    std::vector<pmp::Point>& pts = points.vector();
+    for (size_t i = 0; i < pts.size(); ++i)
+    {
+        const pmp::Point& pt = pts[i]; pmp::Vertex v(i);
+        va->push_back(osg::Vec3(pt[0], pt[1], pt[2]));
+        if (normals)
+        {
+            const pmp::Normal& n = normals[v];
+            na->push_back(osg::Vec3(n[0], n[1], n[2]));
+        }
+        if (colors)
+        {
+            const pmp::Color& c = colors[v];
+            ca->push_back(osg::Vec4(c[0], c[1], c[2], 1.0f));
+        }
+        if (texcoords)
+        {
+            const pmp::TexCoord& t = texcoords[v];
+            ta->push_back(osg::Vec2(t[0], t[1]));
+        }
+    }
+
+    osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+    geom->setUseDisplayList(false);
+    geom->setUseVertexBufferObjects(true);
+    geom->setVertexArray(va.get());
+    if (texcoords) geom->setTexCoordArray(0, ta.get());
+    if (normals)
+    {
+        geom->setNormalArray(na.get());
+        geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+    }
+    if (colors)
+    {
+        geom->setColorArray(ca.get());
+        geom->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+    }
+    return geom.release();
+}
+
+MeshTopology::MeshTopology()
+:   _mesh(NULL), _maxPartitionFaces(0), _adjacencyDirty(true)
 {
 }
 
@@ -19,7 +88,7 @@ MeshTopology::~MeshTopology()
 pmp::SurfaceMesh* MeshTopology::generate(MeshCollector* collector)
 {
     if (_mesh != NULL) delete _mesh;
-    _mesh = new pmp::SurfaceMesh;
+    _mesh = new pmp::SurfaceMesh; _adjacencyDirty = true;
 
     pmp::VertexProperty<pmp::Normal> normals = _mesh->vertex_property<pmp::Normal>("v:normal");
     pmp::VertexProperty<pmp::Color> colors = _mesh->vertex_property<pmp::Color>("v:color");
@@ -63,54 +132,8 @@ pmp::SurfaceMesh* MeshTopology::generate(MeshCollector* collector)
 osg::Geometry* MeshTopology::output(int eID)
 {
     if (!_mesh) return NULL;
-    pmp::VertexProperty<pmp::Point> points = _mesh->get_vertex_property<pmp::Point>("v:point");
-    pmp::VertexProperty<pmp::Normal> normals = _mesh->get_vertex_property<pmp::Normal>("v:normal");
-    pmp::VertexProperty<pmp::Color> colors = _mesh->get_vertex_property<pmp::Color>("v:color");
-    pmp::VertexProperty<pmp::TexCoord> texcoords = _mesh->get_vertex_property<pmp::TexCoord>("v:tex");
-
-    osg::ref_ptr<osg::Vec3Array> va = (points) ? new osg::Vec3Array : NULL;
-    osg::ref_ptr<osg::Vec3Array> na = (normals) ? new osg::Vec3Array : NULL;
-    osg::ref_ptr<osg::Vec4Array> ca = (colors) ? new osg::Vec4Array : NULL;
-    osg::ref_ptr<osg::Vec2Array> ta = (texcoords) ? new osg::Vec2Array : NULL;
-    if (!va) return NULL;
-
-    std::vector<pmp::Point>& pts = points.vector();
-    for (size_t i = 0; i < pts.size(); ++i)
-    {
-        const pmp::Point& pt = pts[i]; pmp::Vertex v(i);
-        va->push_back(osg::Vec3(pt[0], pt[1], pt[2]));
-        if (normals)
-        {
-            const pmp::Normal& n = normals[v];
-            na->push_back(osg::Vec3(n[0], n[1], n[2]));
-        }
-        if (colors)
-        {
-            const pmp::Color& c = colors[v];
-            ca->push_back(osg::Vec4(c[0], c[1], c[2], 1.0f));
-        }
-        if (texcoords)
-        {
-            const pmp::TexCoord& t = texcoords[v];
-            ta->push_back(osg::Vec2(t[0], t[1]));
-        }
-    }
-
-    osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
-    geom->setUseDisplayList(false);
-    geom->setUseVertexBufferObjects(true);
-    geom->setVertexArray(va.get());
-    if (texcoords) geom->setTexCoordArray(0, ta.get());
-    if (normals)
-    {
-        geom->setNormalArray(na.get());
-        geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
-    }
-    if (colors)
-    {
-        geom->setColorArray(ca.get());
-        geom->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
-    }
+    osg::ref_ptr<osg::Geometry> geom = createGeometryArrays(*_mesh);
+    if (!geom) return NULL;
 
     if (eID >= 0)
     {
@@ -166,7 +189,7 @@ osg::Geode* MeshTopology::outputByEntity()
 }
 
 void MeshTopology::prune()
-{ _mesh->garbage_collection(); }
+{ _mesh->garbage_collection(); _adjacencyDirty = true; }
 
 size_t MeshTopology::getNumTopologyData(TopologyType t) const
 {
@@ -181,8 +204,11 @@ size_t MeshTopology::getNumTopologyData(TopologyType t) const
 }
 
 std::vector<uint32_t> MeshTopology::getTopologyData(TopologyType t) const
+{ std::vector<uint32_t> data; getTopologyData(t, data); return data; }
+
+void MeshTopology::getTopologyData(TopologyType t, std::vector<uint32_t>& data) const
 {
-    std::vector<uint32_t> data;
+    data.clear(); data.reserve(getNumTopologyData(t));
     switch (t)
     {
     case MVertex:
@@ -194,12 +220,15 @@ std::vector<uint32_t> MeshTopology::getTopologyData(TopologyType t) const
     case MFace:
         for (auto f : _mesh->faces()) data.push_back(f.idx()); break;
     }
-    return data;
 }
 
 std::vector<uint32_t> MeshTopology::getConnectiveData(TopologyType t, uint32_t idx, QueryType q) const
+{ std::vector<uint32_t> data; getConnectiveData(t, idx, q, data); return data; }
+
+size_t MeshTopology::getConnectiveData(TopologyType t, uint32_t idx, QueryType q,
+                                       std::vector<uint32_t>& data) const
 {
-    std::vector<uint32_t> data;
+    data.clear();
     switch (t)
     {
     case MVertex:
@@ -260,7 +289,7 @@ std::vector<uint32_t> MeshTopology::getConnectiveData(TopologyType t, uint32_t i
         }
         break;
     }
-    return data;
+    return data.size();
 }
 
 bool MeshTopology::isValid(TopologyType t, uint32_t idx) const
@@ -303,90 +332,148 @@ uint32_t MeshTopology::findNextHalfEdge(uint32_t idx) const
 { return _mesh->next_halfedge(pmp::Halfedge(idx)).idx(); }
 
 void MeshTopology::splitEdge(uint32_t idx, const osg::Vec3& pt)
-{ _mesh->split(pmp::Edge(idx), pmp::Point(pt[0], pt[1], pt[2])); }
+{ _mesh->split(pmp::Edge(idx), pmp::Point(pt[0], pt[1], pt[2])); _adjacencyDirty = true; }
 
 void MeshTopology::splitFace(uint32_t idx, const osg::Vec3& pt)
-{ _mesh->split(pmp::Face(idx), pmp::Point(pt[0], pt[1], pt[2])); }
+{ _mesh->split(pmp::Face(idx), pmp::Point(pt[0], pt[1], pt[2])); _adjacencyDirty = true; }
 
 void MeshTopology::flipEdge(uint32_t idx)
-{ _mesh->flip(pmp::Edge(idx)); }
+{ _mesh->flip(pmp::Edge(idx)); _adjacencyDirty = true; }
 
 void MeshTopology::collapseHalfEdge(uint32_t idx)
-{ _mesh->collapse(pmp::Halfedge(idx)); }
+{ _mesh->collapse(pmp::Halfedge(idx)); _adjacencyDirty = true; }
 
 void MeshTopology::deleteFace(uint32_t idx)
-{ _mesh->delete_face(pmp::Face(idx)); }
+{ _mesh->delete_face(pmp::Face(idx)); _adjacencyDirty = true; }
 
 std::vector<std::vector<uint32_t>> MeshTopology::getHalfEdgeBoundaries() const
 {
-    std::vector<uint32_t> hEdges = getTopologyData(osgVerse::MeshTopology::MHalfEdge);
-    std::vector<uint32_t> boundaries;
-    for (size_t i = 0; i < hEdges.size(); ++i)
-    {
-        uint32_t he = hEdges[i];
-        if (isBoundary(osgVerse::MeshTopology::MHalfEdge, he))
-            boundaries.push_back(he);
-    }
+    std::vector<uint32_t> halfEdges, offsets;
+    std::vector<std::vector<uint32_t>> edgeChunkList(getHalfEdgeBoundaries(halfEdges, offsets));
+    for (size_t i = 0; i < edgeChunkList.size(); ++i)
+        edgeChunkList[i].assign(halfEdges.begin() + offsets[i],
+                                halfEdges.begin() + offsets[i + 1]);
+    return edgeChunkList;
+}
 
-    std::set<uint32_t> usedEdges;
-    std::vector<std::vector<uint32_t>> edgeChunkList;
-    for (size_t i = 0; i < boundaries.size(); ++i)
+size_t MeshTopology::getHalfEdgeBoundaries(std::vector<uint32_t>& halfEdges,
+                                           std::vector<uint32_t>& offsets) const
+{
+    // Walk each boundary loop along next half-edges, which stay on the boundary
+    uint32_t stamp = 0; uint32_t* visited = nextVisitStamp(_mesh->halfedges_size(), stamp);
+    halfEdges.clear(); offsets.clear(); offsets.push_back(0);
+    for (auto h : _mesh->halfedges())
     {
-        uint32_t he = boundaries[i];
-        if (usedEdges.find(he) != usedEdges.end()) continue;
-
-        std::vector<uint32_t> subEdges;
-        if (findConnectedEdges(he, subEdges, usedEdges))
-            edgeChunkList.push_back(subEdges);
+        if (visited[h.idx()] == stamp || !_mesh->is_boundary(h)) continue;
+        for (pmp::Halfedge h1 = h; h1.is_valid() && visited[h1.idx()] != stamp;
+             h1 = _mesh->next_halfedge(h1))
+        { visited[h1.idx()] = stamp; halfEdges.push_back(h1.idx()); }
+        offsets.push_back((uint32_t)halfEdges.size());
     }
-    return edgeChunkList;
+    return offsets.size() - 1;
 }
 
 std::vector<std::vector<uint32_t>> MeshTopology::getEntityFaces() const
 {
-    std::vector<uint32_t> faces = getTopologyData(osgVerse::MeshTopology::MFace);
-    std::map<uint32_t, std::set<uint32_t>> faceSetMap;
-    for (size_t i = 0; i < faces.size(); ++i)
+    std::vector<uint32_t> faces, offsets;
+    std::vector<std::vector<uint32_t>> entityList(getEntityFaces(faces, offsets));
+    for (size_t i = 0; i < entityList.size(); ++i)
+        entityList[i].assign(faces.begin() + offsets[i], faces.begin() + offsets[i + 1]);
+    return entityList;
+}
+
+size_t MeshTopology::getEntityFaces(std::vector<uint32_t>& faces,
+                                    std::vector<uint32_t>& offsets) const
+{
+    // Flood over faces sharing vertices, using the output list itself as the queue
+    buildAdjacency(); uint32_t stamp = 0;
+    uint32_t* visited = nextVisitStamp(_mesh->faces_size(), stamp);
+    faces.clear(); offsets.clear(); offsets.push_back(0);
+    for (auto f : _mesh->faces())
     {
-        uint32_t f = faces[i]; bool alreadyAdded = false;
-        for (std::map<uint32_t, std::set<uint32_t>>::iterator itr = faceSetMap.begin();
-             itr != faceSetMap.end(); ++itr)
+        if (visited[f.idx()] == stamp) continue;
+        size_t start = faces.size(); faces.push_back(f.idx());
+        visited[f.idx()] = stamp;
+        for (size_t i = start; i < faces.size(); ++i)
         {
-            if (itr->second.find(f) != itr->second.end())
-            { alreadyAdded = true; break; }
+            IndexRange vertices = getAdjacency(MFace, faces[i], QVertices);
+            for (const uint32_t* v = vertices.begin(); v != vertices.end(); ++v)
+            {
+                IndexRange neighbors = getAdjacency(MVertex, *v, QFaces);
+                for (const uint32_t* f1 = neighbors.begin(); f1 != neighbors.end(); ++f1)
+                {
+                    if (visited[*f1] == stamp) continue;
+                    visited[*f1] = stamp; faces.push_back(*f1);
+                }
+            }
         }
+        std::sort(faces.begin() + start, faces.end());
+        offsets.push_back((uint32_t)faces.size());
+    }
+    return offsets.size() - 1;
+}
 
-        if (alreadyAdded) continue; else faceSetMap[f].insert(f);
-        std::set<uint32_t>& newFaceSet = faceSetMap[f]; addNeighborFaces(newFaceSet, f);
+MeshTopology::IndexRange MeshTopology::getAdjacency(TopologyType t, uint32_t idx,
+                                                    QueryType q) const
+{
+    const std::vector<uint32_t>* offsets = NULL; const std::vector<uint32_t>* data = NULL;
+    buildAdjacency();
+    if (t == MVertex && q == QVertices)
+    { offsets = &_vertexVertexOffsets; data = &_vertexVertices; }
+    else if (t == MVertex && q == QFaces)
+    { offsets = &_vertexFaceOffsets; data = &_vertexFaces; }
+    else if (t == MFace && q == QVertices)
+    { offsets = &_faceVertexOffsets; data = &_faceVertices; }
+    else if (t == MFace && q == QFaces)
+    { offsets = &_faceFaceOffsets; data = &_faceFaces; }
+    if (!offsets || idx + 1 >= offsets->size() || data->empty()) return IndexRange();
+
+    const uint32_t* ptr = &(*data)[0];
+    return IndexRange(ptr + (*offsets)[idx], ptr + (*offsets)[idx + 1]);
+}
+
+size_t MeshTopology::growFaceRegion(uint32_t seed, std::vector<uint32_t>& region,
+                                    std::function<bool (uint32_t)> filter) const
+{
+    region.clear(); buildAdjacency();
+    if (seed >= _mesh->faces_size() || _mesh->is_deleted(pmp::Face(seed))) return 0;
 
-        for (std::set<uint32_t>::iterator itr = newFaceSet.begin(); itr != newFaceSet.end();)
+    if (filter)
+    {
+        // The filter may run other stamp-based queries, so use a buffer of this call only
+        std::vector<bool> visited(_mesh->faces_size(), false);
+        region.push_back(seed); visited[seed] = true;
+        for (size_t i = 0; i < region.size(); ++i)
         {
-            bool toRemove = false;
-            for (std::map<uint32_t, std::set<uint32_t>>::iterator itr2 = faceSetMap.begin();
-                 itr2 != faceSetMap.end(); ++itr2)
+            IndexRange neighbors = getAdjacency(MFace, region[i], QFaces);
+            for (const uint32_t* f = neighbors.begin(); f != neighbors.end(); ++f)
             {
-                if (itr2->first == f) continue;
-                if (itr2->second.find(*itr) != itr2->second.end()) toRemove = true;
+                if (visited[*f]) continue; else visited[*f] = true;
+                if (filter(*f)) region.push_back(*f);
             }
-            if (toRemove) itr = newFaceSet.erase(itr); else itr++;
         }
+        return region.size();
     }
 
-    std::vector<std::vector<uint32_t>> entityList;
-    for (std::map<uint32_t, std::set<uint32_t>>::iterator itr = faceSetMap.begin();
-         itr != faceSetMap.end(); ++itr)
+    uint32_t stamp = 0; uint32_t* visited = nextVisitStamp(_mesh->faces_size(), stamp);
+    region.push_back(seed); visited[seed] = stamp;
+    for (size_t i = 0; i < region.size(); ++i)
     {
-        std::vector<uint32_t> faces;
-        faces.assign(itr->second.begin(), itr->second.end());
-        entityList.push_back(faces);
+        IndexRange neighbors = getAdjacency(MFace, region[i], QFaces);
+        for (const uint32_t* f = neighbors.begin(); f != neighbors.end(); ++f)
+        {
+            if (visited[*f] == stamp) continue;
+            visited[*f] = stamp; region.push_back(*f);
+        }
     }
-    return entityList;
+    return region.size();
 }
 
 std::vector<osg::Vec3> MeshTopology::getVertexData(TopologyType t, const std::vector<uint32_t>& v)
 {
     pmp::VertexProperty<pmp::Point> points = _mesh->get_vertex_property<pmp::Point>("v:point");
     std::vector<pmp::Point>& pts = points.vector(); std::set<osg::Vec3> vertices;
+    std::vector<uint32_t> connData;
     switch (t)
     {
     case MVertex:
@@ -399,7 +486,7 @@ std::vector<osg::Vec3> MeshTopology::getVertexData(TopologyType t, const std::ve
     case MHalfEdge: case MEdge: case MFace:
         for (size_t i = 0; i < v.size(); ++i)
         {
-            std::vector<uint32_t> connData = getConnectiveData(t, v[i], QVertices);
+            getConnectiveData(t, v[i], QVertices, connData);
             for (size_t j = 0; j < connData.size(); ++j)
             {
                 const pmp::Point& pt = pts[connData[j]];
@@ -413,102 +500,548 @@ std::vector<osg::Vec3> MeshTopology::getVertexData(TopologyType t, const std::ve
 
 bool MeshTopology::simplify(float percentage, int aspectRatio, int normalDeviation)
 {
-    try
+    if (!_mesh) return false; bool result = false;
+    if (_maxPartitionFaces > 0)
     {
-        pmp::decimate(*_mesh, _mesh->n_vertices() * percentage,
-                      aspectRatio, 0.0, 0, normalDeviation);
-        return true;
+        result = processPartitions([=](pmp::SurfaceMesh& patch)
+        {
+            // Borders have no feature edges to collapse along, so they are kept as-is
+            if (patch.n_vertices() < 4) return;
+            lockMeshFeatures(patch, 0.0f, true);
+            unsigned int target = (unsigned int)(patch.n_vertices() * percentage);
+            pmp::decimate(patch, osg::maximum(target, 3u), aspectRatio, 0.0, 0, normalDeviation);
+        });
     }
-    catch (const pmp::InvalidInputException& e)
-    { OSG_WARN << "[MeshTopology] " << e.what() << std::endl; }
-    return false;
-}
-
-bool MeshTopology::remesh(float uniformValue, bool adaptive)
-{
-    if (!adaptive)
+    else
     {
         try
         {
-            float l = uniformValue;
-            if (l <= 0.0f)
-            {
-                for (auto eit : _mesh->edges())
-                    l += pmp::distance(_mesh->position(_mesh->vertex(eit, 0)),
-                                       _mesh->position(_mesh->vertex(eit, 1)));
-                l /= (float)_mesh->n_edges();
-            }
-            pmp::uniform_remeshing(*_mesh, l, 10, true); return true;
+            pmp::decimate(*_mesh, _mesh->n_vertices() * percentage,
+                          aspectRatio, 0.0, 0, normalDeviation);
+            if (_progressCallback) _progressCallback(1.0f);
+            result = true;
         }
         catch (const pmp::InvalidInputException& e)
         { OSG_WARN << "[MeshTopology] " << e.what() << std::endl; }
     }
+
+    // Mark after editing, in case the progress callback rebuilt caches from the old mesh
+    _adjacencyDirty = true; return result;
+}
+
+bool MeshTopology::remesh(float uniformValue, bool adaptive)
+{
+    if (!_mesh) return false; bool result = false;
+    float l = uniformValue, bb = pmp::bounds(*_mesh).size();
+    if (!adaptive && l <= 0.0f)
+    {
+        for (auto eit : _mesh->edges())
+            l += pmp::distance(_mesh->position(_mesh->vertex(eit, 0)),
+                               _mesh->position(_mesh->vertex(eit, 1)));
+        l /= (float)_mesh->n_edges();
+    }
+
+    if (_maxPartitionFaces > 0)
+    {
+        // Edge length and error thresholds come from the whole mesh, so patches match
+        result = processPartitions([=](pmp::SurfaceMesh& patch)
+        {
+            // Lock border vertices and edges by selecting interior ones only
+            pmp::VertexProperty<bool> selected = patch.vertex_property<bool>("v:selected", false);
+            bool hasInterior = false;
+            for (auto v : patch.vertices())
+            { selected[v] = !patch.is_boundary(v); if (selected[v]) hasInterior = true; }
+
+            if (hasInterior && !adaptive) pmp::uniform_remeshing(patch, l, 10, true);
+            else if (hasInterior)
+                pmp::adaptive_remeshing(patch, 0.0010 * bb, 0.0500 * bb, 0.0005 * bb, 10, true);
+            patch.remove_vertex_property(selected);
+        });
+    }
     else
     {
-        float bb = pmp::bounds(*_mesh).size();
         try
         {
-            pmp::adaptive_remeshing(*_mesh, 0.0010 * bb, 0.0500 * bb,  // min/max length
-                                    0.0005 * bb /*approx. error*/, 10, true);
-            return true;
+            if (!adaptive) pmp::uniform_remeshing(*_mesh, l, 10, true);
+            else
+                pmp::adaptive_remeshing(*_mesh, 0.0010 * bb, 0.0500 * bb,  // min/max length
+                                        0.0005 * bb /*approx. error*/, 10, true);
+            if (_progressCallback) _progressCallback(1.0f);
+            result = true;
         }
         catch (const pmp::InvalidInputException& e)
         { OSG_WARN << "[MeshTopology] " << e.what() << std::endl; }
     }
-    return false;
+    _adjacencyDirty = true; return result;
 }
 
-bool MeshTopology::findConnectedEdges(
-    uint32_t he, std::vector<uint32_t>& subEdges, std::set<uint32_t>& usedEdges) const
+void MeshTopology::buildAdjacency() const
 {
-    std::vector<uint32_t> ptOfHe = getConnectiveData(
-        osgVerse::MeshTopology::MHalfEdge, he, osgVerse::MeshTopology::QVertices);
-    usedEdges.insert(he); if (ptOfHe.size() < 2) return false;
+    // Concurrent const queries may find the cache outdated at the same time
+    if (!_adjacencyDirty || !_mesh) return;
+    std::unique_lock<std::mutex> lock(_adjacencyMutex);
+    if (!_adjacencyDirty) return;
+    size_t numVertices = _mesh->vertices_size(), numFaces = _mesh->faces_size();
+
+    // Face lists come directly from circulators; deleted elements get empty ranges
+    _vertexVertexOffsets.assign(numVertices + 1, 0); _vertexVertices.clear();
+    for (auto v : _mesh->vertices())
+    {
+        for (auto h : _mesh->halfedges(v)) _vertexVertices.push_back(_mesh->to_vertex(h).idx());
+        _vertexVertexOffsets[v.idx() + 1] = (uint32_t)_vertexVertices.size();
+    }
 
-    //if (topology->isManifoldVertex(ptOfHe[1])) {}  // TODO: check invalid vertex
-    subEdges.push_back(he);
+    _faceVertexOffsets.assign(numFaces + 1, 0); _faceVertices.clear();
+    _faceFaceOffsets.assign(numFaces + 1, 0); _faceFaces.clear();
+    for (auto f : _mesh->faces())
+    {
+        for (auto h : _mesh->halfedges(f))
+        {
+            _faceVertices.push_back(_mesh->to_vertex(h).idx());
+            pmp::Face f1 = _mesh->face(_mesh->opposite_halfedge(h));
+            if (f1.is_valid()) _faceFaces.push_back(f1.idx());
+        }
+        _faceVertexOffsets[f.idx() + 1] = (uint32_t)_faceVertices.size();
+        _faceFaceOffsets[f.idx() + 1] = (uint32_t)_faceFaces.size();
+    }
 
-    bool hasFollowingEdges = false;
-    std::vector<uint32_t> heOnPt = getConnectiveData(
-        osgVerse::MeshTopology::MVertex, ptOfHe[1], osgVerse::MeshTopology::QHalfEdges);
-    for (size_t j = 0; j < heOnPt.size(); ++j)
+    // Offsets of skipped (deleted) elements still hold 0, so make them monotonic
+    for (size_t i = 1; i <= numVertices; ++i)
     {
-        uint32_t he1 = heOnPt[j];
-        //if (he1 == subEdges.front()) {}  // TODO: indicate good boundary
-        if (usedEdges.find(he1) != usedEdges.end()) continue;
-        if (!isBoundary(osgVerse::MeshTopology::MHalfEdge, he1)) continue;
+        _vertexVertexOffsets[i] =
+            osg::maximum(_vertexVertexOffsets[i], _vertexVertexOffsets[i - 1]);
+    }
+    for (size_t i = 1; i <= numFaces; ++i)
+    {
+        _faceVertexOffsets[i] = osg::maximum(_faceVertexOffsets[i], _faceVertexOffsets[i - 1]);
+        _faceFaceOffsets[i] = osg::maximum(_faceFaceOffsets[i], _faceFaceOffsets[i - 1]);
+    }
 
-        findConnectedEdges(he1, subEdges, usedEdges);
-        hasFollowingEdges = true;
+    // Vertex-to-face lists are the transpose of face-to-vertex lists
+    _vertexFaceOffsets.assign(numVertices + 1, 0);
+    for (size_t i = 0; i < _faceVertices.size(); ++i) _vertexFaceOffsets[_faceVertices[i] + 1]++;
+    for (size_t i = 1; i <= numVertices; ++i) _vertexFaceOffsets[i] += _vertexFaceOffsets[i - 1];
+    _vertexFaces.resize(_faceVertices.size());
+    for (size_t f = 0; f < numFaces; ++f)
+    {
+        for (uint32_t i = _faceVertexOffsets[f]; i < _faceVertexOffsets[f + 1]; ++i)
+            _vertexFaces[_vertexFaceOffsets[_faceVertices[i]]++] = (uint32_t)f;
     }
-    return hasFollowingEdges;
+    for (size_t i = numVertices; i > 0; --i) _vertexFaceOffsets[i] = _vertexFaceOffsets[i - 1];
+    _vertexFaceOffsets[0] = 0; _adjacencyDirty = false;
 }
 
-void MeshTopology::addNeighborFaces(std::set<uint32_t>& faceSet, uint32_t f) const
+uint32_t* MeshTopology::nextVisitStamp(size_t numElements, uint32_t& stamp)
 {
-    std::vector<uint32_t> ptOfFace = getConnectiveData(
-        osgVerse::MeshTopology::MFace, f, osgVerse::MeshTopology::QVertices);
-    for (size_t j = 0; j < ptOfFace.size(); ++j)
+    // Stamps avoid clearing visited flags (and allocating sets) for every search. They are
+    // per thread, so that const queries on the same topology may run concurrently
+    static thread_local std::vector<uint32_t> s_visitStamps;
+    static thread_local uint32_t s_visitStamp = 0;
+    if (s_visitStamps.size() < numElements) s_visitStamps.resize(numElements, 0);
+    if (++s_visitStamp == 0)
+    { std::fill(s_visitStamps.begin(), s_visitStamps.end(), 0); s_visitStamp = 1; }
+    stamp = s_visitStamp; return s_visitStamps.empty() ? NULL : &s_visitStamps[0];
+}
+
+/// Partition utilities, shared by MeshTopology and MeshLodBuilder
+static void partitionMeshFaces(pmp::SurfaceMesh& mesh, unsigned int maxFaces,
+                               std::vector<std::vector<pmp::Face>>& partitions)
+{
+    // Find connected entities by flooding over face neighbors
+    std::vector<int> entityOfFace(mesh.faces_size(), -1);
+    std::vector<std::vector<pmp::Face>> entities;
+    for (auto f : mesh.faces())
     {
-        std::vector<uint32_t> faceOfPt = getConnectiveData(
-            osgVerse::MeshTopology::MVertex, ptOfFace[j], osgVerse::MeshTopology::QFaces);
-        for (auto f1 : faceOfPt)
+        if (entityOfFace[f.idx()] >= 0) continue;
+        int id = (int)entities.size(); entities.push_back(std::vector<pmp::Face>());
+        std::vector<pmp::Face> stack(1, f); entityOfFace[f.idx()] = id;
+        while (!stack.empty())
         {
-            if (faceSet.find(f1) != faceSet.end()) continue;
-            faceSet.insert(f1); //addNeighborFaces(faceSet, f1);  // expand one more to avoid overflow
+            pmp::Face f0 = stack.back(); stack.pop_back();
+            entities[id].push_back(f0);
+            for (auto h : mesh.halfedges(f0))
+            {
+                pmp::Face f1 = mesh.face(mesh.opposite_halfedge(h));
+                if (!f1.is_valid() || entityOfFace[f1.idx()] >= 0) continue;
+                entityOfFace[f1.idx()] = id; stack.push_back(f1);
+            }
+        }
+    }
+
+    // Split large entities into a uniform grid of face centroids
+    for (size_t i = 0; i < entities.size(); ++i)
+    {
+        std::vector<pmp::Face>& faces = entities[i];
+        if (maxFaces == 0 || faces.size() <= maxFaces)
+        { partitions.push_back(faces); continue; }
 
-            std::vector<uint32_t> ptOfFace2 = getConnectiveData(
-                osgVerse::MeshTopology::MFace, f1, osgVerse::MeshTopology::QVertices);
-            for (size_t k = 0; k < ptOfFace2.size(); ++k)
+        std::vector<pmp::Point> centroids(faces.size()); pmp::BoundingBox bb;
+        for (size_t j = 0; j < faces.size(); ++j)
+        {
+            pmp::Point c(0, 0, 0); int numPoints = 0;
+            for (auto v : mesh.vertices(faces[j])) { c += mesh.position(v); numPoints++; }
+            centroids[j] = c / (pmp::Scalar)numPoints; bb += centroids[j];
+        }
+
+        int n = (int)ceil(cbrt((double)faces.size() / (double)maxFaces));
+        pmp::Point extent = bb.max() - bb.min();
+        std::map<int, std::vector<pmp::Face>> cells;
+        for (size_t j = 0; j < faces.size(); ++j)
+        {
+            int cell[3];
+            for (int k = 0; k < 3; ++k)
             {
-                std::vector<uint32_t> faceOfPt2 = getConnectiveData(
-                    osgVerse::MeshTopology::MVertex, ptOfFace2[j], osgVerse::MeshTopology::QFaces);
-                for (auto f2 : faceOfPt)
+                pmp::Scalar r = extent[k] > 0 ? (centroids[j][k] - bb.min()[k]) / extent[k] : 0;
+                cell[k] = osg::clampBetween((int)(r * n), 0, n - 1);
+            }
+            cells[cell[0] + n * (cell[1] + n * cell[2])].push_back(faces[j]);
+        }
+        for (std::map<int, std::vector<pmp::Face>>::iterator itr = cells.begin();
+             itr != cells.end(); ++itr) partitions.push_back(itr->second);
+    }
+}
+
+static void extractMeshFaces(pmp::SurfaceMesh& mesh, const std::vector<pmp::Face>& faces,
+                             pmp::SurfaceMesh& result, bool withOrigins)
+{
+    pmp::VertexProperty<pmp::Normal> normals = mesh.get_vertex_property<pmp::Normal>("v:normal");
+    pmp::VertexProperty<pmp::Color> colors = mesh.get_vertex_property<pmp::Color>("v:color");
+    pmp::VertexProperty<pmp::TexCoord> texcoords = mesh.get_vertex_property<pmp::TexCoord>("v:tex");
+    pmp::VertexProperty<pmp::Normal> normals1;
+    pmp::VertexProperty<pmp::Color> colors1;
+    pmp::VertexProperty<pmp::TexCoord> texcoords1;
+    pmp::VertexProperty<int> origins;  // source vertex index, -1 for newly created ones
+    if (withOrigins) origins = result.vertex_property<int>("v:origin", -1);
+    if (normals) normals1 = result.vertex_property<pmp::Normal>("v:normal");
+    if (colors) colors1 = result.vertex_property<pmp::Color>("v:color");
+    if (texcoords) texcoords1 = result.vertex_property<pmp::TexCoord>("v:tex");
+
+    std::unordered_map<uint32_t, pmp::Vertex> vertexMap;
+    for (size_t i = 0; i < faces.size(); ++i)
+    {
+        std::vector<pmp::Vertex> face;
+        for (auto v : mesh.vertices(faces[i]))
+        {
+            std::unordered_map<uint32_t, pmp::Vertex>::iterator itr = vertexMap.find(v.idx());
+            if (itr != vertexMap.end()) { face.push_back(itr->second); continue; }
+
+            pmp::Vertex v1 = result.add_vertex(mesh.position(v));
+            if (normals) normals1[v1] = normals[v];
+            if (colors) colors1[v1] = colors[v];
+            if (texcoords) texcoords1[v1] = texcoords[v];
+            if (withOrigins) origins[v1] = (int)v.idx();
+            vertexMap[v.idx()] = v1; face.push_back(v1);
+        }
+
+        try { result.add_face(face); }
+        catch (pmp::TopologyException&) {}  // already reported by generate()
+    }
+}
+
+static void lockMeshFeatures(pmp::SurfaceMesh& mesh, float featureAngle, bool lockBorders)
+{
+    // Sharp edges are marked as features, so their vertices only collapse along them
+    if (featureAngle > 0.0f) pmp::detect_features(mesh, featureAngle);
+    if (!lockBorders) return;
+
+    // Border vertices (entity/partition borders and unwelded attribute seams) have no feature
+    // edges to collapse along, so they are kept as-is and neighbor partitions still match
+    pmp::VertexProperty<bool> vfeature = mesh.vertex_property<bool>("v:feature", false);
+    pmp::EdgeProperty<bool> efeature = mesh.edge_property<bool>("e:feature", false);
+    for (auto v : mesh.vertices())
+    {
+        if (!mesh.is_boundary(v)) continue; vfeature[v] = true;
+        for (auto h : mesh.halfedges(v)) efeature[mesh.edge(h)] = false;
+    }
+}
+
+static double computeMeshDeviation(pmp::SurfaceMesh& original, pmp::SurfaceMesh& simplified)
+{
+    // One-sided distance from original vertices to the simplified surface, using a uniform grid
+    if (simplified.n_faces() == 0 || original.n_vertices() == 0) return 0.0;
+    pmp::BoundingBox bb = pmp::bounds(simplified);
+    int n = osg::clampBetween((int)cbrt((double)simplified.n_faces()), 1, 64);
+    pmp::Point extent = bb.max() - bb.min(), cellSize;
+    for (int k = 0; k < 3; ++k) cellSize[k] = osg::maximum(extent[k] / n, (pmp::Scalar)1e-6);
+
+    std::vector<std::vector<pmp::Face>> cells(n * n * n);
+    for (auto f : simplified.faces())
+    {
+        pmp::BoundingBox fb;
+        for (auto v : simplified.vertices(f)) fb += simplified.position(v);
+
+        int c0[3], c1[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            c0[k] = osg::clampBetween((int)((fb.min()[k] - bb.min()[k]) / cellSize[k]), 0, n - 1);
+            c1[k] = osg::clampBetween((int)((fb.max()[k] - bb.min()[k]) / cellSize[k]), 0, n - 1);
+        }
+        for (int z = c0[2]; z <= c1[2]; ++z) for (int y = c0[1]; y <= c1[1]; ++y)
+            for (int x = c0[0]; x <= c1[0]; ++x) cells[x + n * (y + n * z)].push_back(f);
+    }
+
+    double maxError = 0.0; pmp::Point nearest;
+    for (auto v : original.vertices())
+    {
+        const pmp::Point& p = original.position(v); int c[3];
+        for (int k = 0; k < 3; ++k)
+            c[k] = osg::clampBetween((int)((p[k] - bb.min()[k]) / cellSize[k]), 0, n - 1);
+
+        // Expand searching rings until a face is found, plus one more ring for safety
+        double minDist = FLT_MAX; int foundRing = -1;
+        for (int r = 0; r < n && (foundRing < 0 || r <= foundRing + 1); ++r)
+        {
+            for (int z = c[2] - r; z <= c[2] + r; ++z) for (int y = c[1] - r; y <= c[1] + r; ++y)
+                for (int x = c[0] - r; x <= c[0] + r; ++x)
                 {
-                    if (faceSet.find(f2) != faceSet.end()) continue;
-                    faceSet.insert(f2); addNeighborFaces(faceSet, f2);
+                    if (x < 0 || y < 0 || z < 0 || x >= n || y >= n || z >= n) continue;
+                    if (osg::maximum(abs(x - c[0]), osg::maximum(abs(y - c[1]), abs(z - c[2]))) != r)
+                        continue;  // only visit the ring shell
+
+                    std::vector<pmp::Face>& faces = cells[x + n * (y + n * z)];
+                    for (size_t i = 0; i < faces.size(); ++i)
+                    {
+                        pmp::SurfaceMesh::VertexAroundFaceCirculator fv = simplified.vertices(faces[i]);
+                        const pmp::Point& p0 = simplified.position(*fv); ++fv;
+                        const pmp::Point& p1 = simplified.position(*fv); ++fv;
+                        const pmp::Point& p2 = simplified.position(*fv);
+                        double d = pmp::dist_point_triangle(p, p0, p1, p2, nearest);
+                        if (d < minDist) minDist = d;
+                    }
                 }
-            }
-        }  // for (auto f1 : faceOfPt)
+            if (foundRing < 0 && minDist < FLT_MAX) foundRing = r;
+        }
+        if (minDist < FLT_MAX && minDist > maxError) maxError = minDist;
+    }
+    return maxError;
+}
+
+bool MeshTopology::processPartitions(std::function<void (pmp::SurfaceMesh&)> func)
+{
+    _mesh->garbage_collection();
+    std::vector<std::vector<pmp::Face>> partitionFaces;
+    partitionMeshFaces(*_mesh, _maxPartitionFaces, partitionFaces);
+
+    int numPartitions = (int)partitionFaces.size();
+    std::vector<pmp::SurfaceMesh> partitions(numPartitions);
+    std::atomic<int> numFinished(0); std::atomic<bool> canceled(false);
+    std::mutex progressMutex;
+
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < numPartitions; ++i)
+    {
+        if (canceled) continue;
+        extractMeshFaces(*_mesh, partitionFaces[i], partitions[i], true);
+        try { func(partitions[i]); }
+        catch (const std::exception& e)
+        {
+            OSG_WARN << "[MeshTopology] Partition " << i << ": " << e.what() << std::endl;
+            partitions[i] = pmp::SurfaceMesh();  // keep the original patch
+            extractMeshFaces(*_mesh, partitionFaces[i], partitions[i], true);
+        }
+        partitions[i].garbage_collection();
+
+        // Stitching is counted as the last step
+        float progress = (float)(++numFinished) / (float)(numPartitions + 1);
+        if (_progressCallback)
+        {
+            std::lock_guard<std::mutex> lock(progressMutex);
+            if (!canceled && !_progressCallback(progress)) canceled = true;
+        }
+    }
+
+    if (canceled)
+    { OSG_NOTICE << "[MeshTopology] Processing canceled" << std::endl; return false; }
+
+    // Stitch patches: vertices from the same source vertex (locked borders) are welded
+    pmp::SurfaceMesh* merged = new pmp::SurfaceMesh;
+    bool withNormals = _mesh->has_vertex_property("v:normal");
+    bool withColors = _mesh->has_vertex_property("v:color");
+    bool withUVs = _mesh->has_vertex_property("v:tex");
+    pmp::VertexProperty<pmp::Normal> normals;
+    pmp::VertexProperty<pmp::Color> colors;
+    pmp::VertexProperty<pmp::TexCoord> texcoords;
+    if (withNormals) normals = merged->vertex_property<pmp::Normal>("v:normal");
+    if (withColors) colors = merged->vertex_property<pmp::Color>("v:color");
+    if (withUVs) texcoords = merged->vertex_property<pmp::TexCoord>("v:tex");
+
+    std::vector<pmp::Vertex> sharedVertices(_mesh->vertices_size()), vertexMap;
+    for (int i = 0; i < numPartitions; ++i)
+    {
+        pmp::SurfaceMesh& patch = partitions[i];
+        pmp::VertexProperty<int> origins = patch.get_vertex_property<int>("v:origin");
+        pmp::VertexProperty<pmp::Normal> normals0 =
+            patch.get_vertex_property<pmp::Normal>("v:normal");
+        pmp::VertexProperty<pmp::Color> colors0 =
+            patch.get_vertex_property<pmp::Color>("v:color");
+        pmp::VertexProperty<pmp::TexCoord> texcoords0 =
+            patch.get_vertex_property<pmp::TexCoord>("v:tex");
+
+        vertexMap.assign(patch.vertices_size(), pmp::Vertex());
+        for (auto v : patch.vertices())
+        {
+            int origin = origins ? origins[v] : -1;
+            if (origin >= 0 && sharedVertices[origin].is_valid())
+            { vertexMap[v.idx()] = sharedVertices[origin]; continue; }
+
+            pmp::Vertex v1 = merged->add_vertex(patch.position(v));
+            if (withNormals && normals0) normals[v1] = normals0[v];
+            if (withColors && colors0) colors[v1] = colors0[v];
+            if (withUVs && texcoords0) texcoords[v1] = texcoords0[v];
+            if (origin >= 0) sharedVertices[origin] = v1;
+            vertexMap[v.idx()] = v1;
+        }
+
+        std::vector<pmp::Vertex> face;
+        for (auto f : patch.faces())
+        {
+            face.clear();
+            for (auto v : patch.vertices(f)) face.push_back(vertexMap[v.idx()]);
+            try { merged->add_face(face); }
+            catch (pmp::TopologyException& e)
+            { OSG_WARN << "[MeshTopology] " << e.what() << std::endl; }
+        }
+    }
+
+    delete _mesh; _mesh = merged;
+    if (_progressCallback) _progressCallback(1.0f);
+    return true;
+}
+
+MeshLodBuilder::MeshLodBuilder()
+:   _maxPartitionFaces(20000), _featureAngle(60.0f), _screenSpaceError(2.0f), _lockBorders(true)
+{
+    _ratios.push_back(1.0f); _ratios.push_back(0.5f);
+    _ratios.push_back(0.25f); _ratios.push_back(0.1f);
+}
+
+bool MeshLodBuilder::buildLevels(MeshTopology* topology,
+                                 std::vector<osg::ref_ptr<osg::Geode>>& levels)
+{
+    pmp::SurfaceMesh* mesh = topology ? topology->getMesh() : NULL;
+    _results.clear(); if (!mesh || mesh->n_faces() == 0 || _ratios.empty()) return false;
+    mesh->garbage_collection();
+
+    std::vector<std::vector<pmp::Face>> partitionFaces;
+    partitionMeshFaces(*mesh, _maxPartitionFaces, partitionFaces);
+
+    int numPartitions = (int)partitionFaces.size(), numLevels = (int)_ratios.size();
+    std::vector<pmp::SurfaceMesh> partitions(numPartitions);
+    std::vector<pmp::SurfaceMesh> results(numPartitions * numLevels);
+    std::vector<double> errors(numPartitions * numLevels, 0.0);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < numPartitions; ++i)
+        extractMeshFaces(*mesh, partitionFaces[i], partitions[i]);
+
+    // Every (partition, level) pair is independent, decimating from the original partition
+#pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < numPartitions * numLevels; ++t)
+    {
+        int p = t / numLevels, l = t % numLevels;
+        pmp::SurfaceMesh& result = results[t]; result = partitions[p];
+        if (_ratios[l] >= 1.0f || result.n_vertices() < 4) continue;
+
+        try
+        {
+            lockMeshFeatures(result, _featureAngle, _lockBorders);
+            unsigned int target = (unsigned int)(result.n_vertices() * _ratios[l]);
+            pmp::decimate(result, osg::maximum(target, 3u), 10, 0.0, 0, 180);
+            errors[t] = computeMeshDeviation(partitions[p], result);
+        }
+        catch (const std::exception& e)
+        {
+            OSG_WARN << "[MeshLodBuilder] Partition " << p << ", level " << l << ": "
+                     << e.what() << std::endl; result = partitions[p];
+        }
+    }
+
+    for (int l = 0; l < numLevels; ++l)
+    {
+        LevelResult lr; lr.ratio = _ratios[l]; lr.geometricError = 0.0;
+        lr.numVertices = 0; lr.numFaces = 0; lr.minPixelSize = 0.0; lr.maxPixelSize = FLT_MAX;
+
+        osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+        for (int p = 0; p < numPartitions; ++p)
+        {
+            pmp::SurfaceMesh& result = results[p * numLevels + l];
+            result.garbage_collection();
+            lr.geometricError = osg::maximum(lr.geometricError, errors[p * numLevels + l]);
+            lr.numVertices += result.n_vertices(); lr.numFaces += result.n_faces();
+
+            osg::ref_ptr<osg::Geometry> geom = createGeometryArrays(result);
+            if (!geom) continue;
+
+            osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt(GL_TRIANGLES);
+            for (auto f : result.faces())
+                for (auto v : result.vertices(f)) de->push_back(v.idx());
+            geom->addPrimitiveSet(de.get()); geode->addDrawable(geom.get());
+        }
+
+        // Coarser levels should never claim a smaller error than finer ones
+        if (l > 0) lr.geometricError = osg::maximum(lr.geometricError, _results.back().geometricError);
+        _results.push_back(lr); levels.push_back(geode);
+        OSG_NOTICE << "[MeshLodBuilder] Level " << l << ": ratio = " << lr.ratio << ", faces = "
+                   << lr.numFaces << ", error = " << lr.geometricError << std::endl;
+    }
+
+    // Level k is correct enough while its projected error is less than the allowed pixels:
+    // error * pixelSize / radius <= screenSpaceError, so it switches to finer at that size
+    double radius = levels[0]->getBound().radius();
+    for (int l = 0; l < numLevels; ++l)
+    {
+        LevelResult& lr = _results[l];
+        if (l > 0 && lr.geometricError > 0.0)
+            lr.maxPixelSize = _screenSpaceError * radius / lr.geometricError;
+        if (l < numLevels - 1 && _results[l + 1].geometricError > 0.0)
+            lr.minPixelSize = _screenSpaceError * radius / _results[l + 1].geometricError;
+        else if (l < numLevels - 1)
+            lr.minPixelSize = FLT_MAX;  // next level is identical, never use this one
+        if (l == numLevels - 1) lr.minPixelSize = 0.0;
+    }
+    return true;
+}
+
+osg::LOD* MeshLodBuilder::build(MeshTopology* topology)
+{
+    std::vector<osg::ref_ptr<osg::Geode>> levels;
+    if (!buildLevels(topology, levels)) return NULL;
+
+    osg::ref_ptr<osg::LOD> lod = new osg::LOD;
+    lod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+        const LevelResult& lr = _results[i];
+        lod->addChild(levels[i].get(), lr.minPixelSize, lr.maxPixelSize);
+    }
+    return lod.release();
+}
+
+osg::PagedLOD* MeshLodBuilder::buildPaged(MeshTopology* topology, const std::string& dbPath,
+                                          const std::string& prefix)
+{
+    std::vector<osg::ref_ptr<osg::Geode>> levels;
+    if (!buildLevels(topology, levels)) return NULL;
+
+    // Coarsest level is the inline child 0, finer levels follow for paging
+    osg::BoundingSphere bs = levels[0]->getBound();
+    osg::ref_ptr<osg::PagedLOD> lod = new osg::PagedLOD;
+    lod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+    lod->setDatabasePath(dbPath); lod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+    lod->setCenter(bs.center()); lod->setRadius(bs.radius());
+
+    int last = (int)levels.size() - 1;
+    lod->addChild(levels[last].get(), _results[last].minPixelSize, _results[last].maxPixelSize);
+    for (int i = last - 1, c = 1; i >= 0; --i, ++c)
+    {
+        std::string fileName = prefix + "_L" + std::to_string(i) + ".osgb";
+        if (!osgDB::writeNodeFile(*levels[i], osgDB::concatPaths(dbPath, fileName)))
+        {
+            OSG_WARN << "[MeshLodBuilder] Failed to write level file "
+                     << osgDB::concatPaths(dbPath, fileName) << std::endl;
+        }
+        lod->setFileName(c, fileName);
+        lod->setRange(c, _results[i].minPixelSize, _results[i].maxPixelSize);
     }
+    return lod.release();
 }
@@ -3,8 +3,12 @@
 
 #include <osg/Geode>
 #include <osg/Geometry>
+#include <osg/PagedLOD>
 #include <map>
 #include <vector>
+#include <functional>
+#include <atomic>
+#include <mutex>
 #include <iostream>
 namespace pmp { class SurfaceMesh; }
 
@@ -19,9 +23,23 @@ namespace osgVerse
         enum QueryType { QVertices, QHalfEdges, QEdges, QFaces };
         MeshTopology();
 
+        /** Progress of simplify() and remesh() in [0, 1]; return false to cancel. In partition
+            mode it is called from worker threads, one at a time */
+        typedef std::function<bool (float)> ProgressCallback;
+        void setProgressCallback(ProgressCallback cb) { _progressCallback = cb; }
+
+        /** Split the mesh into patches of at most this number of faces in simplify() and remesh().
+            Patches are processed concurrently with their borders locked, and then stitched.
+            Default is 0, which processes the whole mesh in calling thread */
+        void setMaxPartitionFaces(unsigned int n) { _maxPartitionFaces = n; }
+        unsigned int getMaxPartitionFaces() const { return _maxPartitionFaces; }
+
         /** Generate mesh structure */
         pmp::SurfaceMesh* generate(MeshCollector* collector);
 
+        /** Get mesh structure created by generate() */
+        pmp::SurfaceMesh* getMesh() const { return _mesh; }
+
         /** Generate OSG scene geometry */
         osg::Geometry* output(int entity = -1);
         osg::Geode* outputByEntity();
@@ -29,9 +47,13 @@ namespace osgVerse
         /** Remove all deleted elements */
         void prune();
 
+        /** Mark adjacency caches as outdated. Call it after editing getMesh() directly */
+        void dirtyAdjacency() { _adjacencyDirty = true; }
+
         /** Topology getters */
         size_t getNumTopologyData(TopologyType t) const;
         std::vector<uint32_t> getTopologyData(TopologyType t) const;
+        void getTopologyData(TopologyType t, std::vector<uint32_t>& data) const;
 
         /** Connectivity queries
             - MVertex
@@ -53,6 +75,35 @@ namespace osgVerse
         std::vector<uint32_t> getConnectiveData(
             TopologyType t, uint32_t idx, QueryType q) const;
 
+        /** Connectivity query writing to a caller's buffer (cleared at first), for frequent use
+            like selecting. Return number of results */
+        size_t getConnectiveData(TopologyType t, uint32_t idx, QueryType q,
+                                 std::vector<uint32_t>& data) const;
+
+        /** Range of indices in adjacency caches, valid until next edit */
+        struct IndexRange
+        {
+            IndexRange() : first(NULL), last(NULL) {}
+            IndexRange(const uint32_t* f, const uint32_t* l) : first(f), last(l) {}
+            const uint32_t* begin() const { return first; }
+            const uint32_t* end() const { return last; }
+            size_t size() const { return last - first; }
+            bool empty() const { return first == last; }
+            const uint32_t *first, *last;
+        };
+
+        /** Cached adjacency in flat (CSR) arrays, built at first use after generating or editing
+            - MVertex: QVertices (one-ring vertices), QFaces (faces containing this vertex)
+            - MFace: QVertices (all vertices), QFaces (faces sharing an edge with this face)
+            Other combinations return empty ranges. Not thread-safe while rebuilding
+        */
+        IndexRange getAdjacency(TopologyType t, uint32_t idx, QueryType q) const;
+
+        /** Grow a face region from the seed through faces sharing an edge, while the filter
+            accepts them (or no filter). Region buffer is reused, return number of faces */
+        size_t growFaceRegion(uint32_t seed, std::vector<uint32_t>& region,
+                              std::function<bool (uint32_t)> filter = nullptr) const;
+
         bool isValid(TopologyType t, uint32_t idx) const;
         bool isBoundary(TopologyType t, uint32_t idx) const;
         bool isManifoldVertex(uint32_t idx) const;
@@ -65,9 +116,16 @@ namespace osgVerse
         /** Get all boundaries, each as a half-edge index list */
         std::vector<std::vector<uint32_t>> getHalfEdgeBoundaries() const;
 
-        /** Get all entities, each as a face index list */
+        /** Get all boundaries in flat arrays, boundary i is halfEdges[offsets[i], offsets[i+1]) */
+        size_t getHalfEdgeBoundaries(std::vector<uint32_t>& halfEdges,
+                                     std::vector<uint32_t>& offsets) const;
+
+        /** Get all entities (faces connected by vertices), each as a face index list */
         std::vector<std::vector<uint32_t>> getEntityFaces() const;
 
+        /** Get all entities in flat arrays: entity i is faces[offsets[i], offsets[i + 1]) */
+        size_t getEntityFaces(std::vector<uint32_t>& faces, std::vector<uint32_t>& offsets) const;
+
         /** Get vertex data of the given index list */
         std::vector<osg::Vec3> getVertexData(TopologyType t, const std::vector<uint32_t>& v);
 
@@ -78,19 +136,86 @@ namespace osgVerse
         void collapseHalfEdge(uint32_t idx);
         void deleteFace(uint32_t idx);
 
-        /** Algorithms */
+        /** Algorithms. Return false if failed or canceled, in which case the mesh is unchanged
+            in partition mode */
         bool simplify(float percentage, int aspectRatio = 10, int normalDeviation = 180);
         bool remesh(float uniformValue, bool adaptive);
 
     protected:
         virtual ~MeshTopology();
 
-        bool findConnectedEdges(
-            uint32_t he, std::vector<uint32_t>& subEdges, std::set<uint32_t>& usedEdges) const;
-        void addNeighborFaces(std::set<uint32_t>& faceSet, uint32_t f) const;
+        void buildAdjacency() const;
+        static uint32_t* nextVisitStamp(size_t numElements, uint32_t& stamp);
         void processGeometryFaces(osg::Geometry* geom, const std::vector<uint32_t>& faces);
+        bool processPartitions(std::function<void (pmp::SurfaceMesh&)> func);
 
+        ProgressCallback _progressCallback;
         pmp::SurfaceMesh* _mesh;
+        unsigned int _maxPartitionFaces;
+
+        mutable std::vector<uint32_t> _vertexVertexOffsets, _vertexVertices;
+        mutable std::vector<uint32_t> _vertexFaceOffsets, _vertexFaces;
+        mutable std::vector<uint32_t> _faceVertexOffsets, _faceVertices;
+        mutable std::vector<uint32_t> _faceFaceOffsets, _faceFaces;
+        mutable std::mutex _adjacencyMutex;
+        mutable std::atomic<bool> _adjacencyDirty;
+    };
+
+    /** Build a chain of simplified levels from a mesh topology. The mesh is split into entities
+        (and spatial partitions of large ones), which are decimated in parallel. Borders and
+        attribute seams are locked so that partitions still match each other after decimation */
+    class MeshLodBuilder : public osg::Referenced
+    {
+    public:
+        struct LevelResult
+        {
+            float ratio;             // requested vertex ratio to the original mesh
+            double geometricError;   // max deviation from the original surface
+            double minPixelSize, maxPixelSize;  // PIXEL_SIZE_ON_SCREEN range of the level
+            unsigned int numVertices, numFaces;
+        };
+
+        MeshLodBuilder();
+
+        /** Vertex ratios of each level, starting from finest. Default: 1, 0.5, 0.25, 0.1 */
+        void setLevelRatios(const std::vector<float>& r) { _ratios = r; }
+        const std::vector<float>& getLevelRatios() const { return _ratios; }
+
+        /** Large entities are split into partitions of at most this number of faces */
+        void setMaxPartitionFaces(unsigned int n) { _maxPartitionFaces = n; }
+        unsigned int getMaxPartitionFaces() const { return _maxPartitionFaces; }
+
+        /** Sharp edges above this angle (degrees) only collapse along themselves; 0 to disable */
+        void setFeatureAngle(float a) { _featureAngle = a; }
+        float getFeatureAngle() const { return _featureAngle; }
+
+        /** Keep border vertices (including seams of unwelded attributes) unchanged */
+        void setLockBorders(bool b) { _lockBorders = b; }
+        bool getLockBorders() const { return _lockBorders; }
+
+        /** Allowed screen-space error in pixels, used to compute level switching ranges */
+        void setScreenSpaceError(float pixels) { _screenSpaceError = pixels; }
+        float getScreenSpaceError() const { return _screenSpaceError; }
+
+        /** Build LOD node, each child is a level using PIXEL_SIZE_ON_SCREEN ranges */
+        osg::LOD* build(MeshTopology* topology);
+
+        /** Build PagedLOD node. The coarsest level is kept inline, and finer ones are
+            written to <dbPath>/<prefix>_L<n>.osgb for paging */
+        osg::PagedLOD* buildPaged(MeshTopology* topology, const std::string& dbPath,
+                                  const std::string& prefix);
+
+        /** Results of last build, starting from finest level */
+        const std::vector<LevelResult>& getLevelResults() const { return _results; }
+
+    protected:
+        bool buildLevels(MeshTopology* topology, std::vector<osg::ref_ptr<osg::Geode>>& levels);
+
+        std::vector<float> _ratios;
+        std::vector<LevelResult> _results;
+        unsigned int _maxPartitionFaces;
+        float _featureAngle, _screenSpaceError;
+        bool _lockBorders;
     };
 }
 
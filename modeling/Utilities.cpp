@@ -3,7 +3,12 @@
 #include <osg/Geometry>
 #include <osg/Geode>
 #include <osgUtil/SmoothingVisitor>
+#include <osgUtil/CullVisitor>
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
 #include <iostream>
+#include <mutex>
 
 #include <ApproxMVBB/ComputeApproxMVBB.hpp>
 #include "MeshTopology.h"
@@ -253,6 +258,252 @@ MeshTopology* MeshTopologyVisitor::generate()
     mesh->generate(this); return mesh.release();
 }
 
+class MeshletCullCallback : public osg::Drawable::CullCallback
+{
+public:
+    MeshletCullCallback(MeshletBuilder* b) : _builder(b) {}
+
+    virtual bool cull(osg::NodeVisitor* nv, osg::Drawable* drawable, osg::State*) const
+    {
+        osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>(nv);
+        osg::Geometry* geom = drawable->asGeometry();
+        if (!cv || !geom || !_builder || geom->getNumPrimitiveSets() == 0) return false;
+
+        const osg::BoundingBox& bb = geom->getBoundingBox();
+        osg::RefMatrix* matrix = cv->getModelViewMatrix();
+        if (geom->isCullingActive() && cv->isCulled(bb)) return true;
+        if (cv->getComputeNearFarMode() != osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR &&
+            bb.valid() && !cv->updateCalculatedNearFar(*matrix, *geom, false)) return true;
+
+        // Frustum and eye are both in local coordinates of the drawable
+        osg::Geometry* viewGeom = getViewGeometry(cv->getCurrentCamera(), geom);
+        osg::DrawElementsUInt* de = static_cast<osg::DrawElementsUInt*>(
+            viewGeom->getPrimitiveSet(0));
+        osg::Polytope frustum = cv->getCurrentCullingSet().getFrustum();
+        _builder->cull(frustum, cv->getEyeLocal(), de->asVector());
+        if (de->empty()) return true; else de->dirty();
+
+        // Draw the view geometry instead of the original one
+        osg::StateSet* stateset = geom->getStateSet();
+        if (stateset) cv->pushStateSet(stateset);
+        float depth = bb.valid() ? -(bb.center() * (*matrix)).z() : 0.0f;
+        cv->addDrawableAndDepth(viewGeom, matrix, depth);
+        if (stateset) cv->popStateSet();
+        return true;
+    }
+
+protected:
+    osg::Geometry* getViewGeometry(osg::Camera* camera, osg::Geometry* geom) const
+    {
+        // Every camera has its own copy of the geometry sharing vertex arrays, so that the
+        // index buffer culled by one view is never drawn by another one or changed while
+        // being drawn. Cameras may be culled in parallel, so lock the list here
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _views.size();)
+        {
+            if (!_views[i].first.valid()) { _views.erase(_views.begin() + i); continue; }
+            if (_views[i].first == camera) return _views[i].second.get(); else ++i;
+        }
+
+        osg::Geometry* viewGeom = new osg::Geometry(*geom, osg::CopyOp::SHALLOW_COPY);
+        viewGeom->setCullCallback(NULL);
+        viewGeom->setDataVariance(osg::Object::DYNAMIC);
+        viewGeom->setPrimitiveSet(0, new osg::DrawElementsUInt(GL_TRIANGLES));
+        _views.push_back(ViewGeometry(camera, viewGeom)); return viewGeom;
+    }
+
+    typedef std::pair<osg::observer_ptr<osg::Camera>, osg::ref_ptr<osg::Geometry>> ViewGeometry;
+    osg::ref_ptr<MeshletBuilder> _builder;
+    mutable std::vector<ViewGeometry> _views;
+    mutable std::mutex _mutex;
+};
+
+static unsigned int computeMortonCode(const osg::Vec3& v, const osg::BoundingBox& bb)
+{
+    unsigned int code = 0; unsigned int cell[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        float extent = bb._max[k] - bb._min[k];
+        float r = extent > 0.0f ? (v[k] - bb._min[k]) / extent : 0.0f;
+        cell[k] = (unsigned int)osg::clampBetween(r * 1023.0f, 0.0f, 1023.0f);
+    }
+    for (int b = 9; b >= 0; --b)
+    {
+        for (int k = 0; k < 3; ++k)
+            code = (code << 1) | ((cell[k] >> b) & 1);
+    }
+    return code;
+}
+
+void MeshletBuilder::build(unsigned int maxTriangles, unsigned int maxVertices)
+{
+    _meshlets.clear(); _meshletIndices.clear();
+    size_t numTriangles = _indices.size() / 3, numVertices = _vertices.size();
+    if (numTriangles == 0 || maxTriangles == 0 || maxVertices < 3) return;
+
+    // Vertex -> triangle table (compressed rows) for finding neighbors
+    std::vector<unsigned int> triOffsets(numVertices + 1, 0), triOfVertex(_indices.size());
+    for (size_t i = 0; i < _indices.size(); ++i) triOffsets[_indices[i] + 1]++;
+    for (size_t i = 0; i < numVertices; ++i) triOffsets[i + 1] += triOffsets[i];
+    {
+        std::vector<unsigned int> cursor(triOffsets.begin(), triOffsets.end() - 1);
+        for (size_t i = 0; i < _indices.size(); ++i) triOfVertex[cursor[_indices[i]]++] = i / 3;
+    }
+
+    // Sort triangles by Morton code of centroids, so new seeds are close to previous clusters
+    osg::BoundingBox bb; std::vector<osg::Vec3> centroids(numTriangles);
+    for (size_t i = 0; i < numVertices; ++i) bb.expandBy(_vertices[i]);
+    std::vector<std::pair<unsigned int, unsigned int>> seeds(numTriangles);
+    for (size_t i = 0; i < numTriangles; ++i)
+    {
+        const unsigned int* t = &_indices[i * 3];
+        centroids[i] = (_vertices[t[0]] + _vertices[t[1]] + _vertices[t[2]]) / 3.0f;
+        seeds[i] = std::pair<unsigned int, unsigned int>(computeMortonCode(centroids[i], bb), i);
+    }
+    std::sort(seeds.begin(), seeds.end());
+
+    std::vector<int> vertexTag(numVertices, -1), candidateTag(numTriangles, -1);
+    std::vector<bool> used(numTriangles, false);
+    std::vector<unsigned int> candidates, clusterVertices;
+    size_t seedIndex = 0;
+    while (true)
+    {
+        while (seedIndex < numTriangles && used[seeds[seedIndex].second]) seedIndex++;
+        if (seedIndex >= numTriangles) break;
+
+        int clusterID = (int)_meshlets.size();
+        Meshlet m; m.indexOffset = _meshletIndices.size(); m.numTriangles = 0;
+        osg::Vec3 centroidSum; candidates.clear(); clusterVertices.clear();
+        candidates.push_back(seeds[seedIndex].second);
+        candidateTag[seeds[seedIndex].second] = clusterID;
+
+        while (m.numTriangles < maxTriangles)
+        {
+            // Prefer triangles adding fewer new vertices, then closer to cluster center
+            osg::Vec3 center = m.numTriangles > 0 ? centroidSum / (float)m.numTriangles
+                             : centroids[candidates[0]];
+            int best = -1, bestNew = 4; float bestDist = FLT_MAX;
+            for (size_t c = 0; c < candidates.size();)
+            {
+                unsigned int tri = candidates[c];
+                if (used[tri])
+                { candidates[c] = candidates.back(); candidates.pop_back(); continue; }
+
+                const unsigned int* t = &_indices[tri * 3]; int newVertices = 0;
+                for (int k = 0; k < 3; ++k) if (vertexTag[t[k]] != clusterID) newVertices++;
+                if (clusterVertices.size() + newVertices <= maxVertices)
+                {
+                    float dist = (centroids[tri] - center).length2();
+                    if (newVertices < bestNew || (newVertices == bestNew && dist < bestDist))
+                    { best = (int)tri; bestNew = newVertices; bestDist = dist; }
+                }
+                c++;
+            }
+            if (best < 0) break;  // no more connected triangles, start a new cluster
+
+            const unsigned int* t = &_indices[best * 3]; used[best] = true;
+            for (int k = 0; k < 3; ++k)
+            {
+                _meshletIndices.push_back(t[k]);
+                if (vertexTag[t[k]] == clusterID) continue;
+                vertexTag[t[k]] = clusterID; clusterVertices.push_back(t[k]);
+
+                for (unsigned int n = triOffsets[t[k]]; n < triOffsets[t[k] + 1]; ++n)
+                {
+                    unsigned int tri = triOfVertex[n];
+                    if (used[tri] || candidateTag[tri] == clusterID) continue;
+                    candidateTag[tri] = clusterID; candidates.push_back(tri);
+                }
+            }
+            centroidSum += centroids[best]; m.numTriangles++;
+        }
+
+        // Bounding sphere and normal cone
+        osg::BoundingBox mbb; osg::Vec3 axis; std::vector<osg::Vec3> normals;
+        for (size_t i = 0; i < clusterVertices.size(); ++i)
+            mbb.expandBy(_vertices[clusterVertices[i]]);
+        m.bound.center() = mbb.center(); m.bound.radius() = 0.0f;
+        for (size_t i = 0; i < clusterVertices.size(); ++i)
+        {
+            float r = (_vertices[clusterVertices[i]] - mbb.center()).length();
+            if (r > m.bound.radius()) m.bound.radius() = r;
+        }
+
+        for (unsigned int i = 0; i < m.numTriangles; ++i)
+        {
+            const unsigned int* t = &_meshletIndices[m.indexOffset + i * 3];
+            osg::Vec3 N = (_vertices[t[1]] - _vertices[t[0]]) ^ (_vertices[t[2]] - _vertices[t[0]]);
+            if (N.normalize() > 0.0f) { normals.push_back(N); axis += N; }
+        }
+
+        float minDot = 1.0f; m.coneCutoff = 1.0f;
+        if (axis.normalize() > 1e-3f)
+        {
+            for (size_t i = 0; i < normals.size(); ++i)
+                minDot = osg::minimum(minDot, axis * normals[i]);
+            if (minDot > 0.1f) m.coneCutoff = sqrt(1.0f - minDot * minDot);
+        }
+        m.coneAxis = axis; _meshlets.push_back(m);
+    }
+}
+
+bool MeshletBuilder::isVisible(const Meshlet& m, osg::Polytope& frustum, const osg::Vec3& eye) const
+{
+    if (!frustum.contains(m.bound)) return false;
+    if (m.coneCutoff >= 1.0f) return true;
+
+    // All triangles are back-facing if the eye is inside the negative cone
+    osg::Vec3 dir = m.bound.center() - eye; float distance = dir.length();
+    return (dir * m.coneAxis) < m.coneCutoff * distance + m.bound.radius();
+}
+
+unsigned int MeshletBuilder::cull(osg::Polytope& frustum, const osg::Vec3& eye,
+                                  std::vector<unsigned int>& visibleIndices) const
+{
+    unsigned int numVisible = 0; visibleIndices.clear();
+    for (size_t i = 0; i < _meshlets.size(); ++i)
+    {
+        const Meshlet& m = _meshlets[i];
+        if (!isVisible(m, frustum, eye)) continue;
+
+        std::vector<unsigned int>::const_iterator itr = _meshletIndices.begin() + m.indexOffset;
+        visibleIndices.insert(visibleIndices.end(), itr, itr + m.numTriangles * 3);
+        numVisible++;
+    }
+    return numVisible;
+}
+
+osg::Geometry* MeshletBuilder::createGeometry(bool clusterCulling)
+{
+    if (_meshlets.empty()) build();
+    osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array(_vertices.begin(), _vertices.end());
+    osg::ref_ptr<osg::Vec3Array> na; osg::ref_ptr<osg::Vec2Array> ta;
+
+    std::vector<osg::Vec4>& normals = _attributes[NormalAttr];
+    std::vector<osg::Vec4>& uvs = _attributes[UvAttr];
+    if (normals.size() == _vertices.size())
+    {
+        na = new osg::Vec3Array(normals.size());
+        for (size_t i = 0; i < normals.size(); ++i)
+            (*na)[i] = osg::Vec3(normals[i][0], normals[i][1], normals[i][2]);
+    }
+    if (uvs.size() == _vertices.size())
+    {
+        ta = new osg::Vec2Array(uvs.size());
+        for (size_t i = 0; i < uvs.size(); ++i) (*ta)[i] = osg::Vec2(uvs[i][0], uvs[i][1]);
+    }
+
+    osg::ref_ptr<osg::DrawElementsUInt> de = new osg::DrawElementsUInt(
+        GL_TRIANGLES, _meshletIndices.begin(), _meshletIndices.end());
+    osg::Geometry* geom = osgVerse::createGeometry(va.get(), na.get(), ta.get(), de.get(), !na);
+    if (clusterCulling)
+    {
+        // Views draw their own copies with culled index buffers
+        geom->setCullCallback(new MeshletCullCallback(this));
+    }
+    return geom;
+}
+
 namespace osgVerse
 {
 
@@ -767,5 +1018,18 @@ namespace osgVerse
     osg::Geometry* createBoundingSphereGeometry(const osg::BoundingSphere& bs)
     { return createEllipsoid(bs.center(), bs.radius(), bs.radius(), bs.radius()); }
 
+    uint64_t hashBytes(const void* data, size_t size, uint64_t hash)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; ++i) { hash ^= bytes[i]; hash *= 1099511628211ull; }
+        return hash;
+    }
+
+    std::string hashToString(uint64_t hash)
+    {
+        char key[17]; snprintf(key, 17, "%016llx", (unsigned long long)hash);
+        return std::string(key);
+    }
+
 }
 
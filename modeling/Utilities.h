@@ -4,6 +4,7 @@
 #include <osg/Transform>
 #include <osg/Geometry>
 #include <osg/Camera>
+#include <osg/Polytope>
 
 namespace osgVerse
 {
@@ -90,6 +91,46 @@ namespace osgVerse
         osg::ref_ptr<osg::StateSet> _stateset;
     };
 
+    /** Split collected triangles into GPU-friendly clusters (meshlets). Each cluster has a bounding
+        sphere and a normal cone, so that invisible / back-facing clusters can be culled on CPU */
+    class MeshletBuilder : public MeshCollector
+    {
+    public:
+        MeshletBuilder() : MeshCollector() {}
+
+        struct Meshlet
+        {
+            osg::BoundingSphere bound;
+            osg::Vec3 coneAxis;        // average normal of all triangles
+            float coneCutoff;          // sine of cone angle, >= 1 means no back-face culling
+            unsigned int indexOffset;  // start position in getMeshletIndices()
+            unsigned int numTriangles;
+        };
+
+        /** Build clusters from collected triangles. Triangles are grown from spatially sorted
+            seeds and prefer sharing vertices with current cluster */
+        void build(unsigned int maxTriangles = 128, unsigned int maxVertices = 256);
+
+        const std::vector<Meshlet>& getMeshlets() const { return _meshlets; }
+        const std::vector<unsigned int>& getMeshletIndices() const { return _meshletIndices; }
+
+        /** Check if the cluster intersects with the frustum and is not back-facing to the eye */
+        bool isVisible(const Meshlet& m, osg::Polytope& frustum, const osg::Vec3& eye) const;
+
+        /** Merge indices of all visible clusters, returning the number of visible clusters */
+        unsigned int cull(osg::Polytope& frustum, const osg::Vec3& eye,
+                          std::vector<unsigned int>& visibleIndices) const;
+
+        /** Create geometry of collected vertices. If clusterCulling is set, every camera draws
+            a copy of it sharing vertex arrays, whose index buffer is rebuilt in cull traversal
+            to contain clusters visible to that camera only */
+        osg::Geometry* createGeometry(bool clusterCulling = true);
+
+    protected:
+        std::vector<Meshlet> _meshlets;
+        std::vector<unsigned int> _meshletIndices;
+    };
+
     /** Create a geometry with specified arrays */
     extern osg::Geometry* createGeometry(osg::Vec3Array* va, osg::Vec3Array* na, osg::Vec2Array* ta,
                                          osg::PrimitiveSet* p, bool autoNormals = true, bool useVBO = true);
@@ -128,6 +169,13 @@ namespace osgVerse
     /** Create a bounding volume geometry */
     extern osg::Geometry* createBoundingBoxGeometry(const osg::BoundingBox& bb);
     extern osg::Geometry* createBoundingSphereGeometry(const osg::BoundingSphere& bs);
+
+    /** FNV-1a hash of a memory block, continuing from 'hash' to combine multiple blocks */
+    extern uint64_t hashBytes(const void* data, size_t size,
+                              uint64_t hash = 14695981039346656037ull);
+
+    /** Get a hash value as 16 hex digits, e.g., to name cache files */
+    extern std::string hashToString(uint64_t hash);
 }
 
 #endif
@@ -1148,6 +1148,13 @@ namespace osgVerse
         ss << "#define VERSE_GLES3 1" << std::endl;
 #else
         if (glslVer > 0) ss << "#version " << glslVer << std::endl;
+        if (glslVer < 140 && s->getType() == osg::Shader::VERTEX &&
+            source.find("gl_InstanceID") != std::string::npos)
+        {
+            // Extensions must precede functions in extraDefs, so they can't be in the source
+            ss << "#extension GL_ARB_draw_instanced : enable" << std::endl;
+            ss << "#define gl_InstanceID gl_InstanceIDARB" << std::endl;
+        }
 #endif
         ss << "//! osgVerse generated shader: " << glslVer << std::endl;
 
@@ -1,4 +1,5 @@
 #include <osg/ImageUtils>
+#include <osg/buffered_value>
 #include <osg/FrameBufferObject>
 #include <osg/RenderInfo>
 #include <osg/GLExtensions>
@@ -15,7 +16,11 @@
 #include <codecvt>
 #include <iostream>
 #include <array>
+#include <atomic>
 #include <random>
+#include <chrono>
+#include <climits>
+#include <sys/stat.h>
 
 #define STB_RECT_PACK_IMPLEMENTATION
 #include <stb/stb_rect_pack.h>
@@ -26,6 +31,7 @@
 #ifdef VERSE_WINDOWS
     #include <windows.h>
 #endif
+#include <modeling/Utilities.h>
 #include "Pipeline.h"
 #include "Utilities.h"
 static int g_argumentCount = 0;
@@ -93,10 +99,10 @@ static std::default_random_engine generator;
 struct MikkTSpaceHelper
 {
     std::vector<Vec3ui> _faceList;
-    osg::Vec4Array *tangents;
+    osg::ref_ptr<osg::Vec4Array> tangents;
     osg::Geometry* _geometry;
 
-    bool initialize(SMikkTSpaceContext* sc, osg::Geometry* g)
+    bool initialize(SMikkTSpaceContext* sc, osg::Geometry* g, bool attach = true)
     {
         sc->m_pInterface->m_getNumFaces = MikkTSpaceHelper::mikk_getNumFaces;
         sc->m_pInterface->m_getNumVerticesOfFace = MikkTSpaceHelper::mikk_getNumVerticesOfFace;
@@ -112,7 +118,9 @@ struct MikkTSpaceHelper
         if (va->size() != na->size() || va->size() != ta->size()) return false;
 
         tangents = new osg::Vec4Array(va->size());
-        g->setVertexAttribArray(6, tangents); g->setVertexAttribBinding(6, osg::Geometry::BIND_PER_VERTEX);
+        if (!attach) return true;  // computed in background, will be swapped in later
+        g->setVertexAttribArray(6, tangents.get());
+        g->setVertexAttribBinding(6, osg::Geometry::BIND_PER_VERTEX);
         return true;
     }
 
@@ -166,6 +174,94 @@ struct MikkTSpaceHelper
     }
 };
 
+static bool requiresTangentSpace(const osg::Geometry& geom)
+{
+    if (geom.getNormalArray() == NULL) return false;
+    if (geom.getNormalBinding() != osg::Geometry::BIND_PER_VERTEX) return false;
+
+    // Existing tangents are kept only if they cover all vertices
+    const osg::Array* tangents = geom.getVertexAttribArray(6);
+    const osg::Array* vertices = geom.getVertexArray();
+    if (tangents != NULL && vertices != NULL &&
+        geom.getVertexAttribBinding(6) == osg::Geometry::BIND_PER_VERTEX &&
+        tangents->getNumElements() >= vertices->getNumElements()) return false;
+    return true;  // not set yet
+}
+
+static bool isIndexedTriangleList(const osg::Geometry& geom)
+{
+    if (geom.getNumPrimitiveSets() == 0) return false;
+    for (unsigned int i = 0; i < geom.getNumPrimitiveSets(); ++i)
+    {
+        const osg::DrawElements* de = geom.getPrimitiveSet(i)->getDrawElements();
+        if (!de || de->getMode() != GL_TRIANGLES) return false;
+    }
+    return true;
+}
+
+static osg::Vec4Array* computeIndexedTangentSpace(osg::Geometry* geom)
+{
+    // Accumulate per-triangle UV directions on shared vertices, then orthogonalize them. As
+    // MikkTSpaceHelper also writes results back to shared vertices, the two are comparable
+    osg::Vec3Array* va = dynamic_cast<osg::Vec3Array*>(geom->getVertexArray());
+    osg::Vec3Array* na = dynamic_cast<osg::Vec3Array*>(geom->getNormalArray());
+    osg::Vec2Array* ta = dynamic_cast<osg::Vec2Array*>(geom->getTexCoordArray(0));
+    if (!va || !na || !ta) return NULL;
+    if (va->size() != na->size() || va->size() != ta->size()) return NULL;
+
+    size_t numVertices = va->size();
+    std::vector<osg::Vec3> sDirs(numVertices), tDirs(numVertices);
+    for (unsigned int p = 0; p < geom->getNumPrimitiveSets(); ++p)
+    {
+        const osg::DrawElements* de = geom->getPrimitiveSet(p)->getDrawElements();
+        for (unsigned int j = 0; j + 2 < de->getNumIndices(); j += 3)
+        {
+            unsigned int i0 = de->index(j), i1 = de->index(j + 1), i2 = de->index(j + 2);
+            if (i0 >= numVertices || i1 >= numVertices || i2 >= numVertices) continue;
+
+            osg::Vec3 e1 = (*va)[i1] - (*va)[i0], e2 = (*va)[i2] - (*va)[i0];
+            osg::Vec2 d1 = (*ta)[i1] - (*ta)[i0], d2 = (*ta)[i2] - (*ta)[i0];
+            float r = d1.x() * d2.y() - d2.x() * d1.y();
+            if (fabs(r) < 1e-12f) continue; else r = 1.0f / r;
+
+            osg::Vec3 sDir = (e1 * d2.y() - e2 * d1.y()) * r;
+            osg::Vec3 tDir = (e2 * d1.x() - e1 * d2.x()) * r;
+            sDirs[i0] += sDir; sDirs[i1] += sDir; sDirs[i2] += sDir;
+            tDirs[i0] += tDir; tDirs[i1] += tDir; tDirs[i2] += tDir;
+        }
+    }
+
+    osg::ref_ptr<osg::Vec4Array> tangents = new osg::Vec4Array(numVertices);
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        const osg::Vec3& N = (*na)[i]; osg::Vec3 T = sDirs[i] - N * (N * sDirs[i]);
+        if (T.normalize() < 1e-6f)
+        { T = N ^ (fabs(N.x()) < 0.9f ? osg::X_AXIS : osg::Y_AXIS); T.normalize(); }
+        (*tangents)[i] = osg::Vec4(T, ((N ^ T) * tDirs[i] < 0.0f) ? -1.0f : 1.0f);
+    }
+    return tangents.release();
+}
+
+static osg::Vec4Array* computeTangentSpace(osg::Geometry* geom, float angularThreshold,
+                                           bool indexedFastPath = false)
+{
+    if (indexedFastPath && angularThreshold >= 180.0f && isIndexedTriangleList(*geom))
+    {
+        osg::Vec4Array* tangents = computeIndexedTangentSpace(geom);
+        if (tangents != NULL) return tangents;  // otherwise fall back to MikkTSpace
+    }
+
+    // Every call owns its context, so that it can run on worker threads
+    SMikkTSpaceInterface mikkInterface; SMikkTSpaceContext mikkContext;
+    mikkContext.m_pInterface = &mikkInterface; mikkContext.m_pUserData = NULL;
+
+    osg::TriangleIndexFunctor<MikkTSpaceHelper> functor;
+    geom->accept(functor);
+    if (!functor.initialize(&mikkContext, geom, false)) return NULL;
+    if (!genTangSpace(&mikkContext, angularThreshold)) return NULL;
+    return functor.tangents.release();
+}
+
 namespace osgVerse
 {
     osg::Texture* generateNoises2D(int numRows, int numCols)
@@ -456,25 +552,412 @@ namespace osgVerse
         return false;
     }
 
-    TangentSpaceVisitor::TangentSpaceVisitor(const float threshold)
-    :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _angularThreshold(threshold)
+    struct TextureAtlas::Page : public osg::Referenced
     {
-        _mikkiTSpace = new SMikkTSpaceContext;
-        _mikkiTSpace->m_pInterface = new SMikkTSpaceInterface;
-        _mikkiTSpace->m_pUserData = NULL;
+        struct Rect { int x, y, w, h; };
+        struct PendingRegions
+        {
+            std::vector<Rect> rects; bool full;
+            PendingRegions() : full(false) {}
+        };
+
+        class SubloadCallback : public osg::Texture2D::SubloadCallback
+        {
+        public:
+            SubloadCallback(Page* p) : _page(p) {}
+
+            virtual void load(const osg::Texture2D& texture, osg::State& state) const
+            {
+                osg::ref_ptr<Page> page; if (!_page.lock(page)) return;
+                std::unique_lock<std::mutex> lock(page->mutex);
+                osg::Image* img = page->image.get();
+                glPixelStorei(GL_UNPACK_ALIGNMENT, img->getPacking());
+                glTexImage2D(GL_TEXTURE_2D, 0, img->getInternalTextureFormat(), img->s(), img->t(),
+                             0, img->getPixelFormat(), img->getDataType(), img->data());
+
+                PendingRegions& pending = page->pending[state.getContextID()];
+                pending.rects.clear(); pending.full = false;
+            }
+
+            virtual void subload(const osg::Texture2D& texture, osg::State& state) const
+            {
+                osg::ref_ptr<Page> page; if (!_page.lock(page)) return;
+                std::unique_lock<std::mutex> lock(page->mutex);
+                PendingRegions& pending = page->pending[state.getContextID()];
+                if (!pending.full && pending.rects.empty()) return;
+
+                osg::Image* img = page->image.get();
+                GLenum format = img->getPixelFormat(), type = img->getDataType();
+                glPixelStorei(GL_UNPACK_ALIGNMENT, img->getPacking());
+                if (pending.full)
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, img->s(), img->t(), format, type,
+                                    img->data());
+                else
+                {
+#if !defined(OSG_GLES1_AVAILABLE) && !defined(OSG_GLES2_AVAILABLE)
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, img->s());
+                    for (size_t i = 0; i < pending.rects.size(); ++i)
+                    {
+                        const Rect& r = pending.rects[i];
+                        glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.w, r.h, format, type,
+                                        img->data(r.x, r.y));
+                    }
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#else
+                    // No unpack row length: upload full-width row bands instead
+                    for (size_t i = 0; i < pending.rects.size(); ++i)
+                    {
+                        const Rect& r = pending.rects[i];
+                        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, r.y, img->s(), r.h, format, type,
+                                        img->data(0, r.y));
+                    }
+#endif
+                }
+                pending.rects.clear(); pending.full = false;
+            }
+
+        protected:
+            osg::observer_ptr<Page> _page;
+        };
+
+        Page(int w, int h, GLenum pixelFormat, GLenum dataType)
+        :   width(w), height(h), lastUsed(0), freedArea(0)
+        {
+            image = new osg::Image;
+            image->allocateImage(w, h, 1, pixelFormat, dataType);
+            memset(image->data(), 0, image->getTotalSizeInBytes());
+
+            texture = new osg::Texture2D;
+            texture->setTextureSize(w, h);
+            texture->setInternalFormat(image->getInternalTextureFormat());
+            texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+            texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+            texture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+            texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+            texture->setSubloadCallback(new SubloadCallback(this)); reset();
+        }
+
+        void reset()
+        {
+            Rect full = { 0, 0, width, height };
+            freeRects.assign(1, full); used.clear(); freedArea = 0;
+        }
+
+        void markDirty(const Rect& r)
+        {
+            // Too many small regions are merged into a full upload
+            std::unique_lock<std::mutex> lock(mutex);
+            for (unsigned int i = 0; i < pending.size(); ++i)
+            {
+                PendingRegions& p = pending[i]; if (p.full) continue;
+                if (p.rects.size() < 64) p.rects.push_back(r);
+                else { p.rects.clear(); p.full = true; }
+            }
+        }
+
+        /** Find a free rectangle with best short side fit (MaxRects) */
+        bool findPosition(int w, int h, Rect& result) const
+        {
+            int bestShortSide = INT_MAX, bestLongSide = INT_MAX;
+            for (size_t i = 0; i < freeRects.size(); ++i)
+            {
+                const Rect& f = freeRects[i]; if (f.w < w || f.h < h) continue;
+                int dw = f.w - w, dh = f.h - h;
+                int shortSide = osg::minimum(dw, dh), longSide = osg::maximum(dw, dh);
+                if (shortSide < bestShortSide ||
+                    (shortSide == bestShortSide && longSide < bestLongSide))
+                {
+                    result.x = f.x; result.y = f.y; result.w = w; result.h = h;
+                    bestShortSide = shortSide; bestLongSide = longSide;
+                }
+            }
+            return bestShortSide != INT_MAX;
+        }
+
+        void place(size_t id, const Rect& r)
+        { used[id] = r; splitFreeRects(r); }
+
+        void release(size_t id)
+        {
+            std::map<size_t, Rect>::iterator itr = used.find(id);
+            if (itr == used.end()) return;
+
+            // Freed area is only merged with neighbors of the same edge here, so the free list
+            // may not be maximal any more; it will be rebuilt if later insertion fails
+            Rect r = itr->second; used.erase(itr); freedArea += r.w * r.h;
+            if (used.empty()) { reset(); return; }
+
+            bool merged = true;
+            while (merged)
+            {
+                merged = false;
+                for (size_t i = 0; i < freeRects.size(); ++i)
+                {
+                    Rect& f = freeRects[i];
+                    if (f.x == r.x && f.w == r.w && (f.y + f.h == r.y || r.y + r.h == f.y))
+                    { r.y = osg::minimum(f.y, r.y); r.h += f.h; merged = true; }
+                    else if (f.y == r.y && f.h == r.h && (f.x + f.w == r.x || r.x + r.w == f.x))
+                    { r.x = osg::minimum(f.x, r.x); r.w += f.w; merged = true; }
+                    if (merged) { freeRects.erase(freeRects.begin() + i); break; }
+                }
+            }
+            addFreeRect(r);
+        }
+
+        void rebuild()
+        {
+            Rect full = { 0, 0, width, height }; freeRects.assign(1, full);
+            for (std::map<size_t, Rect>::iterator itr = used.begin(); itr != used.end(); ++itr)
+                splitFreeRects(itr->second);
+            freedArea = 0;
+        }
+
+        void splitFreeRects(const Rect& u)
+        {
+            std::vector<Rect> result, pieces;
+            for (size_t i = 0; i < freeRects.size(); ++i)
+            {
+                const Rect& f = freeRects[i];
+                if (u.x >= f.x + f.w || u.x + u.w <= f.x || u.y >= f.y + f.h || u.y + u.h <= f.y)
+                { result.push_back(f); continue; }
+
+                if (u.x > f.x)
+                { Rect r = { f.x, f.y, u.x - f.x, f.h }; pieces.push_back(r); }
+                if (u.x + u.w < f.x + f.w)
+                { Rect r = { u.x + u.w, f.y, f.x + f.w - u.x - u.w, f.h }; pieces.push_back(r); }
+                if (u.y > f.y)
+                { Rect r = { f.x, f.y, f.w, u.y - f.y }; pieces.push_back(r); }
+                if (u.y + u.h < f.y + f.h)
+                { Rect r = { f.x, u.y + u.h, f.w, f.y + f.h - u.y - u.h }; pieces.push_back(r); }
+            }
+
+            // Untouched rectangles were maximal before, so only new pieces may be redundant
+            size_t numUntouched = result.size();
+            for (size_t i = 0; i < pieces.size(); ++i)
+            {
+                bool redundant = false;
+                for (size_t j = 0; j < numUntouched && !redundant; ++j)
+                    redundant = contains(result[j], pieces[i]);
+                for (size_t j = 0; j < pieces.size() && !redundant; ++j)
+                {
+                    if (i == j || !contains(pieces[j], pieces[i])) continue;
+                    redundant = !contains(pieces[i], pieces[j]) || j < i;  // keep one duplicate
+                }
+                if (!redundant) result.push_back(pieces[i]);
+            }
+            freeRects.swap(result);
+        }
+
+        void addFreeRect(const Rect& r)
+        {
+            for (size_t i = 0; i < freeRects.size(); ++i)
+            { if (contains(freeRects[i], r)) return; }
+
+            std::vector<Rect> result(1, r);
+            for (size_t i = 0; i < freeRects.size(); ++i)
+            { if (!contains(r, freeRects[i])) result.push_back(freeRects[i]); }
+            freeRects.swap(result);
+        }
+
+        static bool contains(const Rect& a, const Rect& b)
+        {
+            return b.x >= a.x && b.y >= a.y &&
+                   b.x + b.w <= a.x + a.w && b.y + b.h <= a.y + a.h;
+        }
+
+        osg::ref_ptr<osg::Image> image;
+        osg::ref_ptr<osg::Texture2D> texture;
+        osg::buffered_object<PendingRegions> pending;
+        std::vector<Rect> freeRects;
+        std::map<size_t, Rect> used;
+        std::mutex mutex;
+        int width, height;
+        size_t lastUsed;
+        int freedArea;
+    };
+
+    TextureAtlas::TextureAtlas(int pageW, int pageH, int maxPages, GLenum pixelFormat,
+                               GLenum dataType)
+    :   _pixelFormat(pixelFormat), _dataType(dataType), _dictIndex(0), _useStamp(0),
+        _pageWidth(pageW), _pageHeight(pageH), _maxPages(maxPages), _padding(1) {}
+
+    TextureAtlas::~TextureAtlas()
+    {}
+
+    void TextureAtlas::clear()
+    {
+        for (size_t i = 0; i < _pages.size(); ++i) _pages[i]->reset();
+        _elements.clear();
     }
 
-    TangentSpaceVisitor::~TangentSpaceVisitor()
+    size_t TextureAtlas::addElement(osg::Image* image)
     {
-        if (_mikkiTSpace != NULL)
+        if (!image || !image->valid()) return 0;
+        if (image->getPixelFormat() != _pixelFormat || image->getDataType() != _dataType)
         {
-            if (_mikkiTSpace->m_pInterface) delete _mikkiTSpace->m_pInterface;
-            delete _mikkiTSpace; _mikkiTSpace = NULL;
+            OSG_NOTICE << "[TextureAtlas] Pixel format mismatched with atlas pages: "
+                       << image->getFileName() << std::endl; return 0;
         }
+        else if (image->s() > _pageWidth || image->t() > _pageHeight)
+        {
+            OSG_NOTICE << "[TextureAtlas] Image too large for atlas pages: "
+                       << image->getFileName() << std::endl; return 0;
+        }
+
+        // Reserve a gutter of padding pixels on each side, which is filled with edge pixels
+        Page::Rect rect; int pageIndex = -1, numPages = (int)_pages.size();
+        int w = osg::minimum(image->s() + _padding * 2, _pageWidth);
+        int h = osg::minimum(image->t() + _padding * 2, _pageHeight);
+        int offsetX = osg::minimum(_padding, _pageWidth - image->s());
+        int offsetY = osg::minimum(_padding, _pageHeight - image->t());
+        for (int i = 0; i < numPages && pageIndex < 0; ++i)
+        { if (_pages[i]->findPosition(w, h, rect)) pageIndex = i; }
+
+        for (int i = 0; i < numPages && pageIndex < 0; ++i)
+        {
+            Page* page = _pages[i].get(); if (page->freedArea < w * h) continue;
+            page->rebuild(); if (page->findPosition(w, h, rect)) pageIndex = i;
+        }
+
+        if (pageIndex < 0 && numPages < _maxPages)
+        {
+            _pages.push_back(new Page(_pageWidth, _pageHeight, _pixelFormat, _dataType));
+            if (_pages.back()->findPosition(w, h, rect)) pageIndex = numPages;
+        }
+        else if (pageIndex < 0)
+        {
+            int evicted = findPageToEvict(); if (evicted < 0) return 0;
+            evictPage(evicted);
+            if (_pages[evicted]->findPosition(w, h, rect)) pageIndex = evicted;
+        }
+        if (pageIndex < 0) return 0;
+
+        Page* page = _pages[pageIndex].get(); size_t id = ++_dictIndex;
+        page->place(id, rect); page->lastUsed = ++_useStamp;
+        _elements[id] = Element(pageIndex, osg::Vec4(rect.x + offsetX, rect.y + offsetY,
+                                                     image->s(), image->t()));
+        updateElement(id, image); return id;
+    }
+
+    bool TextureAtlas::updateElement(size_t id, osg::Image* image)
+    {
+        std::map<size_t, Element>::iterator itr = _elements.find(id);
+        if (itr == _elements.end() || !image || !image->valid()) return false;
+
+        const osg::Vec4& v = itr->second.second;
+        Page::Rect r = { (int)v[0], (int)v[1], (int)v[2], (int)v[3] };
+        if (image->s() != r.w || image->t() != r.h || image->getPixelFormat() != _pixelFormat ||
+            image->getDataType() != _dataType) return false;
+
+        Page* page = _pages[itr->second.first].get();
+        std::map<size_t, Page::Rect>::iterator itr2 = page->used.find(id);
+        if (itr2 == page->used.end()) return false;
+
+        // Extend edge pixels into the gutter, so that linear filtering and mipmapping
+        // never sample stale pixels of evicted or neighboring elements
+        const Page::Rect& g = itr2->second;
+        unsigned int pixelSize = osg::Image::computePixelSizeInBits(_pixelFormat, _dataType) / 8;
+        unsigned int rowSize = image->s() * pixelSize;
+        {
+            std::unique_lock<std::mutex> lock(page->mutex);
+            for (int row = g.y; row < g.y + g.h; ++row)
+            {
+                int srcRow = osg::clampBetween(row - r.y, 0, r.h - 1);
+                unsigned char* dst = page->image->data(0, row);
+                memcpy(dst + r.x * pixelSize, image->data(0, srcRow), rowSize);
+                for (int x = g.x; x < r.x; ++x)
+                    memcpy(dst + x * pixelSize, dst + r.x * pixelSize, pixelSize);
+                for (int x = r.x + r.w; x < g.x + g.w; ++x)
+                    memcpy(dst + x * pixelSize, dst + (r.x + r.w - 1) * pixelSize, pixelSize);
+            }
+        }
+        page->markDirty(g); page->lastUsed = ++_useStamp; return true;
+    }
+
+    void TextureAtlas::removeElement(size_t id)
+    {
+        std::map<size_t, Element>::iterator itr = _elements.find(id);
+        if (itr == _elements.end()) return;
+        _pages[itr->second.first]->release(id); _elements.erase(itr);
+    }
+
+    void TextureAtlas::touchElement(size_t id)
+    {
+        std::map<size_t, Element>::iterator itr = _elements.find(id);
+        if (itr != _elements.end()) _pages[itr->second.first]->lastUsed = ++_useStamp;
+    }
+
+    void TextureAtlas::evictPage(int pageIndex)
+    {
+        if (pageIndex < 0 || pageIndex >= (int)_pages.size()) return;
+        Page* page = _pages[pageIndex].get(); std::vector<size_t> evicted;
+        for (std::map<size_t, Page::Rect>::iterator itr = page->used.begin();
+             itr != page->used.end(); ++itr)
+        { _elements.erase(itr->first); evicted.push_back(itr->first); }
+
+        page->reset();
+        if (_evictionCallback)
+        { for (size_t i = 0; i < evicted.size(); ++i) _evictionCallback(evicted[i]); }
+    }
+
+    int TextureAtlas::findPageToEvict() const
+    {
+        int result = -1; size_t oldest = 0;
+        for (size_t i = 0; i < _pages.size(); ++i)
+        {
+            if (result < 0 || _pages[i]->lastUsed < oldest)
+            { result = (int)i; oldest = _pages[i]->lastUsed; }
+        }
+        return result;
+    }
+
+    bool TextureAtlas::getPackingData(size_t id, int& page, int& x, int& y, int& w, int& h) const
+    {
+        std::map<size_t, Element>::const_iterator itr = _elements.find(id);
+        if (itr == _elements.end()) return false;
+
+        const osg::Vec4& v = itr->second.second; page = itr->second.first;
+        x = v[0]; y = v[1]; w = v[2]; h = v[3]; return true;
+    }
+
+    osg::Vec4 TextureAtlas::getTexCoordRange(size_t id) const
+    {
+        std::map<size_t, Element>::const_iterator itr = _elements.find(id);
+        if (itr == _elements.end()) return osg::Vec4();
+
+        const osg::Vec4& v = itr->second.second;
+        float invW = 1.0f / (float)_pageWidth, invH = 1.0f / (float)_pageHeight;
+        return osg::Vec4(v[0] * invW, v[1] * invH, (v[0] + v[2]) * invW, (v[1] + v[3]) * invH);
+    }
+
+    osg::Texture2D* TextureAtlas::getTexture(int page)
+    {
+        if (page < 0 || page >= (int)_pages.size()) return NULL;
+        return _pages[page]->texture.get();
+    }
+
+    osg::Image* TextureAtlas::getImage(int page)
+    {
+        if (page < 0 || page >= (int)_pages.size()) return NULL;
+        return _pages[page]->image.get();
+    }
+
+    TangentSpaceVisitor::TangentSpaceVisitor(const float threshold)
+    :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _angularThreshold(threshold),
+        _depth(0), _indexedFastPath(false) {}
+
+    TangentSpaceVisitor::~TangentSpaceVisitor()
+    {}
+
+    void TangentSpaceVisitor::apply(osg::Node& node)
+    {
+        _depth++; traverse(node);
+        if (--_depth == 0) generate();
     }
 
     void TangentSpaceVisitor::apply(osg::Geode& node)
     {
+        _depth++;
 #if OSG_VERSION_LESS_OR_EQUAL(3, 4, 1)
         for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
         {
@@ -483,47 +966,301 @@ namespace osgVerse
         }
 #endif
         traverse(node);
+        if (--_depth == 0) generate();
     }
 
     void TangentSpaceVisitor::apply(osg::Geometry& geom)
     {
+        _depth++;
+        if (requiresTangentSpace(geom) && _collected.find(&geom) == _collected.end())
+        { _geometries.push_back(&geom); _collected.insert(&geom); }
 #if OSG_VERSION_GREATER_THAN(3, 4, 1)
-        if (geom.getNormalArray() == NULL) { traverse(geom); return; }
-        if (geom.getNormalBinding() != osg::Geometry::BIND_PER_VERTEX) { traverse(geom); return; }
+        traverse(geom);
+#endif
+        if (--_depth == 0) generate();
+    }
 
-        if (geom.getVertexAttribArray(6) != NULL &&
-            geom.getVertexAttribBinding(6) == osg::Geometry::BIND_PER_VERTEX)
-        { traverse(geom); return; }  // already set
-#else
-        if (geom.getNormalArray() == NULL) return;
-        if (geom.getNormalBinding() != osg::Geometry::BIND_PER_VERTEX) return;
+    void TangentSpaceVisitor::generate()
+    {
+        int numGeometries = (int)_geometries.size();
+        std::vector<osg::ref_ptr<osg::Vec4Array>> results(numGeometries);
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < numGeometries; ++i)
+        {
+            results[i] = computeTangentSpace(
+                _geometries[i].get(), _angularThreshold, _indexedFastPath);
+        }
+
+        for (int i = 0; i < numGeometries; ++i)
+        {
+            if (!results[i]) continue; osg::Geometry* geom = _geometries[i].get();
+            geom->setVertexAttribArray(6, results[i].get());
+            geom->setVertexAttribBinding(6, osg::Geometry::BIND_PER_VERTEX);
+        }
+        _geometries.clear(); _collected.clear();
+    }
+
+    class TangentSpaceCollector : public osg::NodeVisitor
+    {
+    public:
+        TangentSpaceCollector(const std::set<osg::Geometry*>& s)
+        :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _scheduled(s) {}
+        std::vector<osg::ref_ptr<osg::Geometry>> geometries;
 
-        if (geom.getVertexAttribArray(6) != NULL &&
-            geom.getVertexAttribBinding(6) == osg::Geometry::BIND_PER_VERTEX) return;
+        virtual void apply(osg::Geode& node)
+        {
+#if OSG_VERSION_LESS_OR_EQUAL(3, 4, 1)
+            for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
+            {
+                osg::Geometry* geom = node.getDrawable(i)->asGeometry();
+                if (geom) apply(*geom);
+            }
 #endif
+            traverse(node);
+        }
 
-        osg::TriangleIndexFunctor<MikkTSpaceHelper> functor;
-        geom.accept(functor);
-        if (functor.initialize(_mikkiTSpace, &geom))
-            genTangSpace(_mikkiTSpace, _angularThreshold);
+        virtual void apply(osg::Geometry& geom)
+        {
+            if (requiresTangentSpace(geom) && _visited.find(&geom) == _visited.end() &&
+                _scheduled.find(&geom) == _scheduled.end())
+            { geometries.push_back(&geom); _visited.insert(&geom); }
 #if OSG_VERSION_GREATER_THAN(3, 4, 1)
-        traverse(geom);
+            traverse(geom);
 #endif
+        }
+
+    protected:
+        const std::set<osg::Geometry*>& _scheduled;
+        std::set<osg::Geometry*> _visited;
+    };
+
+    struct TangentSpaceGenerator::Task : public osg::Referenced
+    {
+        std::vector<osg::ref_ptr<osg::Geometry>> geometries;
+        std::vector<osg::ref_ptr<osg::Vec4Array>> tangents;
+        std::atomic<int> remaining; std::string cacheFile;
+
+        std::string computeCacheKey() const
+        {
+            // Modified time of the model file, and arrays which tangents are computed from
+            uint64_t hash = hashBytes(NULL, 0); const std::string suffix = ".tangents.osgb";
+            if (cacheFile.size() > suffix.size() &&
+                cacheFile.compare(cacheFile.size() - suffix.size(), suffix.size(), suffix) == 0)
+            {
+                struct stat info; std::string modelFile =
+                    cacheFile.substr(0, cacheFile.size() - suffix.size());
+                if (stat(modelFile.c_str(), &info) == 0)
+                {
+                    int64_t mtime = (int64_t)info.st_mtime;
+                    hash = hashBytes(&mtime, sizeof(mtime), hash);
+                }
+            }
+
+            for (size_t i = 0; i < geometries.size(); ++i)
+            {
+                const osg::Geometry* geom = geometries[i].get();
+                const osg::Array* arrays[3] = { geom->getVertexArray(), geom->getNormalArray(),
+                                                geom->getTexCoordArray(0) };
+                for (int a = 0; a < 3; ++a)
+                {
+                    unsigned int size = arrays[a] ? arrays[a]->getTotalDataSize() : 0;
+                    hash = hashBytes(&size, sizeof(size), hash);
+                    if (size > 0) hash = hashBytes(arrays[a]->getDataPointer(), size, hash);
+                }
+            }
+            return hashToString(hash);
+        }
+
+        bool loadCache()
+        {
+            osg::ref_ptr<osg::Node> holder = osgDB::readNodeFile(cacheFile);
+            osg::UserDataContainer* udc = holder.valid() ? holder->getUserDataContainer() : NULL;
+            int numGeometries = 0; std::string cacheKey; if (!udc) return false;
+            if (!holder->getUserValue("NumGeometries", numGeometries) ||
+                numGeometries != (int)geometries.size()) return false;
+            if (!holder->getUserValue("CacheKey", cacheKey) || cacheKey != computeCacheKey())
+                return false;
+
+            for (unsigned int i = 0; i < udc->getNumUserObjects(); ++i)
+            {
+                osg::Vec4Array* va = dynamic_cast<osg::Vec4Array*>(udc->getUserObject(i));
+                if (!va) continue; int index = atoi(va->getName().c_str());
+                if (index < 0 || index >= numGeometries) return false;
+
+                osg::Array* vertices = geometries[index]->getVertexArray();
+                if (!vertices || vertices->getNumElements() != va->size()) return false;
+                tangents[index] = va; va->setName("");
+            }
+            return true;
+        }
+
+        void saveCache()
+        {
+            osg::ref_ptr<osg::Node> holder = new osg::Node;
+            holder->setUserValue("NumGeometries", (int)geometries.size());
+            holder->setUserValue("CacheKey", computeCacheKey());
+            for (size_t i = 0; i < tangents.size(); ++i)
+            {
+                if (!tangents[i]) continue;
+                osg::ref_ptr<osg::Vec4Array> va = new osg::Vec4Array(*tangents[i]);
+                va->setName(std::to_string(i));
+                holder->getUserDataContainer()->addUserObject(va.get());
+            }
+            if (!osgDB::writeNodeFile(*holder, cacheFile))
+                OSG_NOTICE << "[TangentSpaceGenerator] Failed to save " << cacheFile << std::endl;
+        }
+    };
+
+    TangentSpaceGenerator* TangentSpaceGenerator::instance()
+    {
+        static osg::ref_ptr<TangentSpaceGenerator> s_instance = new TangentSpaceGenerator;
+        return s_instance.get();
+    }
+
+    TangentSpaceGenerator::TangentSpaceGenerator(const float threshold, int numThreads)
+    :   _angularThreshold(threshold), _numThreads(numThreads), _numPending(0), _done(false)
+    {
+        if (_numThreads <= 0)
+            _numThreads = osg::maximum((int)std::thread::hardware_concurrency() - 1, 1);
+    }
+
+    TangentSpaceGenerator::~TangentSpaceGenerator()
+    {
+        { std::unique_lock<std::mutex> lock(_mutex); _done = true; }
+        _jobCondition.notify_all();
+        if (_thread.joinable()) _thread.join();
+    }
+
+    std::string TangentSpaceGenerator::getCacheFileName(const std::string& modelFile)
+    {
+        if (modelFile.empty() || osgDB::containsServerAddress(modelFile)) return "";
+        if (!osgDB::fileExists(modelFile)) return "";  // pseudo-loaders, etc.
+        return modelFile + ".tangents.osgb";
+    }
+
+    void TangentSpaceGenerator::add(osg::Node* node, const std::string& cacheFile)
+    {
+        if (!node) return;
+        std::unique_lock<std::mutex> lock(_mutex);
+        TangentSpaceCollector collector(_scheduled); node->accept(collector);
+        if (collector.geometries.empty()) return;
+
+        osg::ref_ptr<Task> task = new Task;
+        task->geometries.swap(collector.geometries);
+        task->tangents.resize(task->geometries.size());
+        task->remaining = (int)task->geometries.size(); task->cacheFile = cacheFile;
+        for (size_t i = 0; i < task->geometries.size(); ++i)
+            _scheduled.insert(task->geometries[i].get());
+        _numPending += (int)task->geometries.size();
+
+        if (!cacheFile.empty() && osgDB::fileExists(cacheFile))
+            _jobs.push_back(Job(task, -1));
+        else
+        {
+            for (size_t i = 0; i < task->geometries.size(); ++i)
+                _jobs.push_back(Job(task, (int)i));
+        }
+        if (!_thread.joinable()) _thread = std::thread(&TangentSpaceGenerator::runThread, this);
+        _jobCondition.notify_all();
+    }
+
+    void TangentSpaceGenerator::applyResults()
+    {
+        std::vector<Result> results;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_results.empty()) return; results.swap(_results);
+            for (size_t i = 0; i < results.size(); ++i)
+                _scheduled.erase(results[i].first.get());
+            _numPending -= (int)results.size();
+        }
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            osg::Geometry* geom = results[i].first.get();
+            if (!results[i].second || !requiresTangentSpace(*geom)) continue;
+            geom->setVertexAttribArray(6, results[i].second.get());
+            geom->setVertexAttribBinding(6, osg::Geometry::BIND_PER_VERTEX);
+        }
+    }
+
+    void TangentSpaceGenerator::flush()
+    {
+        applyResults();
+        while (getNumPendingGeometries() > 0)
+        { std::this_thread::sleep_for(std::chrono::milliseconds(1)); applyResults(); }
+    }
+
+    unsigned int TangentSpaceGenerator::getNumPendingGeometries() const
+    { std::unique_lock<std::mutex> lock(_mutex); return _numPending; }
+
+    void TangentSpaceGenerator::runThread()
+    {
+        while (true)
+        {
+            std::vector<Job> jobs, computeJobs;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _jobCondition.wait(lock, [this]() { return _done || !_jobs.empty(); });
+                if (_done) break; jobs.assign(_jobs.begin(), _jobs.end()); _jobs.clear();
+            }
+
+            for (size_t j = 0; j < jobs.size(); ++j)
+            {
+                Task* task = jobs[j].first.get();
+                if (jobs[j].second >= 0) { computeJobs.push_back(jobs[j]); continue; }
+
+                // Read from cache file; fallback to compute each geometry if failed
+                if (task->loadCache())
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    for (size_t i = 0; i < task->geometries.size(); ++i)
+                        _results.push_back(Result(task->geometries[i], task->tangents[i]));
+                    continue;
+                }
+
+                OSG_NOTICE << "[TangentSpaceGenerator] Outdated cache " << task->cacheFile
+                           << ", regenerating..." << std::endl;
+                for (size_t i = 0; i < task->geometries.size(); ++i)
+                    computeJobs.push_back(Job(task, (int)i));
+            }
+
+            int numJobs = (int)computeJobs.size(), numThreads = _numThreads;
+#pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+            for (int j = 0; j < numJobs; ++j)
+            {
+                Task* task = computeJobs[j].first.get(); int index = computeJobs[j].second;
+                osg::Geometry* geom = task->geometries[index].get();
+                osg::ref_ptr<osg::Vec4Array> tangents =
+                    computeTangentSpace(geom, _angularThreshold);
+                task->tangents[index] = tangents;  // every job writes its own slot
+
+                // Save before returning the last result, so that flush() also waits for it
+                if ((--task->remaining) == 0 && !task->cacheFile.empty()) task->saveCache();
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _results.push_back(Result(geom, tangents));
+                }
+            }
+        }
     }
 
     NormalMapGenerator::NormalMapGenerator(double nStrength, double spScale, double spContrast, bool nInvert)
     :   osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
         _nStrength(nStrength), _spScale(spScale), _spContrast(spContrast),
-        _normalMapUnit(1), _specMapUnit(2), _nInvert(nInvert) {}
+        _normalMapUnit(1), _specMapUnit(2), _depth(0), _nInvert(nInvert) {}
 
     void NormalMapGenerator::apply(osg::Node& node)
     {
+        _depth++;
         if (node.getStateSet()) apply(*node.getStateSet());
         traverse(node);
+        if (--_depth == 0) generate();
     }
 
     void NormalMapGenerator::apply(osg::Geode& node)
     {
+        _depth++;
 #if OSG_VERSION_LESS_OR_EQUAL(3, 4, 1)
         for (unsigned int i = 0; i < node.getNumDrawables(); ++i)
         {
@@ -533,21 +1270,24 @@ namespace osgVerse
 #endif
         if (node.getStateSet()) apply(*node.getStateSet());
         traverse(node);
+        if (--_depth == 0) generate();
     }
 
     void NormalMapGenerator::apply(osg::Drawable& drawable)
     {
+        _depth++;
         if (drawable.getStateSet()) apply(*drawable.getStateSet());
 #if OSG_VERSION_GREATER_THAN(3, 4, 1)
         traverse(drawable);
 #endif
+        if (--_depth == 0) generate();
     }
 
     void NormalMapGenerator::apply(osg::StateSet& ss)
     {
         osg::Texture2D* tex2D = dynamic_cast<osg::Texture2D*>(
             ss.getTextureAttribute(0, osg::StateAttribute::TEXTURE));
-        if (!tex2D) return;
+        if (!tex2D || _collected.find(&ss) != _collected.end()) return;
 
         osg::Image* image = tex2D->getImage();
         if (!image || (image && !image->valid())) return;
@@ -557,51 +1297,98 @@ namespace osgVerse
             OSG_NOTICE << "[NormalMapGenerator] Only support Vec3ub/Vec4ub pixels, mismatched with "
                        << image->getFileName() << std::endl; return;
         }
+        _stateSets.push_back(StateSetJob(&ss, image));
+        _collected.insert(&ss);
+    }
 
-        double invPixel = 1.0 / 255.0;
-        std::string fileName = osgDB::getSimpleFileName(image->getFileName());
-        if (_normalMapUnit > 0)
+    std::string NormalMapGenerator::getCacheKey(osg::Image* image) const
+    {
+        // Hash of pixels, dimensions, generator parameters and cache format
+        const int cacheFormat = 2;  // 2: uncompressed KTX2 (1: BasisU ETC1S)
+        int dims[5] = { image->s(), image->t(), (int)image->getPixelFormat(), _nInvert ? 1 : 0,
+                        cacheFormat };
+        double params[3] = { _nStrength, _spScale, _spContrast };
+        uint64_t hash = hashBytes(dims, sizeof(dims));
+        hash = hashBytes(params, sizeof(params), hash);
+        hash = hashBytes(image->data(), image->getTotalSizeInBytes(), hash);
+        return hashToString(hash);
+    }
+
+    void NormalMapGenerator::generate()
+    {
+        // Images shared by statesets are computed only once
+        std::map<osg::Image*, int> imageIndices;
+        std::vector<osg::ref_ptr<osg::Image>> images;
+        for (size_t i = 0; i < _stateSets.size(); ++i)
+        {
+            osg::Image* image = _stateSets[i].second.get();
+            if (imageIndices.find(image) != imageIndices.end()) continue;
+            imageIndices[image] = (int)images.size(); images.push_back(image);
+        }
+
+        // Cached maps are saved as uncompressed KTX2 files, so warm loads need neither generation
+        // nor PNG decoding, and are identical to cold loads (lossy BasisU would blur normals)
+        int numImages = (int)images.size(); double invPixel = 1.0 / 255.0;
+        std::vector<osg::ref_ptr<osg::Image>> nMaps(numImages), spMaps(numImages);
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < numImages; ++i)
         {
-            osg::ref_ptr<osg::Image> nMap;
-            std::string normFile = _cacheFolder + "/" + fileName + ".norm.png";
-            if (!_cacheFolder.empty())
+            osg::Image* image = images[i].get(); std::string prefix;
+            if (!_cacheFolder.empty()) prefix = _cacheFolder + "/" + getCacheKey(image);
+            if (_normalMapUnit > 0)
             {
-                if (osgDB::fileExists(normFile))
-                    nMap = osgDB::readImageFile(normFile);
+                std::string normFile = prefix + ".norm.ktx";
+                if (!prefix.empty() && osgDB::fileExists(normFile))
+                    nMaps[i] = osgDB::readImageFile(normFile + ".verse_ktx");
+
+                if (!nMaps[i])
+                {
+                    NormalmapGenerator ng(IntensityMap::AVERAGE, invPixel, invPixel, invPixel, invPixel);
+                    nMaps[i] = ng.calculateNormalmap(
+                        image, NormalmapGenerator::PREWITT, _nStrength, _nInvert);
+                    if (!prefix.empty() && nMaps[i].valid())
+                        osgDB::writeImageFile(*nMaps[i], normFile + ".verse_ktx");
+                }
             }
 
-            if (!nMap)
+            if (_specMapUnit > 0)
             {
-                NormalmapGenerator ng(IntensityMap::AVERAGE, invPixel, invPixel, invPixel, invPixel);
-                nMap = ng.calculateNormalmap(image, NormalmapGenerator::PREWITT, _nStrength, _nInvert);
-                if (!_cacheFolder.empty()) osgDB::writeImageFile(*nMap, normFile);
+                std::string specFile = prefix + ".spec.ktx";
+                if (!prefix.empty() && osgDB::fileExists(specFile))
+                    spMaps[i] = osgDB::readImageFile(specFile + ".verse_ktx");
+
+                if (!spMaps[i])
+                {
+                    SpecularmapGenerator spg(IntensityMap::AVERAGE, invPixel, invPixel, invPixel, invPixel);
+                    spMaps[i] = spg.calculateSpecmap(image, _spScale, _spContrast);
+                    if (!prefix.empty() && spMaps[i].valid())
+                        osgDB::writeImageFile(*spMaps[i], specFile + ".verse_ktx");
+                }
             }
-
-            if (nMap.valid() && nMap->valid())
-                ss.setTextureAttributeAndModes(_normalMapUnit, createTexture2D(nMap.get()));
         }
 
-        if (_specMapUnit > 0)
+        // Textures are shared between statesets using the same image
+        std::vector<osg::ref_ptr<osg::Texture2D>> nTextures(numImages), spTextures(numImages);
+        for (int i = 0; i < numImages; ++i)
         {
-            osg::ref_ptr<osg::Image> spMap;
-            std::string specFile = _cacheFolder + "/" + fileName + ".spec.png";
-            if (!_cacheFolder.empty())
-            {
-                if (osgDB::fileExists(specFile))
-                    spMap = osgDB::readImageFile(specFile);
-            }
+            osg::Image *nMap = nMaps[i].get(), *spMap = spMaps[i].get();
+            if (nMap && nMap->valid()) nTextures[i] = createTexture2D(nMap);
+            if (spMap && spMap->valid()) spTextures[i] = createTexture2D(spMap);
 
-            if (!spMap)
-            {
-                SpecularmapGenerator spg(IntensityMap::AVERAGE, invPixel, invPixel, invPixel, invPixel);
-                spMap = spg.calculateSpecmap(image, _spScale, _spContrast);
-                if (!_cacheFolder.empty()) osgDB::writeImageFile(*spMap, specFile);
-            }
+            std::string fileName = osgDB::getSimpleFileName(images[i]->getFileName());
+            OSG_NOTICE << "Normal-map generation for " << fileName << " finished" << std::endl;
+        }
 
-            if (spMap.valid() && spMap->valid())
-                ss.setTextureAttributeAndModes(_specMapUnit, createTexture2D(spMap.get()));
+        for (size_t i = 0; i < _stateSets.size(); ++i)
+        {
+            osg::StateSet* ss = _stateSets[i].first.get();
+            int index = imageIndices[_stateSets[i].second.get()];
+            if (nTextures[index].valid())
+                ss->setTextureAttributeAndModes(_normalMapUnit, nTextures[index].get());
+            if (spTextures[index].valid())
+                ss->setTextureAttributeAndModes(_specMapUnit, spTextures[index].get());
         }
-        OSG_NOTICE << "Normal-map generation for " << fileName << " finished" << std::endl;
+        _stateSets.clear(); _collected.clear();
     }
 
     void Frustum::create(const osg::Matrix& modelview, const osg::Matrix& originProj,
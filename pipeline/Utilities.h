@@ -11,7 +11,11 @@
 #include <osgGA/GUIEventHandler>
 #include "Global.h"
 #include <functional>
-struct SMikkTSpaceContext;
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <set>
 
 namespace osgVerse
 {
@@ -64,21 +68,140 @@ namespace osgVerse
         int _maxWidth, _maxHeight, _dictIndex;
     };
 
-    /** The tangent/binormal computing visitor */
+    /** The dynamic 2D texture atlas. Different from TexturePacker, elements can be added and
+        removed at any time: free rectangles of each page are kept between calls, and only changed
+        regions are uploaded with glTexSubImage2D. If all pages are full, the least recently used
+        page is evicted, and the eviction callback is notified with every element removed */
+    class TextureAtlas : public osg::Referenced
+    {
+    public:
+        typedef std::function<void (size_t)> EvictionCallback;
+        TextureAtlas(int pageW, int pageH, int maxPages = 4,
+                     GLenum pixelFormat = GL_RGBA, GLenum dataType = GL_UNSIGNED_BYTE);
+        void clear();
+
+        /** Set gutter width around each element, filled with its edge pixels to avoid bleeding */
+        void setPadding(int p) { _padding = p; }
+        int getPadding() const { return _padding; }
+
+        void setEvictionCallback(EvictionCallback cb) { _evictionCallback = cb; }
+        EvictionCallback getEvictionCallback() const { return _evictionCallback; }
+
+        /** Add image to one of the pages, returning 0 if too large or no page can be evicted */
+        size_t addElement(osg::Image* image);
+
+        /** Replace pixels of an element with image of the same size */
+        bool updateElement(size_t id, osg::Image* image);
+        void removeElement(size_t id);
+
+        /** Mark the element as recently used, so that its page is not evicted soon */
+        void touchElement(size_t id);
+        void evictPage(int page);
+
+        /** Get page index and pixel rectangle of the element */
+        bool getPackingData(size_t id, int& page, int& x, int& y, int& w, int& h) const;
+
+        /** Get texture coordinate range (u0, v0, u1, v1) of the element */
+        osg::Vec4 getTexCoordRange(size_t id) const;
+
+        osg::Texture2D* getTexture(int page);
+        osg::Image* getImage(int page);
+        int getNumPages() const { return (int)_pages.size(); }
+        int getNumElements() const { return (int)_elements.size(); }
+
+    protected:
+        virtual ~TextureAtlas();
+        struct Page;
+        typedef std::pair<int, osg::Vec4> Element;
+        int findPageToEvict() const;
+
+        std::vector<osg::ref_ptr<Page>> _pages;
+        std::map<size_t, Element> _elements;
+        EvictionCallback _evictionCallback;
+        GLenum _pixelFormat, _dataType;
+        size_t _dictIndex, _useStamp;
+        int _pageWidth, _pageHeight, _maxPages, _padding;
+    };
+
+    /** The tangent/binormal computing visitor. Geometries are collected while traversing, and
+        computed in parallel when the traversal from the applied node ends. Geometries which
+        already have valid tangent arrays are skipped */
     class TangentSpaceVisitor : public osg::NodeVisitor
     {
     public:
         TangentSpaceVisitor(const float angularThreshold = 180.0f);
         virtual ~TangentSpaceVisitor();
+        virtual void apply(osg::Node& node);
         virtual void apply(osg::Geode& node);
         virtual void apply(osg::Geometry& geometry);
 
+        /** Compute indexed triangle lists directly on shared vertices instead of MikkTSpace,
+            which welds vertices again internally. Only used if angular threshold >= 180.
+            Disabled by default, as results may not match normal maps baked with MikkTSpace */
+        void setIndexedFastPath(bool b) { _indexedFastPath = b; }
+        bool getIndexedFastPath() const { return _indexedFastPath; }
+
+        /** Compute all collected geometries. Called automatically at the end of traversal */
+        void generate();
+
     protected:
-        SMikkTSpaceContext* _mikkiTSpace;
+        std::vector<osg::ref_ptr<osg::Geometry>> _geometries;
+        std::set<osg::Geometry*> _collected;
         float _angularThreshold;
+        int _depth;
+        bool _indexedFastPath;
     };
 
-    /** The normal-map & specular-map generator */
+    /** The background tangent/binormal generator. Scheduled geometries are computed by one
+        worker thread in OpenMP parallel loops (using at most 'numThreads' threads), and results
+        are swapped in at frame boundary (update traversal) */
+    class TangentSpaceGenerator : public osg::NodeCallback
+    {
+    public:
+        static TangentSpaceGenerator* instance();
+        TangentSpaceGenerator(const float angularThreshold = 180.0f, int numThreads = 0);
+
+        /** Get side file for caching tangents of the model file, or empty if not applicable */
+        static std::string getCacheFileName(const std::string& modelFile);
+
+        /** Schedule all geometries of the node. If cache file is set, read tangents from it
+            at first, and save newly generated ones to it for next time. The cache is rejected
+            if modified time of the model file, or vertices, normals or texture coordinates
+            of any geometry changed since it was saved */
+        void add(osg::Node* node, const std::string& cacheFile = "");
+
+        /** Apply finished tangent arrays to geometries. Call it at frame boundary only */
+        void applyResults();
+
+        /** Wait until all scheduled works (including saving caches) done and apply them */
+        void flush();
+
+        unsigned int getNumPendingGeometries() const;
+        virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
+        { applyResults(); traverse(node, nv); }
+
+    protected:
+        virtual ~TangentSpaceGenerator();
+        struct Task;
+        typedef std::pair<osg::ref_ptr<Task>, int> Job;
+        typedef std::pair<osg::ref_ptr<osg::Geometry>, osg::ref_ptr<osg::Vec4Array>> Result;
+        void runThread();
+
+        std::deque<Job> _jobs;
+        std::vector<Result> _results;
+        std::set<osg::Geometry*> _scheduled;
+        std::thread _thread;
+        std::condition_variable _jobCondition;
+        mutable std::mutex _mutex;
+        float _angularThreshold;
+        int _numThreads, _numPending;
+        bool _done;
+    };
+
+    /** The normal-map & specular-map generator. Statesets are collected while traversing, and
+        their maps are computed in parallel when the traversal from the applied node ends.
+        Cached maps are keyed by image content and generator parameters, and saved as
+        uncompressed KTX files */
     class NormalMapGenerator : public osg::NodeVisitor
     {
     public:
@@ -92,10 +215,18 @@ namespace osgVerse
         virtual void apply(osg::Drawable& geometry);
         void apply(osg::StateSet& ss);
 
+        /** Compute all collected statesets. Called automatically at the end of traversal */
+        void generate();
+
     protected:
+        std::string getCacheKey(osg::Image* image) const;
+        typedef std::pair<osg::ref_ptr<osg::StateSet>, osg::ref_ptr<osg::Image>> StateSetJob;
+        std::vector<StateSetJob> _stateSets;
+        std::set<osg::StateSet*> _collected;
+
         std::string _cacheFolder;
         double _nStrength, _spScale, _spContrast;
-        int _normalMapUnit, _specMapUnit;
+        int _normalMapUnit, _specMapUnit, _depth;
         bool _nInvert;
     };
 
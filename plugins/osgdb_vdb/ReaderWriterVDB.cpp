@@ -2,6 +2,8 @@
 #include <osg/Image>
 #include <osg/Geometry>
 #include <osg/Geode>
+#include <osg/MatrixTransform>
+#include <osg/Texture3D>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/Registry>
@@ -9,6 +11,157 @@
 #include <pipeline/Global.h>
 #include <openvdb/openvdb.h>
 #include <openvdb/io/Stream.h>
+#include <openvdb/tree/LeafManager.h>
+#include <algorithm>
+#include <cmath>
+
+/* Brick-pool volume: every VDB leaf node (8^3 voxels) becomes a brick in a 3D atlas texture,
+   and an indirection texture (one texel per leaf cell) stores the brick coordinate in the
+   atlas. Texels with zero alpha are empty and can be skipped by the raymarcher entirely.
+   Each brick is stored with a 1-voxel apron so that trilinear filtering stays seamless.
+   Uniforms set on the returned node:
+   - BrickAtlas (unit 0), BrickIndirection (unit 1): the two 3D textures
+   - BrickAtlasCount: number of bricks along each atlas axis
+   - BrickIndirectionSize: number of leaf cells along each axis
+   - BrickParameters: (voxels per brick side, voxels per brick side with apron, apron)
+*/
+namespace BrickVolume
+{
+    static const int APRON = 1;
+
+    template<typename GridType, typename Func>
+    osg::Node* create(typename GridType::ConstPtr grid, Func toFloat)
+    {
+        typedef typename GridType::TreeType TreeType;
+        typedef typename TreeType::LeafNodeType LeafType;
+        const int dim = (int)LeafType::DIM, size = dim + 2 * APRON;
+
+        openvdb::tree::LeafManager<const TreeType> leafManager(grid->tree());
+        size_t numBricks = leafManager.leafCount();
+        if (numBricks == 0) return NULL;
+
+        // Compute leaf-cell range, which decides size of the indirection texture
+        openvdb::Coord minCell = leafManager.leaf(0).origin() >> LeafType::TOTAL, maxCell = minCell;
+        for (size_t i = 1; i < numBricks; ++i)
+        {
+            openvdb::Coord cell = leafManager.leaf(i).origin() >> LeafType::TOTAL;
+            minCell.minComponent(cell); maxCell.maxComponent(cell);
+        }
+        openvdb::Coord numCells = maxCell - minCell + openvdb::Coord(1);
+
+        // Atlas layout: as cubic as possible to keep each dimension under texture size limits
+        int bx = (int)std::ceil(std::cbrt((double)numBricks)), by = bx;
+        int bz = (int)((numBricks + bx * by - 1) / (bx * by));
+        if (bx > 255 || bz > 255)
+        {
+            OSG_WARN << "[ReaderWriterVDB] Too many bricks (" << numBricks
+                     << ") to be addressed by indirection texture" << std::endl;
+            return NULL;
+        }
+
+        osg::ref_ptr<osg::Image> atlas = new osg::Image;
+        atlas->allocateImage(bx * size, by * size, bz * size, GL_RED, GL_FLOAT);
+        atlas->setInternalTextureFormat(GL_R32F);
+        memset(atlas->data(), 0, atlas->getTotalSizeInBytes());
+
+        osg::ref_ptr<osg::Image> indirection = new osg::Image;
+        indirection->allocateImage(numCells.x(), numCells.y(), numCells.z(),
+                                   GL_RGBA, GL_UNSIGNED_BYTE);
+        indirection->setInternalTextureFormat(GL_RGBA8);
+        memset(indirection->data(), 0, indirection->getTotalSizeInBytes());
+
+        // Fill bricks in parallel: each leaf writes to its own brick and indirection texel
+        leafManager.foreach([&](const LeafType& leaf, size_t index)
+        {
+            typename GridType::ConstAccessor accessor = grid->getConstAccessor();
+            int ix = (int)(index % bx), iy = (int)((index / bx) % by), iz = (int)(index / (bx * by));
+            const openvdb::Coord origin = leaf.origin();
+            for (int z = -APRON; z < dim + APRON; ++z)
+                for (int y = -APRON; y < dim + APRON; ++y)
+                {
+                    float* dst = (float*)atlas->data(ix * size, iy * size + y + APRON,
+                                                     iz * size + z + APRON);
+                    for (int x = -APRON; x < dim + APRON; ++x)
+                    {
+                        openvdb::Coord c = origin.offsetBy(x, y, z);
+                        bool inside = (x >= 0 && y >= 0 && z >= 0 && x < dim && y < dim && z < dim);
+                        dst[x + APRON] = toFloat(inside ? leaf.getValue(c) : accessor.getValue(c));
+                    }
+                }
+
+            openvdb::Coord cell = (origin >> LeafType::TOTAL) - minCell;
+            unsigned char* ptr = indirection->data(cell.x(), cell.y(), cell.z());
+            ptr[0] = ix; ptr[1] = iy; ptr[2] = iz; ptr[3] = 255;
+        });
+
+        osg::ref_ptr<osg::Texture3D> atlasTex = new osg::Texture3D;
+        atlasTex->setImage(atlas.get());
+        atlasTex->setResizeNonPowerOfTwoHint(false);
+        atlasTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+        atlasTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+        atlasTex->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+        atlasTex->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+        atlasTex->setWrap(osg::Texture::WRAP_R, osg::Texture::CLAMP_TO_EDGE);
+
+        osg::ref_ptr<osg::Texture3D> indirectionTex = new osg::Texture3D;
+        indirectionTex->setImage(indirection.get());
+        indirectionTex->setResizeNonPowerOfTwoHint(false);
+        indirectionTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+        indirectionTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+        indirectionTex->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+        indirectionTex->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+        indirectionTex->setWrap(osg::Texture::WRAP_R, osg::Texture::CLAMP_TO_EDGE);
+
+        // Unit cube as proxy geometry, transformed to the index-space bound of all leaves
+        osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array(8);
+        for (int i = 0; i < 8; ++i)
+            (*va)[i] = osg::Vec3((i & 1) ? 1.0f : 0.0f, (i & 2) ? 1.0f : 0.0f, (i & 4) ? 1.0f : 0.0f);
+
+        osg::ref_ptr<osg::DrawElementsUByte> de = new osg::DrawElementsUByte(GL_TRIANGLES);
+        const unsigned char faces[36] = { 0, 2, 3, 0, 3, 1,  4, 5, 7, 4, 7, 6,  0, 1, 5, 0, 5, 4,
+                                          2, 6, 7, 2, 7, 3,  0, 4, 6, 0, 6, 2,  1, 3, 7, 1, 7, 5 };
+        de->insert(de->end(), faces, faces + 36);
+
+        osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+        geom->setUseDisplayList(false);
+        geom->setUseVertexBufferObjects(true);
+        geom->setVertexArray(va.get());
+        geom->setTexCoordArray(0, va.get());
+        geom->addPrimitiveSet(de.get());
+
+        osg::StateSet* ss = geom->getOrCreateStateSet();
+        ss->setTextureAttribute(0, atlasTex.get());
+        ss->setTextureAttribute(1, indirectionTex.get());
+        ss->addUniform(new osg::Uniform("BrickAtlas", (int)0));
+        ss->addUniform(new osg::Uniform("BrickIndirection", (int)1));
+        ss->addUniform(new osg::Uniform("BrickAtlasCount", osg::Vec3((float)bx, (float)by, (float)bz)));
+        ss->addUniform(new osg::Uniform("BrickIndirectionSize", osg::Vec3(
+            (float)numCells.x(), (float)numCells.y(), (float)numCells.z())));
+        ss->addUniform(new osg::Uniform("BrickParameters", osg::Vec3(
+            (float)dim, (float)size, (float)APRON)));
+
+        osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+        geode->addDrawable(geom.get());
+
+        openvdb::Coord minVoxel = minCell << LeafType::TOTAL, extent = numCells << LeafType::TOTAL;
+        osg::Matrix matrix = osg::Matrix::scale(extent.x(), extent.y(), extent.z())
+                           * osg::Matrix::translate(minVoxel.x(), minVoxel.y(), minVoxel.z());
+        if (grid->transform().isLinear())
+        {
+            openvdb::math::Mat4d m = grid->transform().baseMap()->getAffineMap()->getMat4();
+            matrix = matrix * osg::Matrix(m.asPointer());
+        }
+
+        osg::MatrixTransform* mt = new osg::MatrixTransform;
+        mt->setName(grid->getName());
+        mt->setMatrix(matrix);
+        mt->addChild(geode.get());
+        OSG_NOTICE << "[ReaderWriterVDB] Brick volume " << grid->getName() << ": " << numBricks
+                   << " bricks, atlas " << atlas->s() << "x" << atlas->t() << "x" << atlas->r()
+                   << ", indirection " << numCells << std::endl;
+        return mt;
+    }
+}
 
 class ReaderWriterVDB : public osgDB::ReaderWriter
 {
@@ -49,6 +202,15 @@ public:
         openvdb::GridPtrVecPtr grids = strm.getGrids();
         if (!grids) return ReadResult::ERROR_IN_READING_FILE;
 
+        bool useBricks = false;
+        if (options)
+        {
+            std::string ba = options->getPluginStringData("BrickAtlas");
+            std::transform(ba.begin(), ba.end(), ba.begin(), tolower);
+            useBricks = (ba == "true" || atoi(ba.c_str()) > 0);
+        }
+        if (useBricks) return readBrickVolumes(*grids);
+
         osg::ref_ptr<osg::Vec3Array> va = new osg::Vec3Array;
         osg::ref_ptr<osg::Vec4Array> ca = new osg::Vec4Array;
         for (size_t i = 0; i < grids->size(); ++i)
@@ -111,6 +273,34 @@ public:
         return ReadResult::ERROR_IN_READING_FILE;
     }
 
+    ReadResult readBrickVolumes(openvdb::GridPtrVec& grids) const
+    {
+        osg::ref_ptr<osg::Group> root = new osg::Group;
+        for (size_t i = 0; i < grids.size(); ++i)
+        {
+            osg::ref_ptr<osg::Node> volume;
+            openvdb::FloatGrid::Ptr g0 = openvdb::gridPtrCast<openvdb::FloatGrid>(grids[i]);
+            if (g0)
+            {
+                volume = BrickVolume::create<openvdb::FloatGrid>(
+                    g0, [](float v) { return v; });
+            }
+            else
+            {
+                openvdb::Int32Grid::Ptr g1 = openvdb::gridPtrCast<openvdb::Int32Grid>(grids[i]);
+                if (g1) volume = BrickVolume::create<openvdb::Int32Grid>(
+                    g1, [](int v) { return v / 255.0f; });
+            }
+
+            if (volume.valid()) root->addChild(volume.get());
+            else OSG_WARN << "[ReaderWriterVDB] Unsupported VDB grid for brick volume: "
+                          << grids[i]->getName() << std::endl;
+        }
+
+        if (root->getNumChildren() == 0) return ReadResult::ERROR_IN_READING_FILE;
+        return (root->getNumChildren() == 1) ? root->getChild(0) : root.get();
+    }
+
     virtual WriteResult writeImage(const osg::Image& image, const std::string& path,
                                    const Options* options) const
     {
@@ -22,7 +22,7 @@ void LibraryEntry::refresh(const std::string& libName)
     osgDB::ObjectWrapperManager* owm = osgDB::Registry::instance()->getObjectWrapperManager();
     osgDB::ObjectWrapperManager::WrapperMap& wrappers = owm->getWrapperMap();
 
-    _classes.clear(); _libraryName = libName;
+    _classes.clear(); _classTables.clear(); _libraryName = libName;
     for (osgDB::ObjectWrapperManager::WrapperMap::iterator itr = wrappers.begin();
          itr != wrappers.end(); ++itr)
     {
@@ -146,6 +146,28 @@ std::vector<LibraryEntry::Method> LibraryEntry::getMethodNames(const std::string
     return methods;
 }
 
+const LibraryEntry::ClassTable& LibraryEntry::getClassTable(const std::string& clsName)
+{
+    std::map<std::string, ClassTable>::iterator itr = _classTables.find(clsName);
+    if (itr != _classTables.end()) return itr->second;
+
+    ClassTable& table = _classTables[clsName];
+    table.properties = getPropertyNames(clsName);
+    table.methods = getMethodNames(clsName);
+    for (size_t i = 0; i < table.properties.size(); ++i)
+    {
+        const Property& prop = table.properties[i];
+        if (!prop.outdated) table.propertyIndices.insert(std::make_pair(prop.name, (int)i));
+    }
+
+    for (size_t i = 0; i < table.methods.size(); ++i)
+    {
+        const Method& method = table.methods[i];
+        if (!method.outdated) table.methodIndices.insert(std::make_pair(method.name, (int)i));
+    }
+    return table;
+}
+
 std::string LibraryEntry::getClassName(osg::Object* obj, bool withLibName)
 {
     if (!obj) return ""; else if (!withLibName) return obj->className();
@@ -16,6 +16,7 @@ namespace osg
 #include <osgDB/WriteFile>
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <iostream>
 
 namespace osgVerse
@@ -43,6 +44,25 @@ namespace osgVerse
         };
         std::vector<Method> getMethodNames(const std::string& clsName) const;
 
+        /** Per-class property/method table, built once and then looked up by hashed names.
+            Outdated properties/methods are excluded from the indices */
+        struct ClassTable
+        {
+            std::vector<Property> properties;
+            std::vector<Method> methods;
+            std::unordered_map<std::string, int> propertyIndices, methodIndices;
+
+            const Property* findProperty(const std::string& name) const
+            {
+                std::unordered_map<std::string, int>::const_iterator itr = propertyIndices.find(name);
+                return (itr != propertyIndices.end()) ? &properties[itr->second] : NULL;
+            }
+
+            bool hasMethod(const std::string& name) const
+            { return methodIndices.find(name) != methodIndices.end(); }
+        };
+        const ClassTable& getClassTable(const std::string& clsName);
+
 #if OSGVERSE_COMPLETED_SCRIPT
         template<typename T>
         bool getProperty(const osg::Object* object, const std::string& name, T& value)
@@ -147,6 +167,7 @@ namespace osgVerse
 #if OSGVERSE_COMPLETED_SCRIPT
         osgDB::ClassInterface _manager;
 #endif
+        std::map<std::string, ClassTable> _classTables;
         std::set<std::string> _classes;
         std::string _libraryName;
     };
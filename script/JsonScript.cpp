@@ -1,10 +1,68 @@
 #include <osg/Version>
+#include <string.h>
 #include "JsonScript.h"
 using namespace osgVerse;
 
-picojson::value JsonScript::execute(ExecutionType t, picojson::value in)
+static JsonScript::ExecutionType getCommandType(const picojson::value& in,
+                                                JsonScript::ExecutionType t)
 {
-    PropertyMap properties; ParameterList params;
+    if (!in.contains("command")) return t;
+    std::string cmd = in.get("command").to_str();
+    if (cmd == "create") return JsonScript::EXE_Creation;
+    else if (cmd == "set") return JsonScript::EXE_Set;
+    else if (cmd == "get") return JsonScript::EXE_Get;
+    else if (cmd == "remove") return JsonScript::EXE_Remove;
+    else if (cmd == "list") return JsonScript::EXE_List;
+    return t;
+}
+
+static bool readPropertyValues(const picojson::value& v, ScriptBase::Values& values,
+                               const std::vector<unsigned char>* payload)
+{
+    if (v.is<double>() || v.is<bool>())
+        values.numbers.push_back(v.is<bool>() ? (v.get<bool>() ? 1.0 : 0.0) : v.get<double>());
+    else if (v.is<picojson::array>())
+    {
+        const picojson::array& arr = v.get<picojson::array>();
+        values.numbers.reserve(arr.size());
+        for (size_t i = 0; i < arr.size(); ++i)
+        {
+            if (arr[i].is<double>()) values.numbers.push_back(arr[i].get<double>());
+            else return false;
+        }
+    }
+    else if (v.is<picojson::object>() && v.contains("offset") && v.contains("count"))
+    {
+        size_t offset = (size_t)v.get("offset").get<double>();
+        size_t count = (size_t)v.get("count").get<double>();
+        if (!payload || count == 0 || offset > payload->size() ||
+            count > (payload->size() - offset) / sizeof(float)) return false;
+        values.floats.resize(count);  // payload data may be unaligned
+        memcpy(&values.floats[0], payload->data() + offset, count * sizeof(float));
+    }
+    else return false;
+    return true;
+}
+
+picojson::value JsonScript::execute(ExecutionType t, picojson::value in,
+                                    const std::vector<unsigned char>* payload)
+{
+    std::lock_guard<std::recursive_mutex> lock(_sceneMutex);
+    if (in.is<picojson::array>())
+    {
+        const picojson::array& commands = in.get<picojson::array>();
+        picojson::array results(commands.size());
+        for (size_t i = 0; i < commands.size(); ++i)
+            results[i] = executeCommand(getCommandType(commands[i], t), commands[i], payload);
+        return picojson::value(results);
+    }
+    return executeCommand(getCommandType(in, t), in, payload);
+}
+
+picojson::value JsonScript::executeCommand(ExecutionType t, const picojson::value& in,
+                                           const std::vector<unsigned char>* payload)
+{
+    PropertyMap properties; ValueMap values; ParameterList params;
     if (in.contains("properties"))
     {
         const picojson::value& propsVal = in.get("properties");
@@ -17,8 +75,12 @@ picojson::value JsonScript::execute(ExecutionType t, picojson::value in)
                 if (propVal.is<picojson::object>())
                 {
                     const picojson::object& obj = propVal.get<picojson::object>();
-                    for (picojson::object::const_iterator itr = obj.begin();
-                         itr != obj.end(); ++itr) properties[itr->first] = itr->second.to_str();
+                    for (picojson::object::const_iterator itr = obj.begin(); itr != obj.end(); ++itr)
+                    {
+                        if (itr->second.is<std::string>() ||
+                            !readPropertyValues(itr->second, values[itr->first], payload))
+                        { values.erase(itr->first); properties[itr->first] = itr->second.to_str(); }
+                    }
                 }
                 else if (!propVal.is<picojson::array>())
                     params.push_back(propVal.to_str());
@@ -27,8 +89,12 @@ picojson::value JsonScript::execute(ExecutionType t, picojson::value in)
         else if (propsVal.is<picojson::object>())
         {
             const picojson::object& obj = propsVal.get<picojson::object>();
-            for (picojson::object::const_iterator itr = obj.begin();
-                 itr != obj.end(); ++itr) properties[itr->first] = itr->second.to_str();
+            for (picojson::object::const_iterator itr = obj.begin(); itr != obj.end(); ++itr)
+            {
+                if (itr->second.is<std::string>() ||
+                    !readPropertyValues(itr->second, values[itr->first], payload))
+                { values.erase(itr->first); properties[itr->first] = itr->second.to_str(); }
+            }
         }
         else
             OSG_WARN << "[JsonScript] Unknown properties format: "
@@ -56,6 +122,16 @@ picojson::value JsonScript::execute(ExecutionType t, picojson::value in)
                      << in.to_str() << std::endl;
             result.code = -10; result.msg = "Incomplete JSON command";
         }
+
+        if (!values.empty() && result.obj.valid())
+        {
+            Result result2 = set(result.value, values);
+            if (result2.code != 0)
+            {
+                if (!result.msg.empty()) result.msg += "\n";
+                result.msg += result2.msg;
+            }
+        }
         break;
     case EXE_Set:
         if (in.contains("object"))
@@ -67,7 +143,18 @@ picojson::value JsonScript::execute(ExecutionType t, picojson::value in)
                 result = call(objVal.to_str(), methodVal.to_str(), params);
             }
             else
+            {
                 result = set(objVal.to_str(), properties);
+                if (!values.empty() && result.code != -1)
+                {
+                    Result result2 = set(objVal.to_str(), values);
+                    if (result2.code != 0)
+                    {
+                        if (!result.msg.empty()) result.msg += "\n"; else result.code = result2.code;
+                        result.msg += result2.msg;
+                    }
+                }
+            }
         }
         else
         {
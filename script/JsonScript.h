@@ -30,8 +30,21 @@ namespace osgVerse
         *     { 'library': ... }, { 'library': ..., 'class': ... }, { 'object': ... }
         *   Json result:
         *     { 'code': ..., 'message': '...', 'value': ..., 'object': ... }
+        *
+        *   Property values may be strings, or native numbers / number arrays for scalar, vector,
+        *   matrix and array types, e.g., { 'Matrix': [1, 0, 0, 0, ..., 1] }. Bulk arrays may also
+        *   refer to the binary payload as little-endian float32: { 'Vertices': {'offset': 0, 'count': 300} }
+        *
+        *   An array of commands is executed as a batch under the scene mutex, returning an array
+        *   of results. Each command may override the execution type with 'command' key:
+        *   'create', 'set', 'get', 'remove' or 'list'.
         */
-        picojson::value execute(ExecutionType t, picojson::value in);
+        picojson::value execute(ExecutionType t, picojson::value in,
+                                const std::vector<unsigned char>* payload = NULL);
+
+    protected:
+        picojson::value executeCommand(ExecutionType t, const picojson::value& in,
+                                       const std::vector<unsigned char>* payload);
     };
 }
 
@@ -89,18 +89,40 @@ ScriptBase::Result ScriptBase::set(const std::string& nodePath, const PropertyMa
     osg::Object* obj = getFromPath(nodePath);
     if (obj != NULL)
     {
-        std::string libName = obj->libraryName(), clsName = obj->className();
-        if (_entries.find(libName) == _entries.end())
-            _entries[libName] = new LibraryEntry(libName);
-
-        Result result; result.obj = obj;
-        LibraryEntry* entry = _entries[libName].get();
-        std::vector<LibraryEntry::Property> names = entry->getPropertyNames(clsName);
-
+        Result result; result.obj = obj; LibraryEntry* entry = NULL;
+        const LibraryEntry::ClassTable& table = getClassTable(obj, &entry);
         for (PropertyMap::const_iterator itr = properties.begin();
             itr != properties.end(); ++itr)
         {
-            if (!setProperty(itr->first, itr->second, entry, obj, names))
+            if (!setProperty(itr->first, itr->second, entry, obj, table.findProperty(itr->first)))
+            {
+                if (!result.msg.empty()) result.msg += "\n"; else result.code = -2;
+                result.msg += "Can't set property: " + itr->first;
+            }
+        }
+        return result;
+    }
+    else
+        return Result(-1, "Invalid scene object: " + nodePath);
+}
+
+ScriptBase::Result ScriptBase::set(const std::string& nodePath, const ValueMap& values)
+{
+    osg::Object* obj = getFromPath(nodePath);
+    if (obj != NULL)
+    {
+        Result result; result.obj = obj; LibraryEntry* entry = NULL;
+        const LibraryEntry::ClassTable& table = getClassTable(obj, &entry);
+        for (ValueMap::const_iterator itr = values.begin(); itr != values.end(); ++itr)
+        {
+            const Values& v = itr->second; bool ok = false;
+            const LibraryEntry::Property* prop = table.findProperty(itr->first);
+            if (!v.floats.empty())
+                ok = setPropertyValues(itr->first, &v.floats[0], v.floats.size(), entry, obj, prop);
+            else if (!v.numbers.empty())
+                ok = setPropertyValues(itr->first, &v.numbers[0], v.numbers.size(), entry, obj, prop);
+
+            if (!ok)
             {
                 if (!result.msg.empty()) result.msg += "\n"; else result.code = -2;
                 result.msg += "Can't set property: " + itr->first;
@@ -118,18 +140,17 @@ ScriptBase::Result ScriptBase::call(const std::string& nodePath, const std::stri
     osg::Object* obj = getFromPath(nodePath);
     if (obj != NULL)
     {
-        std::string libName = obj->libraryName(), clsName = obj->className();
-        if (_entries.find(libName) == _entries.end())
-            _entries[libName] = new LibraryEntry(libName);
-
-        Result result; LibraryEntry* entry = _entries[libName].get();
-        std::vector<LibraryEntry::Method> methods = entry->getMethodNames(clsName);
+        Result result; LibraryEntry* entry = NULL;
+        const LibraryEntry::ClassTable& table = getClassTable(obj, &entry);
+        if (!table.hasMethod(key))
+            return Result(-8, "Can't call method: " + key);
 
         osg::Parameters inArgs, outArgs;
         for (size_t i = 0; i < params.size(); ++i)
             inArgs.push_back(getFromPath(params[i]));
         if (!entry->callMethod(obj, key, inArgs, outArgs))
         { result.code = -8; result.msg += "Can't call method: " + key; }
+        else dirtyPathCache();  // methods may change the scene graph
 
         if (!outArgs.empty()) result.obj = outArgs[0].get();
         return result;
@@ -143,15 +164,9 @@ ScriptBase::Result ScriptBase::get(const std::string& nodePath, const std::strin
     osg::Object* obj = getFromPath(nodePath);
     if (obj != NULL)
     {
-        std::string libName = obj->libraryName(), clsName = obj->className();
-        if (_entries.find(libName) == _entries.end())
-            _entries[libName] = new LibraryEntry(libName);
-
-        Result result; result.obj = obj;
-        LibraryEntry* entry = _entries[libName].get();
-        std::vector<LibraryEntry::Property> names = entry->getPropertyNames(clsName);
-
-        if (!getProperty(key, result.value, entry, obj, names))
+        Result result; result.obj = obj; LibraryEntry* entry = NULL;
+        const LibraryEntry::ClassTable& table = getClassTable(obj, &entry);
+        if (!getProperty(key, result.value, entry, obj, table.findProperty(key)))
             return Result(-3, "Can't get property: " + key);
         return result;
     }
@@ -174,25 +189,132 @@ ScriptBase::Result ScriptBase::remove(const std::string& nodePath)
         { result.code = -4; result.msg = "Can't delete object not created here: " + nodePath; }
         else if (obj->referenceCount() > 1)
         { result.code = -5; result.msg = "Can't delete object still referenced: " + nodePath; }
-        else _objects.erase(_objects.find(id));
+        else { _objects.erase(_objects.find(id)); dirtyPathCache(); }
         return result;
     }
     else
         return Result(-1, "Invalid scene object: " + nodePath);
 }
 
+int ScriptBase::resolveProperty(const std::string& nodePath, const std::string& key)
+{
+    osg::Object* obj = getFromPath(nodePath);
+    if (obj == NULL) return -1;
+
+    LibraryEntry* entry = NULL;
+    const LibraryEntry::Property* prop = getClassTable(obj, &entry).findProperty(key);
+    if (prop == NULL) return -1;
+
+    PropertyHandle handle;
+    handle.object = obj; handle.entry = entry; handle.property = *prop;
+    for (size_t i = 0; i < _handles.size(); ++i)
+    {
+        // Reuse released slots
+        if (_handles[i].entry.valid()) continue;
+        _handles[i] = handle; return (int)i;
+    }
+    _handles.push_back(handle);
+    return (int)_handles.size() - 1;
+}
+
+void ScriptBase::releaseProperty(int handle)
+{
+    if (handle < 0 || handle >= (int)_handles.size()) return;
+    _handles[handle] = PropertyHandle();
+}
+
+ScriptBase::Result ScriptBase::set(int handle, const std::string& value)
+{
+    if (handle < 0 || handle >= (int)_handles.size() || !_handles[handle].entry)
+        return Result(-11, "Invalid property handle: " + std::to_string(handle));
+
+    PropertyHandle& h = _handles[handle];
+    osg::ref_ptr<osg::Object> obj;
+    if (!h.object.lock(obj))
+        return Result(-1, "Invalid scene object of handle: " + std::to_string(handle));
+
+    Result result; result.obj = obj.get();
+    if (!setProperty(h.property.name, value, h.entry.get(), obj.get(), &h.property))
+    { result.code = -2; result.msg = "Can't set property: " + h.property.name; }
+    return result;
+}
+
+ScriptBase::Result ScriptBase::get(int handle)
+{
+    if (handle < 0 || handle >= (int)_handles.size() || !_handles[handle].entry)
+        return Result(-11, "Invalid property handle: " + std::to_string(handle));
+
+    PropertyHandle& h = _handles[handle];
+    osg::ref_ptr<osg::Object> obj;
+    if (!h.object.lock(obj))
+        return Result(-1, "Invalid scene object of handle: " + std::to_string(handle));
+
+    Result result; result.obj = obj.get();
+    if (!getProperty(h.property.name, result.value, h.entry.get(), obj.get(), &h.property))
+        return Result(-3, "Can't get property: " + h.property.name);
+    return result;
+}
+
+const LibraryEntry::ClassTable& ScriptBase::getClassTable(osg::Object* obj, LibraryEntry** entry)
+{
+    std::string libName = obj->libraryName(), clsName = obj->className();
+    std::map<std::string, osg::ref_ptr<LibraryEntry>>::iterator itr = _entries.find(libName);
+    if (itr == _entries.end())
+        itr = _entries.insert(std::make_pair(libName, new LibraryEntry(libName))).first;
+    *entry = itr->second.get();
+    return itr->second->getClassTable(clsName);
+}
+
 osg::Object* ScriptBase::getFromPath(const std::string& nodePath)
 {
-    osg::Object* obj = _rootNode.get();
     if (nodePath.empty() || nodePath == "root")
-        return obj;
-    else if (_objects.find(nodePath) != _objects.end())
-        return _objects[nodePath].get();
+        return _rootNode.get();
+
+    std::unordered_map<std::string, CachedPath>::iterator itr = _pathCache.find(nodePath);
+    if (itr != _pathCache.end())
+    {
+        osg::Object* obj = validatePath(itr->second);
+        if (obj != NULL) return obj; else _pathCache.erase(itr);
+    }
+
+    CachedPath cached; osg::Object* obj = findFromPath(nodePath, cached);
+    if (obj != NULL) _pathCache[nodePath] = cached;
+    return obj;
+}
+
+osg::Object* ScriptBase::validatePath(const CachedPath& cached) const
+{
+    // Check every step of the path: each node must still be the same child of previous one,
+    // and keep the name it was found by, so renaming or reparenting an ancestor is detected
+    osg::ref_ptr<osg::Object> head;
+    if (!cached.head.lock(head)) return NULL;
+
+    osg::Object* obj = head.get();
+    for (size_t i = 0; i < cached.steps.size(); ++i)
+    {
+        const PathStep& step = cached.steps[i];
+        osg::Group* parent = (i == 0) ? dynamic_cast<osg::Group*>(obj)
+                           : static_cast<osg::Node*>(obj)->asGroup();
+        osg::ref_ptr<osg::Node> node;
+        if (!parent || !step.node.lock(node) || step.childIndex >= parent->getNumChildren() ||
+            parent->getChild(step.childIndex) != node.get()) return NULL;
+        if (!step.name.empty() && node->getName() != step.name) return NULL;
+        obj = node.get();
+    }
+    return obj;
+}
+
+osg::Object* ScriptBase::findFromPath(const std::string& nodePath, CachedPath& cached)
+{
+    osg::Object* obj = _rootNode.get();
+    if (_objects.find(nodePath) != _objects.end())
+    { obj = _objects[nodePath].get(); cached.head = obj; return obj; }
 
     osgDB::StringList path;
     osgDB::split(nodePath, path, '/');
     if (_objects.find(path[0]) != _objects.end())
         obj = _objects[path[0]].get();
+    cached.head = obj;
 
 #if OSG_VERSION_GREATER_THAN(3, 3, 0)
     osg::Node* node = obj ? obj->asNode() : NULL;
@@ -207,25 +329,27 @@ osg::Object* ScriptBase::getFromPath(const std::string& nodePath)
             osg::Group* parent = node ? node->asGroup() : NULL;
             if (parent == NULL) return NULL; node = NULL;
 
+            PathStep step;
             if (name == "0")
             {
                 if (parent->getNumChildren() > 0)
-                    node = parent->getChild(0);
+                { node = parent->getChild(0); step.childIndex = 0; }
             }
             else
             {
                 int index = atoi(name.c_str());
                 if (index > 0 && index < (int)parent->getNumChildren())
-                    node = parent->getChild(index);
+                { node = parent->getChild(index); step.childIndex = index; }
                 else
                 {
                     for (size_t j = 0; j < parent->getNumChildren(); ++j)
                     {
-                        if (parent->getChild(j)->getName() == name)
-                        { node = parent->getChild(j); break; }
+                        if (parent->getChild(j)->getName() != name) continue;
+                        node = parent->getChild(j); step.childIndex = j; step.name = name; break;
                     }
                 }
             }
+            step.node = node; cached.steps.push_back(step);
         }
         obj = node;
     }
@@ -280,17 +404,15 @@ template<typename T> static std::vector<T> getVecVector(const std::string& v, ch
 
 bool ScriptBase::setProperty(const std::string& key, const std::string& value,
                              LibraryEntry* entry, osg::Object* object,
-                             const std::vector<LibraryEntry::Property>& names)
+                             const LibraryEntry::Property* prop)
 {
     std::string clsName = object->className();
     std::string value2; char sep = _vecSeparator;
-    for (size_t i = 0; i < names.size(); ++i)
+    if (key == "Name") dirtyPathCache();  // names are used to find nodes from paths
+    if (prop != NULL)
     {
-        const LibraryEntry::Property& prop = names[i];
-        if (prop.name != key || prop.outdated) continue;
-
 #if OSGVERSE_COMPLETED_SCRIPT
-        switch (prop.type)
+        switch (prop->type)
         {
         case osgDB::BaseSerializer::RW_OBJECT:
         case osgDB::BaseSerializer::RW_IMAGE:
@@ -405,6 +527,124 @@ bool ScriptBase::setProperty(const std::string& key, const std::string& value,
     return false;
 }
 
+template<typename T, typename S> static T makeVecValue(const S* v, size_t n)
+{
+    T result; int num = osg::minimum((int)n, (int)T::num_components);
+    for (int i = 0; i < num; ++i) result[i] = (typename T::value_type)v[i];
+    return result;
+}
+
+template<typename T, typename S> static T makeMatrixValue(const S* v, size_t n)
+{
+    T result; typename T::value_type* ptr = (typename T::value_type*)result.ptr();
+    int num = osg::minimum((int)n, 16);
+    for (int i = 0; i < num; ++i) *(ptr + i) = (typename T::value_type)v[i];
+    return result;
+}
+
+template<typename T, typename S> static std::vector<T> makeVector(const S* v, size_t n)
+{ return std::vector<T>(v, v + n); }
+
+template<typename T, typename S> static std::vector<T> makeVecVector(const S* v, size_t n)
+{
+    const size_t num = T::num_components; std::vector<T> result(n / num);
+    for (size_t i = 0; i < result.size(); ++i)
+        result[i] = makeVecValue<T>(v + i * num, num);
+    return result;
+}
+
+template<typename S>
+bool ScriptBase::setPropertyValues(const std::string& key, const S* v, size_t n,
+                                   LibraryEntry* entry, osg::Object* object,
+                                   const LibraryEntry::Property* prop)
+{
+    std::string clsName = object->className();
+    if (prop != NULL && n > 0)
+    {
+#if OSGVERSE_COMPLETED_SCRIPT
+        switch (prop->type)
+        {
+        case osgDB::BaseSerializer::RW_BOOL:
+            return entry->setProperty(object, key, v[0] != 0);
+        case osgDB::BaseSerializer::RW_CHAR:
+            return entry->setProperty(object, key, (char)v[0]);
+        case osgDB::BaseSerializer::RW_UCHAR:
+            return entry->setProperty(object, key, (unsigned char)v[0]);
+        case osgDB::BaseSerializer::RW_SHORT:
+            return entry->setProperty(object, key, (short)v[0]);
+        case osgDB::BaseSerializer::RW_USHORT:
+            return entry->setProperty(object, key, (unsigned short)v[0]);
+        case osgDB::BaseSerializer::RW_INT:
+        case osgDB::BaseSerializer::RW_GLENUM:
+            return entry->setProperty(object, key, (int)v[0]);
+        case osgDB::BaseSerializer::RW_UINT:
+            return entry->setProperty(object, key, (unsigned int)v[0]);
+        case osgDB::BaseSerializer::RW_FLOAT:
+            return entry->setProperty(object, key, (float)v[0]);
+        case osgDB::BaseSerializer::RW_DOUBLE:
+            return entry->setProperty(object, key, (double)v[0]);
+        case osgDB::BaseSerializer::RW_QUAT:
+            return entry->setProperty(object, key, osg::Quat(n > 0 ? v[0] : 0.0, n > 1 ? v[1] : 0.0,
+                                                             n > 2 ? v[2] : 0.0, n > 3 ? v[3] : 1.0));
+        case osgDB::BaseSerializer::RW_VEC2F:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec2f>(v, n));
+        case osgDB::BaseSerializer::RW_VEC3F:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec3f>(v, n));
+        case osgDB::BaseSerializer::RW_VEC4F:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec4f>(v, n));
+        case osgDB::BaseSerializer::RW_VEC2D:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec2d>(v, n));
+        case osgDB::BaseSerializer::RW_VEC3D:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec3d>(v, n));
+        case osgDB::BaseSerializer::RW_VEC4D:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec4d>(v, n));
+#if OSG_VERSION_GREATER_THAN(3, 4, 0)
+        case osgDB::BaseSerializer::RW_VEC2I:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec2i>(v, n));
+        case osgDB::BaseSerializer::RW_VEC3I:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec3i>(v, n));
+        case osgDB::BaseSerializer::RW_VEC4I:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec4i>(v, n));
+        case osgDB::BaseSerializer::RW_VEC2UI:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec2ui>(v, n));
+        case osgDB::BaseSerializer::RW_VEC3UI:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec3ui>(v, n));
+        case osgDB::BaseSerializer::RW_VEC4UI:
+            return entry->setProperty(object, key, makeVecValue<osg::Vec4ui>(v, n));
+#endif
+        case osgDB::BaseSerializer::RW_MATRIXF:
+            return entry->setProperty(object, key, makeMatrixValue<osg::Matrixf>(v, n));
+        case osgDB::BaseSerializer::RW_MATRIXD:
+            return entry->setProperty(object, key, makeMatrixValue<osg::Matrixd>(v, n));
+        case osgDB::BaseSerializer::RW_MATRIX:
+            return entry->setProperty(object, key, makeMatrixValue<osg::Matrix>(v, n));
+        case osgDB::BaseSerializer::RW_VECTOR:
+            if (clsName == "FloatArray")
+                return entry->setProperty(object, key, makeVector<float>(v, n));
+            else if (clsName == "Vec2Array")
+                return entry->setVecProperty(object, key, makeVecVector<osg::Vec2f>(v, n));
+            else if (clsName == "Vec3Array")
+                return entry->setVecProperty(object, key, makeVecVector<osg::Vec3f>(v, n));
+            else if (clsName == "Vec4Array")
+                return entry->setVecProperty(object, key, makeVecVector<osg::Vec4f>(v, n));
+            else if (clsName == "DoubleArray")
+                return entry->setProperty(object, key, makeVector<double>(v, n));
+            else if (clsName == "Vec2dArray")
+                return entry->setVecProperty(object, key, makeVecVector<osg::Vec2d>(v, n));
+            else if (clsName == "Vec3dArray")
+                return entry->setVecProperty(object, key, makeVecVector<osg::Vec3d>(v, n));
+            else if (clsName == "Vec4dArray")
+                return entry->setVecProperty(object, key, makeVecVector<osg::Vec4d>(v, n));
+            break;
+        default: break;
+        }
+#else
+        OSG_WARN << "[ScriptBase] setPropertyValues() not implemented" << std::endl;
+#endif
+    }
+    return false;
+}
+
 template<typename T> static std::string setVecValue(const T& v)
 {
     std::stringstream ss; int num = T::num_components;
@@ -447,15 +687,12 @@ template<typename T> static std::string setVecVector(const std::vector<T>& v, ch
 
 bool ScriptBase::getProperty(const std::string& key, std::string& value,
                              LibraryEntry* entry, osg::Object* object,
-                             const std::vector<LibraryEntry::Property>& names)
+                             const LibraryEntry::Property* prop)
 {
     std::string clsName = object->className();
     std::string value2; char sep = _vecSeparator;
-    for (size_t i = 0; i < names.size(); ++i)
+    if (prop != NULL)
     {
-        const LibraryEntry::Property& prop = names[i];
-        if (prop.name != key || prop.outdated) continue;
-
 #define GET_PROP_VALUE(type, func) { \
     type v; if (!entry->getProperty(object, key, v)) return false; \
     value = func (v); return true; }
@@ -464,7 +701,7 @@ bool ScriptBase::getProperty(const std::string& key, std::string& value,
     value = func (v, arg); return true; }
 
 #if OSGVERSE_COMPLETED_SCRIPT
-        switch (prop.type)
+        switch (prop->type)
         {
         //case osgDB::BaseSerializer::RW_OBJECT:
         //case osgDB::BaseSerializer::RW_IMAGE:
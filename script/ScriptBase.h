@@ -3,6 +3,7 @@
 
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <mutex>
 #include "Entry.h"
 
 namespace osgVerse
@@ -13,6 +14,15 @@ namespace osgVerse
         typedef std::map<std::string, std::string> PropertyMap;
         typedef std::vector<std::string> ParameterList;
 
+        /** Typed property values, set without string conversion. Bulk data may be copied
+            from an external float buffer (e.g., binary payload of a request) to 'floats' */
+        struct Values
+        {
+            std::vector<double> numbers;
+            std::vector<float> floats;
+        };
+        typedef std::map<std::string, Values> ValueMap;
+
         struct Result
         {
             Result(int c = 0, const std::string& m = "") : code(c), msg(m) {}
@@ -27,6 +37,7 @@ namespace osgVerse
 
         /** PUT: find an object and set properties/call methods */
         virtual Result set(const std::string& nodePath, const PropertyMap& properties);
+        virtual Result set(const std::string& nodePath, const ValueMap& values);
         virtual Result call(const std::string& nodePath, const std::string& method,
                             const ParameterList& params);
 
@@ -36,26 +47,76 @@ namespace osgVerse
         /** DELETE: delete an object (only from script manager, not scene graph) */
         virtual Result remove(const std::string& nodePath);
 
-        /** Get node path: idXXX, idA/idB, idA/0 (first child), or empty for root node */
+        /** Get node path: idXXX, idA/idB, idA/0 (first child), or empty for root node.
+            Resolved paths are cached and every step is checked again on next use */
         osg::Object* getFromPath(const std::string& nodePath);
 
-        void setRootNode(osg::Group* root) { _rootNode = root; }
+        /** Clear all cached paths, should be called if scene graph is changed outside */
+        void dirtyPathCache() { _pathCache.clear(); }
+
+        /** Handle-based property access: resolve object and property once, then set/get by ID.
+            Returns -1 if object or property is not found */
+        int resolveProperty(const std::string& nodePath, const std::string& key);
+        void releaseProperty(int handle);
+
+        Result set(int handle, const std::string& value);
+        Result get(int handle);
+
+        void setRootNode(osg::Group* root) { _rootNode = root; dirtyPathCache(); }
         osg::Group* getRootNode() { return _rootNode.get(); }
 
         LibraryEntry* getOrCreateEntry(const std::string& lib);
         Result createFromObject(osg::Object* obj);
 
+        /** Mutex held while executing script commands. If commands come from other threads,
+            lock it around the update traversal to apply a whole batch between two frames.
+            It is recursive, so event and update callbacks may still execute commands */
+        std::recursive_mutex& getSceneMutex() { return _sceneMutex; }
+
     protected:
         bool setProperty(const std::string& key, const std::string& value,
                          LibraryEntry* entry, osg::Object* object,
-                         const std::vector<LibraryEntry::Property>& names);
+                         const LibraryEntry::Property* prop);
         bool getProperty(const std::string& key, std::string& value,
                          LibraryEntry* entry, osg::Object* object,
-                         const std::vector<LibraryEntry::Property>& names);
+                         const LibraryEntry::Property* prop);
+
+        template<typename S>
+        bool setPropertyValues(const std::string& key, const S* values, size_t num,
+                               LibraryEntry* entry, osg::Object* object,
+                               const LibraryEntry::Property* prop);
+
+        struct PathStep
+        {
+            PathStep() : childIndex(0) {}
+            osg::observer_ptr<osg::Node> node;
+            unsigned int childIndex;
+            std::string name;  // only if found by name
+        };
+
+        struct CachedPath
+        {
+            osg::observer_ptr<osg::Object> head;
+            std::vector<PathStep> steps;
+        };
+
+        osg::Object* findFromPath(const std::string& nodePath, CachedPath& cached);
+        osg::Object* validatePath(const CachedPath& cached) const;
+        const LibraryEntry::ClassTable& getClassTable(osg::Object* obj, LibraryEntry** entry);
+
+        struct PropertyHandle
+        {
+            osg::observer_ptr<osg::Object> object;
+            osg::ref_ptr<LibraryEntry> entry;
+            LibraryEntry::Property property;
+        };
 
         std::map<std::string, osg::ref_ptr<osg::Object>> _objects;
         std::map<std::string, osg::ref_ptr<LibraryEntry>> _entries;
+        std::unordered_map<std::string, CachedPath> _pathCache;
+        std::vector<PropertyHandle> _handles;
         osg::observer_ptr<osg::Group> _rootNode;
+        std::recursive_mutex _sceneMutex;
         char _vecSeparator;
     };
 }
@@ -1,4 +1,5 @@
 #include <osg/io_utils>
+#include <osg/Timer>
 #include <osg/ComputeBoundsVisitor>
 #include <osg/PagedLOD>
 #include <osg/MatrixTransform>
@@ -17,8 +18,50 @@
 #include <backward.hpp>  // for better debug info
 namespace backward { backward::SignalHandling sh; }
 
+static void benchmarkTriangulation(int numFootprints)
+{
+    // Building footprints of a tile: star-shaped polygons, some with duplicated points,
+    // duplicated constraints and self-intersections
+    std::vector<osgVerse::GeometryAlgorithm::TriangulationData> polygons(numFootprints);
+    for (int p = 0; p < numFootprints; ++p)
+    {
+        osgVerse::GeometryAlgorithm::TriangulationData& data = polygons[p];
+        osg::Vec2 center((p % 300) * 50.0f, (p / 300) * 50.0f); int n = 6 + rand() % 14;
+        for (int i = 0; i < n; ++i)
+        {
+            float angle = osg::PI * 2.0f * i / n, r = 10.0f + 10.0f * (float)rand() / RAND_MAX;
+            osg::Vec2 pt = center + osg::Vec2(cosf(angle), sinf(angle)) * r;
+            data.points.push_back(osgVerse::PointType2D(pt, i));
+            data.edges.push_back(osgVerse::EdgeType(i, (i + 1) % n));
+        }
+        if (p % 10 == 0)
+        { data.points.push_back(data.points[2]); data.edges.push_back(data.edges[0]); }
+        if (p % 7 == 0) std::swap(data.points[1].first, data.points[2].first);
+    }
+
+    size_t numSerial = 0;
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for (int p = 0; p < numFootprints; ++p)
+    {
+        std::vector<size_t> indices = osgVerse::GeometryAlgorithm::delaunayTriangulation(
+            polygons[p].points, polygons[p].edges);
+        numSerial += indices.size() / 3;
+    }
+
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    size_t numFailed = osgVerse::GeometryAlgorithm::delaunayTriangulation(polygons), numBatch = 0;
+    osg::Timer_t t2 = osg::Timer::instance()->tick();
+    for (int p = 0; p < numFootprints; ++p) numBatch += polygons[p].indices.size() / 3;
+
+    std::cout << "Triangulating " << numFootprints << " footprints: per-call = "
+              << osg::Timer::instance()->delta_m(t0, t1) << "ms (" << numSerial
+              << " triangles), batched = " << osg::Timer::instance()->delta_m(t1, t2) << "ms ("
+              << numBatch << " triangles, " << numFailed << " failed)" << std::endl;
+}
+
 int main(int argc, char** argv)
 {
+    benchmarkTriangulation(100000);
     osg::ref_ptr<osg::Node> nodeA = (argc < 2)
                                   ? osgDB::readNodeFile("cow.osg") : osgDB::readNodeFile(argv[1]);
     osg::Polytope polytope;
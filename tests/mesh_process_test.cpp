@@ -1,12 +1,15 @@
 #include <osg/io_utils>
 #include <osg/MatrixTransform>
 #include <osg/Geometry>
+#include <osg/Polytope>
+#include <osg/Timer>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 #include <osgGA/TrackballManipulator>
 #include <osgGA/StateSetManipulator>
 #include <osgViewer/Viewer>
 #include <osgViewer/ViewerEventHandlers>
+#include <modeling/Math.h>
 #include <modeling/MeshTopology.h>
 #include <modeling/Utilities.h>
 #include <iostream>
@@ -15,12 +18,113 @@
 #include <backward.hpp>  // for better debug info
 namespace backward { backward::SignalHandling sh; }
 
+static void benchmarkMeshlets(osg::Node* scene)
+{
+    osg::ref_ptr<osgVerse::MeshletBuilder> builder = new osgVerse::MeshletBuilder;
+    scene->accept(*builder);
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    builder->build(128);
+    double buildTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+
+    const std::vector<osg::Vec3>& vertices = builder->getVertices();
+    const std::vector<unsigned int>& indices = builder->getTriangles();
+    size_t numTriangles = indices.size() / 3, numViews = 64;
+    size_t drawableSubmitted = 0, clusterSubmitted = 0, visible = 0;
+    double cullTime = 0.0; std::vector<unsigned int> visibleIndices;
+
+    osg::BoundingSphere bs = scene->getBound();
+    for (size_t i = 0; i < numViews; ++i)
+    {
+        // Orbit around the model, looking at one side of it
+        double angle = osg::PI * 2.0 * i / numViews;
+        osg::Vec3 dir(cos(angle), sin(angle), 0.3f); dir.normalize();
+        osg::Vec3 eye = bs.center() + dir * bs.radius() * 1.2f;
+        osg::Vec3 target = bs.center() + (dir ^ osg::Z_AXIS) * bs.radius() * 0.5f;
+        osg::Matrix mvp = osg::Matrix::lookAt(eye, target, osg::Z_AXIS) *
+                          osg::Matrix::perspective(45.0, 1.0, 0.01, bs.radius() * 10.0);
+
+        osg::Polytope frustum; frustum.setToUnitFrustum();
+        frustum.transformProvidingInverse(mvp);
+        if (frustum.contains(bs)) drawableSubmitted += numTriangles;
+
+        osg::Timer_t t1 = osg::Timer::instance()->tick();
+        builder->cull(frustum, eye, visibleIndices);
+        cullTime += osg::Timer::instance()->delta_m(t1, osg::Timer::instance()->tick());
+        clusterSubmitted += visibleIndices.size() / 3;
+
+        for (size_t t = 0; t < numTriangles; ++t)
+        {
+            const osg::Vec3& v0 = vertices[indices[t * 3 + 0]];
+            const osg::Vec3& v1 = vertices[indices[t * 3 + 1]];
+            const osg::Vec3& v2 = vertices[indices[t * 3 + 2]];
+            osg::Vec3 N = (v1 - v0) ^ (v2 - v0); if (N * (eye - v0) <= 0.0f) continue;
+
+            osg::BoundingSphere triBound; triBound.expandBy(v0);
+            triBound.expandBy(v1); triBound.expandBy(v2);
+            if (frustum.contains(triBound)) visible++;
+        }
+    }
+
+    std::cout << "Meshlets: " << builder->getMeshlets().size() << " clusters of " << numTriangles
+              << " triangles, built in " << buildTime << "ms" << std::endl;
+    std::cout << "Average of " << numViews << " views: drawable-culling submitted = "
+              << drawableSubmitted / numViews << ", cluster-culling submitted = "
+              << clusterSubmitted / numViews << ", visible = " << visible / numViews
+              << ", cluster-culling time = " << cullTime / numViews << "ms" << std::endl;
+}
+
+static void benchmarkMathExpression(int resolution)
+{
+    // Procedural height field over a grid, as used for terrain-like modeling
+    std::string exp = "h * sin(x * 0.1) * cos(y * 0.1) + 0.5 * sqrt(x * x + y * y)";
+    size_t count = resolution * resolution;
+    std::vector<osg::Vec3d> points(count);
+    std::vector<double> results0(count), results1(count);
+    for (size_t i = 0; i < count; ++i)
+        points[i] = osg::Vec3d(i % resolution, i / resolution, 0.0);
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    double x = 0.0, y = 0.0, h = 2.0;
+    osgVerse::MathExpression perCall(exp);
+    perCall.setVariable("x", x); perCall.setVariable("y", y);
+    perCall.setVariable("h", (const double&)h);
+    for (size_t i = 0; i < count; ++i)
+    { x = points[i][0]; y = points[i][1]; results0[i] = perCall.evaluate(); }
+
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    osgVerse::MathExpression batched(exp);
+    batched.setVariable("h", (const double&)h);
+    batched.setArray("x", &points[0][0], 3); batched.setArray("y", &points[0][1], 3);
+    batched.evaluate(&results1[0], count);
+    osg::Timer_t t2 = osg::Timer::instance()->tick();
+
+    double maxDiff = 0.0;
+    for (size_t i = 0; i < count; ++i)
+        maxDiff = osg::maximum(maxDiff, fabs(results0[i] - results1[i]));
+    std::cout << "MathExpression over " << count << " elements: per-call = "
+              << osg::Timer::instance()->delta_m(t0, t1) << "ms, batched = "
+              << osg::Timer::instance()->delta_m(t1, t2) << "ms, max difference = "
+              << maxDiff << std::endl;
+
+    // Array names keep scalar variables (0 here), so per-call evaluation still compiles
+    bool ok = false; double value = batched.evaluate(&ok);
+    batched.removeArray("x"); batched.removeArray("y");
+    batched.setVariable("x", x); batched.setVariable("y", y);
+    std::cout << "MathExpression with arrays bound: ok = " << ok << ", value = " << value
+              << "; after removing arrays: " << batched.evaluate() << " (expected "
+              << perCall.evaluate() << ")" << std::endl;
+}
+
 int main(int argc, char** argv)
 {
     osg::ref_ptr<osg::Node> scene =
         (argc < 2) ? osgDB::readNodeFile("cessna.osg") : osgDB::readNodeFile(argv[1]);
     if (!scene) { OSG_WARN << "Failed to load " << (argc < 2) ? "" : argv[1]; return 1; }
 
+    benchmarkMathExpression(1000);
+    benchmarkMeshlets(scene.get());
+
     osgVerse::MeshTopologyVisitor mtv;
     mtv.setWeldingVertices(true);
     scene->accept(mtv);
@@ -74,6 +178,21 @@ int main(int argc, char** argv)
         topoMT->setMatrix(osg::Matrix::translate(0.0f, 0.0f, 20.0f));
     }
 
+    // Build LOD chain from the topology, decimating partitions in parallel
+    osg::ref_ptr<osgVerse::MeshLodBuilder> lodBuilder = new osgVerse::MeshLodBuilder;
+    osg::ref_ptr<osg::LOD> lodNode = lodBuilder->build(topology.get());
+    if (lodNode.valid())
+    {
+        const std::vector<osgVerse::MeshLodBuilder::LevelResult>& levels =
+            lodBuilder->getLevelResults();
+        for (size_t i = 0; i < levels.size(); ++i)
+            std::cout << "LOD-" << i << ": Faces = " << levels[i].numFaces << ", Error = "
+                      << levels[i].geometricError << ", Pixels = [" << levels[i].minPixelSize
+                      << ", " << levels[i].maxPixelSize << "]" << std::endl;
+        lodNode->setStateSet(mtv.getMergedStateSet());
+        osgDB::writeNodeFile(*lodNode, "lodResult.osgb");
+    }
+
     osg::ref_ptr<osg::MatrixTransform> root = new osg::MatrixTransform;
     root->addChild(scene.get());
     root->addChild(topoMT.get());
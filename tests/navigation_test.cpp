@@ -0,0 +1,165 @@
+#include <osg/io_utils>
+#include <osg/Timer>
+#include <osg/MatrixTransform>
+#include <osg/ShapeDrawable>
+#include <osg/Geode>
+#include <osgGA/TrackballManipulator>
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+#include <animation/NavigationManager.h>
+#include <iostream>
+#include <sstream>
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static float randomValue(float range)
+{ return ((float)rand() / (float)RAND_MAX - 0.5f) * range; }
+
+static osg::Geode* createBox(const osg::Vec3& center, const osg::Vec3& size)
+{
+    osg::Geode* geode = new osg::Geode;
+    geode->addDrawable(new osg::ShapeDrawable(new osg::Box(center, size[0], size[1], size[2])));
+    return geode;
+}
+
+class AgentUpdater : public osg::NodeCallback
+{
+public:
+    AgentUpdater(osgVerse::NavigationManager* nav, float range) : _nav(nav), _range(range) {}
+    void addAgent(int id, osg::MatrixTransform* mt) { _agents[id] = mt; }
+
+    virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
+    {
+        int numActive = _nav->getAgentPositions(_positions);
+        for (std::map<int, osg::ref_ptr<osg::MatrixTransform>>::iterator itr = _agents.begin();
+             itr != _agents.end() && numActive > 0; ++itr)
+        {
+            // Choose a new target when the agent nearly stops
+            const osg::Vec3& pos = _positions[itr->first];
+            itr->second->setMatrix(osg::Matrix::translate(pos));
+            if (_nav->getAgentVelocity(itr->first).length2() < 0.01f)
+                _nav->setAgentTarget(itr->first, osg::Vec3(randomValue(_range),
+                                                           randomValue(_range), 0.0f));
+        }
+        traverse(node, nv);
+    }
+
+protected:
+    osg::ref_ptr<osgVerse::NavigationManager> _nav;
+    std::map<int, osg::ref_ptr<osg::MatrixTransform>> _agents;
+    std::vector<osg::Vec3> _positions;
+    float _range;
+};
+
+class ObstacleHandler : public osgGA::GUIEventHandler
+{
+public:
+    ObstacleHandler(osgVerse::NavigationManager* nav, osg::MatrixTransform* mt, int id, float r)
+    : _nav(nav), _obstacle(mt), _obstacleID(id), _range(r) {}
+
+    virtual bool handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa)
+    {
+        if (ea.getEventType() == osgGA::GUIEventAdapter::KEYDOWN &&
+            ea.getKey() == osgGA::GUIEventAdapter::KEY_Space)
+        {
+            // Move the obstacle, and only rebuild tiles around old and new places
+            osg::Matrix m = osg::Matrix::translate(randomValue(_range), randomValue(_range), 0.0f);
+            _obstacle->setMatrix(m);
+            _nav->updateWalkableGeometry(_obstacleID, _obstacle->getChild(0), m);
+
+            osg::Timer_t t0 = osg::Timer::instance()->tick();
+            int numTiles = _nav->rebuildModifiedTiles();
+            osg::Timer_t t1 = osg::Timer::instance()->tick();
+            OSG_NOTICE << "Rebuilt " << numTiles << " tiles: "
+                       << osg::Timer::instance()->delta_m(t0, t1) << "ms" << std::endl;
+        }
+        return false;
+    }
+
+protected:
+    osg::ref_ptr<osgVerse::NavigationManager> _nav;
+    osg::ref_ptr<osg::MatrixTransform> _obstacle;
+    int _obstacleID; float _range;
+};
+
+static void runBenchmark(osgVerse::NavigationManager* nav, float range, int numQueries)
+{
+    std::vector<osgVerse::NavigationManager::PathQuery> queries;
+    for (int i = 0; i < numQueries; ++i)
+        queries.push_back(osgVerse::NavigationManager::PathQuery(
+            osg::Vec3(randomValue(range), randomValue(range), 0.0f),
+            osg::Vec3(randomValue(range), randomValue(range), 0.0f)));
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick(); int numSerial = 0;
+    for (int i = 0; i < numQueries; ++i)
+    { if (nav->findPath(queries[i].start, queries[i].end, queries[i].path)) numSerial++; }
+
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    int numBatched = nav->findPaths(queries);
+    osg::Timer_t t2 = osg::Timer::instance()->tick();
+    OSG_NOTICE << "Path queries: " << numQueries << ", serial = "
+               << osg::Timer::instance()->delta_m(t0, t1) << "ms (" << numSerial
+               << " found), batched = " << osg::Timer::instance()->delta_m(t1, t2) << "ms ("
+               << numBatched << " found)" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    // navigation_test [--agents <count>] [--benchmark <queries>]
+    int numAgents = 200, numQueries = 0; float range = 200.0f;
+    for (int i = 1; i < argc - 1; ++i)
+    {
+        if (std::string(argv[i]) == "--agents") numAgents = atoi(argv[i + 1]);
+        else if (std::string(argv[i]) == "--benchmark") numQueries = atoi(argv[i + 1]);
+    }
+
+    osg::ref_ptr<osg::Group> root = new osg::Group;
+    osg::ref_ptr<osgVerse::NavigationManager> nav = new osgVerse::NavigationManager;
+    osg::ref_ptr<osg::Geode> ground = createBox(osg::Vec3(0.0f, 0.0f, -0.5f),
+                                                osg::Vec3(range, range, 1.0f));
+    nav->addWalkableGeometry(ground.get()); root->addChild(ground.get());
+    for (int i = 0; i < 100; ++i)
+    {
+        osg::ref_ptr<osg::Geode> wall = createBox(
+            osg::Vec3(randomValue(range), randomValue(range), 2.0f),
+            osg::Vec3(2.0f + fabs(randomValue(20.0f)), 2.0f + fabs(randomValue(20.0f)), 4.0f));
+        nav->addWalkableGeometry(wall.get()); root->addChild(wall.get());
+    }
+
+    osg::ref_ptr<osg::MatrixTransform> obstacle = new osg::MatrixTransform;
+    obstacle->addChild(createBox(osg::Vec3(0.0f, 0.0f, 2.0f), osg::Vec3(30.0f, 5.0f, 4.0f)));
+    int obstacleID = nav->addWalkableGeometry(obstacle->getChild(0));
+    root->addChild(obstacle.get());
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    if (!nav->build()) return 1;
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    OSG_NOTICE << "Navigation mesh built: " << osg::Timer::instance()->delta_m(t0, t1)
+               << "ms" << std::endl;
+    if (numQueries > 0) runBenchmark(nav.get(), range, numQueries);
+
+    // Agents are only steered by the crowd, without any physics queries
+    osg::ref_ptr<osg::Geode> agentShape = createBox(osg::Vec3(0.0f, 0.0f, 1.0f),
+                                                    osg::Vec3(1.0f, 1.0f, 2.0f));
+    osg::ref_ptr<AgentUpdater> updater = new AgentUpdater(nav.get(), range);
+    for (int i = 0; i < numAgents; ++i)
+    {
+        int id = nav->addAgent(osg::Vec3(randomValue(range), randomValue(range), 0.0f));
+        if (id < 0) continue;
+
+        osg::ref_ptr<osg::MatrixTransform> mt = new osg::MatrixTransform;
+        mt->addChild(agentShape.get()); root->addChild(mt.get());
+        updater->addAgent(id, mt.get());
+    }
+    root->addUpdateCallback(new osgVerse::NavigationUpdateCallback(nav.get()));
+    root->addUpdateCallback(updater.get());
+
+    osgViewer::Viewer viewer;
+    viewer.addEventHandler(new osgViewer::StatsHandler);
+    viewer.addEventHandler(new ObstacleHandler(nav.get(), obstacle.get(), obstacleID, range));
+    viewer.setCameraManipulator(new osgGA::TrackballManipulator);
+    viewer.setSceneData(root.get());
+    viewer.setUpViewOnSingleScreen(0);
+    return viewer.run();
+}
@@ -1,13 +1,19 @@
 #include <osg/io_utils>
+#include <osg/Timer>
 #include <osg/MatrixTransform>
 #include <osg/ShapeDrawable>
 #include <osg/Geometry>
+#include <osg/PagedLOD>
 #include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgDB/FileUtils>
+#include <osgDB/DatabasePager>
 #include <osgGA/TrackballManipulator>
 #include <osgViewer/Viewer>
 #include <osgViewer/ViewerEventHandlers>
 #include <animation/PhysicsEngine.h>
 #include <animation/Utilities.h>
+#include <pipeline/Global.h>
 #include <iostream>
 #include <sstream>
 
@@ -136,8 +142,260 @@ protected:
     int _sphereCount;
 };
 
+static int runBenchmark(int numBodies, int numRays)
+{
+    for (int mt = 0; mt < 2; ++mt)
+    {
+        // Create a debris-heavy world: lots of small boxes falling onto the ground
+        osg::ref_ptr<osgVerse::PhysicsEngine> physics = new osgVerse::PhysicsEngine(mt > 0);
+        physics->addRigidBody("ground",
+            osgVerse::createPhysicsBox(osg::Vec3(200.0f, 200.0f, 0.05f)));
+
+        int numColumns = (int)ceil(sqrt((double)numBodies));
+        for (int i = 0; i < numBodies; ++i)
+        {
+            osg::Vec3 pos((float)(i % numColumns) * 0.5f, (float)(i / numColumns) * 0.5f,
+                          1.0f + (float)(i % 7) * 0.5f);
+            physics->addRigidBody("debris" + std::to_string(i), osgVerse::createPhysicsBox(
+                osg::Vec3(0.2f, 0.2f, 0.2f)), 1.0f, osg::Matrix::translate(pos));
+        }
+
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+        for (int f = 0; f < 300; ++f) physics->advance(1.0f / 60.0f);
+        double stepTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+
+        // Copy transforms of moved bodies in bulk, compared with name-based queries
+        std::vector<osg::Matrix> matrices; bool valid = false;
+        physics->advance(1.0f / 60.0f); t0 = osg::Timer::instance()->tick();
+        int numMoved = physics->syncTransforms(matrices);
+        double syncTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+
+        t0 = osg::Timer::instance()->tick();
+        for (int i = 0; i < numBodies; ++i)
+            matrices[i] = physics->getTransform("debris" + std::to_string(i), valid);
+        double lookupTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+
+        // Cast sensor rays downwards, one by one and then in a batch
+        float range = (float)numColumns * 0.5f; std::vector<osgVerse::PhysicsEngine::Ray> rays;
+        for (int i = 0; i < numRays; ++i)
+        {
+            osg::Vec3 p((float)rand() / (float)RAND_MAX * range,
+                        (float)rand() / (float)RAND_MAX * range, 10.0f);
+            rays.push_back(osgVerse::PhysicsEngine::Ray(p, p - osg::Z_AXIS * 20.0f));
+        }
+
+        osgVerse::PhysicsEngine::RaycastHit hit; int numHits0 = 0;
+        t0 = osg::Timer::instance()->tick();
+        for (int i = 0; i < numRays; ++i)
+        { if (physics->raycast(rays[i].first, rays[i].second, hit, false)) numHits0++; }
+        double singleTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+
+        std::vector<osgVerse::PhysicsEngine::RaycastHit> hits;
+        t0 = osg::Timer::instance()->tick();
+        int numHits1 = physics->raycastBatch(rays, hits);
+        double batchTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+
+        std::cout << (physics->isMultithreaded() ? "Multithreaded" : "Single-threaded")
+                  << " world, " << numBodies << " bodies: step = " << stepTime / 300.0 << "ms; "
+                  << "sync = " << syncTime << "ms (" << numMoved << " moved), by name = "
+                  << lookupTime << "ms; "
+                  << numRays << " rays: single = " << singleTime << "ms (" << numHits0
+                  << " hits), batch = " << batchTime << "ms (" << numHits1 << " hits)\n";
+    }
+    return 0;
+}
+
+class FindPlayerVisitor : public osg::NodeVisitor
+{
+public:
+    FindPlayerVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), player(NULL) {}
+    osgVerse::PlayerAnimation* player; osg::NodePath playerPath;
+
+    virtual void apply(osg::Geode& geode)
+    {
+        osgVerse::PlayerAnimation* p =
+            dynamic_cast<osgVerse::PlayerAnimation*>(geode.getUpdateCallback());
+        if (p && !player) { player = p; playerPath = getNodePath(); }
+        traverse(geode);
+    }
+};
+
+class RagdollHandler : public osgGA::GUIEventHandler
+{
+public:
+    RagdollHandler(osgVerse::PhysicsRagdoll* r) : _ragdoll(r) {}
+
+    virtual bool handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa)
+    {
+        if (ea.getEventType() == osgGA::GUIEventAdapter::KEYDOWN &&
+            ea.getKey() == osgGA::GUIEventAdapter::KEY_Space)
+        {
+            _ragdoll->setSimulated(!_ragdoll->isSimulated(), 0.3f);
+            OSG_NOTICE << "Ragdoll " << (_ragdoll->isSimulated() ? "simulated" : "animated")
+                       << std::endl;
+        }
+        return false;
+    }
+
+protected:
+    osg::ref_ptr<osgVerse::PhysicsRagdoll> _ragdoll;
+};
+
+static int runRagdoll(const std::string& file)
+{
+    osg::ref_ptr<osg::Geode> ground = new osg::Geode;
+    ground->addDrawable(new osg::ShapeDrawable(new osg::Box(osg::Vec3(), 20.0f, 20.0f, 0.1f)));
+
+    osg::ref_ptr<osg::MatrixTransform> character = new osg::MatrixTransform;
+    character->setMatrix(osg::Matrix::rotate(osg::PI_2, osg::X_AXIS) *
+                         osg::Matrix::translate(0.0f, 0.0f, 0.5f));
+    character->addChild(osgDB::readNodeFile(file));
+
+    osg::ref_ptr<osg::MatrixTransform> root = new osg::MatrixTransform;
+    root->addChild(ground.get()); root->addChild(character.get());
+    FindPlayerVisitor fpv; root->accept(fpv);
+    if (!fpv.player) { OSG_WARN << "No player found in " << file << std::endl; return 1; }
+
+    osg::ref_ptr<osgVerse::PhysicsEngine> physics = new osgVerse::PhysicsEngine;
+    physics->addRigidBody("ground", osgVerse::createPhysicsBox(osg::Vec3(10.0f, 10.0f, 0.05f)));
+
+    osgViewer::Viewer viewer;
+    viewer.addEventHandler(new osgViewer::StatsHandler);
+    viewer.setCameraManipulator(new osgGA::TrackballManipulator);
+    viewer.setSceneData(root.get());
+    viewer.setUpViewOnSingleScreen(0);
+    viewer.frame();  // update once to get the animated pose
+
+    // Press space to switch between animation and simulation
+    osg::ref_ptr<osgVerse::PhysicsRagdoll> ragdoll = new osgVerse::PhysicsRagdoll(physics.get());
+    if (!ragdoll->build(fpv.player, "girl:", osg::computeLocalToWorld(fpv.playerPath)))
+    { OSG_WARN << "Failed to build ragdoll" << std::endl; return 1; }
+    viewer.addEventHandler(new RagdollHandler(ragdoll.get()));
+
+    while (!viewer.done())
+    {
+        physics->advance(0.02f);
+        viewer.frame();
+    }
+    return 0;
+}
+
+static osg::Node* createTerrainTile(int tx, int ty, float tileSize)
+{
+    const unsigned int numCells = 32;
+    osg::ref_ptr<osg::HeightField> hf = new osg::HeightField;
+    hf->allocate(numCells + 1, numCells + 1);
+    hf->setXInterval(tileSize / numCells); hf->setYInterval(tileSize / numCells);
+    for (unsigned int r = 0; r <= numCells; ++r)
+        for (unsigned int c = 0; c <= numCells; ++c)
+        {
+            float x = tx * tileSize + c * hf->getXInterval();
+            float y = ty * tileSize + r * hf->getYInterval();
+            hf->setHeight(c, r, sin(x * 0.2f) * cos(y * 0.15f) * 2.0f);
+        }
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(new osg::ShapeDrawable(hf.get()));
+    osg::MatrixTransform* tile = new osg::MatrixTransform;
+    tile->setMatrix(osg::Matrix::translate(tx * tileSize, ty * tileSize, 0.0f));
+    tile->addChild(geode.get()); return tile;
+}
+
+static int runTerrain(int numTiles, bool paged)
+{
+    // Tiles of heightfields, added directly or loaded by the database pager
+    osg::ref_ptr<osg::MatrixTransform> root = new osg::MatrixTransform;
+    osg::ref_ptr<osgVerse::PhysicsEngine> physics = new osgVerse::PhysicsEngine;
+    osg::ref_ptr<osgVerse::PhysicsTerrainManager> terrain =
+        new osgVerse::PhysicsTerrainManager(physics.get());
+    terrain->setActivationRadius(20.0f);
+
+    const float tileSize = 32.0f; const std::string tileDir = "physics_terrain_tiles";
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options;
+    if (paged)
+    {
+        // Loaded tiles are registered from pager threads, and merged to the scene later
+        osgDB::makeDirectory(tileDir);
+        terrain->installReadFileCallback(options.get());
+    }
+
+    for (int ty = 0; ty < numTiles; ++ty)
+        for (int tx = 0; tx < numTiles; ++tx)
+        {
+            osg::ref_ptr<osg::Node> tile = createTerrainTile(tx, ty, tileSize);
+            if (!paged)
+            {
+                root->addChild(tile.get());
+                terrain->addTerrainTile(tile.get()); continue;
+            }
+
+            std::stringstream ss; ss << tileDir << "/tile_" << tx << "_" << ty << ".osgb";
+            if (!osgDB::writeNodeFile(*tile, ss.str()))
+            { OSG_WARN << "Failed to write terrain tile " << ss.str() << std::endl; return 1; }
+
+            osg::ref_ptr<osg::PagedLOD> plod = new osg::PagedLOD;
+            plod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+            plod->setCenter(osg::Vec3((tx + 0.5f) * tileSize, (ty + 0.5f) * tileSize, 0.0f));
+            plod->setRadius(tileSize * 0.75f);
+            plod->setFileName(0, ss.str()); plod->setRange(0, 0.0f, tileSize * 3.0f);
+            plod->setMinimumExpiryTime(0, 1.0); plod->setMinimumExpiryFrames(0, 60);
+            plod->setDatabaseOptions(options.get()); root->addChild(plod.get());
+        }
+    root->addUpdateCallback(terrain.get());
+
+    // Press Enter to shoot spheres, only tiles near them are added to the physics world.
+    // Paged tiles expire when the camera leaves them, and are released once no body is near
+    osgViewer::Viewer viewer;
+    viewer.addEventHandler(new ShootSphereHandler(physics.get(), root.get()));
+    viewer.addEventHandler(new osgViewer::StatsHandler);
+    viewer.setCameraManipulator(new osgGA::TrackballManipulator);
+    viewer.setSceneData(root.get());
+    viewer.setUpViewOnSingleScreen(0);
+    if (paged && viewer.getDatabasePager())
+        viewer.getDatabasePager()->setTargetMaximumNumberOfPageLOD(16);
+
+    unsigned int numActiveTiles = 0, numTilesLoaded = 0;
+    while (!viewer.done())
+    {
+        physics->advance(0.02f);
+        viewer.frame();
+        if (numActiveTiles != terrain->getNumActiveTiles() ||
+            numTilesLoaded != terrain->getNumTiles())
+        {
+            numActiveTiles = terrain->getNumActiveTiles();
+            numTilesLoaded = terrain->getNumTiles();
+            OSG_NOTICE << "Active terrain tiles: " << numActiveTiles << " / "
+                       << numTilesLoaded << std::endl;
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
+    // Benchmark: physics_basic_test --benchmark <bodies> <rays>
+    for (int i = 1; i < argc - 2; ++i)
+    {
+        if (std::string(argv[i]) == "--benchmark")
+            return runBenchmark(atoi(argv[i + 1]), atoi(argv[i + 2]));
+    }
+
+    // Ragdoll: physics_basic_test --ragdoll
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--ragdoll")
+            return runRagdoll(BASE_DIR "/models/Characters/girl.glb");
+    }
+
+    // Terrain: physics_basic_test --terrain <tiles per side>
+    // Paged terrain: physics_basic_test --paged-terrain <tiles per side>
+    for (int i = 1; i < argc - 1; ++i)
+    {
+        if (std::string(argv[i]) == "--terrain") return runTerrain(atoi(argv[i + 1]), false);
+        if (std::string(argv[i]) == "--paged-terrain")
+            return runTerrain(atoi(argv[i + 1]), true);
+    }
+
     const float groundSize = 40.0f, groundThickness = 0.1f;
     const float boxHalfSize = 0.49f, boxMass = 2.0f;
 
@@ -193,8 +451,10 @@ int main(int argc, char** argv)
         osg::Vec3(groundSize * 0.5f, groundSize * 0.5f, groundThickness * 0.5f)), 0.0f);
     if (cessnaModel.valid())
     {
-        physics->addRigidBody("cessna", osgVerse::createPhysicsHull(
-            cessnaMT->getChild(0)), 15.0f, cessnaMT->getMatrix());
+        // Decomposed into convex parts, and shared if the same model is added again
+        physics->addRigidBody("cessna", osgVerse::getOrCreatePhysicsShape(
+            physics.get(), cessnaMT->getChild(0), osgVerse::COMPOUND_HULL_SHAPE),
+            15.0f, cessnaMT->getMatrix());
     }
 
     for (int i = 0; i < 50; ++i)
@@ -204,9 +464,13 @@ int main(int argc, char** argv)
     // Setup callbacks for scene object to update its pose
     groundMT->setUpdateCallback(new osgVerse::PhysicsUpdateCallback(physics.get(), "ground"));
     if (cessnaModel.valid()) cessnaMT->setUpdateCallback(new osgVerse::PhysicsUpdateCallback(physics.get(), "cessna"));
+
+    // Boxes are synced in bulk, only moving ones are touched every frame
+    osg::ref_ptr<osgVerse::PhysicsSyncCallback> syncCallback =
+        new osgVerse::PhysicsSyncCallback(physics.get());
     for (int i = 0; i < 50; ++i)
-        boxMT[i]->setUpdateCallback(
-            new osgVerse::PhysicsUpdateCallback(physics.get(), "box" + std::to_string(i)));
+        syncCallback->addTransform("box" + std::to_string(i), boxMT[i].get());
+    root->addUpdateCallback(syncCallback.get());
 
     // Start the viewer
     osgViewer::Viewer viewer;
@@ -1,4 +1,5 @@
 #include <osg/io_utils>
+#include <osg/Timer>
 #include <osg/MatrixTransform>
 #include <osg/Geometry>
 #include <osgDB/ReadFile>
@@ -8,6 +9,7 @@
 #include <osgViewer/Viewer>
 #include <osgViewer/ViewerEventHandlers>
 #include <pipeline/Global.h>
+#include <pipeline/Pipeline.h>
 #include <animation/PlayerAnimation.h>
 #include <animation/BlendShapeAnimation.h>
 #include <iostream>
@@ -39,9 +41,135 @@ osgVerse::PlayerAnimation* findAnimationManager(osg::Node* node)
     return fav.pAnim;
 }
 
+static int runCrowdBenchmark(const std::string& file, int numPlayers, bool parallel)
+{
+    osg::ref_ptr<osgVerse::CrowdAnimationManager> crowdManager = new osgVerse::CrowdAnimationManager;
+    crowdManager->setParallel(parallel);
+
+    osg::ref_ptr<osg::Group> crowd = new osg::Group;
+    crowd->addUpdateCallback(crowdManager.get());
+    int numColumns = (int)ceil(sqrt((double)numPlayers));
+    for (int i = 0; i < numPlayers; ++i)
+    {
+        // Read the character every time, so that each one has its own player
+        osg::ref_ptr<osg::Node> player = osgDB::readNodeFile(file);
+        if (!player) { OSG_WARN << "Failed to load " << file << std::endl; return 1; }
+
+        osg::ref_ptr<osg::MatrixTransform> mt = new osg::MatrixTransform;
+        mt->setMatrix(osg::Matrix::translate(
+            (float)(i % numColumns) * 2.0f, (float)(i / numColumns) * 2.0f, 0.0f));
+        mt->addChild(player.get()); crowd->addChild(mt.get());
+    }
+
+    osg::ref_ptr<osg::MatrixTransform> root = new osg::MatrixTransform;
+    root->setMatrix(osg::Matrix::rotate(osg::PI_2, osg::X_AXIS));
+    root->addChild(crowd.get());
+
+    osgViewer::Viewer viewer;
+    viewer.addEventHandler(new osgViewer::StatsHandler);
+    viewer.setCameraManipulator(new osgGA::TrackballManipulator);
+    viewer.setSceneData(root.get());
+    viewer.setUpViewOnSingleScreen(0);
+    viewer.realize();
+
+    double updateTime = 0.0; int numFrames = 0;
+    while (!viewer.done())
+    {
+        viewer.advance(); viewer.eventTraversal();
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+        viewer.updateTraversal();
+        updateTime += osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+        viewer.renderingTraversals();
+
+        if ((++numFrames) % 120 == 0)
+        {
+            std::cout << "Crowd of " << numPlayers << (parallel ? " (parallel)" : " (serial)")
+                      << ": players evaluated = " << crowdManager->getNumEvaluatedPlayers()
+                      << ", update traversal = " << updateTime / numFrames << "ms\n";
+            updateTime = 0.0; numFrames = 0;
+        }
+    }
+    return 0;
+}
+
+static const char* crowdFragmentShaderCode = {
+    "uniform sampler2D DiffuseMap;\n"
+    "VERSE_FS_IN vec4 texCoord0, texCoord1, color;\n"
+    "VERSE_FS_IN vec3 eyeNormal, eyeTangent, eyeBinormal;\n"
+    "VERSE_FS_OUT vec4 fragData;\n"
+    "void main() {\n"
+    "    float lambert = max(dot(normalize(eyeNormal), vec3(0.0, 0.0, 1.0)), 0.2);\n"
+    "    fragData = vec4(VERSE_TEX2D(DiffuseMap, texCoord0.xy).rgb * color.rgb * lambert, 1.0);\n"
+    "    VERSE_FS_FINAL(fragData);\n"
+    "}\n"
+};
+
+static int runInstancedCrowd(const std::string& file, int numPlayers)
+{
+    osg::ref_ptr<osg::Node> player = osgDB::readNodeFile(file);
+    osgVerse::PlayerAnimation* animManager = findAnimationManager(player.get());
+    if (!animManager) { OSG_WARN << "No player found in " << file << std::endl; return 1; }
+
+    // Bake all clips of the player and draw every character with instancing
+    osg::ref_ptr<osg::Geode> crowd = new osg::Geode;
+    osg::ref_ptr<osgVerse::InstancedCrowd> instancer = new osgVerse::InstancedCrowd;
+    if (!instancer->initialize(animManager, *crowd, animManager->getAnimationNames())) return 1;
+    crowd->addUpdateCallback(instancer.get());
+
+    int numColumns = (int)ceil(sqrt((double)numPlayers));
+    int numClips = (int)instancer->getClips().size();
+    for (int i = 0; i < numPlayers; ++i)
+    {
+        osgVerse::InstancedCrowd::Instance instance;
+        instance.position.set((float)(i % numColumns) * 2.0f,
+                              (float)(i / numColumns) * 2.0f, 0.0f);
+        instance.heading = (float)(rand() % 360) * osg::PI / 180.0f;
+        instance.timeOffset = (float)rand() / (float)RAND_MAX * 10.0f;
+        instance.clip = (numClips > 0) ? (i % numClips) : 0;
+        instancer->addInstance(instance);
+    }
+
+    // Vertex shader is the pipeline one, so a deferred pipeline can use it with its GBuffer FS
+    osg::Shader* vs = osgDB::readShaderFile(
+        osg::Shader::VERTEX, SHADER_DIR "std_gbuffer_crowd.vert.glsl");
+    osg::Shader* fs = new osg::Shader(osg::Shader::FRAGMENT, crowdFragmentShaderCode);
+    if (!vs) { OSG_WARN << "Failed to load crowd shader" << std::endl; return 1; }
+    osgVerse::Pipeline::createShaderDefinitions(vs, 100, 130);
+    osgVerse::Pipeline::createShaderDefinitions(fs, 100, 130);
+
+    osg::ref_ptr<osg::Program> program = new osg::Program;
+    program->addShader(vs); program->addShader(fs);
+    program->addBindAttribLocation("osg_Tangent", 6);
+    crowd->getOrCreateStateSet()->setAttributeAndModes(
+        program.get(), osg::StateAttribute::ON | osg::StateAttribute::PROTECTED);
+    crowd->getOrCreateStateSet()->addUniform(new osg::Uniform("DiffuseMap", (int)0));
+
+    osg::ref_ptr<osg::MatrixTransform> root = new osg::MatrixTransform;
+    root->setMatrix(osg::Matrix::rotate(osg::PI_2, osg::X_AXIS));
+    root->addChild(crowd.get());
+
+    osgViewer::Viewer viewer;
+    viewer.addEventHandler(new osgViewer::StatsHandler);
+    viewer.setCameraManipulator(new osgGA::TrackballManipulator);
+    viewer.setSceneData(root.get());
+    viewer.setUpViewOnSingleScreen(0);
+    return viewer.run();
+}
+
 int main(int argc, char** argv)
 {
     osgVerse::globalInitialize(argc, argv);
+    for (int i = 1; i < argc - 1; ++i)
+    {
+        // Instancing: player_animation_test --instanced <count>
+        if (std::string(argv[i]) == "--instanced")
+            return runInstancedCrowd(BASE_DIR "/models/Characters/girl.glb", atoi(argv[i + 1]));
+
+        // Benchmark: player_animation_test --crowd <count> [--serial]
+        if (std::string(argv[i]) != "--crowd") continue;
+        bool parallel = !(i + 2 < argc && std::string(argv[i + 2]) == "--serial");
+        return runCrowdBenchmark(BASE_DIR "/models/Characters/girl.glb", atoi(argv[i + 1]), parallel);
+    }
 
     osg::ref_ptr<osg::MatrixTransform> skeleton = new osg::MatrixTransform;
     osg::ref_ptr<osg::MatrixTransform> playerRoot = new osg::MatrixTransform;
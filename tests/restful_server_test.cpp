@@ -16,6 +16,7 @@
 #include <pipeline/SkyBox.h>
 #include <pipeline/Pipeline.h>
 #include <pipeline/Utilities.h>
+#include <script/JsonScript.h>
 #include <iostream>
 #include <sstream>
 
@@ -121,7 +122,40 @@ public:
         return response_status(ctx, 200, "OK");
     }
 
+    // curl -v http://127.0.0.1:2520/script/set -H "Content-Type:application/json"
+    //      -d "{\"object\":\"root\", \"properties\": ...}"
+    // curl -v http://127.0.0.1:2520/script/set -F "json={\"object\": ..., \"properties\":
+    //      {\"Vertices\": {\"offset\": 0, \"count\": 300}}}" -F "payload=@vertices.bin"
+    static int execute_script(const HttpContextPtr& ctx)
+    {
+        std::string command = ctx->param("command"), json;
+        std::vector<unsigned char> payload; bool withPayload = false;
+        if (ctx->is(MULTIPART_FORM_DATA))
+        {
+            std::string data = ctx->request->GetFormData("payload");
+            json = ctx->request->GetFormData("json");
+            payload.assign(data.begin(), data.end()); withPayload = true;
+        }
+        else if (ctx->is(APPLICATION_JSON))
+            json = ctx->body();
+        else
+            return response_status(ctx, HTTP_STATUS_BAD_REQUEST);
+
+        picojson::value in, out;
+        std::string error = picojson::parse(in, json);
+        if (!error.empty()) return response_status(ctx, HTTP_STATUS_BAD_REQUEST, error.c_str());
+
+        osgVerse::JsonScript::ExecutionType type = osgVerse::JsonScript::EXE_Get;
+        if (command == "create") type = osgVerse::JsonScript::EXE_Creation;
+        else if (command == "set") type = osgVerse::JsonScript::EXE_Set;
+        else if (command == "remove") type = osgVerse::JsonScript::EXE_Remove;
+        else if (command == "list") type = osgVerse::JsonScript::EXE_List;
+        out = scripter->execute(type, in, withPayload ? &payload : NULL);
+        return ctx->send(out.serialize(false), APPLICATION_JSON);
+    }
+
     static osg::ref_ptr<osg::Group> root;
+    static osg::ref_ptr<osgVerse::JsonScript> scripter;
     static osgViewer::Viewer viewer;
 
 protected:
@@ -155,6 +189,7 @@ protected:
 };
 
 osg::ref_ptr<osg::Group> Handler::root;
+osg::ref_ptr<osgVerse::JsonScript> Handler::scripter;
 osgViewer::Viewer Handler::viewer;
 
 int main(int argc, char** argv)
@@ -170,6 +205,7 @@ int main(int argc, char** argv)
     service.GET("/camera/matrix", Handler::get_matrix);
     service.POST("/scene/:npath", Handler::add_child);
     service.Delete("/scene/:npath", Handler::remove_child);
+    service.POST("/script/:command", Handler::execute_script);
     server.registerHttpService(&service);
     server.start();
 
@@ -180,6 +216,8 @@ int main(int argc, char** argv)
     Handler::root = new osg::Group;
     Handler::root->addChild(node);
     Handler::root->setName("root");
+    Handler::scripter = new osgVerse::JsonScript;
+    Handler::scripter->setRootNode(Handler::root.get());
 
     Handler::viewer;
     Handler::viewer.addEventHandler(new osgViewer::StatsHandler);
@@ -187,5 +225,17 @@ int main(int argc, char** argv)
     Handler::viewer.setCameraManipulator(new osgGA::TrackballManipulator);
     Handler::viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
     Handler::viewer.setSceneData(Handler::root.get());
-    return Handler::viewer.run();
+    Handler::viewer.realize();
+
+    // Script commands from server threads are applied only between update traversals
+    while (!Handler::viewer.done())
+    {
+        Handler::viewer.advance();
+        {
+            std::lock_guard<std::recursive_mutex> lock(Handler::scripter->getSceneMutex());
+            Handler::viewer.eventTraversal(); Handler::viewer.updateTraversal();
+        }
+        Handler::viewer.renderingTraversals();
+    }
+    return 0;
 }
@@ -2,6 +2,7 @@
 #include <osg/LightSource>
 #include <osg/Texture2D>
 #include <osg/MatrixTransform>
+#include <osg/Timer>
 #include <osgDB/ClassInterface>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
@@ -81,6 +82,48 @@ int main(int argc, char** argv)
     std::cout << "Exe4: " << ret4.serialize(true);
     std::cout << "Exe5 (FAILED): " << ret5.serialize(true);
 
+    // Micro-benchmark: set properties by node path vs. by pre-resolved handle
+    {
+        const int numCalls = 5000; std::string path = id2 + "/0";
+        std::string matrix = ret2.get("value").to_str();
+        osgVerse::ScriptBase::PropertyMap props; props["Matrix"] = matrix;
+
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+        for (int i = 0; i < numCalls; ++i) scripter->set(path, props);
+
+        osg::Timer_t t1 = osg::Timer::instance()->tick();
+        int handle = scripter->resolveProperty(path, "Matrix");
+        for (int i = 0; i < numCalls; ++i) scripter->set(handle, matrix);
+        scripter->releaseProperty(handle);
+
+        osg::Timer_t t2 = osg::Timer::instance()->tick();
+        std::cout << "Setting " << numCalls << " properties: by path = "
+                  << osg::Timer::instance()->delta_m(t0, t1) << "ms, by handle = "
+                  << osg::Timer::instance()->delta_m(t1, t2) << "ms\n";
+    }
+
+    // Batched commands with native JSON values, executed in one call
+    {
+        std::string batch = "[{\"command\": \"set\", \"object\": \"" + id1 + "\", \"properties\": "
+                            "{\"Matrix\": [1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 20, 1, 0, 1]}}, "
+                            "{\"command\": \"get\", \"object\": \"" + id1 + "\", \"property\": \"Matrix\"}]";
+        picojson::parse(exe, batch);
+        std::cout << "Batch: " << scripter->execute(osgVerse::JsonScript::EXE_Set, exe).serialize(true);
+    }
+
+    // Bulk values read from binary payload, as sent by the REST and WASM entry points
+    {
+        osg::Matrixf matrix = osg::Matrixf::translate(20.0f, 2.0f, 0.0f);
+        std::vector<unsigned char> payload(16 * sizeof(float));
+        memcpy(&payload[0], matrix.ptr(), payload.size());
+
+        std::string cmd = "{\"object\": \"" + id1 + "\", \"properties\": "
+                          "{\"Matrix\": {\"offset\": 0, \"count\": 16}}}";
+        picojson::parse(exe, cmd);
+        std::cout << "Payload: " << scripter->execute(
+            osgVerse::JsonScript::EXE_Set, exe, &payload).serialize(true);
+    }
+
     osgVerse::QuickEventHandler* handler = new osgVerse::QuickEventHandler;
     handler->addKeyUpCallback('t', [&](int key) {
         s1 = "{\"class\": \"osg::MatrixTransform\"}";
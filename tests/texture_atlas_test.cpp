@@ -0,0 +1,174 @@
+#include <osg/io_utils>
+#include <osg/Texture2D>
+#include <osg/Geometry>
+#include <osg/Geode>
+#include <osg/MatrixTransform>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgGA/TrackballManipulator>
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+#include <iostream>
+#include <sstream>
+#include <set>
+#include <pipeline/Utilities.h>
+
+#include <backward.hpp>  // for better debug info
+namespace backward { backward::SignalHandling sh; }
+
+static int s_numFailures = 0;
+#define CHECK(expr, msg) \
+    if (!(expr)) { OSG_WARN << "[FAILED] " << msg << std::endl; s_numFailures++; } \
+    else OSG_NOTICE << "[OK] " << msg << std::endl;
+
+static osg::Image* createColorImage(int w, int h, const osg::Vec4ub& color)
+{
+    osg::Image* image = new osg::Image;
+    image->allocateImage(w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    osg::Vec4ub* ptr = (osg::Vec4ub*)image->data();
+    for (int i = 0; i < w * h; ++i) *(ptr + i) = color;
+    return image;
+}
+
+static bool checkPixels(osgVerse::TextureAtlas* atlas, size_t id, const osg::Vec4ub& color)
+{
+    // The element and its gutter should all be filled with the same color
+    int page = 0, x = 0, y = 0, w = 0, h = 0, p = atlas->getPadding();
+    if (!atlas->getPackingData(id, page, x, y, w, h)) return false;
+
+    osg::Image* image = atlas->getImage(page);
+    int x0 = osg::maximum(x - p, 0), x1 = osg::minimum(x + w + p, image->s());
+    int y0 = osg::maximum(y - p, 0), y1 = osg::minimum(y + h + p, image->t());
+    for (int t = y0; t < y1; ++t)
+        for (int s = x0; s < x1; ++s)
+        { if (*(osg::Vec4ub*)image->data(s, t) != color) return false; }
+    return true;
+}
+
+static bool checkOverlapping(osgVerse::TextureAtlas* atlas, const std::set<size_t>& ids)
+{
+    std::vector<osg::Vec4> rects[4];
+    for (std::set<size_t>::const_iterator itr = ids.begin(); itr != ids.end(); ++itr)
+    {
+        int page = 0, x = 0, y = 0, w = 0, h = 0;
+        if (!atlas->getPackingData(*itr, page, x, y, w, h)) continue;
+
+        std::vector<osg::Vec4>& list = rects[page];
+        for (size_t i = 0; i < list.size(); ++i)
+        {
+            const osg::Vec4& r = list[i];
+            if (x < r[0] + r[2] && r[0] < x + w && y < r[1] + r[3] && r[1] < y + h)
+                return true;
+        }
+        list.push_back(osg::Vec4(x, y, w, h));
+    }
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    const osg::Vec4ub colors[4] = {
+        osg::Vec4ub(255, 0, 0, 255), osg::Vec4ub(0, 255, 0, 255),
+        osg::Vec4ub(0, 0, 255, 255), osg::Vec4ub(255, 255, 0, 255)
+    };
+
+    osg::ref_ptr<osgVerse::TextureAtlas> atlas = new osgVerse::TextureAtlas(256, 256, 2);
+    std::set<size_t> alive, evicted;
+    atlas->setPadding(2);
+    atlas->setEvictionCallback([&](size_t id) { evicted.insert(id); alive.erase(id); });
+
+    // Fill both pages with 60x60 elements: 4x4 per page including the gutter
+    std::vector<size_t> ids;
+    for (int i = 0; i < 32; ++i)
+    {
+        osg::ref_ptr<osg::Image> image = createColorImage(60, 60, colors[i % 4]);
+        size_t id = atlas->addElement(image.get());
+        if (id > 0) { ids.push_back(id); alive.insert(id); }
+    }
+    CHECK(ids.size() == 32 && atlas->getNumPages() == 2, "Fill two atlas pages");
+    CHECK(evicted.empty(), "No eviction before pages are full");
+    CHECK(!checkOverlapping(atlas.get(), alive), "No overlapping elements");
+
+    bool gutterFilled = true;
+    for (size_t i = 0; i < ids.size(); ++i)
+        gutterFilled &= checkPixels(atlas.get(), ids[i], colors[i % 4]);
+    CHECK(gutterFilled, "Gutters filled with edge pixels");
+
+    // Removing elements leaves holes, which should be reused without eviction
+    atlas->removeElement(ids[5]); atlas->removeElement(ids[6]); atlas->removeElement(ids[20]);
+    alive.erase(ids[5]); alive.erase(ids[6]); alive.erase(ids[20]);
+    {
+        osg::ref_ptr<osg::Image> image = createColorImage(60, 60, colors[3]);
+        size_t id0 = atlas->addElement(image.get()), id1 = atlas->addElement(image.get());
+        if (id0 > 0) alive.insert(id0);
+        if (id1 > 0) alive.insert(id1);
+        CHECK(id0 > 0 && id1 > 0 && evicted.empty(), "Reuse space of removed elements");
+        CHECK(checkPixels(atlas.get(), id0, colors[3]) && checkPixels(atlas.get(), id1, colors[3]),
+              "Reused elements overwrite old pixels and gutters");
+    }
+
+    // Two adjacent holes should be merged to hold a wider element
+    size_t left = 0, right = 0;
+    for (size_t i = 0; i < 16 && !right; ++i)
+    {
+        int page0 = 0, x0 = 0, y0 = 0, w0 = 0, h0 = 0;
+        if (!atlas->getPackingData(ids[i], page0, x0, y0, w0, h0)) continue;
+        for (size_t j = 0; j < 16 && !right; ++j)
+        {
+            int page1 = 0, x1 = 0, y1 = 0, w1 = 0, h1 = 0;
+            if (!atlas->getPackingData(ids[j], page1, x1, y1, w1, h1)) continue;
+            if (page0 == page1 && y0 == y1 && x1 == x0 + 64) { left = ids[i]; right = ids[j]; }
+        }
+    }
+    atlas->removeElement(left); atlas->removeElement(right);
+    alive.erase(left); alive.erase(right);
+
+    size_t wideId = 0;
+    {
+        osg::ref_ptr<osg::Image> image = createColorImage(120, 60, colors[1]);
+        wideId = atlas->addElement(image.get()); if (wideId > 0) alive.insert(wideId);
+        CHECK(wideId > 0 && evicted.empty(), "Merge adjacent holes for a wider element");
+        CHECK(!checkOverlapping(atlas.get(), alive), "No overlapping after rebuilding");
+    }
+
+    // Keep the first page in use, so the second page is evicted for a new element
+    atlas->touchElement(wideId);
+    {
+        osg::ref_ptr<osg::Image> image = createColorImage(100, 100, colors[2]);
+        size_t id = atlas->addElement(image.get()); if (id > 0) alive.insert(id);
+
+        int page = -1, x = 0, y = 0, w = 0, h = 0;
+        atlas->getPackingData(id, page, x, y, w, h);
+        CHECK(id > 0 && page == 1, "Evict least recently used page");
+        CHECK(evicted.size() == 15 && evicted.count(ids[16]) > 0 && evicted.count(wideId) == 0,
+              "Eviction callback reports all elements of the page");
+        CHECK(!atlas->getPackingData(ids[16], page, x, y, w, h), "Evicted elements invalidated");
+        CHECK(checkPixels(atlas.get(), id, colors[2]), "Evicted page overwritten");
+        CHECK(!checkOverlapping(atlas.get(), alive), "No overlapping after eviction");
+    }
+
+    osg::ref_ptr<osg::Image> tooLarge = createColorImage(300, 60, colors[0]);
+    CHECK(atlas->addElement(tooLarge.get()) == 0, "Reject images larger than the page");
+    CHECK(!atlas->updateElement(ids[16], tooLarge.get()), "Reject updating evicted elements");
+
+    // Show atlas pages side by side
+    osg::ref_ptr<osg::MatrixTransform> root = new osg::MatrixTransform;
+    for (int i = 0; i < atlas->getNumPages(); ++i)
+    {
+        osg::Geode* geode = new osg::Geode;
+        geode->addDrawable(osg::createTexturedQuadGeometry(
+            osg::X_AXIS * 1.1f * (float)i, osg::X_AXIS, osg::Z_AXIS));
+        geode->getOrCreateStateSet()->setTextureAttributeAndModes(0, atlas->getTexture(i));
+        geode->getOrCreateStateSet()->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+        root->addChild(geode);
+    }
+    OSG_NOTICE << "Texture atlas test: " << s_numFailures << " failure(s)" << std::endl;
+    if (s_numFailures > 0) return 1;
+
+    osgViewer::Viewer viewer;
+    viewer.addEventHandler(new osgViewer::StatsHandler);
+    viewer.addEventHandler(new osgViewer::WindowSizeHandler);
+    viewer.setCameraManipulator(new osgGA::TrackballManipulator);
+    viewer.setSceneData(root.get());
+    return viewer.run();
+}
@@ -3,7 +3,10 @@
 #include <osg/Texture3D>
 #include <osg/ImageSequence>
 #include <osg/ImageUtils>
+#include <osg/CullFace>
 #include <osg/MatrixTransform>
+#include <osg/Program>
+#include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 #include <osgGA/TrackballManipulator>
@@ -16,13 +19,90 @@
 #include <backward.hpp>  // for better debug info
 namespace backward { backward::SignalHandling sh; }
 
+static const char* brickVertCode = {
+    "varying vec3 rayStart, eyePosition;\n"
+    "void main() {\n"
+    "    rayStart = gl_Vertex.xyz;\n"
+    "    eyePosition = (gl_ModelViewMatrixInverse * vec4(0.0, 0.0, 0.0, 1.0)).xyz;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n"
+};
+
+static const char* brickFragCode = {
+    "uniform sampler3D BrickAtlas, BrickIndirection;\n"
+    "uniform vec3 BrickAtlasCount, BrickIndirectionSize, BrickParameters;\n"
+    "varying vec3 rayStart, eyePosition;\n"
+
+    "vec2 intersectBox(vec3 orig, vec3 dir, vec3 bMin, vec3 bMax) {\n"
+    "    vec3 t0 = (bMin - orig) / dir, t1 = (bMax - orig) / dir;\n"
+    "    vec3 tMin = min(t0, t1), tMax = max(t0, t1);\n"
+    "    return vec2(max(max(tMin.x, tMin.y), tMin.z), min(min(tMax.x, tMax.y), tMax.z));\n"
+    "}\n"
+
+    "void main() {\n"
+    "    vec3 dir = normalize(rayStart - eyePosition);\n"
+    "    vec2 range = intersectBox(eyePosition, dir, vec3(0.0), vec3(1.0));\n"
+    "    float t = max(range.x, 0.0), stepSize = 0.5 / (BrickIndirectionSize.x * BrickParameters.x);\n"
+    "    vec3 atlasSize = BrickAtlasCount * BrickParameters.y; vec4 color = vec4(0.0);\n"
+    "    for (int i = 0; i < 2048 && t < range.y && color.a < 0.99; ++i) {\n"
+    "        vec3 uvw = eyePosition + dir * t, cell = uvw * BrickIndirectionSize;\n"
+    "        vec4 brick = texture3D(BrickIndirection, uvw);\n"
+    "        if (brick.a < 0.5) {\n"  // empty leaf cell: jump to where the ray leaves it
+    "            vec3 c0 = floor(cell) / BrickIndirectionSize, c1 = c0 + 1.0 / BrickIndirectionSize;\n"
+    "            t = intersectBox(eyePosition, dir, c0, c1).y + stepSize * 0.01; continue;\n"
+    "        }\n"
+    "        vec3 local = fract(cell) * BrickParameters.x + BrickParameters.z;\n"
+    "        vec3 coord = (floor(brick.xyz * 255.0 + 0.5) * BrickParameters.y + local) / atlasSize;\n"
+    "        float density = clamp(texture3D(BrickAtlas, coord).r, 0.0, 1.0) * 0.2;\n"
+    "        color.rgb += (1.0 - color.a) * density * vec3(1.0);\n"
+    "        color.a += (1.0 - color.a) * density; t += stepSize;\n"
+    "    }\n"
+    "    if (color.a < 0.001) discard;\n"
+    "    gl_FragColor = color;\n"
+    "}\n"
+};
+
+static int runBrickVolume(const std::string& fileName)
+{
+    // Sparse VDB volume: read leaf nodes as brick atlas + indirection texture and raymarch it
+    // Back faces of the proxy cube are drawn so that the camera may also enter the volume
+    osg::ref_ptr<osgDB::Options> options = new osgDB::Options;
+    options->setPluginStringData("BrickAtlas", "true");
+
+    osg::ref_ptr<osg::Node> volume = osgDB::readNodeFile(fileName, options.get());
+    if (!volume) return 1;
+
+    osg::ref_ptr<osg::Program> program = new osg::Program;
+    program->addShader(new osg::Shader(osg::Shader::VERTEX, brickVertCode));
+    program->addShader(new osg::Shader(osg::Shader::FRAGMENT, brickFragCode));
+
+    osg::StateSet* ss = volume->getOrCreateStateSet();
+    ss->setAttributeAndModes(program.get());
+    ss->setAttributeAndModes(new osg::CullFace(osg::CullFace::FRONT));
+    ss->setMode(GL_BLEND, osg::StateAttribute::ON);
+    ss->setRenderingHint(osg::StateSet::TRANSPARENT_BIN);
+
+    osg::ref_ptr<osg::Group> root = new osg::Group;
+    root->addChild(volume.get());
+
+    osgViewer::Viewer viewer;
+    viewer.addEventHandler(new osgViewer::StatsHandler);
+    viewer.addEventHandler(new osgViewer::WindowSizeHandler);
+    viewer.setCameraManipulator(new osgGA::TrackballManipulator);
+    viewer.setSceneData(root.get());
+    return viewer.run();
+}
+
 int main(int argc, char** argv)
 {
     if (argc < 2)
     {
-        std::cout << "Usage: " << argv[0] << " <image/image_seq file>" << std::endl;
+        std::cout << "Usage: " << argv[0] << " <image/image_seq/vdb file>" << std::endl;
         return 1;
     }
+    else if (osgDB::getLowerCaseFileExtension(argv[1]) == "vdb")
+        return runBrickVolume(argv[1]);
+
     osg::ref_ptr<osg::Image> image = osgDB::readImageFile(argv[1]);
     if (!image) return 1;
 
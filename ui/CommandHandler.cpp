@@ -4,6 +4,7 @@
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 
+#include <pipeline/Utilities.h>
 #include "CommandHandler.h"
 using namespace osgVerse;
 extern void loadDefaultExecutors(CommandHandler* handler);
@@ -14,61 +15,79 @@ CommandBuffer* CommandBuffer::instance()
     return s_instance.get();
 }
 
-bool CommandBuffer::canMerge(const std::list<CommandData>& cList, CommandType t, osg::Object* n) const
+bool CommandBuffer::canMerge(CommandType t) const
 {
-    if (cList.empty()) return false;
     switch (t)
     {
-    case TransformCommand: break;  // Transformation value (matrix) can be replaced by later one
-    case RefreshSceneCommand: break;  // Scene refresh only happen once
+    case TransformCommand: return true;  // Transformation value (matrix) can be replaced by later one
+    case RefreshSceneCommand: return true;  // Scene refresh only happen once
     default: return false;
     }
-
-    const CommandData& last = cList.back();
-    return (last.type == t && last.object == n);
 }
 
-void CommandBuffer::mergeCommand(std::list<CommandData>& cList, CommandType t, osg::Object* n,
-                                 const linb::any& v0, const linb::any& v1)
+bool CommandBuffer::add(CommandType t, osg::Object* n, const linb::any& v0, const linb::any& v1)
 {
-    // TODO: merging should happen when this command been executed and taken from command buffer,
-    //       so that 'undo' will work on an integrated operation instead of many small fractures
-    cList.back() = CommandData{ n, v0, v1, t };  // FIXME: consider complex merging?
+    std::thread::id threadId = std::this_thread::get_id();
+    if (t < CommandToUI)
+    {
+        if (threadId == _sceneThread.load()) _localToScene.push_back(CommandData{ n, v0, v1, t });
+        else if (!_bufferToScene.push(CommandData{ n, v0, v1, t }))
+        { OSG_WARN << "[CommandBuffer] Scene command buffer full, dropping " << t << std::endl; return false; }
+        _numToScene++;
+    }
+    else
+    {
+        if (threadId == _uiThread.load()) _localToUI.push_back(CommandData{ n, v0, v1, t });
+        else if (!_bufferToUI.push(CommandData{ n, v0, v1, t }))
+        { OSG_WARN << "[CommandBuffer] UI command buffer full, dropping " << t << std::endl; return false; }
+    }
+    return true;
 }
 
-void CommandBuffer::add(CommandType t, osg::Object* n, const linb::any& v0, const linb::any& v1)
+bool CommandBuffer::take(CommandRing<CommandData, 4096>& ring, std::deque<CommandData>& local,
+                         CommandData& c)
 {
-    _mutex.lock();
-    if (t < CommandToUI)
+    CommandData* front = ring.peek();
+    if (front != NULL)
     {
-        if (canMerge(_bufferToScene, t, n)) mergeCommand(_bufferToScene, t, n, v0, v1);
-        else _bufferToScene.push_back(CommandData{ n, v0, v1, t });
+        c = *front; ring.pop();
+        if (canMerge(c.type))
+        {
+            // Merge in place: skip to the latest one of consecutive same-object commands
+            for (CommandData* next = ring.peek(); next != NULL; next = ring.peek())
+            {
+                if (next->type != c.type || next->object != c.object) break;
+                c = *next; ring.pop(); if (&ring == &_bufferToScene) _numToScene--;
+            }
+        }
+        return true;
     }
-    else
+    else if (!local.empty())
     {
-        if (canMerge(_bufferToUI, t, n)) mergeCommand(_bufferToUI, t, n, v0, v1);
-        else _bufferToUI.push_back(CommandData{ n, v0, v1, t });
+        c = local.front(); local.pop_front();
+        return true;
     }
-    _mutex.unlock();
+    return false;
 }
 
 bool CommandBuffer::take(CommandData& c, bool fromSceneHandler)
 {
-    bool hasData = false; _mutex.lock();
-    if (fromSceneHandler && !_bufferToScene.empty())
+    if (fromSceneHandler)
     {
-        c = _bufferToScene.front(); hasData = true;
-        _bufferToScene.pop_front();
+        _sceneThread = std::this_thread::get_id();
+        if (!take(_bufferToScene, _localToScene, c)) return false;
+        _numToScene--; return true;
     }
-    else if (!fromSceneHandler && !_bufferToUI.empty() && _bufferToScene.empty())
+    else
     {   // UI events must be taken after all scene events handled...
-        c = _bufferToUI.front(); hasData = true;
-        _bufferToUI.pop_front();
+        _uiThread = std::this_thread::get_id();
+        if (_numToScene.load() > 0) return false;
+        return take(_bufferToUI, _localToUI, c);
     }
-    _mutex.unlock(); return hasData;
 }
 
 CommandHandler::CommandHandler()
+:   _frameNumber(0), _maxHistorySize(256)
 {
     loadDefaultExecutors(this);
 }
@@ -77,11 +96,19 @@ bool CommandHandler::handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAd
 {
     if (ea.getEventType() == osgGA::GUIEventAdapter::FRAME)
     {
-        CommandData cmd;
+        CommandData cmd; _frameNumber++;
+        TangentSpaceGenerator::instance()->applyResults();  // swap in at frame boundary
         while (CommandBuffer::instance()->take(cmd, true))
         {
             if (cmd.type == CommandToScene) continue;
-            if (_executors.find(cmd.type) == _executors.end())
+            else if (cmd.type == UndoCommand || cmd.type == RedoCommand)
+            {
+                int steps = 1; cmd.get(steps, 1, false);
+                for (int i = 0; i < steps; ++i)
+                { if (!(cmd.type == UndoCommand ? undo() : redo())) break; }
+                continue;
+            }
+            else if (_executors.find(cmd.type) == _executors.end())
             {
                 OSG_WARN << "[CommandHandler] Unknown command " << cmd.type << std::endl;
                 continue;  // no executors for command...
@@ -90,6 +117,8 @@ bool CommandHandler::handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAd
             CommandExecutor* executor = getExecutor(cmd.type);
             if (executor && !executor->redo(cmd))
                 OSG_WARN << "[CommandHandler] Failed to execute " << cmd.type << std::endl;
+            else if (!cmd.undoData.empty())
+            { recordHistory(cmd); _redoHistory.clear(); }
         }
     }
     else if (ea.getEventType() == osgGA::GUIEventAdapter::RESIZE)
@@ -99,3 +128,56 @@ bool CommandHandler::handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAd
     }
     return false;
 }
+
+void CommandHandler::recordHistory(const CommandData& cmd)
+{
+    if (!_undoHistory.empty() && CommandBuffer::instance()->canMerge(cmd.type))
+    {
+        // Continuous changes (e.g., dragging) become one undo step, keeping the oldest state
+        HistoryItem& last = _undoHistory.back();
+        if (last.command.type == cmd.type && last.command.object == cmd.object &&
+            last.frameNumber + 1 >= _frameNumber)
+        {
+            linb::any undoData = last.command.undoData;
+            last.command = cmd; last.command.undoData = undoData;
+            last.frameNumber = _frameNumber; return;
+        }
+    }
+
+    HistoryItem item; item.command = cmd; item.frameNumber = _frameNumber;
+    _undoHistory.push_back(item);
+    while (_undoHistory.size() > _maxHistorySize) _undoHistory.pop_front();
+}
+
+bool CommandHandler::undo()
+{
+    if (_undoHistory.empty()) return false;
+    CommandData cmd = _undoHistory.back().command; _undoHistory.pop_back();
+
+    CommandExecutor* executor = getExecutor(cmd.type);
+    if (!executor || !executor->undo(cmd))
+    {
+        OSG_WARN << "[CommandHandler] Failed to undo " << cmd.type << std::endl;
+        return false;
+    }
+
+    HistoryItem item; item.command = cmd; item.frameNumber = _frameNumber;
+    _redoHistory.push_back(item); return true;
+}
+
+bool CommandHandler::redo()
+{
+    if (_redoHistory.empty()) return false;
+    CommandData cmd = _redoHistory.back().command; _redoHistory.pop_back();
+
+    CommandExecutor* executor = getExecutor(cmd.type);
+    if (!executor || !executor->redo(cmd))
+    {
+        OSG_WARN << "[CommandHandler] Failed to redo " << cmd.type << std::endl;
+        return false;
+    }
+
+    // Redone command should not be merged with previous one
+    HistoryItem item; item.command = cmd; item.frameNumber = 0;
+    _undoHistory.push_back(item); return true;
+}
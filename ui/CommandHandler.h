@@ -4,7 +4,9 @@
 #include <osg/Camera>
 #include <osg/MatrixTransform>
 #include <osgGA/GUIEventHandler>
-#include <mutex>
+#include <atomic>
+#include <deque>
+#include <thread>
 #include <any.hpp>
 
 namespace osgVerse
@@ -19,6 +21,8 @@ namespace osgVerse
         TransformCommand,        // [node]item, [matrix]transformation, [int]0-mt node;1-pat node
         GoHomeCommand,           // [view]viewer, [node]item-or-null, [matrix]home-pos
         RefreshSceneCommand,     // [view]viewer, [pipeline]pipeline, [bool]to-go-home
+        UndoCommand,             // [null], [int]steps
+        RedoCommand,             // [null], [int]steps
 
         CommandToUI = 100,
         ResizeEditor,            // [null], [vec2]size
@@ -31,6 +35,7 @@ namespace osgVerse
     {
         osg::observer_ptr<osg::Object> object;
         linb::any value, valueEx; CommandType type;
+        linb::any undoData;  // compact previous state, recorded by executor for undoing
 
         template<typename T> bool get(T& v, int i = 0, bool toWarn = true)
         {
@@ -46,22 +51,68 @@ namespace osgVerse
         }
     };
 
+    /** Bounded ring buffer with a lock-free consumer. Producers are serialized by a spin flag,
+        which is never contended when there is only one producer thread */
+    template<typename T, size_t N>
+    class CommandRing
+    {
+    public:
+        CommandRing() : _data(N), _head(0), _tail(0) { _producing.clear(); }
+
+        bool push(const T& v)
+        {
+            while (_producing.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+            size_t tail = _tail.load(std::memory_order_relaxed), next = (tail + 1) % N;
+            bool pushed = (next != _head.load(std::memory_order_acquire));
+            if (pushed) { _data[tail] = v; _tail.store(next, std::memory_order_release); }
+            _producing.clear(std::memory_order_release); return pushed;
+        }
+
+        /** Get the i-th element from the front (consumer only), or NULL if not available */
+        T* peek(size_t i = 0)
+        {
+            size_t head = _head.load(std::memory_order_relaxed);
+            size_t tail = _tail.load(std::memory_order_acquire);
+            if (i >= (tail + N - head) % N) return NULL;
+            return &_data[(head + i) % N];
+        }
+
+        void pop()
+        {
+            size_t head = _head.load(std::memory_order_relaxed);
+            _data[head] = T(); _head.store((head + 1) % N, std::memory_order_release);
+        }
+
+    protected:
+        std::vector<T> _data;
+        std::atomic<size_t> _head, _tail;
+        std::atomic_flag _producing;
+    };
+
     class CommandBuffer : public osg::Referenced
     {
     public:
         static CommandBuffer* instance();
-        bool canMerge(const std::list<CommandData>& cList, CommandType t, osg::Object* n) const;
-        void mergeCommand(std::list<CommandData>& cList, CommandType t, osg::Object* n,
-                          const linb::any& v0, const linb::any& v1);
+        bool canMerge(CommandType t) const;
+
+        /** Add a command. Commands added from the consuming thread itself (e.g., by executors)
+            are queued locally; others go through the ring buffer. Returns false if it is full */
+        bool add(CommandType t, osg::Object* n, const linb::any& v0, const linb::any& v1 = (int)0);
 
-        void add(CommandType t, osg::Object* n, const linb::any& v0, const linb::any& v1 = (int)0);
+        /** Take next command. Consecutive mergeable commands of the same object are merged here,
+            so that only the latest value is executed */
         bool take(CommandData& c, bool fromSceneHandler);
 
     protected:
-        CommandBuffer() {}
-        std::list<CommandData> _bufferToScene;
-        std::list<CommandData> _bufferToUI;
-        std::mutex _mutex;
+        CommandBuffer()
+        :   _sceneThread(std::thread::id()), _uiThread(std::thread::id()), _numToScene(0) {}
+        bool take(CommandRing<CommandData, 4096>& ring, std::deque<CommandData>& local,
+                  CommandData& c);
+
+        CommandRing<CommandData, 4096> _bufferToScene, _bufferToUI;
+        std::deque<CommandData> _localToScene, _localToUI;
+        std::atomic<std::thread::id> _sceneThread, _uiThread;
+        std::atomic<int> _numToScene;
     };
 
     class CommandHandler : public osgGA::GUIEventHandler
@@ -70,6 +121,8 @@ namespace osgVerse
         CommandHandler();
         virtual bool handle(const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa);
 
+        /** Command executor. redo() should record the previous state in cmd.undoData if the
+            command can be undone later; undo() restores the state from it */
         struct CommandExecutor : public osg::Referenced
         {
             virtual bool redo(CommandData& cmd) = 0;
@@ -78,8 +131,27 @@ namespace osgVerse
         void addExecutor(CommandType t, CommandExecutor* e) { _executors[t] = e; }
         CommandExecutor* getExecutor(CommandType t) { return _executors[t].get(); }
 
+        /** Undo / redo executed commands in history, must be called in scene thread.
+            Use UndoCommand / RedoCommand from other threads instead */
+        bool undo();
+        bool redo();
+
+        void setMaxHistorySize(unsigned int s) { _maxHistorySize = s; }
+        unsigned int getMaxHistorySize() const { return _maxHistorySize; }
+        unsigned int getNumUndoSteps() const { return _undoHistory.size(); }
+        unsigned int getNumRedoSteps() const { return _redoHistory.size(); }
+
     protected:
+        void recordHistory(const CommandData& cmd);
+
+        struct HistoryItem
+        {
+            CommandData command;
+            unsigned int frameNumber;
+        };
         std::map<CommandType, osg::ref_ptr<CommandExecutor>> _executors;
+        std::deque<HistoryItem> _undoHistory, _redoHistory;
+        unsigned int _frameNumber, _maxHistorySize;
     };
 }
 
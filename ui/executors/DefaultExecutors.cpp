@@ -18,11 +18,19 @@ using namespace osgVerse;
 //                [int]0-single mode, 1-add sel, 2-remove sel, 3-clear all
 struct SelectExecutor : public CommandHandler::CommandExecutor
 {
+    typedef std::vector<osg::observer_ptr<osg::Node>> Selection;
+
     virtual bool redo(CommandData& cmd)
     {
         osgVerse::NodeSelector* selector = NULL;
         osg::Node* n = static_cast<osg::Node*>(cmd.object.get());
         if (!n || !cmd.get(selector)) return false;
+
+        // Record selected nodes (not the subgraphs) for undoing
+        Selection selection; const NodeSelector::SelectionMap& selMap = selector->getSelectionMap();
+        for (NodeSelector::SelectionMap::const_iterator itr = selMap.begin(); itr != selMap.end(); ++itr)
+            selection.push_back(itr->first);
+        cmd.undoData = selection;
         
         int mode = 0; cmd.get(mode, 1);
         switch (mode)
@@ -39,8 +47,15 @@ struct SelectExecutor : public CommandHandler::CommandExecutor
 
     virtual bool undo(CommandData& cmd)
     {
-        return false;
-    }  // TODO
+        osgVerse::NodeSelector* selector = NULL; Selection selection;
+        if (!cmd.get(selector) || cmd.undoData.empty()) return false;
+        selection = linb::any_cast<Selection>(cmd.undoData);
+
+        selector->clearAllSelectedNodes();
+        for (size_t i = 0; i < selection.size(); ++i)
+        { if (selection[i].valid()) selector->addSelectedNode(selection[i].get()); }
+        return true;
+    }
 };
 
 // SetNodeCommand: [node]parent, [node]child, [bool]true-to-delete
@@ -53,7 +68,8 @@ struct SetNodeExecutor : public CommandHandler::CommandExecutor
         if (child != NULL)
         {
             osg::Group* n = static_cast<osg::Group*>(cmd.object.get()); parent = n;
-            if (!n) return false; if (toDel) n->removeChild(child); else n->addChild(child);
+            if (!n) return false; cmd.undoData = n->getChildIndex(child);
+            if (toDel) n->removeChild(child); else n->addChild(child);
             CommandBuffer::instance()->add(RefreshHierarchy, parent, child, toDel);
         }
         else
@@ -62,61 +78,95 @@ struct SetNodeExecutor : public CommandHandler::CommandExecutor
             if (childD != NULL)
             {
                 osg::Geode* n = static_cast<osg::Geode*>(cmd.object.get()); parent = n;
-                if (!n) return false; if (toDel) n->removeDrawable(childD); else n->addDrawable(childD);
+                if (!n) return false; cmd.undoData = n->getDrawableIndex(childD);
+                if (toDel) n->removeDrawable(childD); else n->addDrawable(childD);
                 CommandBuffer::instance()->add(RefreshHierarchy, parent, childD, toDel);
             }
         }
-        
-        osgVerse::TangentSpaceVisitor tsv;
-        if (!toDel) parent->accept(tsv);  // Add tangent/bi-normal arrays for normal mapping
+
+        // Add tangent/bi-normal arrays for normal mapping in background
+        if (!toDel && parent)
+        {
+            std::string cacheFile; if (child) child->getUserValue("TangentCacheFile", cacheFile);
+            TangentSpaceGenerator::instance()->add(child ? child : parent, cacheFile);
+        }
         return true;
     }
 
     virtual bool undo(CommandData& cmd)
     {
-        return false;
-    }  // TODO
+        // Only the child pointer and its previous index is needed to revert
+        osg::Node* child = NULL; cmd.get(child, 0, false);
+        bool toDel = false; cmd.get(toDel, 1);
+        unsigned int index = 0; if (cmd.undoData.empty()) return false;
+        index = linb::any_cast<unsigned int>(cmd.undoData);
+
+        if (child != NULL)
+        {
+            osg::Group* n = static_cast<osg::Group*>(cmd.object.get()); if (!n) return false;
+            if (!toDel) n->removeChild(child); else n->insertChild(index, child);
+            CommandBuffer::instance()->add(RefreshHierarchy, n, child, !toDel);
+        }
+        else
+        {
+            osg::Drawable* childD = NULL; cmd.get(childD, 0, false);
+            osg::Geode* n = static_cast<osg::Geode*>(cmd.object.get());
+            if (!n || !childD) return false;
+            if (!toDel) n->removeDrawable(childD); else n->insertDrawable(index, childD);
+            CommandBuffer::instance()->add(RefreshHierarchy, n, childD, !toDel);
+        }
+        return true;
+    }
 };
 
 // SetValueCommand: [node/drawable]item, [string]key, [any]value
 struct SetValueExecutor : public CommandHandler::CommandExecutor
 {
     virtual bool redo(CommandData& cmd)
+    { return apply(cmd, cmd.valueEx, &cmd.undoData); }
+
+    virtual bool undo(CommandData& cmd)
+    { return cmd.undoData.empty() ? false : apply(cmd, cmd.undoData, NULL); }
+
+    bool apply(CommandData& cmd, const linb::any& value, linb::any* previous)
     {
         std::string key; if (!cmd.get(key)) return false;
+        CommandData c; c.value = key; c.valueEx = value;  // for reading typed value
         if (key == "d_visibility")
         {
             osg::Drawable* d = static_cast<osg::Drawable*>(cmd.object.get());
-            bool v; cmd.get(v, 1); if (d) d->setCullCallback(v ? NULL : _drawableHider.get());
+            bool v; c.get(v, 1); if (!d) return false;
+            if (previous) *previous = (d->getCullCallback() != _drawableHider.get());
+            d->setCullCallback(v ? NULL : _drawableHider.get());
         }
         else if (key == "d_name")
         {
             osg::Drawable* d = static_cast<osg::Drawable*>(cmd.object.get());
-            std::string v; cmd.get(v, 1); if (d) d->setName(v);
+            std::string v; c.get(v, 1); if (!d) return false;
+            if (previous) *previous = d->getName(); d->setName(v);
         }
         else if (key == "n_visibility")
         {
             osg::Node* n = static_cast<osg::Node*>(cmd.object.get());
-            bool v; cmd.get(v, 1); if (n) n->setCullCallback(v ? NULL : _nodeHider.get());
+            bool v; c.get(v, 1); if (!n) return false;
+            if (previous) *previous = (n->getCullCallback() != _nodeHider.get());
+            n->setCullCallback(v ? NULL : _nodeHider.get());
         }
         else if (key == "n_name")
         {
             osg::Node* n = static_cast<osg::Node*>(cmd.object.get());
-            std::string v; cmd.get(v, 1); if (n) n->setName(v);
+            std::string v; c.get(v, 1); if (!n) return false;
+            if (previous) *previous = n->getName(); n->setName(v);
         }
         else if (key == "n_mask")
         {
             osg::Node* n = static_cast<osg::Node*>(cmd.object.get());
-            unsigned int v = 0xffffffff; cmd.get(v, 1); if (n) n->setNodeMask(v);
+            unsigned int v = 0xffffffff; c.get(v, 1); if (!n) return false;
+            if (previous) *previous = (unsigned int)n->getNodeMask(); n->setNodeMask(v);
         }
         return true;
     }
 
-    virtual bool undo(CommandData& cmd)
-    {
-        return false;
-    }  // TODO
-
     SetValueExecutor()
     {
         _nodeHider = new DisableNodeCallback;
@@ -131,32 +181,40 @@ struct TransformExecutor : public CommandHandler::CommandExecutor
 {
     virtual bool redo(CommandData& cmd)
     {
-        osg::Matrix m; int type = 0;
-        osg::Node* n = static_cast<osg::Node*>(cmd.object.get());
-        if (!n || !cmd.get(m)) return false; cmd.get(type, 1);
+        osg::Matrix m; if (!cmd.get(m)) return false;
+        return apply(cmd, m, &cmd.undoData);
+    }
+
+    virtual bool undo(CommandData& cmd)
+    {
+        if (cmd.undoData.empty()) return false;
+        return apply(cmd, linb::any_cast<osg::Matrix>(cmd.undoData), NULL);
+    }
 
+    bool apply(CommandData& cmd, const osg::Matrix& m, linb::any* previous)
+    {
+        int type = 0; cmd.get(type, 1);
+        osg::Node* n = static_cast<osg::Node*>(cmd.object.get()); if (!n) return false;
         if (type == 1)
         {
             osg::PositionAttitudeTransform* pat =
                 static_cast<osg::PositionAttitudeTransform*>(n);
+            if (previous) *previous = osg::Matrix::scale(pat->getScale()) *
+                osg::Matrix::rotate(pat->getAttitude()) * osg::Matrix::translate(pat->getPosition());
+
             osg::Vec3 t, s; osg::Quat r, so; m.decompose(t, r, s, so);
             pat->setPosition(t); pat->setScale(s); pat->setAttitude(r);
         }
         else
         {
             osg::MatrixTransform* mt = static_cast<osg::MatrixTransform*>(n);
-            mt->setMatrix(m);
+            if (previous) *previous = mt->getMatrix(); mt->setMatrix(m);
         }
 
         osgVerse::CommandBuffer::instance()->add(
             osgVerse::RefreshSceneCommand, (osgViewer::View*)NULL, (osgVerse::Pipeline*)NULL, false);
         return true;
     }
-
-    virtual bool undo(CommandData& cmd)
-    {
-        return false;
-    }  // TODO
 };
 
 // GoHomeCommand: [view]viewer, [node]item-or-null, [matrix]home-pos
@@ -224,11 +282,6 @@ struct RefreshSceneExecutor : public CommandHandler::CommandExecutor
         return true;
     }
 
-    virtual bool undo(CommandData& cmd)
-    {
-        return false;
-    }  // TODO
-
     osg::observer_ptr<osgVerse::Pipeline> defPipeline;
     osg::observer_ptr<osgViewer::View> defPiew;
 };
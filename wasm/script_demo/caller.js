@@ -2,6 +2,17 @@
 if (typeof(Module) != "undefined") {
     Module.postRun = function() {
         let verse_executer = Module.cwrap("execute", "string", ["string", "string"], {async: true});
+        let verse_payload_executer = Module.cwrap("execute_payload", "string",
+                                                  ["string", "string", "number", "number"], {async: true});
+        let verse_payload_allocator = Module.cwrap("allocate_payload", "number", ["number"]);
+
+        // Send bulk data as binary payload, e.g., {"Vertices": {"offset": 0, "count": 300}}
+        async function executeWithPayload(cmd, json, floatArray) {
+            let bytes = new Uint8Array(floatArray.buffer, floatArray.byteOffset, floatArray.byteLength);
+            let ptr = verse_payload_allocator(bytes.length);
+            if (ptr) Module.HEAPU8.set(bytes, ptr);
+            return await verse_payload_executer(cmd, json, ptr, bytes.length);
+        }
         async function loadOsgScene() {
             result = await verse_executer('list', '{"library": "osg", "class": "MatrixTransform"}');
             console.log(result);
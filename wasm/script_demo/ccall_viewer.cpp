@@ -15,36 +15,54 @@ void loop()
     g_app->frame();
 }
 
+static const char* executeCommand(const char* cmd, const char* json,
+                                  const std::vector<unsigned char>* payload)
+{
+    std::string type = (cmd == NULL) ? "get" : std::string(cmd);
+    std::string input = (json == NULL) ? "" : std::string(json);
+    osgVerse::JsonScript* scripter = g_app->scripter();
+
+    picojson::value in, out;
+    std::string output = picojson::parse(in, input);
+    if (output.empty())
+    {
+        if (type.find("creat") != type.npos)
+            out = scripter->execute(osgVerse::JsonScript::EXE_Creation, in, payload);
+        else if (type.find("list") != type.npos)
+            out = scripter->execute(osgVerse::JsonScript::EXE_List, in, payload);
+        else if (type.find("remove") != type.npos)
+            out = scripter->execute(osgVerse::JsonScript::EXE_Remove, in, payload);
+        else if (type.find("set") != type.npos)
+            out = scripter->execute(osgVerse::JsonScript::EXE_Set, in, payload);
+        else
+            out = scripter->execute(osgVerse::JsonScript::EXE_Get, in, payload);
+        output = out.serialize(false);
+    }
+
+    static char* result = NULL; if (result != NULL) free(result);
+    int size = output.length(); result = (char*)malloc(size + 1);
+    memcpy(result, output.c_str(), size);
+    result[size] = '\0'; return result;
+}
+
 extern "C"
 {
     const char* EMSCRIPTEN_KEEPALIVE execute(const char* cmd, const char* json)
+    { return executeCommand(cmd, json, NULL); }
+
+    /** Execute with binary payload, which is allocated by allocate_payload() and filled
+        from Javascript side using HEAPU8, and freed after execution */
+    const char* EMSCRIPTEN_KEEPALIVE execute_payload(const char* cmd, const char* json,
+                                                      unsigned char* data, int size)
     {
-        std::string type = (cmd == NULL) ? "get" : std::string(cmd);
-        std::string input = (json == NULL) ? "" : std::string(json);
-        osgVerse::JsonScript* scripter = g_app->scripter();
-
-        picojson::value in, out;
-        std::string output = picojson::parse(in, input);
-        if (output.empty())
-        {
-            if (type.find("creat") != type.npos)
-                out = scripter->execute(osgVerse::JsonScript::EXE_Creation, in);
-            else if (type.find("list") != type.npos)
-                out = scripter->execute(osgVerse::JsonScript::EXE_List, in);
-            else if (type.find("remove") != type.npos)
-                out = scripter->execute(osgVerse::JsonScript::EXE_Remove, in);
-            else if (type.find("set") != type.npos)
-                out = scripter->execute(osgVerse::JsonScript::EXE_Set, in);
-            else
-                out = scripter->execute(osgVerse::JsonScript::EXE_Get, in);
-            output = out.serialize(false);
-        }
-
-        static char* result = NULL; if (result != NULL) free(result);
-        int size = output.length(); result = (char*)malloc(size + 1);
-        memcpy(result, output.c_str(), size);
-        result[size] = '\0'; return result;
+        std::vector<unsigned char> payload;
+        if (data != NULL && size > 0) payload.assign(data, data + size);
+        if (data != NULL) free(data);
+        return executeCommand(cmd, json, &payload);
     }
+
+    unsigned char* EMSCRIPTEN_KEEPALIVE allocate_payload(int size)
+    { return (size > 0) ? (unsigned char*)malloc(size) : NULL; }
 }
 
 // Server structure
@@ -101,7 +101,16 @@ public:
     }
 
     osgVerse::JsonScript* scripter() { return _scripter.get(); }
-    void frame() { _viewer->frame(); }
+    void frame()
+    {
+        // Script commands are applied only between update traversals
+        _viewer->advance();
+        {
+            std::lock_guard<std::recursive_mutex> lock(_scripter->getSceneMutex());
+            _viewer->eventTraversal(); _viewer->updateTraversal();
+        }
+        _viewer->renderingTraversals();
+    }
 
 protected:
     osg::ref_ptr<NotifyLogger> _logger;